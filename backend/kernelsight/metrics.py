@@ -8,6 +8,8 @@ from collections import deque
 from dataclasses import dataclass, field
 from datetime import datetime
 
+from .wrapper import load_library, CgroupSampler, open_metrics_export, MetricsShmStale
+
 @dataclass 
 class MetricPoint:
     timestamp: float
@@ -26,6 +28,9 @@ class MetricsCollector:
         self._metrics: Dict[str, deque] = {}
         self._prev_cpu: Dict[str, int] = {}
         self._prev_time: Dict[str, float] = {}
+        self._lib = load_library()
+        self._samplers: Dict[str, CgroupSampler] = {}
+        self._sampler_pids: Dict[str, int] = {}
         self._callbacks: List[Callable] = []
         self._running = False
         self._thread = None
@@ -46,8 +51,49 @@ class MetricsCollector:
         except:
             return 0
     
+    def _first_pid(self, cgroup_path: Path) -> int:
+        """A process of the container, for its network namespace (0 if empty)"""
+        try:
+            with open(cgroup_path / "cgroup.procs") as f:
+                line = f.readline()
+            return int(line) if line.strip() else 0
+        except (OSError, ValueError):
+            return 0
+    
+    def _collect_native(self, container_id: str, cgroup_path: Path):
+        """Collect via the C sampler (CPU % and rates computed natively)"""
+        pid = self._first_pid(cgroup_path)
+        sampler = self._samplers.get(container_id)
+        if sampler is not None and self._sampler_pids.get(container_id) != pid:
+            # Restarted: the old /proc/<pid>/net/dev went away with its process
+            self._samplers.pop(container_id).close()
+            sampler = None
+        if sampler is None:
+            try:
+                sampler = CgroupSampler(self._lib, str(cgroup_path), pid)
+            except OSError:
+                return None
+            self._samplers[container_id] = sampler
+            self._sampler_pids[container_id] = pid
+        
+        m = sampler.read()
+        point = MetricPoint(timestamp=time.time(),
+                            cpu_percent=m.cpu_usage_percent,
+                            memory_bytes=max(m.memory_usage_bytes, 0),
+                            pids=max(m.pids_current, 0),
+                            net_rx_bytes=m.net_rx_bytes,
+                            net_tx_bytes=m.net_tx_bytes)
+        if m.memory_limit_bytes > 0:
+            point.memory_percent = (point.memory_bytes / m.memory_limit_bytes) * 100
+        return point
+    
     def _collect_container_metrics(self, container_id: str, cgroup_path: Path) -> MetricPoint:
         """Collect metrics for a single container"""
+        if self._lib is not None:
+            point = self._collect_native(container_id, cgroup_path)
+            if point is not None:
+                return point
+        
         point = MetricPoint(timestamp=time.time())
         
         # Memory
@@ -87,18 +133,58 @@ class MetricsCollector:
         
         return point
     
+    def _point_from_sample(self, sample) -> MetricPoint:
+        m = sample.metrics
+        point = MetricPoint(timestamp=sample.timestamp_ns / 1e9,
+                            cpu_percent=m.cpu_usage_percent,
+                            memory_bytes=max(m.memory_usage_bytes, 0),
+                            pids=max(m.pids_current, 0),
+                            net_rx_bytes=m.net_rx_bytes,
+                            net_tx_bytes=m.net_tx_bytes)
+        if m.memory_limit_bytes > 0:
+            point.memory_percent = (point.memory_bytes / m.memory_limit_bytes) * 100
+        return point
+    
+    def _collect_exported(self, shm) -> Dict[str, MetricPoint]:
+        """Latest samples from the daemon's metrics segment (it keeps the history)"""
+        results = {}
+        for container_id in shm.container_ids():
+            sample = shm.latest(container_id)
+            if sample is not None:
+                results[container_id] = self._point_from_sample(sample)
+        return results
+    
     def collect_all(self) -> Dict[str, MetricPoint]:
         """Collect metrics for all containers"""
+        shm = open_metrics_export()
+        try:
+            results = self._collect_exported(shm) if shm else self._collect_cgroups()
+        except MetricsShmStale:
+            results = self._collect_cgroups()
+        
+        # Notify callbacks
+        for callback in self._callbacks:
+            try:
+                callback(results)
+            except:
+                pass
+        
+        return results
+    
+    def _collect_cgroups(self) -> Dict[str, MetricPoint]:
+        """Sample the cgroup files ourselves, keeping history in memory"""
         results = {}
         cgroup_base = Path("/sys/fs/cgroup/kernelsight")
         
         if not cgroup_base.exists():
             return results
         
+        seen = set()
         for container_dir in cgroup_base.iterdir():
             if not container_dir.is_dir():
                 continue
             container_id = container_dir.name
+            seen.add(container_id)
             
             point = self._collect_container_metrics(container_id, container_dir)
             results[container_id] = point
@@ -108,17 +194,23 @@ class MetricsCollector:
                 self._metrics[container_id] = deque(maxlen=self.history_size)
             self._metrics[container_id].append(point)
         
-        # Notify callbacks
-        for callback in self._callbacks:
-            try:
-                callback(results)
-            except:
-                pass
+        # Drop samplers of containers whose cgroup has gone away
+        for container_id in [cid for cid in self._samplers if cid not in seen]:
+            self._samplers.pop(container_id).close()
+            self._sampler_pids.pop(container_id, None)
         
         return results
     
     def get_history(self, container_id: str) -> List[MetricPoint]:
         """Get metric history for a container"""
+        shm = open_metrics_export()
+        if shm is not None:
+            try:
+                samples = shm.history(container_id, self.history_size)
+            except MetricsShmStale:
+                samples = []
+            if samples:
+                return [self._point_from_sample(s) for s in samples]
         return list(self._metrics.get(container_id, []))
     
     def _collection_loop(self, interval: float):
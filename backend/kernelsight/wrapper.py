@@ -1,13 +1,30 @@
 """KernelSight - Python wrapper for libkernelsight.so"""
 
 import ctypes
+import mmap
 import os
+import struct
 from ctypes import Structure, c_char, c_int, c_long, c_double, c_uint, POINTER, create_string_buffer
-from typing import Optional, List, Dict
+from typing import Optional, List, Dict, Callable
 from pathlib import Path
 
-# Find the library
-LIB_PATH = Path(__file__).parent.parent.parent / "runtime" / "build" / "libkernelsight.so"
+# Find the library (the runtime Makefile builds libminicontainer.so)
+BUILD_DIR = Path(__file__).parent.parent.parent / "runtime" / "build"
+LIB_PATH = next((p for p in (BUILD_DIR / "libminicontainer.so", BUILD_DIR / "libkernelsight.so")
+                 if p.exists()), BUILD_DIR / "libminicontainer.so")
+
+IO_MAX_DEVICES = 8
+CPUSET_LEN = 128
+
+class IoDeviceLimit(Structure):
+    _fields_ = [
+        ("major", c_uint),
+        ("minor", c_uint),
+        ("rbps", c_long),
+        ("wbps", c_long),
+        ("riops", c_long),
+        ("wiops", c_long),
+    ]
 
 class ResourceLimits(Structure):
     _fields_ = [
@@ -17,14 +34,35 @@ class ResourceLimits(Structure):
         ("cpu_quota_us", c_int),
         ("cpu_period_us", c_int),
         ("pids_max", c_int),
+        ("io_weight", c_int),
+        ("io_device_count", c_int),
+        ("io_devices", IoDeviceLimit * IO_MAX_DEVICES),
+        ("memory_high_bytes", c_long),
+        ("cpuset_cpus", c_char * CPUSET_LEN),
+        ("cpuset_mems", c_char * CPUSET_LEN),
+        ("cpuset_count", c_int),
+        ("cpuset_exclusive", c_int),
+        ("memory_low_bytes", c_long),
+        ("memory_min_bytes", c_long),
     ]
 
+# Field mask for container_update_limits()
+(LIMIT_MEMORY, LIMIT_MEMORY_HIGH, LIMIT_SWAP, LIMIT_CPU, LIMIT_CPU_WEIGHT, LIMIT_PIDS,
+ LIMIT_IO_WEIGHT, LIMIT_IO_MAX, LIMIT_CPUSET, LIMIT_CPUSET_MEMS, LIMIT_MEMORY_LOW,
+ LIMIT_MEMORY_MIN) = (1 << i for i in range(12))
+
+# Flags for container_checkpoint()
+CHECKPOINT_LEAVE_RUNNING, CHECKPOINT_TMPFS = 0x1, 0x2
+
 class ContainerConfig(Structure):
     _fields_ = [
         ("id", c_char * 65),
         ("name", c_char * 256),
         ("hostname", c_char * 256),
         ("rootfs", c_char * 4096),
+        ("image", c_char * 4096),
+        ("layers", POINTER(ctypes.c_char_p)),
+        ("layer_count", c_int),
         ("cmd", POINTER(ctypes.c_char_p)),
         ("cmd_count", c_int),
         ("env", POINTER(ctypes.c_char_p)),
@@ -38,6 +76,84 @@ class ContainerConfig(Structure):
         ("gid_map_container", c_uint),
     ]
 
+class PsiStats(Structure):
+    _fields_ = [
+        ("some_avg10", c_double),
+        ("some_avg60", c_double),
+        ("some_total_us", c_long),
+        ("full_avg10", c_double),
+        ("full_avg60", c_double),
+        ("full_total_us", c_long),
+    ]
+
+PSI_CPU, PSI_MEMORY, PSI_IO = 0, 1, 2
+PSI_FILES = {PSI_CPU: "cpu.pressure", PSI_MEMORY: "memory.pressure", PSI_IO: "io.pressure"}
+
+def parse_flat_keyed(text: str) -> Dict[str, int]:
+    """Parse a "key value" per line cgroup file (cpu.stat, memory.stat, ...)"""
+    result = {}
+    for line in text.splitlines():
+        key, _, val = line.partition(" ")
+        if val.lstrip("-").isdigit():
+            result[key] = int(val)
+    return result
+
+def parse_pressure(text: str) -> Dict:
+    """Parse a *.pressure file into {"some": {...}, "full": {...}}"""
+    result = {}
+    for line in text.splitlines():
+        kind, *fields = line.split()
+        values = dict(field.partition("=")[::2] for field in fields)
+        result[kind] = {
+            "avg10": float(values.get("avg10", 0)),
+            "avg60": float(values.get("avg60", 0)),
+            "total_us": int(values.get("total", 0)),
+        }
+    return result
+
+class CpuStat(Structure):
+    _fields_ = [(name, c_long) for name in (
+        "usage_usec", "user_usec", "system_usec", "nr_periods", "nr_throttled", "throttled_usec",
+        "nr_bursts", "burst_usec",
+    )]
+
+class MemoryStat(Structure):
+    _fields_ = [(name, c_long) for name in (
+        "anon", "file", "kernel", "kernel_stack", "pagetables", "percpu", "sock", "vmalloc",
+        "shmem", "zswap", "zswapped", "file_mapped", "file_dirty", "file_writeback", "swapcached",
+        "anon_thp", "file_thp", "shmem_thp", "inactive_anon", "active_anon", "inactive_file",
+        "active_file", "unevictable", "slab_reclaimable", "slab_unreclaimable", "slab",
+        "workingset_refault_anon", "workingset_refault_file", "workingset_activate_anon",
+        "workingset_activate_file", "workingset_restore_anon", "workingset_restore_file",
+        "workingset_nodereclaim", "pgscan", "pgsteal", "pgfault", "pgmajfault", "pgrefill",
+        "pgactivate", "pgdeactivate", "pglazyfree", "pglazyfreed", "thp_fault_alloc",
+        "thp_collapse_alloc",
+    )]
+
+class MemoryEvents(Structure):
+    _fields_ = [(name, c_long) for name in (
+        "low", "high", "max", "oom", "oom_kill", "oom_group_kill",
+    )]
+
+# mc_counter_t / mc_histogram_t sizes (runtime counters)
+COUNTER_COUNT = 6
+HIST_COUNT = 6
+HIST_BUCKETS = 24
+
+class HistogramData(Structure):
+    _fields_ = [
+        ("buckets", ctypes.c_ulong * HIST_BUCKETS),
+        ("count", ctypes.c_ulong),
+        ("sum_ns", ctypes.c_ulong),
+    ]
+
+class Counters(Structure):
+    _fields_ = [
+        ("calls", ctypes.c_ulong * COUNTER_COUNT),
+        ("failures", ctypes.c_ulong * COUNTER_COUNT),
+        ("latency", HistogramData * HIST_COUNT),
+    ]
+
 class ContainerMetrics(Structure):
     _fields_ = [
         ("memory_usage_bytes", c_long),
@@ -49,8 +165,332 @@ class ContainerMetrics(Structure):
         ("pids_limit", c_int),
         ("net_rx_bytes", c_long),
         ("net_tx_bytes", c_long),
+        ("memory_growth_bytes_per_sec", c_double),
+        ("net_rx_bytes_per_sec", c_double),
+        ("net_tx_bytes_per_sec", c_double),
+        ("sample_interval_ns", c_long),
+        ("io_read_bytes", c_long),
+        ("io_write_bytes", c_long),
+        ("io_read_ops", c_long),
+        ("io_write_ops", c_long),
+        ("io_read_bytes_per_sec", c_double),
+        ("io_write_bytes_per_sec", c_double),
+        ("cpu_pressure", PsiStats),
+        ("memory_pressure", PsiStats),
+        ("io_pressure", PsiStats),
+        ("cpu_stat", CpuStat),
+        ("memory_stat", MemoryStat),
+        ("memory_events", MemoryEvents),
+        ("pgfault_per_sec", c_double),
+        ("pgmajfault_per_sec", c_double),
+        ("workingset_refault_per_sec", c_double),
+        ("reclaim_bytes", c_long),
+        ("reclaim_count", c_long),
     ]
 
+# Shared-memory metrics export written by the daemon (metrics_shm.c)
+METRICS_SHM_PATH = Path("/dev/shm/kernelsight-metrics")
+METRICS_MAGIC = 0x4d54534b
+METRICS_VERSION = 2
+METRICS_SLOTS = 64
+METRICS_HISTORY = 60
+# Seqlock retries as in metrics_shm.c: spins per yield, yields per writer check, yields in all
+SEQLOCK_SPINS = 64
+SEQLOCK_CHECK_YIELDS = 256
+SEQLOCK_MAX_YIELDS = 4096
+
+class MetricsShmHeader(Structure):
+    _fields_ = [
+        ("magic", ctypes.c_uint32),
+        ("version", ctypes.c_uint32),
+        ("slot_count", ctypes.c_uint32),
+        ("history", ctypes.c_uint32),
+        ("slot_size", ctypes.c_uint32),
+        ("sample_size", ctypes.c_uint32),
+        ("interval_ms", ctypes.c_int32),
+        ("writer_pid", ctypes.c_int32),
+        ("generation", ctypes.c_uint64),
+        ("updated_ns", ctypes.c_int64),
+        ("reserved", c_char * 16),
+    ]
+
+class MetricsSample(Structure):
+    _fields_ = [
+        ("timestamp_ns", ctypes.c_int64),
+        ("metrics", ContainerMetrics),
+    ]
+
+class MetricsSlotHeader(Structure):
+    """metrics_slot_t without its samples array"""
+    _fields_ = [
+        ("seq", ctypes.c_uint64),
+        ("count", ctypes.c_uint64),
+        ("in_use", ctypes.c_int32),
+        ("reserved", ctypes.c_int32),
+        ("id", c_char * 72),
+    ]
+
+class MetricsShmStale(OSError):
+    """The writer died, or stalled, in the middle of updating a slot"""
+
+class MetricsShm:
+    """Read-only view of the daemon's metrics segment
+    
+    Reads are plain memory copies out of the mapping (no syscalls, no
+    parsing).  Each slot is a seqlock: a copy is retried if the writer was
+    inside the slot.  Python has no explicit fences; this relies on loads
+    not being reordered with loads, as on x86-64.
+    """
+    
+    def __init__(self, path: Path = METRICS_SHM_PATH):
+        with open(path, "rb") as f:
+            self._mm = mmap.mmap(f.fileno(), 0, prot=mmap.PROT_READ)
+        header = self.header()
+        if (header.magic != METRICS_MAGIC or header.version != METRICS_VERSION or
+                header.slot_count != METRICS_SLOTS or header.history != METRICS_HISTORY or
+                header.slot_size != ctypes.sizeof(MetricsSlotHeader) +
+                METRICS_HISTORY * ctypes.sizeof(MetricsSample) or
+                header.sample_size != ctypes.sizeof(MetricsSample)):
+            self._mm.close()
+            raise ValueError(f"{path}: unsupported metrics segment layout")
+        self._slot_size = header.slot_size
+        self._index: Dict[str, int] = {}
+        self._generation = None
+    
+    def header(self) -> MetricsShmHeader:
+        return MetricsShmHeader.from_buffer_copy(self._mm, 0)
+    
+    @property
+    def alive(self) -> bool:
+        """False once the writing daemon has shut down or been killed"""
+        pid = struct.unpack_from("i", self._mm, MetricsShmHeader.writer_pid.offset)[0]
+        if pid <= 0:
+            return False
+        try:
+            os.kill(pid, 0)
+        except ProcessLookupError:
+            return False
+        except PermissionError:
+            pass
+        return True
+    
+    def _slot_offset(self, index: int) -> int:
+        return ctypes.sizeof(MetricsShmHeader) + index * self._slot_size
+    
+    def _read_slot(self, index: int, max_samples: int):
+        """Seqlocked copy of a slot: (slot header, samples oldest first)"""
+        offset = self._slot_offset(index)
+        samples_offset = offset + ctypes.sizeof(MetricsSlotHeader)
+        sample_size = ctypes.sizeof(MetricsSample)
+        spins = 0
+        while True:
+            # Both seq loads and the copy between them are plain loads; their
+            # order holds on x86-64 (TSO) but not on weakly ordered CPUs
+            seq = struct.unpack_from("Q", self._mm, offset)[0]
+            if seq & 1:
+                spins += 1
+                if spins % SEQLOCK_SPINS == 0:
+                    yields = spins // SEQLOCK_SPINS
+                    if yields >= SEQLOCK_MAX_YIELDS or \
+                            (yields % SEQLOCK_CHECK_YIELDS == 0 and not self.alive):
+                        raise MetricsShmStale(f"metrics slot {index} stuck mid-update")
+                    os.sched_yield()
+                continue
+            slot = MetricsSlotHeader.from_buffer_copy(self._mm, offset)
+            n = min(slot.count, METRICS_HISTORY, max_samples) if slot.in_use else 0
+            samples = [MetricsSample.from_buffer_copy(
+                           self._mm, samples_offset + ((slot.count - n + k) % METRICS_HISTORY) * sample_size)
+                       for k in range(n)]
+            if struct.unpack_from("Q", self._mm, offset)[0] == seq:
+                return slot, samples
+    
+    def _refresh_index(self):
+        generation = struct.unpack_from("Q", self._mm, MetricsShmHeader.generation.offset)[0]
+        if generation == self._generation:
+            return
+        index = {}
+        for i in range(METRICS_SLOTS):
+            slot, _ = self._read_slot(i, 0)
+            if slot.in_use:
+                index[slot.id.decode()] = i
+        self._index, self._generation = index, generation
+    
+    def container_ids(self) -> List[str]:
+        """Containers currently exported"""
+        self._refresh_index()
+        return list(self._index)
+    
+    def history(self, container_id: str, limit: int = METRICS_HISTORY) -> List[MetricsSample]:
+        """Up to limit most recent samples of a container, oldest first"""
+        self._refresh_index()
+        index = self._index.get(container_id)
+        if index is None:
+            return []
+        slot, samples = self._read_slot(index, limit)
+        if not slot.in_use or slot.id.decode() != container_id:
+            self._generation = None  # Slot was reused since the index was built
+            return []
+        return samples
+    
+    def latest(self, container_id: str) -> Optional[MetricsSample]:
+        samples = self.history(container_id, 1)
+        return samples[0] if samples else None
+    
+    def close(self):
+        self._mm.close()
+
+_metrics_shm: Optional[MetricsShm] = None
+
+def open_metrics_export() -> Optional[MetricsShm]:
+    """The daemon's metrics segment, or None when no daemon exports one"""
+    global _metrics_shm
+    if _metrics_shm is not None and _metrics_shm.alive:
+        return _metrics_shm
+    if _metrics_shm is not None:
+        _metrics_shm.close()
+        _metrics_shm = None
+    try:
+        _metrics_shm = MetricsShm()
+    except (OSError, ValueError):
+        return None
+    return _metrics_shm if _metrics_shm.alive else None
+
+def _struct_to_dict(s: Structure) -> Dict:
+    return {name: getattr(s, name) for name, _ in s._fields_}
+
+def metrics_to_dict(m: ContainerMetrics) -> Dict:
+    """ContainerMetrics in the shape of Container.get_metrics()"""
+    result = {name: getattr(m, name) for name in (
+        "memory_usage_bytes", "memory_limit_bytes", "cpu_usage_ns", "cpu_usage_percent",
+        "pids_current", "pids_limit", "io_read_bytes", "io_write_bytes", "io_read_ops",
+        "io_write_ops", "reclaim_bytes", "reclaim_count")}
+    result["cpu_stat"] = _struct_to_dict(m.cpu_stat)
+    result["memory_stat"] = _struct_to_dict(m.memory_stat)
+    result["memory_events"] = _struct_to_dict(m.memory_events)
+    for name in PSI_FILES.values():
+        psi = getattr(m, name.replace(".", "_"))
+        result[name.replace(".", "_")] = {
+            kind: {"avg10": getattr(psi, f"{kind}_avg10"), "avg60": getattr(psi, f"{kind}_avg60"),
+                   "total_us": getattr(psi, f"{kind}_total_us")}
+            for kind in ("some", "full")}
+    return result
+
+def load_library():
+    """Load the runtime library, or return None if it is not built"""
+    try:
+        if LIB_PATH.exists():
+            return ctypes.CDLL(str(LIB_PATH))
+    except Exception:
+        pass
+    return None
+
+class CgroupSampler:
+    """Native cgroup sampler: keeps cgroup fds open and computes rates in C"""
+    
+    def __init__(self, lib, cgroup_path: str, pid: int = 0):
+        self._lib = lib
+        self._handle = ctypes.c_void_p()
+        lib.cgroup_sampler_open_path.argtypes = [ctypes.c_char_p, c_int, POINTER(ctypes.c_void_p)]
+        lib.cgroup_sampler_read.argtypes = [ctypes.c_void_p, POINTER(ContainerMetrics)]
+        lib.cgroup_sampler_close.argtypes = [ctypes.c_void_p]
+        ret = lib.cgroup_sampler_open_path(cgroup_path.encode(), pid, ctypes.byref(self._handle))
+        if ret != 0:
+            raise OSError(f"cgroup_sampler_open_path failed for {cgroup_path} ({ret})")
+        self._metrics = ContainerMetrics()
+    
+    def read(self) -> ContainerMetrics:
+        """Take one sample (the returned structure is reused between calls)"""
+        self._lib.cgroup_sampler_read(self._handle, ctypes.byref(self._metrics))
+        return self._metrics
+    
+    def close(self):
+        if self._handle:
+            self._lib.cgroup_sampler_close(self._handle)
+            self._handle = ctypes.c_void_p()
+    
+    def __del__(self):
+        self.close()
+
+class ContainerEvent(Structure):
+    _fields_ = [
+        ("type", c_int),
+        ("container_id", c_char * 65),
+        ("pid", c_int),
+        ("exit_status", c_int),
+        ("oom_kills", c_long),
+        ("psi_resource", c_int),
+        ("psi_full", c_int),
+        ("psi_avg10", c_double),
+    ]
+
+EVENT_EXIT, EVENT_UNPOPULATED, EVENT_OOM, EVENT_PRESSURE = 0, 1, 2, 3
+EVENT_CALLBACK = ctypes.CFUNCTYPE(None, POINTER(ContainerEvent), ctypes.c_void_p)
+
+class EventLoop:
+    """Native exit / cgroup-empty / OOM / PSI notifications (pidfd + inotify + epoll)"""
+    
+    def __init__(self, lib):
+        self._lib = lib
+        self._handle = ctypes.c_void_p()
+        self._callbacks = {}
+        lib.event_loop_create.argtypes = [POINTER(ctypes.c_void_p)]
+        lib.event_loop_fd.argtypes = [ctypes.c_void_p]
+        lib.event_loop_watch_cgroup.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p,
+                                                c_int, EVENT_CALLBACK, ctypes.c_void_p]
+        lib.event_loop_unwatch.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+        lib.event_loop_watch_pressure.argtypes = [ctypes.c_void_p, ctypes.c_char_p, c_int, c_int,
+                                                  c_long, c_long]
+        lib.event_loop_run_once.argtypes = [ctypes.c_void_p, c_int]
+        lib.event_loop_destroy.argtypes = [ctypes.c_void_p]
+        if lib.event_loop_create(ctypes.byref(self._handle)) != 0:
+            raise OSError("event_loop_create failed")
+    
+    def fileno(self) -> int:
+        """epoll fd, usable with selectors / asyncio add_reader"""
+        return self._lib.event_loop_fd(self._handle)
+    
+    def watch(self, container_id: str, cgroup_path: str, pid: int, callback: Callable):
+        """Call callback(type, container_id, pid, exit_status, oom_kills, psi) on events
+
+        psi is (resource, full, avg10) for EVENT_PRESSURE and None otherwise.
+        """
+        def trampoline(event, _userdata):
+            ev = event.contents
+            psi = (ev.psi_resource, bool(ev.psi_full), ev.psi_avg10) \
+                if ev.type == EVENT_PRESSURE else None
+            callback(ev.type, ev.container_id.decode(), ev.pid, ev.exit_status, ev.oom_kills, psi)
+        cb = EVENT_CALLBACK(trampoline)
+        ret = self._lib.event_loop_watch_cgroup(self._handle, container_id.encode(),
+                                                cgroup_path.encode(), pid, cb, None)
+        if ret != 0:
+            raise OSError(f"event_loop_watch_cgroup failed for {container_id} ({ret})")
+        self._callbacks[container_id] = cb  # keep the ctypes thunk alive
+    
+    def watch_pressure(self, container_id: str, resource: int, stall_us: int,
+                       window_us: int = 1000000, full: bool = False):
+        """Fire EVENT_PRESSURE when stalls exceed stall_us within window_us (watch first)"""
+        ret = self._lib.event_loop_watch_pressure(self._handle, container_id.encode(), resource,
+                                                  int(full), stall_us, window_us)
+        if ret != 0:
+            raise OSError(f"event_loop_watch_pressure failed for {container_id} ({ret})")
+    
+    def unwatch(self, container_id: str):
+        self._lib.event_loop_unwatch(self._handle, container_id.encode())
+        self._callbacks.pop(container_id, None)
+    
+    def run_once(self, timeout_ms: int = -1) -> int:
+        """Block up to timeout_ms and dispatch callbacks; returns events dispatched"""
+        return self._lib.event_loop_run_once(self._handle, timeout_ms)
+    
+    def close(self):
+        if self._handle:
+            self._lib.event_loop_destroy(self._handle)
+            self._handle = ctypes.c_void_p()
+            self._callbacks.clear()
+    
+    def __del__(self):
+        self.close()
+
 class Container:
     """Python representation of a container"""
     
@@ -65,7 +505,15 @@ class Container:
         self.state_dir = state_dir or f"/var/lib/kernelsight/containers/{id}"
     
     def get_metrics(self) -> Dict:
-        """Get container metrics from cgroup"""
+        """Get container metrics (the daemon's export if it has them, else the cgroup files)"""
+        shm = open_metrics_export()
+        try:
+            sample = shm.latest(self.id) if shm else None
+        except MetricsShmStale:
+            sample = None
+        if sample is not None:
+            return metrics_to_dict(sample.metrics)
+        
         metrics = {}
         try:
             mem_current = Path(self.cgroup_path) / "memory.current"
@@ -79,9 +527,15 @@ class Container:
             
             cpu_stat = Path(self.cgroup_path) / "cpu.stat"
             if cpu_stat.exists():
-                for line in cpu_stat.read_text().splitlines():
-                    if line.startswith("usage_usec"):
-                        metrics["cpu_usage_ns"] = int(line.split()[1]) * 1000
+                stat = parse_flat_keyed(cpu_stat.read_text())
+                metrics["cpu_stat"] = stat
+                if "usage_usec" in stat:
+                    metrics["cpu_usage_ns"] = stat["usage_usec"] * 1000
+            
+            for name in ("memory.stat", "memory.events"):
+                path = Path(self.cgroup_path) / name
+                if path.exists():
+                    metrics[name.replace(".", "_")] = parse_flat_keyed(path.read_text())
             
             pids_current = Path(self.cgroup_path) / "pids.current"
             if pids_current.exists():
@@ -91,10 +545,51 @@ class Container:
             if pids_max.exists():
                 val = pids_max.read_text().strip()
                 metrics["pids_limit"] = -1 if val == "max" else int(val)
+            
+            io_stat = Path(self.cgroup_path) / "io.stat"
+            if io_stat.exists():
+                totals = {"rbytes": 0, "wbytes": 0, "rios": 0, "wios": 0}
+                for line in io_stat.read_text().splitlines():
+                    for field in line.split()[1:]:
+                        key, _, val = field.partition("=")
+                        if key in totals:
+                            totals[key] += int(val)
+                metrics["io_read_bytes"] = totals["rbytes"]
+                metrics["io_write_bytes"] = totals["wbytes"]
+                metrics["io_read_ops"] = totals["rios"]
+                metrics["io_write_ops"] = totals["wios"]
+            
+            for name in PSI_FILES.values():
+                pressure = Path(self.cgroup_path) / name
+                if pressure.exists():
+                    metrics[name.replace(".", "_")] = parse_pressure(pressure.read_text())
         except Exception:
             pass
         return metrics
     
+    def placement(self) -> Optional[Dict]:
+        """CPUs and NUMA nodes the runtime placed this container on, if any"""
+        record = Path(self.state_dir) / "cpuset"
+        if not record.exists():
+            return None
+        data = dict(line.split("=", 1) for line in record.read_text().splitlines() if "=" in line)
+        return {
+            "cpus": data.get("cpus", ""),
+            "mems": data.get("mems", ""),
+            "exclusive": data.get("exclusive") == "1",
+        }
+    
+    def network(self) -> Optional[Dict]:
+        """Veth pair and address of a running container with its own network"""
+        record = Path(self.state_dir) / "network"
+        if not record.exists():
+            return None
+        data = dict(line.split("=", 1) for line in record.read_text().splitlines() if "=" in line)
+        return {
+            "host_interface": data.get("host_if", ""),
+            "address": data.get("address", ""),
+        }
+    
     def to_dict(self) -> Dict:
         return {
             "id": self.id,
@@ -102,6 +597,8 @@ class Container:
             "state": self.state,
             "pid": self.pid,
             "rootfs": self.rootfs,
+            "cpuset": self.placement(),
+            "network": self.network(),
         }
 
 class ContainerManager:
@@ -110,12 +607,20 @@ class ContainerManager:
     STATE_DIR = Path("/var/lib/kernelsight/containers")
     
     def __init__(self):
-        self._lib = None
-        try:
-            if LIB_PATH.exists():
-                self._lib = ctypes.CDLL(str(LIB_PATH))
-        except Exception:
-            pass
+        self._lib = load_library()
+        if self._lib:
+            lib = self._lib
+            lib.container_get.argtypes = [ctypes.c_char_p, POINTER(ctypes.c_void_p)]
+            lib.container_free.argtypes = [ctypes.c_void_p]
+            lib.container_update_limits.argtypes = [ctypes.c_void_p, POINTER(ResourceLimits), c_uint]
+            lib.container_pause.argtypes = [ctypes.c_void_p]
+            lib.container_resume.argtypes = [ctypes.c_void_p]
+            lib.container_checkpoint.argtypes = [ctypes.c_void_p, c_uint]
+            lib.container_restore.argtypes = [ctypes.c_void_p]
+            lib.mc_counters_snapshot.argtypes = [POINTER(Counters)]
+            lib.mc_counters_format_prometheus.argtypes = [POINTER(Counters), ctypes.c_char_p,
+                                                          ctypes.c_size_t]
+            lib.mc_log_set_level.argtypes = [c_int]
     
     def list_containers(self) -> List[Container]:
         """List all containers"""
@@ -152,6 +657,89 @@ class ContainerManager:
                 return c
         return None
     
+    def _call_on_container(self, id_or_name: str, func, *args) -> int:
+        """Load a container through the C runtime and call func(container, *args)"""
+        if not self._lib:
+            raise RuntimeError("runtime library is not built")
+        handle = ctypes.c_void_p()
+        ret = self._lib.container_get(id_or_name.encode(), ctypes.byref(handle))
+        if ret != 0:
+            return ret
+        try:
+            return func(handle, *args)
+        finally:
+            self._lib.container_free(handle)
+    
+    def update_limits(self, id_or_name: str, memory: Optional[int] = None,
+                      memory_high: Optional[int] = None, cpu_percent: Optional[float] = None,
+                      pids: Optional[int] = None, cpu_period_us: int = 100000,
+                      cpuset: Optional[str] = None, cpuset_mems: Optional[str] = None,
+                      memory_low: Optional[int] = None, memory_min: Optional[int] = None) -> int:
+        """Change limits of a live container; only the given ones are touched, 0 or "" lifts a limit"""
+        limits = ResourceLimits()
+        fields = 0
+        if memory is not None:
+            limits.memory_limit_bytes = memory or -1
+            fields |= LIMIT_MEMORY
+        if memory_high is not None:
+            limits.memory_high_bytes = memory_high or -1
+            fields |= LIMIT_MEMORY_HIGH
+        if memory_low is not None:
+            limits.memory_low_bytes = memory_low or -1
+            fields |= LIMIT_MEMORY_LOW
+        if memory_min is not None:
+            limits.memory_min_bytes = memory_min or -1
+            fields |= LIMIT_MEMORY_MIN
+        if cpu_percent is not None:
+            limits.cpu_quota_us = int(cpu_percent * cpu_period_us / 100) or -1
+            limits.cpu_period_us = cpu_period_us
+            fields |= LIMIT_CPU
+        if pids is not None:
+            limits.pids_max = pids or -1
+            fields |= LIMIT_PIDS
+        if cpuset is not None:
+            limits.cpuset_cpus = cpuset.encode()
+            fields |= LIMIT_CPUSET
+        if cpuset_mems is not None:
+            limits.cpuset_mems = cpuset_mems.encode()
+            fields |= LIMIT_CPUSET_MEMS
+        return self._call_on_container(
+            id_or_name, lambda c: self._lib.container_update_limits(c, ctypes.byref(limits), fields))
+    
+    def pause(self, id_or_name: str) -> int:
+        """Freeze a running container (returns once cgroup.events reports frozen)"""
+        return self._call_on_container(id_or_name, lambda c: self._lib.container_pause(c))
+    
+    def resume(self, id_or_name: str) -> int:
+        """Thaw a paused container"""
+        return self._call_on_container(id_or_name, lambda c: self._lib.container_resume(c))
+    
+    def checkpoint(self, id_or_name: str, leave_running: bool = False, tmpfs: bool = False) -> int:
+        """Dump a container with criu; it stops unless leave_running, tmpfs keeps images in memory"""
+        flags = (CHECKPOINT_LEAVE_RUNNING if leave_running else 0) | \
+                (CHECKPOINT_TMPFS if tmpfs else 0)
+        return self._call_on_container(id_or_name, lambda c: self._lib.container_checkpoint(c, flags))
+    
+    def restore(self, id_or_name: str) -> int:
+        """Restore a stopped container from its last checkpoint"""
+        return self._call_on_container(id_or_name, lambda c: self._lib.container_restore(c))
+    
+    def counters_prometheus(self) -> str:
+        """Runtime counters of this process in the Prometheus text format"""
+        if not self._lib:
+            raise RuntimeError("runtime library is not built")
+        counters = Counters()
+        self._lib.mc_counters_snapshot(ctypes.byref(counters))
+        size = self._lib.mc_counters_format_prometheus(ctypes.byref(counters), None, 0) + 1
+        buf = ctypes.create_string_buffer(size)
+        self._lib.mc_counters_format_prometheus(ctypes.byref(counters), buf, size)
+        return buf.value.decode()
+    
+    def set_log_level(self, level: int):
+        """Lowest runtime log level written to stderr (0=debug .. 3=error)"""
+        if self._lib:
+            self._lib.mc_log_set_level(level)
+    
     def get_all_metrics(self) -> List[Dict]:
         """Get metrics for all running containers"""
         result = []
@@ -0,0 +1,464 @@
+/*
+ * KernelSight - Linux Container Runtime
+ * lifecycle_bench.c - Container lifecycle latency benchmark
+ *
+ * Drives whole container lifecycles (create, start, exec, sample, stop,
+ * delete) through the library and times each phase, plus the pieces that
+ * run inside the child (ns_create, fs_pivot_root, fs_mount_essentials) in
+ * isolation, and a start from a parked zygote (container_start_warm; the
+ * pool is filled off the clock, and a start that fell back to a cold clone
+ * counts as failed).  Every concurrency level in -j is run in turn with that many
+ * worker processes each doing -n iterations; per-phase p50/p99/p999 go to
+ * stdout and, with -o, to a JSON file that can be diffed between kernels
+ * or commits.  Phases the host cannot run (no cgroup v2, no exec) are
+ * reported as unavailable rather than failing the run.
+ *
+ * Usage: lifecycle-bench [-n iterations] [-j 1,4,...] [-o out.json] <rootfs>
+ */
+
+#define _GNU_SOURCE
+#include "../include/container.h"
+#include <sys/mman.h>
+#include <sys/utsname.h>
+#include <time.h>
+
+#define MAX_LEVELS 8
+#define MAX_WORKERS 256
+
+typedef enum {
+    PHASE_CREATE,
+    PHASE_APPLY_LIMITS,
+    PHASE_START,
+    PHASE_EXEC,
+    PHASE_SAMPLE,
+    PHASE_STOP,
+    PHASE_CGROUP_CLEANUP,
+    PHASE_DELETE,
+    PHASE_NS_CREATE,
+    PHASE_PIVOT_ROOT,
+    PHASE_MOUNT_ESSENTIALS,
+    PHASE_WARM_START,
+    PHASE_COUNT
+} phase_t;
+
+static const char *const phase_names[PHASE_COUNT] = {
+    "container_create", "cgroup_apply_limits", "container_start", "container_exec",
+    "cgroup_sampler_read", "container_stop", "cgroup_cleanup", "container_delete",
+    "ns_create", "fs_pivot_root", "fs_mount_essentials", "container_start_warm",
+};
+
+/* Sample slots for one run, shared with the worker processes */
+typedef struct {
+    int workers;
+    int iterations;
+    long *samples;                /* [phase][worker * iterations + i], -1 = none */
+    int failed[PHASE_COUNT];
+} run_t;
+
+static const char *rootfs;
+/* PID 1 ignores SIGTERM without a handler: trap it so stop measures a
+ * clean shutdown rather than the SIGKILL timeout */
+static char *init_cmd[] = { "/bin/sh", "-c", "trap 'exit 0' TERM; sleep 3600 & wait", NULL };
+static char *exec_cmd[] = { "/bin/sh", "-c", ":", NULL };
+
+static long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int cmp_long(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+static long *slot(run_t *run, phase_t phase, int worker, int i) {
+    return &run->samples[((size_t)phase * run->workers + worker) * run->iterations + i];
+}
+
+/**
+ * Store one phase result: elapsed ns on success, a failure count otherwise
+ */
+static void record(run_t *run, phase_t phase, int worker, int i, long start, int ret) {
+    if (ret == MC_OK) {
+        *slot(run, phase, worker, i) = now_ns() - start;
+    } else {
+        __atomic_fetch_add(&run->failed[phase], 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void bench_config(container_config_t *config, char **cmd, int worker, int i) {
+    int count = 0;
+    while (cmd[count]) count++;
+    
+    memset(config, 0, sizeof(*config));
+    /* Fixed IDs: forked workers would otherwise share one rand() stream */
+    snprintf(config->id, sizeof(config->id), "%06x%06x",
+             ((unsigned)getpid() << 8 | (unsigned)worker) & 0xffffff, (unsigned)i & 0xffffff);
+    snprintf(config->name, sizeof(config->name), "bench-%s", config->id);
+    strncpy(config->rootfs, rootfs, sizeof(config->rootfs) - 1);
+    config->cmd = cmd;
+    config->cmd_count = count;
+    config->limits.memory_limit_bytes = 64L * 1024 * 1024;
+    config->limits.memory_swap_bytes = -1;
+    config->limits.cpu_quota_us = 50000;
+    config->limits.cpu_period_us = 100000;
+    config->limits.pids_max = 64;
+}
+
+/**
+ * Wait (up to ~1s) until the init has its SIGTERM handler installed
+ */
+static void wait_term_handler(pid_t pid) {
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    
+    for (int tries = 0; tries < 1000; tries++) {
+        FILE *f = fopen(path, "r");
+        if (!f) return;
+        unsigned long long caught = 0;
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "SigCgt: %llx", &caught) == 1) break;
+        }
+        fclose(f);
+        if (caught & (1ULL << (SIGTERM - 1))) return;
+        usleep(1000);
+    }
+}
+
+/**
+ * One full lifecycle through the public API
+ */
+static void lifecycle(run_t *run, int worker, int i) {
+    container_config_t config;
+    container_t *c = NULL;
+    long start;
+    int ret;
+    
+    bench_config(&config, init_cmd, worker, i);
+    
+    start = now_ns();
+    ret = container_create(&config, &c);
+    record(run, PHASE_CREATE, worker, i, start, ret);
+    if (ret != MC_OK) return;
+    
+    /* Only meaningful with a live cgroup directory */
+    if (access(c->cgroup_path, W_OK) == 0) {
+        start = now_ns();
+        record(run, PHASE_APPLY_LIMITS, worker, i, start, cgroup_apply_limits(c));
+    }
+    
+    start = now_ns();
+    ret = container_start(c);
+    record(run, PHASE_START, worker, i, start, ret);
+    
+    if (ret == MC_OK) {
+        /* The init is up (root switched, shell running) once it traps TERM */
+        wait_term_handler(c->pid);
+    
+        start = now_ns();
+        record(run, PHASE_EXEC, worker, i, start, container_exec(c, exec_cmd, 3));
+    
+        cgroup_sampler_t *sampler;
+        if (cgroup_sampler_open(c, &sampler) == MC_OK) {
+            container_metrics_t metrics;
+            start = now_ns();
+            record(run, PHASE_SAMPLE, worker, i, start, cgroup_sampler_read(sampler, &metrics));
+            cgroup_sampler_close(sampler);
+        }
+    
+        start = now_ns();
+        record(run, PHASE_STOP, worker, i, start, container_stop(c, 1));
+    }
+    
+    if (access(c->cgroup_path, F_OK) == 0) {
+        start = now_ns();
+        record(run, PHASE_CGROUP_CLEANUP, worker, i, start, cgroup_cleanup(c));
+    }
+    
+    start = now_ns();
+    record(run, PHASE_DELETE, worker, i, start, container_delete(c));
+    container_free(c);
+}
+
+/**
+ * container_start from a zygote parked for just this start, so the pool
+ * never serves the cold starts of lifecycle()
+ */
+static void warm_start(run_t *run, int worker, int i) {
+    container_config_t config;
+    container_t *c = NULL;
+    zygote_pool_t *pool = NULL;
+    
+    bench_config(&config, init_cmd, worker, i);
+    if (container_create(&config, &c) != MC_OK) return;
+    
+    /* Zygotes attach to the container cgroup; without one they can't start */
+    if (access(c->cgroup_path, W_OK) == 0) {
+        if (zygote_pool_create(rootfs, 0, 1, &pool) == MC_OK) {
+            mc_counters_t before, after;
+            mc_counters_snapshot(&before);
+            long start = now_ns();
+            int ret = container_start(c);
+            long elapsed = now_ns() - start;
+            mc_counters_snapshot(&after);
+            
+            /* No clone during the start: the zygote was used */
+            if (ret == MC_OK && after.calls[MC_COUNTER_CLONE] == before.calls[MC_COUNTER_CLONE]) {
+                *slot(run, PHASE_WARM_START, worker, i) = elapsed;
+            } else {
+                __atomic_fetch_add(&run->failed[PHASE_WARM_START], 1, __ATOMIC_RELAXED);
+            }
+            zygote_pool_destroy(pool);
+            if (ret == MC_OK) {
+                wait_term_handler(c->pid);
+                container_stop(c, 1);
+            }
+        } else {
+            __atomic_fetch_add(&run->failed[PHASE_WARM_START], 1, __ATOMIC_RELAXED);
+        }
+    }
+    
+    container_delete(c);
+    container_free(c);
+}
+
+/**
+ * ns_create on its own: clone + sync, the child pivots, mounts and execs
+ */
+static void namespaces(run_t *run, int worker, int i) {
+    container_config_t config;
+    bench_config(&config, exec_cmd, worker, i);
+    
+    long start = now_ns();
+    pid_t pid = ns_create(&config);
+    record(run, PHASE_NS_CREATE, worker, i, start, pid > 0 ? MC_OK : pid);
+    if (pid > 0) waitpid(pid, NULL, 0);
+}
+
+/**
+ * The child's root switch and essential mounts, timed inside the child
+ */
+static void root_setup(run_t *run, int worker, int i) {
+    long times[2] = { -1, -1 };
+    int fds[2];
+    
+    if (pipe(fds) != 0) return;
+    
+    pid_t pid = (pid_t)syscall(SYS_clone, CLONE_NEWNS | CLONE_NEWPID | SIGCHLD,
+                               NULL, NULL, NULL, 0);
+    if (pid == 0) {
+        close(fds[0]);
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) dup2(devnull, STDERR_FILENO);
+    
+        long start = now_ns();
+        if (fs_pivot_root(rootfs) == MC_OK) {
+            times[0] = now_ns() - start;
+            start = now_ns();
+            if (fs_mount_essentials() == MC_OK) times[1] = now_ns() - start;
+        }
+        ssize_t n = write(fds[1], times, sizeof(times));
+        _exit(n == (ssize_t)sizeof(times) ? 0 : 1);
+    }
+    close(fds[1]);
+    if (pid > 0) {
+        if (read(fds[0], times, sizeof(times)) != (ssize_t)sizeof(times)) times[0] = -1;
+        waitpid(pid, NULL, 0);
+    }
+    close(fds[0]);
+    
+    phase_t phases[2] = { PHASE_PIVOT_ROOT, PHASE_MOUNT_ESSENTIALS };
+    for (int k = 0; k < 2; k++) {
+        if (times[k] >= 0) {
+            *slot(run, phases[k], worker, i) = times[k];
+        } else {
+            __atomic_fetch_add(&run->failed[phases[k]], 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void worker_main(run_t *run, int worker) {
+    int devnull = open("/dev/null", O_WRONLY);
+    /* Library warnings would dominate the output at -j > 1 */
+    if (devnull >= 0) dup2(devnull, STDERR_FILENO);
+    
+    for (int i = 0; i < run->iterations; i++) {
+        lifecycle(run, worker, i);
+        warm_start(run, worker, i);
+        namespaces(run, worker, i);
+        root_setup(run, worker, i);
+    }
+}
+
+/**
+ * Nearest-rank percentile of a sorted array
+ */
+static long percentile(const long *sorted, int n, double p) {
+    int rank = (int)(p * n + 0.999999);
+    if (rank < 1) rank = 1;
+    return sorted[(rank > n ? n : rank) - 1];
+}
+
+static void report(run_t *run, long wall_ns, FILE *json, int first) {
+    int total = run->workers * run->iterations;
+    long *sorted = malloc(sizeof(long) * total);
+    if (!sorted) return;
+    
+    printf("\nconcurrency=%d iterations=%d wall=%.1fms\n", run->workers, run->iterations,
+           wall_ns / 1e6);
+    printf("%-22s %7s %6s %10s %10s %10s %10s\n", "phase", "n", "failed",
+           "mean_us", "p50_us", "p99_us", "p999_us");
+    if (json) {
+        fprintf(json, "%s\n    {\"concurrency\": %d, \"wall_ms\": %.3f, \"phases\": {",
+                first ? "" : ",", run->workers, wall_ns / 1e6);
+    }
+    
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        int n = 0;
+        double sum = 0;
+        for (int w = 0; w < run->workers; w++) {
+            for (int i = 0; i < run->iterations; i++) {
+                long v = *slot(run, p, w, i);
+                if (v >= 0) {
+                    sorted[n++] = v;
+                    sum += v;
+                }
+            }
+        }
+        qsort(sorted, n, sizeof(long), cmp_long);
+    
+        if (json) {
+            fprintf(json, "%s\n      \"%s\": {\"n\": %d, \"failed\": %d", p ? "," : "",
+                    phase_names[p], n, run->failed[p]);
+        }
+        if (n == 0) {
+            printf("%-22s %7d %6d %10s\n", phase_names[p], n, run->failed[p], "unavailable");
+            if (json) fprintf(json, "}");
+            continue;
+        }
+    
+        double mean = sum / n / 1000.0;
+        double p50 = percentile(sorted, n, 0.50) / 1000.0;
+        double p99 = percentile(sorted, n, 0.99) / 1000.0;
+        double p999 = percentile(sorted, n, 0.999) / 1000.0;
+        printf("%-22s %7d %6d %10.1f %10.1f %10.1f %10.1f\n", phase_names[p], n,
+               run->failed[p], mean, p50, p99, p999);
+        if (json) {
+            fprintf(json, ", \"mean_us\": %.3f, \"p50_us\": %.3f, \"p99_us\": %.3f, "
+                    "\"p999_us\": %.3f, \"max_us\": %.3f}", mean, p50, p99, p999,
+                    sorted[n - 1] / 1000.0);
+        }
+    }
+    
+    if (json) fprintf(json, "\n    }}");
+    free(sorted);
+}
+
+/**
+ * Run one concurrency level: fork the workers and wait for all of them
+ */
+static int run_level(int workers, int iterations, FILE *json, int first) {
+    size_t slots = (size_t)PHASE_COUNT * workers * iterations;
+    size_t size = sizeof(run_t) + slots * sizeof(long);
+    pid_t pids[MAX_WORKERS];
+
+    run_t *run = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (run == MAP_FAILED) return 1;
+    run->workers = workers;
+    run->iterations = iterations;
+    run->samples = (long *)(run + 1);
+    memset(run->samples, 0xff, slots * sizeof(long));
+
+    /* Or every worker flushes a copy of the buffered output */
+    fflush(stdout);
+    if (json) fflush(json);
+    
+    long start = now_ns();
+    int started = 0;
+    for (int w = 0; w < workers; w++) {
+        pids[w] = fork();
+        if (pids[w] == 0) {
+            worker_main(run, w);
+            _exit(0);
+        }
+        if (pids[w] < 0) {
+            fprintf(stderr, "fork: %s\n", strerror(errno));
+            break;
+        }
+        started++;
+    }
+    for (int w = 0; w < started; w++) waitpid(pids[w], NULL, 0);
+    long wall = now_ns() - start;
+
+    report(run, wall, json, first);
+    munmap(run, size);
+    return started == workers ? 0 : 1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n iterations] [-j 1,4,...] [-o out.json] <rootfs>\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = 100, levels[MAX_LEVELS] = { 1, 4 }, nlevels = 2, opt;
+    const char *out = NULL;
+
+    while ((opt = getopt(argc, argv, "n:j:o:")) != -1) {
+        switch (opt) {
+            case 'n': iterations = atoi(optarg); break;
+            case 'o': out = optarg; break;
+            case 'j':
+                nlevels = 0;
+                for (char *tok = strtok(optarg, ","); tok && nlevels < MAX_LEVELS;
+                     tok = strtok(NULL, ",")) {
+                    levels[nlevels++] = atoi(tok);
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc || iterations <= 0 || nlevels == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    for (int l = 0; l < nlevels; l++) {
+        if (levels[l] <= 0 || levels[l] > MAX_WORKERS) {
+            fprintf(stderr, "Concurrency must be 1-%d\n", MAX_WORKERS);
+            return 1;
+        }
+    }
+    rootfs = argv[optind];
+
+    FILE *json = NULL;
+    if (out && !(json = fopen(out, "w"))) {
+        fprintf(stderr, "Cannot open %s: %s\n", out, strerror(errno));
+        return 1;
+    }
+
+    /* Shared by every worker, as in a long-running daemon */
+    fs_prepare_essentials();
+
+    struct utsname uts;
+    uname(&uts);
+    printf("kernel %s, rootfs %s, %ld cpus\n", uts.release, rootfs,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    if (json) {
+        fprintf(json, "{\n  \"benchmark\": \"lifecycle\",\n  \"kernel\": \"%s\",\n"
+                "  \"cpus\": %ld,\n  \"iterations\": %d,\n  \"runs\": [",
+                uts.release, sysconf(_SC_NPROCESSORS_ONLN), iterations);
+    }
+    
+    int ret = 0;
+    for (int l = 0; l < nlevels; l++) {
+        ret |= run_level(levels[l], iterations, json, l == 0);
+    }
+    
+    if (json) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+    return ret;
+}
@@ -0,0 +1,131 @@
+/*
+ * KernelSight - Linux Container Runtime
+ * stat_bench.c - cgroup stat parser benchmark
+ *
+ * Parses a representative memory.stat (or the file given on the command
+ * line) with the single-pass table parser and, for comparison, with a
+ * lookup per key (scan from the start of the buffer, sscanf the value),
+ * which is how one-off keys used to be read.
+ *
+ * Usage: stat-bench [-n iterations] [memory.stat]
+ */
+
+#define _GNU_SOURCE
+#include "../include/container.h"
+#include <stddef.h>
+#include <time.h>
+
+static const char sample_memory_stat[] =
+    "anon 104857600\nfile 52428800\nkernel 8388608\nkernel_stack 393216\n"
+    "pagetables 1048576\nsec_pagetables 0\npercpu 123456\nsock 4096\nvmalloc 8192\n"
+    "shmem 0\nzswap 0\nzswapped 0\nfile_mapped 10485760\nfile_dirty 4096\n"
+    "file_writeback 0\nswapcached 0\nanon_thp 0\nfile_thp 0\nshmem_thp 0\n"
+    "inactive_anon 104857600\nactive_anon 0\ninactive_file 41943040\n"
+    "active_file 10485760\nunevictable 0\nslab_reclaimable 4194304\n"
+    "slab_unreclaimable 2097152\nslab 6291456\nworkingset_refault_anon 0\n"
+    "workingset_refault_file 1234\nworkingset_activate_anon 0\n"
+    "workingset_activate_file 100\nworkingset_restore_anon 0\n"
+    "workingset_restore_file 50\nworkingset_nodereclaim 0\npgdemote_kswapd 0\n"
+    "pgdemote_direct 0\npgdemote_khugepaged 0\npgpromote_success 0\npgscan 1000\n"
+    "pgsteal 900\npgscan_kswapd 800\npgscan_direct 200\npgscan_khugepaged 0\n"
+    "pgsteal_kswapd 700\npgsteal_direct 200\npgsteal_khugepaged 0\npgfault 987654\n"
+    "pgmajfault 321\npgrefill 10\npgactivate 2000\npgdeactivate 100\npglazyfree 0\n"
+    "pglazyfreed 0\nzswpin 0\nzswpout 0\nzswpwb 0\nthp_fault_alloc 0\n"
+    "thp_collapse_alloc 0\nthp_swpout 0\nthp_swpout_fallback 0\n";
+
+/* Keys looked up individually by the baseline, in struct order */
+static const char *const baseline_keys[] = {
+    "anon", "file", "kernel", "kernel_stack", "pagetables", "percpu", "sock", "vmalloc",
+    "shmem", "zswap", "zswapped", "file_mapped", "file_dirty", "file_writeback",
+    "swapcached", "anon_thp", "file_thp", "shmem_thp", "inactive_anon", "active_anon",
+    "inactive_file", "active_file", "unevictable", "slab_reclaimable",
+    "slab_unreclaimable", "slab", "workingset_refault_anon", "workingset_refault_file",
+    "workingset_activate_anon", "workingset_activate_file", "workingset_restore_anon",
+    "workingset_restore_file", "workingset_nodereclaim", "pgscan", "pgsteal", "pgfault",
+    "pgmajfault", "pgrefill", "pgactivate", "pgdeactivate", "pglazyfree", "pglazyfreed",
+    "thp_fault_alloc", "thp_collapse_alloc",
+};
+
+static long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * Baseline: one scan of the buffer per key
+ */
+static void parse_per_key(const char *buf, memory_stat_t *stat) {
+    long *fields = (long *)stat;
+    size_t nkeys = sizeof(baseline_keys) / sizeof(baseline_keys[0]);
+    
+    for (size_t k = 0; k < nkeys; k++) {
+        size_t len = strlen(baseline_keys[k]);
+        for (const char *line = buf; line && *line; ) {
+            if (strncmp(line, baseline_keys[k], len) == 0 && line[len] == ' ') {
+                sscanf(line + len + 1, "%ld", &fields[k]);
+                break;
+            }
+            line = strchr(line, '\n');
+            if (line) line++;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    static char buf[65536];
+    int iterations = 200000, opt;
+    
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt != 'n') {
+            fprintf(stderr, "Usage: %s [-n iterations] [memory.stat]\n", argv[0]);
+            return 1;
+        }
+        iterations = atoi(optarg);
+    }
+    if (iterations <= 0) {
+        return 1;
+    }
+    
+    if (optind < argc) {
+        int fd = open(argv[optind], O_RDONLY);
+        ssize_t n = fd >= 0 ? read(fd, buf, sizeof(buf) - 1) : -1;
+        if (n <= 0) {
+            fprintf(stderr, "Cannot read %s\n", argv[optind]);
+            return 1;
+        }
+        buf[n] = '\0';
+        close(fd);
+    } else {
+        snprintf(buf, sizeof(buf), "%s", sample_memory_stat);
+    }
+    
+    memory_stat_t a, b;
+    memset(&b, 0, sizeof(b));
+    parse_per_key(buf, &b);
+    int stored = cgroup_parse_memory_stat(buf, &a);
+    if (memcmp(&a, &b, sizeof(a)) != 0) {
+        fprintf(stderr, "Parsers disagree\n");
+        return 1;
+    }
+    
+    long start = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        cgroup_parse_memory_stat(buf, &a);
+        __asm__ volatile("" : : "r"(&a) : "memory");
+    }
+    long single = now_ns() - start;
+    
+    start = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        memset(&b, 0, sizeof(b));
+        parse_per_key(buf, &b);
+        __asm__ volatile("" : : "r"(&b) : "memory");
+    }
+    long per_key = now_ns() - start;
+    
+    printf("memory.stat %zu bytes, %d keys stored\n", strlen(buf), stored);
+    printf("single-pass  %8.1f ns/parse\n", (double)single / iterations);
+    printf("per-key scan %8.1f ns/parse\n", (double)per_key / iterations);
+    return 0;
+}
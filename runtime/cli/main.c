@@ -15,32 +15,67 @@ static void print_usage(const char *prog) {
     printf("  start    Start a container\n");
     printf("  stop     Stop a container\n");
     printf("  delete   Delete a container\n");
+    printf("  pause    Freeze a running container\n");
+    printf("  resume   Thaw a paused container\n");
+    printf("  checkpoint Dump a container with criu (it stops unless --leave-running)\n");
+    printf("  restore  Restore a container from its checkpoint\n");
+    printf("  update   Change limits of a container (--memory, --memory-high, --cpus, ...)\n");
     printf("  list     List containers\n");
     printf("  stats    Show container stats\n");
+    printf("  counters Show runtime counters (Prometheus text format)\n");
     printf("  run      Create and start container\n");
     printf("  exec     Execute command in container's cgroup\n");
-    printf("  shell    Start interactive shell in new container\n\n");
+    printf("  shell    Start interactive shell in new container\n");
+    printf("  import   Import a layer tarball into the layer store\n");
+    printf("  daemon   Run the runtime daemon (other commands then go through it)\n\n");
     printf("Options:\n");
     printf("  --name <name>        Container name\n");
     printf("  --rootfs <path>      Path to rootfs\n");
+    printf("  --image <path>       Read-only image for a copy-on-write overlay rootfs\n");
+    printf("  --layer <digest>     Image layer from the store (repeat, base first)\n");
     printf("  --memory <bytes>     Memory limit\n");
+    printf("  --memory-high <bytes> Memory throttling threshold (memory.high)\n");
+    printf("  --memory-low <bytes> Best-effort memory protection (memory.low)\n");
+    printf("  --memory-min <bytes> Hard memory protection (memory.min)\n");
     printf("  --cpus <percent>     CPU limit (0-100)\n");
     printf("  --pids <max>         PID limit\n");
+    printf("  --cpuset <list>      Pin to CPUs, e.g. \"0-3,8\" (cpuset.cpus)\n");
+    printf("  --cpuset-mems <list> NUMA nodes to allocate from (cpuset.mems)\n");
+    printf("  --place-cpus <n>     Place on n CPUs chosen from the host topology\n");
+    printf("  --exclusive          With --place-cpus: whole cores, SMT siblings kept idle\n");
+    printf("  --io-weight <n>      IO weight (1-10000, default 100)\n");
+    printf("  --io-max <spec>      IO throttle, e.g. \"/dev/sda rbps=10M,wiops=200\" (repeat)\n");
+    printf("  --net                Own network namespace on the %s bridge (eth0 + address)\n", MC_NET_BRIDGE);
     printf("  --cmd <command>      Command to run\n");
+    printf("  --replicas <n>       run: create and start n containers in parallel\n");
+    printf("  --metrics-interval <ms> daemon: shared-memory metrics export rate (0 = off)\n");
+    printf("  --reclaim            daemon: proactively reclaim memory on each metrics tick\n");
+    printf("  --zygotes <n>        daemon: keep n pre-forked zygotes for --rootfs\n");
+    printf("  --leave-running      checkpoint: keep the container running after the dump\n");
+    printf("  --tmpfs              checkpoint: keep the images in /dev/shm\n");
+    printf("  --log-level <n>      0=debug, 1=info, 2=warn, 3=error (default 1)\n");
     printf("  --help               Show this help\n");
 }
 
+/* Connection to a running daemon, NULL = operate in-process */
+static daemon_client_t *daemon_conn;
+
+static int list_containers(container_t ***list, int *count) {
+    if (daemon_conn) return daemon_client_list(daemon_conn, list, count);
+    return container_list(list, count);
+}
+
 static void print_containers(void) {
-    container_t **list;
-    int count;
-    container_list(&list, &count);
+    container_t **list = NULL;
+    int count = 0;
+    list_containers(&list, &count);
     
     printf("%-12s %-20s %-10s %-8s\n", "ID", "NAME", "STATUS", "PID");
     printf("%-12s %-20s %-10s %-8s\n", "----", "----", "------", "---");
     
     const char *states[] = {"created", "running", "stopped", "paused", "deleted"};
     for (int i = 0; i < count; i++) {
-        printf("%-12s %-20s %-10s %-8d\n",
+        printf("%-12.12s %-20s %-10s %-8d\n",
                list[i]->config.id, list[i]->config.name,
                states[list[i]->state], list[i]->pid);
         container_free(list[i]);
@@ -49,31 +84,238 @@ static void print_containers(void) {
     printf("\nTotal: %d containers\n", count);
 }
 
+static void print_container_stats(container_t *c) {
+    container_metrics_t m;
+    int ret = daemon_conn ? daemon_client_stats(daemon_conn, c->config.id, &m)
+                          : cgroup_get_metrics(c, &m);
+    if (ret == MC_OK) {
+        printf("Container: %s (%s)\n", c->config.name, c->config.id);
+        printf("  Memory: %.2f MB / %.2f MB\n",
+               m.memory_usage_bytes / 1048576.0,
+               m.memory_limit_bytes > 0 ? m.memory_limit_bytes / 1048576.0 : -1);
+        printf("  CPU: %ld ns\n", m.cpu_usage_ns);
+        printf("  Memory breakdown: anon %.2f MB, file %.2f MB, kernel %.2f MB, sock %.2f MB\n",
+               m.memory_stat.anon / 1048576.0, m.memory_stat.file / 1048576.0,
+               m.memory_stat.kernel / 1048576.0, m.memory_stat.sock / 1048576.0);
+        printf("  Faults: %ld (%ld major), refaults %ld\n", m.memory_stat.pgfault,
+               m.memory_stat.pgmajfault,
+               m.memory_stat.workingset_refault_anon + m.memory_stat.workingset_refault_file);
+        printf("  PIDs: %d / %d\n", m.pids_current, m.pids_limit);
+        printf("  IO: read %.2f MB (%ld ops), write %.2f MB (%ld ops)\n",
+               m.io_read_bytes / 1048576.0, m.io_read_ops,
+               m.io_write_bytes / 1048576.0, m.io_write_ops);
+        printf("  Pressure (avg10 some/full): cpu %.2f/%.2f memory %.2f/%.2f io %.2f/%.2f\n",
+               m.cpu_pressure.some_avg10, m.cpu_pressure.full_avg10,
+               m.memory_pressure.some_avg10, m.memory_pressure.full_avg10,
+               m.io_pressure.some_avg10, m.io_pressure.full_avg10);
+        if (m.reclaim_count > 0) {
+            printf("  Reclaimed: %.2f MB in %ld steps\n", m.reclaim_bytes / 1048576.0, m.reclaim_count);
+        }
+        char startup[256];
+        startup_trace_format(&c->startup, startup, sizeof(startup));
+        printf("  Startup: %s\n", startup);
+        printf("\n");
+    }
+}
+
 static void print_stats(const char *id) {
-    container_t **list;
-    int count;
-    container_list(&list, &count);
+    if (id) {
+        container_t *c;
+        int ret = daemon_conn ? daemon_client_get(daemon_conn, id, &c) : container_get(id, &c);
+        if (ret == MC_OK) {
+            print_container_stats(c);
+            container_free(c);
+        }
+        return;
+    }
     
+    container_t **list = NULL;
+    int count = 0;
+    list_containers(&list, &count);
     for (int i = 0; i < count; i++) {
-        if (id && strcmp(list[i]->config.id, id) != 0 && strcmp(list[i]->config.name, id) != 0) {
-            container_free(list[i]);
-            continue;
-        }
-        container_metrics_t m;
-        if (cgroup_get_metrics(list[i], &m) == MC_OK) {
-            printf("Container: %s (%s)\n", list[i]->config.name, list[i]->config.id);
-            printf("  Memory: %.2f MB / %.2f MB\n",
-                   m.memory_usage_bytes / 1048576.0,
-                   m.memory_limit_bytes > 0 ? m.memory_limit_bytes / 1048576.0 : -1);
-            printf("  CPU: %ld ns\n", m.cpu_usage_ns);
-            printf("  PIDs: %d / %d\n", m.pids_current, m.pids_limit);
-            printf("\n");
-        }
+        print_container_stats(list[i]);
         container_free(list[i]);
     }
     if (list) free(list);
 }
 
+/**
+ * counters: the daemon's counters when one runs, else this process's
+ */
+static int counters_command(void) {
+    mc_counters_t counters;
+    if (daemon_conn) {
+        int ret = daemon_client_counters(daemon_conn, &counters);
+        if (ret != MC_OK) {
+            fprintf(stderr, "Could not read counters: %s\n", mc_strerror(ret));
+            return 1;
+        }
+    } else {
+        mc_counters_snapshot(&counters);
+    }
+    
+    int len = mc_counters_format_prometheus(&counters, NULL, 0);
+    char *text = malloc(len + 1);
+    if (!text) return 1;
+    mc_counters_format_prometheus(&counters, text, len + 1);
+    fputs(text, stdout);
+    free(text);
+    return 0;
+}
+
+/**
+ * Start, stop or delete containers; requests to the daemon are pipelined
+ */
+static int lifecycle_command(const char *cmd, char **ids, int count) {
+    daemon_op_t op = strcmp(cmd, "start") == 0 ? DAEMON_OP_START :
+                     strcmp(cmd, "stop") == 0 ? DAEMON_OP_STOP :
+                     strcmp(cmd, "pause") == 0 ? DAEMON_OP_PAUSE :
+                     strcmp(cmd, "resume") == 0 ? DAEMON_OP_RESUME : DAEMON_OP_DELETE;
+    int failed = 0;
+    
+    if (daemon_conn) {
+        int sent = 0;
+        while (sent < count && daemon_client_send_target(daemon_conn, op, ids[sent], 10) >= 0) sent++;
+        for (int i = 0; i < sent; i++) {
+            daemon_reply_t reply;
+            if (daemon_client_recv(daemon_conn, &reply) != MC_OK) {
+                sent = i;
+                break;
+            }
+            if (reply.status != MC_OK) {
+                fprintf(stderr, "%s: %s\n", ids[i], mc_strerror(reply.status));
+                failed++;
+            }
+        }
+        failed += count - sent;
+    } else {
+        for (int i = 0; i < count; i++) {
+            container_t *c;
+            if (container_get(ids[i], &c) != MC_OK) {
+                fprintf(stderr, "Container not found: %s\n", ids[i]);
+                failed++;
+                continue;
+            }
+            int ret;
+            if (op == DAEMON_OP_START) ret = container_start(c);
+            else if (op == DAEMON_OP_STOP) ret = container_stop(c, 10);
+            else if (op == DAEMON_OP_PAUSE) ret = container_pause(c);
+            else if (op == DAEMON_OP_RESUME) ret = container_resume(c);
+            else ret = container_delete(c);
+            if (ret != MC_OK) {
+                fprintf(stderr, "%s: %s\n", ids[i], mc_strerror(ret));
+                failed++;
+            }
+            container_free(c);
+        }
+    }
+    
+    if (failed == 0) printf("Done\n");
+    return failed ? 1 : 0;
+}
+
+/**
+ * checkpoint or restore one container; always local, since the restored
+ * tree must be a child of the caller
+ */
+static int checkpoint_command(const char *cmd, const char *id, unsigned int flags) {
+    container_t *c;
+    if (container_get(id, &c) != MC_OK) {
+        fprintf(stderr, "Container not found: %s\n", id);
+        return 1;
+    }
+    int ret = strcmp(cmd, "checkpoint") == 0 ? container_checkpoint(c, flags) : container_restore(c);
+    if (ret == MC_OK && strcmp(cmd, "restore") == 0) printf("Restored with PID %d\n", c->pid);
+    else if (ret != MC_OK) fprintf(stderr, "%s: %s\n", id, mc_strerror(ret));
+    container_free(c);
+    
+    if (ret == MC_OK) printf("Done\n");
+    return ret == MC_OK ? 0 : 1;
+}
+
+/**
+ * update: apply the limit options that were given; 0 lifts a limit
+ */
+static int update_command(const char *id, resource_limits_t *limits, unsigned int fields) {
+    if (fields == 0) {
+        fprintf(stderr, "Error: No limits given\n");
+        return 1;
+    }
+    
+    int ret;
+    if (daemon_conn) {
+        ret = daemon_client_update(daemon_conn, id, limits, fields);
+    } else {
+        container_t *c;
+        ret = container_get(id, &c);
+        if (ret == MC_OK) {
+            ret = container_update_limits(c, limits, fields);
+            container_free(c);
+        }
+    }
+    
+    if (ret != MC_OK) {
+        fprintf(stderr, "Update failed: %s\n", mc_strerror(ret));
+        return 1;
+    }
+    printf("Done\n");
+    return 0;
+}
+
+/**
+ * run --replicas: create and start copies of one configuration as a batch,
+ * named <name>-<i>, then wait for all of them
+ */
+static int run_replicas(const container_config_t *config, int replicas) {
+    container_config_t *configs = calloc(replicas, sizeof(container_config_t));
+    container_t **containers = calloc(replicas, sizeof(container_t *));
+    if (!configs || !containers) {
+        free(configs);
+        free(containers);
+        return 1;
+    }
+    
+    char base[sizeof(config->name)];
+    if (config->name[0]) {
+        snprintf(base, sizeof(base), "%s", config->name);
+    } else {
+        snprintf(base, sizeof(base), "run-%lx", (unsigned long)time(NULL));
+    }
+    for (int i = 0; i < replicas; i++) {
+        configs[i] = *config;
+        if (snprintf(configs[i].name, sizeof(configs[i].name), "%s-%d", base, i) >=
+            (int)sizeof(configs[i].name)) {
+            fprintf(stderr, "Error: Name too long for %d replicas: %s\n", replicas, base);
+            free(configs);
+            free(containers);
+            return 1;
+        }
+        snprintf(configs[i].id, sizeof(configs[i].id), "%s", configs[i].name);
+    }
+    
+    int created = container_create_batch(configs, replicas, containers);
+    int started = created > 0 ? container_start_batch(containers, replicas, NULL) : 0;
+    printf("Created %d, started %d of %d containers\n", created < 0 ? 0 : created, started, replicas);
+    
+    for (int i = 0; i < replicas; i++) {
+        if (containers[i] && containers[i]->state == CONTAINER_RUNNING) {
+            printf("  %s PID %d\n", containers[i]->config.id, containers[i]->pid);
+        }
+    }
+    for (int i = 0; i < replicas; i++) {
+        if (containers[i] && containers[i]->state == CONTAINER_RUNNING) {
+            int status;
+            waitpid(containers[i]->pid, &status, 0);
+            printf("  %s exited with code %d\n", containers[i]->config.id, WEXITSTATUS(status));
+        }
+        container_free(containers[i]);
+    }
+    
+    free(containers);
+    free(configs);
+    return started == replicas ? 0 : 1;
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 2 || strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0) {
         print_usage(argv[0]);
@@ -90,27 +332,119 @@ int main(int argc, char *argv[]) {
     static struct option opts[] = {
         {"name", required_argument, 0, 'n'},
         {"rootfs", required_argument, 0, 'r'},
+        {"image", required_argument, 0, 'i'},
+        {"layer", required_argument, 0, 'l'},
         {"memory", required_argument, 0, 'm'},
+        {"memory-high", required_argument, 0, 'H'},
+        {"memory-low", required_argument, 0, 'B'},
+        {"memory-min", required_argument, 0, 'F'},
         {"cpus", required_argument, 0, 'c'},
         {"pids", required_argument, 0, 'p'},
         {"cmd", required_argument, 0, 'x'},
+        {"replicas", required_argument, 0, 'N'},
+        {"io-weight", required_argument, 0, 'W'},
+        {"cpuset", required_argument, 0, 'S'},
+        {"cpuset-mems", required_argument, 0, 'U'},
+        {"place-cpus", required_argument, 0, 'P'},
+        {"exclusive", no_argument, 0, 'X'},
+        {"io-max", required_argument, 0, 'O'},
+        {"log-level", required_argument, 0, 'L'},
+        {"metrics-interval", required_argument, 0, 'M'},
+        {"reclaim", no_argument, 0, 'A'},
+        {"zygotes", required_argument, 0, 'Z'},
+        {"net", no_argument, 0, 'e'},
+        {"leave-running", no_argument, 0, 'R'},
+        {"tmpfs", no_argument, 0, 'T'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
     
     char *run_cmd = NULL;
+    const char *layers[64];
+    int replicas = 1;
+    int zygotes = 0;
+    unsigned int limit_fields = 0;  /* Limits given on the command line */
+    unsigned int checkpoint_flags = 0;
     int opt;
-    while ((opt = getopt_long(argc, argv, "n:r:m:c:p:x:h", opts, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "n:r:i:l:m:H:B:F:c:p:x:N:W:O:L:M:AZ:RTS:U:P:Xeh", opts, NULL)) != -1) {
         switch (opt) {
             case 'n': 
                 strncpy(config.name, optarg, sizeof(config.name)-1);
                 strncpy(config.id, optarg, sizeof(config.id)-1); 
                 break;
             case 'r': strncpy(config.rootfs, optarg, sizeof(config.rootfs)-1); break;
-            case 'm': config.limits.memory_limit_bytes = atoll(optarg); break;
-            case 'c': config.limits.cpu_quota_us = atoi(optarg) * 1000; break;
-            case 'p': config.limits.pids_max = atoi(optarg); break;
+            case 'i': strncpy(config.image, optarg, sizeof(config.image)-1); break;
+            case 'l':
+                if (config.layer_count < (int)(sizeof(layers) / sizeof(layers[0]))) {
+                    layers[config.layer_count++] = optarg;
+                    config.layers = layers;
+                }
+                break;
+            case 'm':
+                config.limits.memory_limit_bytes = atoll(optarg);
+                limit_fields |= MC_LIMIT_MEMORY;
+                break;
+            case 'H':
+                config.limits.memory_high_bytes = atoll(optarg);
+                limit_fields |= MC_LIMIT_MEMORY_HIGH;
+                break;
+            case 'B':
+                config.limits.memory_low_bytes = atoll(optarg);
+                limit_fields |= MC_LIMIT_MEMORY_LOW;
+                break;
+            case 'F':
+                config.limits.memory_min_bytes = atoll(optarg);
+                limit_fields |= MC_LIMIT_MEMORY_MIN;
+                break;
+            case 'c':
+                config.limits.cpu_quota_us = atoi(optarg) * 1000;
+                limit_fields |= MC_LIMIT_CPU;
+                break;
+            case 'p':
+                config.limits.pids_max = atoi(optarg);
+                limit_fields |= MC_LIMIT_PIDS;
+                break;
             case 'x': run_cmd = optarg; break;
+            case 'N': replicas = atoi(optarg); break;
+            case 'L': mc_log_set_level(atoi(optarg)); break;
+            case 'M': daemon_set_metrics_interval(atoi(optarg)); break;
+            case 'A': {
+                reclaim_policy_t policy;
+                reclaim_policy_default(&policy);
+                daemon_set_reclaim(&policy);
+                break;
+            }
+            case 'Z': zygotes = atoi(optarg); break;
+            case 'e': config.enable_network = 1; break;
+            case 'R': checkpoint_flags |= MC_CHECKPOINT_LEAVE_RUNNING; break;
+            case 'T': checkpoint_flags |= MC_CHECKPOINT_TMPFS; break;
+            case 'S':
+            case 'U': {
+                cpu_set_t set;
+                char *list = opt == 'S' ? config.limits.cpuset_cpus : config.limits.cpuset_mems;
+                if (cpuset_parse(optarg, &set) != MC_OK || strlen(optarg) >= MC_CPUSET_LEN) {
+                    fprintf(stderr, "Invalid --%s: %s\n", opt == 'S' ? "cpuset" : "cpuset-mems", optarg);
+                    return 1;
+                }
+                snprintf(list, MC_CPUSET_LEN, "%s", optarg);
+                limit_fields |= opt == 'S' ? MC_LIMIT_CPUSET : MC_LIMIT_CPUSET_MEMS;
+                break;
+            }
+            case 'P': config.limits.cpuset_count = atoi(optarg); break;
+            case 'X': config.limits.cpuset_exclusive = 1; break;
+            case 'W':
+                config.limits.io_weight = atoi(optarg);
+                limit_fields |= MC_LIMIT_IO_WEIGHT;
+                break;
+            case 'O':
+                if (config.limits.io_device_count >= MC_IO_MAX_DEVICES ||
+                    cgroup_parse_io_max(optarg, &config.limits.io_devices[config.limits.io_device_count]) != MC_OK) {
+                    fprintf(stderr, "Invalid --io-max: %s\n", optarg);
+                    return 1;
+                }
+                config.limits.io_device_count++;
+                limit_fields |= MC_LIMIT_IO_MAX;
+                break;
             case 'h': print_usage(argv[0]); return 0;
             default: print_usage(argv[0]); return 1;
         }
@@ -131,13 +465,41 @@ int main(int argc, char *argv[]) {
         config.cmd_count = 3;
     }
     
-    if (strcmp(cmd, "list") == 0 || strcmp(cmd, "ps") == 0) {
+    /* Commands that need no terminal go through the daemon when one runs */
+    if (strcmp(cmd, "list") == 0 || strcmp(cmd, "ps") == 0 || strcmp(cmd, "stats") == 0 ||
+        strcmp(cmd, "create") == 0 || strcmp(cmd, "start") == 0 ||
+        strcmp(cmd, "stop") == 0 || strcmp(cmd, "delete") == 0 ||
+        strcmp(cmd, "pause") == 0 || strcmp(cmd, "resume") == 0 || strcmp(cmd, "update") == 0 ||
+        strcmp(cmd, "counters") == 0) {
+        daemon_client_open(NULL, &daemon_conn);
+    }
+    
+    if (strcmp(cmd, "daemon") == 0) {
+        if (zygotes > 0 && !config.rootfs[0]) {
+            fprintf(stderr, "Error: --zygotes needs --rootfs\n");
+            return 1;
+        }
+        daemon_set_zygotes(config.rootfs, zygotes);
+        return daemon_run(optind < argc ? argv[optind] : NULL) == MC_OK ? 0 : 1;
+    } else if (strcmp(cmd, "list") == 0 || strcmp(cmd, "ps") == 0) {
         print_containers();
+    } else if (strcmp(cmd, "import") == 0) {
+        if (optind >= argc) { fprintf(stderr, "Error: Tarball required\n"); return 1; }
+        char digest[65];
+        if (layer_import(argv[optind], digest) != MC_OK) return 1;
+        printf("%s\n", digest);
     } else if (strcmp(cmd, "stats") == 0) {
         print_stats(optind < argc ? argv[optind] : NULL);
+    } else if (strcmp(cmd, "counters") == 0) {
+        return counters_command();
     } else if (strcmp(cmd, "create") == 0) {
         container_t *c;
-        if (container_create(&config, &c) == MC_OK) {
+        char id[65];
+        if (daemon_conn) {
+            int ret = daemon_client_create(daemon_conn, &config, id);
+            if (ret != MC_OK) { fprintf(stderr, "Create failed: %s\n", mc_strerror(ret)); return 1; }
+            printf("Created container: %s\n", id);
+        } else if (container_create(&config, &c) == MC_OK) {
             printf("Created container: %s\n", c->config.id);
             container_free(c);
         }
@@ -162,12 +524,24 @@ int main(int argc, char *argv[]) {
             config.cmd = &argv[optind];
             config.cmd_count = argc - optind;
         }
+        if (replicas > 1) {
+            int ret = run_replicas(&config, replicas);
+            if (config.cmd == &argv[optind]) config.cmd = NULL;
+            if (config.cmd) free(config.cmd);
+            return ret;
+        }
         if (container_create(&config, &c) == MC_OK) {
             printf("Created container: %s\n", c->config.id);
             if (container_start(c) == MC_OK) {
+                char startup[256];
                 printf("Started container (PID %d)\n", c->pid);
                 int status;
                 waitpid(c->pid, &status, 0);
+                
+                /* The trace pipe is closed by now: exec'd or exited */
+                container_trace_poll(c);
+                startup_trace_format(&c->startup, startup, sizeof(startup));
+                printf("Startup: %s\n", startup);
                 printf("Container exited with code %d\n", WEXITSTATUS(status));
             }
             /* Don't delete - keep container persistent */
@@ -175,41 +549,28 @@ int main(int argc, char *argv[]) {
         }
         /* Clear config.cmd since it points to argv, not malloc'd memory */
         config.cmd = NULL;
-    } else if (strcmp(cmd, "start") == 0 || strcmp(cmd, "stop") == 0 || strcmp(cmd, "delete") == 0) {
+    } else if (strcmp(cmd, "start") == 0 || strcmp(cmd, "stop") == 0 || strcmp(cmd, "delete") == 0 ||
+               strcmp(cmd, "pause") == 0 || strcmp(cmd, "resume") == 0) {
         if (optind >= argc) { fprintf(stderr, "Container ID required\n"); return 1; }
-        container_t **list; int count;
-        container_list(&list, &count);
-        for (int i = 0; i < count; i++) {
-            if (strcmp(list[i]->config.id, argv[optind]) == 0 || 
-                strcmp(list[i]->config.name, argv[optind]) == 0) {
-                if (strcmp(cmd, "start") == 0) container_start(list[i]);
-                else if (strcmp(cmd, "stop") == 0) container_stop(list[i], 10);
-                else container_delete(list[i]);
-                printf("Done\n");
-            }
-            container_free(list[i]);
-        }
-        if (list) free(list);
+        int ret = lifecycle_command(cmd, &argv[optind], argc - optind);
+        daemon_client_close(daemon_conn);
+        return ret;
+    } else if (strcmp(cmd, "checkpoint") == 0 || strcmp(cmd, "restore") == 0) {
+        if (optind >= argc) { fprintf(stderr, "Container ID required\n"); return 1; }
+        return checkpoint_command(cmd, argv[optind], checkpoint_flags);
+    } else if (strcmp(cmd, "update") == 0) {
+        if (optind >= argc) { fprintf(stderr, "Container ID required\n"); return 1; }
+        int ret = update_command(argv[optind], &config.limits, limit_fields);
+        daemon_client_close(daemon_conn);
+        return ret;
     } else if (strcmp(cmd, "exec") == 0) {
         /* Execute command inside container's cgroup */
         if (optind >= argc) { fprintf(stderr, "Container ID required\n"); return 1; }
         const char *container_id = argv[optind];
         
         /* Find the container */
-        container_t **list; int count;
-        container_list(&list, &count);
         container_t *target = NULL;
-        for (int i = 0; i < count; i++) {
-            if (strcmp(list[i]->config.id, container_id) == 0 || 
-                strcmp(list[i]->config.name, container_id) == 0) {
-                target = list[i];
-            } else {
-                container_free(list[i]);
-            }
-        }
-        if (list) free(list);
-        
-        if (!target) {
+        if (container_get(container_id, &target) != MC_OK) {
             fprintf(stderr, "Container not found: %s\n", container_id);
             return 1;
         }
@@ -247,7 +608,7 @@ int main(int argc, char *argv[]) {
         container_free(target);
     } else if (strcmp(cmd, "shell") == 0) {
         /* Start interactive shell in a new container */
-        if (strlen(config.rootfs) == 0) {
+        if (strlen(config.rootfs) == 0 && strlen(config.image) == 0 && config.layer_count == 0) {
             strncpy(config.rootfs, "/tmp/alpine-rootfs", sizeof(config.rootfs)-1);
         }
         if (strlen(config.name) == 0) {
@@ -276,6 +637,7 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
+    daemon_client_close(daemon_conn);
     if (config.cmd) free(config.cmd);
     return 0;
 }
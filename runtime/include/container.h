@@ -1,6 +1,11 @@
 /*
  * KernelSight - Linux Container Runtime
  * container.h - Main header file
+ *
+ * The library may be called from several threads at once.  Process-wide
+ * state (state index, container cache, counters, logger, zygote registry)
+ * is synchronized internally; a handle (container_t, sampler, event loop,
+ * zygote pool, daemon client) must be used by one thread at a time.
  */
 
 #ifndef MINICONTAINER_H
@@ -15,6 +20,7 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <sched.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/mount.h>
@@ -50,6 +56,22 @@ typedef enum {
     MC_ERR_IO = -10
 } mc_error_t;
 
+/* Maximum number of per-device IO throttles in resource_limits_t */
+#define MC_IO_MAX_DEVICES 8
+
+/* Per-device IO throttle (one io.max line; 0 = no limit for a field) */
+typedef struct {
+    unsigned int major;           /* Block device major number */
+    unsigned int minor;           /* Block device minor number */
+    long rbps;                    /* Read bytes per second */
+    long wbps;                    /* Write bytes per second */
+    long riops;                   /* Read operations per second */
+    long wiops;                   /* Write operations per second */
+} io_device_limit_t;
+
+/* Length of a cpuset list ("0-3,8,10-11") in resource_limits_t */
+#define MC_CPUSET_LEN 128
+
 /* Resource limits configuration */
 typedef struct {
     long memory_limit_bytes;      /* Memory limit in bytes (0 = unlimited) */
@@ -58,20 +80,48 @@ typedef struct {
     int cpu_quota_us;             /* CPU quota in microseconds */
     int cpu_period_us;            /* CPU period in microseconds (default 100000) */
     int pids_max;                 /* Maximum number of PIDs (0 = unlimited) */
+    int io_weight;                /* IO weight 1-10000 (0 = default 100) */
+    int io_device_count;          /* Number of entries in io_devices */
+    io_device_limit_t io_devices[MC_IO_MAX_DEVICES]; /* io.max throttles */
+    long memory_high_bytes;       /* memory.high throttling threshold (0 = none) */
+    char cpuset_cpus[MC_CPUSET_LEN]; /* cpuset.cpus ("" = all CPUs of the parent) */
+    char cpuset_mems[MC_CPUSET_LEN]; /* cpuset.mems NUMA nodes ("" = those of the parent) */
+    int cpuset_count;             /* CPUs to place at create when cpuset_cpus is "" (0 = none) */
+    int cpuset_exclusive;         /* Placed on whole cores that no other placed container gets */
+    long memory_low_bytes;        /* memory.low best-effort protection (0 = none) */
+    long memory_min_bytes;        /* memory.min hard protection (0 = none) */
 } resource_limits_t;
 
+/* resource_limits_t fields selected for container_update_limits() */
+#define MC_LIMIT_MEMORY       (1u << 0)  /* memory_limit_bytes -> memory.max */
+#define MC_LIMIT_MEMORY_HIGH  (1u << 1)  /* memory_high_bytes -> memory.high */
+#define MC_LIMIT_SWAP         (1u << 2)  /* memory_swap_bytes -> memory.swap.max */
+#define MC_LIMIT_CPU          (1u << 3)  /* cpu_quota_us, cpu_period_us -> cpu.max */
+#define MC_LIMIT_CPU_WEIGHT   (1u << 4)  /* cpu_shares -> cpu.weight */
+#define MC_LIMIT_PIDS         (1u << 5)  /* pids_max -> pids.max */
+#define MC_LIMIT_IO_WEIGHT    (1u << 6)  /* io_weight -> io.weight */
+#define MC_LIMIT_IO_MAX       (1u << 7)  /* io_devices -> io.max */
+#define MC_LIMIT_CPUSET       (1u << 8)  /* cpuset_cpus -> cpuset.cpus */
+#define MC_LIMIT_CPUSET_MEMS  (1u << 9)  /* cpuset_mems -> cpuset.mems */
+#define MC_LIMIT_MEMORY_LOW   (1u << 10) /* memory_low_bytes -> memory.low */
+#define MC_LIMIT_MEMORY_MIN   (1u << 11) /* memory_min_bytes -> memory.min */
+#define MC_LIMIT_ALL          0xfffu
+
 /* Container configuration */
 typedef struct {
     char id[65];                  /* Container ID (64 chars + null) */
     char name[256];               /* Container name */
     char hostname[256];           /* Hostname inside container */
     char rootfs[PATH_MAX];        /* Path to rootfs directory */
+    char image[PATH_MAX];         /* Read-only lower image (overlay rootfs, "" = none) */
+    const char **layers;          /* Layer digests, base first (resolved into image) */
+    int layer_count;              /* Number of layer digests */
     char **cmd;                   /* Command to execute */
     int cmd_count;                /* Number of command arguments */
     char **env;                   /* Environment variables */
     int env_count;                /* Number of environment variables */
     resource_limits_t limits;     /* Resource limits */
-    int enable_network;           /* Enable network namespace */
+    int enable_network;           /* Network namespace, attached to MC_NET_BRIDGE */
     int enable_user_ns;           /* Enable user namespace */
     uid_t uid_map_host;           /* Host UID for mapping */
     uid_t uid_map_container;      /* Container UID for mapping */
@@ -79,6 +129,110 @@ typedef struct {
     gid_t gid_map_container;      /* Container GID for mapping */
 } container_config_t;
 
+/* Resources with pressure stall information (cpu/memory/io.pressure) */
+typedef enum {
+    PSI_CPU = 0,
+    PSI_MEMORY = 1,
+    PSI_IO = 2
+} psi_resource_t;
+
+/* Pressure stall information for one resource */
+typedef struct {
+    double some_avg10;            /* % of time some tasks stalled, 10s average */
+    double some_avg60;            /* Same, 60s average */
+    long some_total_us;           /* Cumulative "some" stall time */
+    double full_avg10;            /* % of time all tasks stalled, 10s average */
+    double full_avg60;            /* Same, 60s average */
+    long full_total_us;           /* Cumulative "full" stall time */
+} psi_stats_t;
+
+/* cpu.stat (microseconds and counts) */
+typedef struct {
+    long usage_usec;
+    long user_usec;
+    long system_usec;
+    long nr_periods;
+    long nr_throttled;            /* Periods in which the quota ran out */
+    long throttled_usec;
+    long nr_bursts;
+    long burst_usec;
+} cpu_stat_t;
+
+/* memory.stat; field names are the kernel keys, in the kernel's order */
+typedef struct {
+    long anon;                    /* Anonymous memory (bytes) */
+    long file;                    /* Page cache (bytes) */
+    long kernel;                  /* All kernel memory (bytes) */
+    long kernel_stack;
+    long pagetables;
+    long percpu;
+    long sock;                    /* Network buffers (bytes) */
+    long vmalloc;
+    long shmem;
+    long zswap;
+    long zswapped;
+    long file_mapped;
+    long file_dirty;
+    long file_writeback;
+    long swapcached;
+    long anon_thp;
+    long file_thp;
+    long shmem_thp;
+    long inactive_anon;
+    long active_anon;
+    long inactive_file;
+    long active_file;
+    long unevictable;
+    long slab_reclaimable;
+    long slab_unreclaimable;
+    long slab;
+    long workingset_refault_anon; /* Refaults of evicted anon pages (count) */
+    long workingset_refault_file;
+    long workingset_activate_anon;
+    long workingset_activate_file;
+    long workingset_restore_anon;
+    long workingset_restore_file;
+    long workingset_nodereclaim;
+    long pgscan;
+    long pgsteal;
+    long pgfault;                 /* Page faults (count) */
+    long pgmajfault;              /* Major page faults (count) */
+    long pgrefill;
+    long pgactivate;
+    long pgdeactivate;
+    long pglazyfree;
+    long pglazyfreed;
+    long thp_fault_alloc;
+    long thp_collapse_alloc;
+} memory_stat_t;
+
+/* memory.events (cumulative counts) */
+typedef struct {
+    long low;
+    long high;                    /* Throttled for exceeding memory.high */
+    long max;                     /* Hit memory.max */
+    long oom;
+    long oom_kill;
+    long oom_group_kill;
+} memory_events_t;
+
+/* io.stat, summed over devices */
+typedef struct {
+    long rbytes;
+    long wbytes;
+    long rios;
+    long wios;
+    long dbytes;
+    long dios;
+} io_stat_t;
+
+/* One key of a cgroup stat file and the offset of its long in the output struct */
+typedef struct {
+    const char *key;
+    unsigned short len;           /* strlen(key) */
+    unsigned short offset;        /* offsetof(struct, field) */
+} cgroup_stat_key_t;
+
 /* Container runtime metrics */
 typedef struct {
     long memory_usage_bytes;      /* Current memory usage */
@@ -90,8 +244,99 @@ typedef struct {
     int pids_limit;               /* PID limit */
     long net_rx_bytes;            /* Network bytes received */
     long net_tx_bytes;            /* Network bytes transmitted */
+    double memory_growth_bytes_per_sec; /* Memory usage change rate */
+    double net_rx_bytes_per_sec;  /* Network receive rate */
+    double net_tx_bytes_per_sec;  /* Network transmit rate */
+    long sample_interval_ns;      /* Time since previous sample (0 = first sample) */
+    long io_read_bytes;           /* io.stat rbytes, summed over devices */
+    long io_write_bytes;          /* io.stat wbytes */
+    long io_read_ops;             /* io.stat rios */
+    long io_write_ops;            /* io.stat wios */
+    double io_read_bytes_per_sec; /* Read throughput */
+    double io_write_bytes_per_sec; /* Write throughput */
+    psi_stats_t cpu_pressure;     /* cpu.pressure */
+    psi_stats_t memory_pressure;  /* memory.pressure */
+    psi_stats_t io_pressure;      /* io.pressure */
+    cpu_stat_t cpu_stat;          /* cpu.stat */
+    memory_stat_t memory_stat;    /* memory.stat breakdown */
+    memory_events_t memory_events; /* memory.events */
+    double pgfault_per_sec;       /* memory.stat pgfault rate */
+    double pgmajfault_per_sec;    /* memory.stat pgmajfault rate */
+    double workingset_refault_per_sec; /* Anon + file refault rate */
+    long reclaim_bytes;           /* Proactively reclaimed by the daemon (memory.reclaim) */
+    long reclaim_count;           /* memory.reclaim writes by the daemon */
 } container_metrics_t;
 
+/* Startup phases, in the order they run */
+typedef enum {
+    STARTUP_CLONE = 0,                /* Parent: sync pipes, root tree, envp, clone() */
+    STARTUP_USER_NS = 1,              /* Parent: uid/gid maps */
+    STARTUP_NETWORK = 2,              /* Parent: veth handoff and addresses */
+    STARTUP_SYNC_WAIT = 3,            /* Child: waiting for the parent's go */
+    STARTUP_UTS = 4,                  /* Child: hostname */
+    STARTUP_PIVOT_ROOT = 5,           /* Child: root switch */
+    STARTUP_MOUNTS = 6,               /* Child: /proc, /sys, /dev, /tmp */
+    STARTUP_ENV = 7,                  /* Parent: envp for execve(), within the clone phase */
+    STARTUP_EXEC = 8,                 /* execve() until the trace pipe closed */
+    STARTUP_PHASE_COUNT = 9
+} startup_phase_t;
+
+/* Per-phase breakdown of a container start (clock: CLOCK_MONOTONIC) */
+typedef struct {
+    long start_ns[STARTUP_PHASE_COUNT];    /* Phase start (0 = did not run) */
+    long duration_ns[STARTUP_PHASE_COUNT]; /* Phase duration */
+    long total_ns;                /* Clone until the command was exec'd */
+    int complete;                 /* 1 once the command was exec'd */
+    int failed_phase;             /* Phase the child failed in, -1 = none */
+} startup_trace_t;
+
+/* Library operations counted by mc_counters_snapshot() */
+typedef enum {
+    MC_COUNTER_CLONE = 0,             /* clone()/clone3()/fork() of container processes */
+    MC_COUNTER_MOUNT = 1,             /* Mounts and open_tree() done in this process */
+    MC_COUNTER_CGROUP_WRITE = 2,      /* Cgroup control file writes */
+    MC_COUNTER_CGROUP_READ = 3,       /* Cgroup stat file reads */
+    MC_COUNTER_SIGNAL = 4,            /* Signals sent to containers */
+    MC_COUNTER_STATE_WRITE = 5,       /* state.txt writes */
+    MC_COUNTER_COUNT = 6
+} mc_counter_t;
+
+/* Library operations with latency histograms */
+typedef enum {
+    MC_HIST_CREATE = 0,               /* container_create() */
+    MC_HIST_START = 1,                /* container_start() */
+    MC_HIST_STOP = 2,                 /* container_stop() */
+    MC_HIST_DELETE = 3,               /* container_delete() */
+    MC_HIST_STARTUP = 4,              /* Clone until exec (startup_trace_t.total_ns) */
+    MC_HIST_SAMPLE = 5,               /* cgroup_sampler_read() */
+    MC_HIST_COUNT = 6
+} mc_histogram_t;
+
+/* Histogram buckets: upper bounds 1us, 2us, 4us ... 2^22us (~4.2s), +Inf */
+#define MC_HIST_BUCKETS 24
+
+typedef struct {
+    unsigned long buckets[MC_HIST_BUCKETS]; /* Observations per bucket (not cumulative) */
+    unsigned long count;          /* Observations */
+    unsigned long sum_ns;         /* Sum of observed values */
+} mc_histogram_data_t;
+
+/* Cumulative counters of this process */
+typedef struct {
+    unsigned long calls[MC_COUNTER_COUNT];    /* Operations attempted */
+    unsigned long failures[MC_COUNTER_COUNT]; /* Operations that failed */
+    mc_histogram_data_t latency[MC_HIST_COUNT];
+} mc_counters_t;
+
+/* Bridge that container network namespaces are attached to (10.88.0.1/16) */
+#define MC_NET_BRIDGE "ks0"
+
+/* Network of a container: the veth pair it was given */
+typedef struct {
+    char host_if[16];             /* Host end of the pair ("" = no network) */
+    char address[24];             /* Container address with prefix, e.g. "10.88.0.2/16" */
+} net_lease_t;
+
 /* Container structure */
 typedef struct {
     container_config_t config;    /* Container configuration */
@@ -103,8 +348,185 @@ typedef struct {
     time_t created_at;            /* Creation timestamp */
     time_t started_at;            /* Start timestamp */
     time_t stopped_at;            /* Stop timestamp */
+    startup_trace_t startup;      /* Breakdown of the last start (zygote starts: none) */
+    net_lease_t net;              /* Network while running (also in <state_dir>/network) */
+    int limits_known;             /* config.limits were recorded (0 = state from an older version) */
 } container_t;
 
+/* Shared-memory metrics export (published by the daemon's sampler) */
+#define MC_METRICS_SHM_NAME "/kernelsight-metrics"
+#define MC_METRICS_MAGIC 0x4d54534bU  /* "KSTM" */
+#define MC_METRICS_VERSION 2
+#define MC_METRICS_SLOTS 64           /* Containers exported at once */
+#define MC_METRICS_HISTORY 60         /* Samples kept per container */
+
+/* Segment header; slots follow at offset sizeof(metrics_shm_header_t) */
+typedef struct {
+    uint32_t magic;               /* MC_METRICS_MAGIC, written last */
+    uint32_t version;             /* MC_METRICS_VERSION */
+    uint32_t slot_count;          /* MC_METRICS_SLOTS */
+    uint32_t history;             /* MC_METRICS_HISTORY */
+    uint32_t slot_size;           /* sizeof(metrics_slot_t) */
+    uint32_t sample_size;         /* sizeof(metrics_sample_t) */
+    int32_t interval_ms;          /* Sampling interval of the writer */
+    int32_t writer_pid;           /* 0 once the writer has shut down */
+    uint64_t generation;          /* Bumped when a slot is claimed or released */
+    int64_t updated_ns;           /* CLOCK_REALTIME of the last published sample */
+    char reserved[16];
+} metrics_shm_header_t;
+
+/* One published sample */
+typedef struct {
+    int64_t timestamp_ns;         /* CLOCK_REALTIME */
+    container_metrics_t metrics;
+} metrics_sample_t;
+
+/* Per-container history ring, guarded by a seqlock */
+typedef struct {
+    uint64_t seq;                 /* Odd while the writer is updating the slot */
+    uint64_t count;               /* Samples written since claimed; newest at (count - 1) % history */
+    int32_t in_use;               /* Slot holds a container */
+    int32_t reserved;
+    char id[72];                  /* Container ID */
+    metrics_sample_t samples[MC_METRICS_HISTORY];
+} metrics_slot_t;
+
+/* Opaque handle on a metrics segment (writer or reader) */
+typedef struct metrics_shm metrics_shm_t;
+
+/* Container event types delivered by the event loop */
+typedef enum {
+    CONTAINER_EVENT_EXIT = 0,         /* Init process exited */
+    CONTAINER_EVENT_UNPOPULATED = 1,  /* cgroup.events reports populated 0 */
+    CONTAINER_EVENT_OOM = 2,          /* memory.events oom_kill increased */
+    CONTAINER_EVENT_PRESSURE = 3      /* A PSI trigger fired */
+} container_event_type_t;
+
+/* Container event */
+typedef struct {
+    container_event_type_t type;  /* Event type */
+    char container_id[65];        /* Container ID */
+    pid_t pid;                    /* Container init PID */
+    int exit_status;              /* waitpid() status, -1 if not our child */
+    long oom_kills;               /* Cumulative OOM kill count */
+    psi_resource_t psi_resource;  /* Resource of a PRESSURE event */
+    int psi_full;                 /* Trigger was on "full" rather than "some" */
+    double psi_avg10;             /* avg10 of the triggering line when it fired */
+} container_event_t;
+
+/* Event callback */
+typedef void (*container_event_cb_t)(const container_event_t *event, void *userdata);
+
+/* Opaque event loop handle */
+typedef struct event_loop event_loop_t;
+
+/* Opaque pool of pre-forked, pre-mounted container processes */
+typedef struct zygote_pool zygote_pool_t;
+
+/* Opaque daemon control socket client */
+typedef struct daemon_client daemon_client_t;
+
+/* Daemon request opcodes */
+typedef enum {
+    DAEMON_OP_PING = 1,
+    DAEMON_OP_CREATE = 2,             /* Payload: serialized config, reply: id */
+    DAEMON_OP_START = 3,              /* Payload: target, no reply data */
+    DAEMON_OP_STOP = 4,               /* Payload: target (arg = timeout) */
+    DAEMON_OP_DELETE = 5,             /* Payload: target */
+    DAEMON_OP_GET = 6,                /* Payload: target, reply: one record */
+    DAEMON_OP_LIST = 7,               /* Reply: array of records */
+    DAEMON_OP_STATS = 8,              /* Payload: target, reply: container_metrics_t */
+    DAEMON_OP_PAUSE = 9,              /* Payload: target */
+    DAEMON_OP_RESUME = 10,            /* Payload: target */
+    DAEMON_OP_UPDATE = 11,            /* Payload: limits + field mask + target */
+    DAEMON_OP_COUNTERS = 12           /* Reply: the daemon's mc_counters_t */
+} daemon_op_t;
+
+/* Daemon reply (data is valid until the next receive on the client) */
+typedef struct {
+    uint32_t seq;                 /* Sequence number of the request */
+    daemon_op_t op;               /* Opcode of the request */
+    int status;                   /* mc_error_t result */
+    const void *data;             /* Reply payload */
+    uint32_t len;                 /* Reply payload length */
+} daemon_reply_t;
+
+/* Native filesystem tree operations with latency counters */
+typedef enum {
+    FS_OP_MKDIR = 0,                  /* fs_mkdir_p() */
+    FS_OP_REMOVE = 1                  /* fs_remove_tree() */
+} fs_op_t;
+
+/* Latency counters for one fs_op_t (process-wide, since start) */
+typedef struct {
+    unsigned long calls;          /* Completed calls */
+    unsigned long errors;         /* Calls that failed */
+    unsigned long entries;        /* Directories created / entries removed */
+    long total_ns;                /* Cumulative wall time */
+    long max_ns;                  /* Slowest call */
+} fs_op_stats_t;
+
+/* How a container's root filesystem is set up */
+typedef enum {
+    FS_ROOT_AUTO = 0,                 /* Mount API when the kernel has it, else legacy */
+    FS_ROOT_LEGACY = 1,               /* rprivate /, rbind rootfs, pivot_root to .old_root */
+    FS_ROOT_MOUNT_API = 2             /* open_tree clone attached in a seed namespace */
+} fs_root_mode_t;
+
+/* Per-step timing of fs_mount_essentials_timed() */
+typedef struct {
+    long proc_ns;                 /* /proc */
+    long sys_ns;                  /* /sys */
+    long dev_ns;                  /* /dev skeleton (template attach or node by node) */
+    long devfs_ns;                /* /dev/pts and /dev/shm */
+    long tmp_ns;                  /* /tmp */
+    long total_ns;                /* All steps */
+    int dev_template;             /* 1 if /dev was attached from the template */
+    int failures;                 /* Steps that failed */
+} fs_mount_timing_t;
+
+/* One CPU as the placer sees it */
+typedef struct {
+    int core;                     /* Physical core: its first SMT sibling */
+    int node;                     /* NUMA node (0 without NUMA) */
+} cpu_info_t;
+
+/* CPU topology of the host (CPUs up to CPU_SETSIZE) */
+typedef struct {
+    cpu_set_t online;             /* CPUs containers may be placed on */
+    int cpu_count;                /* CPUs in online */
+    int node_count;               /* Highest NUMA node + 1 */
+    cpu_info_t cpus[CPU_SETSIZE]; /* Indexed by CPU number, valid for online CPUs */
+} cpu_topology_t;
+
+/* CPUs already given out to placed containers */
+typedef struct {
+    cpu_set_t held;               /* Exclusive containers' CPUs and their SMT siblings */
+    unsigned short shared[CPU_SETSIZE]; /* Shared containers placed on each CPU */
+} cpu_usage_t;
+
+/* Proactive reclaim policy (see reclaim_plan()) */
+typedef struct {
+    double idle_cpu_percent;      /* Below this CPU use a container counts as idle */
+    double pressure_limit;        /* memory some avg10 (%) above which it is left alone */
+    double refault_limit;         /* Refaults/s above which its cache is still in use */
+    int idle_step_percent;        /* Share of an idle container's usage reclaimed per tick */
+    int high_headroom_percent;    /* Usage kept below this share of memory.high */
+    long min_step_bytes;          /* Smallest memory.reclaim request */
+    long max_step_bytes;          /* Largest memory.reclaim request per tick, 0 = no cap */
+} reclaim_policy_t;
+
+/* What the reclaim engine remembers about one container */
+typedef struct {
+    int primed;                   /* A sample was seen (rates are valid from the next) */
+    int disabled;                 /* memory.reclaim is missing: stop trying */
+    long prev_high_events;        /* memory.events high at the previous tick */
+    int backoff;                  /* Ticks sat out after the last ineffective step */
+    int skip_ticks;               /* Ticks still to sit out */
+    long reclaim_bytes;           /* Reclaimed so far */
+    long reclaim_count;           /* memory.reclaim writes so far */
+} reclaim_state_t;
+
 /* Stack size for clone */
 #define STACK_SIZE (1024 * 1024)
 
@@ -117,6 +539,87 @@ typedef struct {
  */
 int ns_create(container_config_t *config);
 
+/**
+ * Create new namespaces for a container, born inside its cgroup
+ * Uses clone3() with CLONE_INTO_CGROUP; on kernels without it, falls back
+ * to clone() and the caller must add the PID to the cgroup itself.
+ * @param config Container configuration
+ * @param cgroup_fd Open cgroup directory (-1 = plain clone())
+ * @param in_cgroup Output: 1 if the child was placed into the cgroup
+ * @return Child PID on success, error code on failure
+ */
+int ns_create_in_cgroup(container_config_t *config, int cgroup_fd, int *in_cgroup);
+
+/**
+ * ns_create_in_cgroup() that traces the startup phases
+ * The child reports its phases over a close-on-exec pipe whose read end
+ * is returned in trace_fd; ns_trace_read() or ns_trace_collect() read
+ * it until the exec closes it.  Parent-side phases are filled in before returning.
+ * @param config Container configuration
+ * @param cgroup_fd Open cgroup directory (-1 = plain clone())
+ * @param in_cgroup Output: 1 if the child was placed into the cgroup
+ * @param trace Output: startup breakdown so far
+ * @param trace_fd Output: read end of the trace pipe (-1 if unavailable)
+ * @param net Output: network attached before the child is released, when
+ *            config->enable_network (NULL = leave the namespace empty)
+ * @return Child PID on success, error code on failure
+ */
+int ns_create_traced(container_config_t *config, int cgroup_fd, int *in_cgroup,
+                     startup_trace_t *trace, int *trace_fd, net_lease_t *net);
+
+/**
+ * Read the startup phases a child has reported so far, without blocking
+ * @param trace_fd Read end returned by ns_create_traced() (closed once finished)
+ * @param trace Trace to complete
+ * @return 1 while the child has not exec'd yet (call again when trace_fd
+ *         is readable), MC_OK once the command was exec'd, error code if
+ *         the child exited before that
+ */
+int ns_trace_read(int trace_fd, startup_trace_t *trace);
+
+/**
+ * Read a child's startup phases until it execs, exits or times out
+ * @param trace_fd Read end returned by ns_create_traced() (closed here)
+ * @param trace Trace to complete
+ * @param timeout_ms Time to wait for the exec
+ * @return MC_OK once the command was exec'd, error code otherwise
+ */
+int ns_trace_collect(int trace_fd, startup_trace_t *trace, int timeout_ms);
+
+/**
+ * fork()-like clone3() that places the child into a cgroup
+ * @param flags Namespace flags for the child (0 = none)
+ * @param cgroup_fd Open cgroup directory
+ * @return 0 in the child, PID in the parent, -1 on failure (errno set)
+ */
+pid_t ns_clone_into_cgroup(int flags, int cgroup_fd);
+
+/**
+ * Set up the container environment and exec its command
+ * @param config Container configuration (cmd and env are used)
+ * @return Only returns on failure: MC_ERR_PROCESS (errno from execve) or MC_ERR_MEMORY
+ */
+int ns_exec(container_config_t *config);
+
+/**
+ * Build the environment ns_exec() runs the command with: the defaults
+ * (PATH, TERM, HOME), then the config's "KEY=value" entries, a later one
+ * replacing an earlier one
+ * @param config Container configuration (env is used)
+ * @return calloc()ed array pointing into config->env (free() it only), NULL on failure
+ */
+char **ns_build_envp(container_config_t *config);
+
+/**
+ * Exec the container's command with a prepared environment
+ * Async-signal-safe: neither allocates nor logs, so a clone()d child may
+ * call it.  /bin/sh runs when no command is configured.
+ * @param config Container configuration (cmd is used)
+ * @param envp Environment, e.g. from ns_build_envp()
+ * @return Only returns on failure: MC_ERR_PROCESS (errno from execve)
+ */
+int ns_exec_command(container_config_t *config, char *const envp[]);
+
 /**
  * Set up UTS namespace (hostname)
  * @param hostname Hostname to set
@@ -152,6 +655,144 @@ int ns_enter(pid_t pid, int ns_type);
  */
 int ns_enter_all(pid_t pid, int flags);
 
+/**
+ * Enter namespaces of a process with one setns() on its pidfd
+ * Falls back to ns_enter_all() on kernels before 5.8 or without a pidfd.
+ * @param pidfd pidfd of the process (-1 = none)
+ * @param pid Process ID, for the fallback
+ * @param flags Namespace flags to enter
+ * @return MC_OK on success, error code on failure
+ */
+int ns_enter_pidfd(int pidfd, pid_t pid, int flags);
+
+/**
+ * Take a clone() child stack from the process-wide pool
+ * Stacks are mmap'd with a guard page below them and reused once returned.
+ * @param size Usable stack size (0 = STACK_SIZE)
+ * @return Top of the stack (pass to clone()), NULL on failure
+ */
+void *ns_stack_get(size_t size);
+
+/**
+ * Return a stack to the pool once no child runs on it: right after
+ * clone() when CLONE_VM is not set (the child has its own copy), after
+ * the child has exec'd or exited otherwise
+ * @param top Stack top returned by ns_stack_get()
+ * @param size Size passed to ns_stack_get()
+ */
+void ns_stack_put(void *top, size_t size);
+
+/* ===== Zygote Pool Functions ===== */
+
+/**
+ * Create a pool of pre-forked zygotes for a rootfs
+ * Zygotes are cloned into their namespaces, pivoted into the rootfs and
+ * have their essential mounts in place; they wait for a configuration.
+ * The pool is registered so container_start() uses it automatically for
+ * containers with a matching rootfs and network setting.
+ * Zygotes are killed when the thread that cloned them exits
+ * (PR_SET_PDEATHSIG), so create and refill the pool from a thread that
+ * outlives it, such as the main thread.
+ * @param rootfs Path to rootfs
+ * @param enable_network Whether zygotes get a network namespace
+ * @param size Number of zygotes to keep parked
+ * @param pool Output pool handle
+ * @return MC_OK on success, error code on failure
+ */
+int zygote_pool_create(const char *rootfs, int enable_network, int size,
+                       zygote_pool_t **pool);
+
+/**
+ * Clone zygotes until the pool is back at its target size
+ * Meant to be called off the start path (e.g. when the caller is idle),
+ * from a thread that outlives the pool (see zygote_pool_create())
+ * @param pool Pool handle
+ * @return MC_OK on success, error code on failure
+ */
+int zygote_pool_refill(zygote_pool_t *pool);
+
+/**
+ * Find a registered pool able to start a container
+ * @param config Container configuration
+ * @return Pool handle, or NULL if none matches
+ */
+zygote_pool_t *zygote_pool_find(const container_config_t *config);
+
+/**
+ * Start a container from a parked zygote
+ * Moves the zygote into the container cgroup and hands over hostname,
+ * command and environment; returns once the command has been exec'd.
+ * @param pool Pool handle
+ * @param container Container structure (cgroup must exist)
+ * @return PID on success, MC_ERR_NOT_FOUND if the pool is empty, error code on failure
+ */
+pid_t zygote_pool_spawn(zygote_pool_t *pool, container_t *container);
+
+/**
+ * Get the number of parked zygotes
+ * @param pool Pool handle
+ * @return Number of zygotes ready to start
+ */
+int zygote_pool_available(zygote_pool_t *pool);
+
+/**
+ * Destroy a pool, killing its parked zygotes
+ * No start may be using the pool concurrently.
+ * @param pool Pool handle
+ */
+void zygote_pool_destroy(zygote_pool_t *pool);
+
+/* ===== Network Functions ===== */
+
+/**
+ * Create the MC_NET_BRIDGE bridge if needed, with the gateway address, up
+ * Done once per process; container starts call it implicitly.
+ * @return MC_OK on success, error code on failure
+ */
+int net_setup(void);
+
+/**
+ * Plug a process's network namespace into the bridge
+ * Creates a veth pair whose peer is born inside the namespace as eth0
+ * (creating it in place is several times cheaper than moving a
+ * pre-made one in), gives it the pair's address, brings eth0 and lo up
+ * and routes through the bridge, in three netlink round trips.  Call
+ * before the process starts using the network, e.g. while it waits for
+ * its go signal; the pair goes away with the namespace.
+ * @param pid Process in the namespace (not the host's)
+ * @param lease Output: the pair and address it was given
+ * @return MC_OK on success, error code on failure
+ */
+int net_attach(pid_t pid, net_lease_t *lease);
+
+/**
+ * Persist a lease in <state_dir>/network (an empty lease removes it)
+ * @param state_dir Container state directory
+ * @param lease Lease to record
+ * @return MC_OK on success, error code on failure
+ */
+int net_lease_save(const char *state_dir, const net_lease_t *lease);
+
+/**
+ * Read the lease recorded in <state_dir>/network
+ * @param state_dir Container state directory
+ * @param lease Output: the lease (cleared if there is none)
+ * @return MC_OK on success, MC_ERR_NOT_FOUND without a record
+ */
+int net_lease_load(const char *state_dir, net_lease_t *lease);
+
+/**
+ * Get the byte counters of a pair's host end
+ * All pairs are read by one RTM_GETLINK dump that is reused for 200ms,
+ * so sampling every container in a tick costs a single dump.  Host end
+ * counters are the container's mirrored: its RX is their TX.
+ * @param host_if Host end (net_lease_t.host_if)
+ * @param rx_bytes Output: bytes received by the host end
+ * @param tx_bytes Output: bytes sent by the host end
+ * @return MC_OK on success, MC_ERR_NOT_FOUND if the pair is gone
+ */
+int net_link_stats(const char *host_if, long *rx_bytes, long *tx_bytes);
+
 /* ===== Cgroup Functions ===== */
 
 /**
@@ -169,154 +810,1215 @@ int cgroup_init(container_t *container);
 int cgroup_apply_limits(container_t *container);
 
 /**
- * Add process to cgroup
+ * Change limits of a live cgroup
+ * Only files whose value differs from container->config.limits are
+ * written; values <= 0 lift the limit.  Written fields are stored back
+ * into container->config.limits.
  * @param container Container structure
- * @param pid Process ID to add
- * @return MC_OK on success, error code on failure
+ * @param limits New limits
+ * @param fields MC_LIMIT_* mask of the fields to take from limits
+ * @return MC_OK on success, MC_ERR_CGROUP if any file could not be written
  */
-int cgroup_add_pid(container_t *container, pid_t pid);
+int cgroup_update_limits(container_t *container, const resource_limits_t *limits,
+                         unsigned int fields);
 
 /**
- * Get container metrics from cgroup
+ * Freeze every process of the cgroup (cgroup.freeze)
  * @param container Container structure
- * @param metrics Output metrics structure
  * @return MC_OK on success, error code on failure
  */
-int cgroup_get_metrics(container_t *container, container_metrics_t *metrics);
+int cgroup_freeze(container_t *container);
 
 /**
- * Cleanup cgroup for container
+ * Thaw the cgroup
  * @param container Container structure
  * @return MC_OK on success, error code on failure
  */
-int cgroup_cleanup(container_t *container);
+int cgroup_unfreeze(container_t *container);
 
-/* ===== Filesystem Functions ===== */
+/**
+ * Wait until cgroup.events reports the requested frozen state
+ * @param container Container structure
+ * @param frozen 1 to wait for frozen, 0 for thawed
+ * @param timeout_ms Timeout in milliseconds
+ * @return MC_OK once reached, MC_ERR_PROCESS on timeout, error code on failure
+ */
+int cgroup_wait_frozen(container_t *container, int frozen, int timeout_ms);
 
 /**
- * Set up container filesystem
+ * Kill every process of the cgroup (cgroup.kill, or SIGKILL per PID)
  * @param container Container structure
  * @return MC_OK on success, error code on failure
  */
-int fs_setup(container_t *container);
+int cgroup_kill_all(container_t *container);
 
 /**
- * Set up mount namespace and pivot root
- * @param rootfs Path to rootfs
+ * Parse an IO throttle specification into an io.max entry
+ * Format: "MAJ:MIN" or a block device path, then any of rbps=, wbps=,
+ * riops=, wiops= separated by spaces or commas (K/M/G suffixes allowed),
+ * e.g. "/dev/sda rbps=10M,wiops=200"
+ * @param spec Specification string
+ * @param io Output device limit
  * @return MC_OK on success, error code on failure
  */
-int fs_pivot_root(const char *rootfs);
+int cgroup_parse_io_max(const char *spec, io_device_limit_t *io);
 
 /**
- * Mount essential filesystems (/proc, /sys, /dev)
- * @return MC_OK on success, error code on failure
+ * Parse the content of a cpu/memory/io.pressure file
+ * @param buf NUL-terminated file content
+ * @param psi Output pressure stats (missing lines stay 0)
+ * @return MC_OK on success, MC_ERR_INVALID if nothing was recognised
  */
-int fs_mount_essentials(void);
+int cgroup_parse_pressure(const char *buf, psi_stats_t *psi);
 
 /**
- * Cleanup filesystem mounts
- * @param container Container structure
- * @return MC_OK on success, error code on failure
+ * Parse a cgroup stat file in one pass without allocating
+ * Flat files have one "key value" per line; nested files (io.stat) have a
+ * device followed by key=value pairs, and values are summed over lines.
+ * Keys are best listed in the order the kernel prints them.
+ * @param buf NUL-terminated file content
+ * @param keys Keys to extract
+ * @param nkeys Number of keys
+ * @param out Struct receiving the values (longs at keys[i].offset)
+ * @param nested Parse key=value pairs and accumulate
+ * @return Number of values stored, or error code on failure
  */
-int fs_cleanup(container_t *container);
+int cgroup_parse_keyed(const char *buf, const cgroup_stat_key_t *keys, int nkeys,
+                       void *out, int nested);
 
-/* ===== Container Lifecycle Functions ===== */
+/**
+ * Parse cpu.stat
+ * @param buf NUL-terminated file content
+ * @param stat Output (zeroed first)
+ * @return Number of values stored, or error code on failure
+ */
+int cgroup_parse_cpu_stat(const char *buf, cpu_stat_t *stat);
 
 /**
- * Create a new container
- * @param config Container configuration
- * @param container Output container structure
- * @return MC_OK on success, error code on failure
+ * Parse memory.stat
+ * @param buf NUL-terminated file content
+ * @param stat Output (zeroed first)
+ * @return Number of values stored, or error code on failure
  */
-int container_create(container_config_t *config, container_t **container);
+int cgroup_parse_memory_stat(const char *buf, memory_stat_t *stat);
 
 /**
- * Start a container
+ * Parse memory.events
+ * @param buf NUL-terminated file content
+ * @param events Output (zeroed first)
+ * @return Number of values stored, or error code on failure
+ */
+int cgroup_parse_memory_events(const char *buf, memory_events_t *events);
+
+/**
+ * Parse io.stat, summing every device
+ * @param buf NUL-terminated file content
+ * @param stat Output (zeroed first)
+ * @return Number of values stored, or error code on failure
+ */
+int cgroup_parse_io_stat(const char *buf, io_stat_t *stat);
+
+/**
+ * Add process to cgroup
  * @param container Container structure
+ * @param pid Process ID to add
  * @return MC_OK on success, error code on failure
  */
-int container_start(container_t *container);
+int cgroup_add_pid(container_t *container, pid_t pid);
 
 /**
- * Stop a container
+ * Get container metrics from cgroup
  * @param container Container structure
- * @param timeout Timeout in seconds before SIGKILL
+ * @param metrics Output metrics structure
  * @return MC_OK on success, error code on failure
  */
-int container_stop(container_t *container, int timeout);
+int cgroup_get_metrics(container_t *container, container_metrics_t *metrics);
 
 /**
- * Delete a container
+ * Cleanup cgroup for container
  * @param container Container structure
  * @return MC_OK on success, error code on failure
  */
-int container_delete(container_t *container);
+int cgroup_cleanup(container_t *container);
 
 /**
- * Get container by ID or name
- * @param id_or_name Container ID or name
- * @param container Output container structure
- * @return MC_OK on success, error code on failure
+ * Cleanup cgroups of many containers
+ * Kills all of them first, then waits for every cgroup.events to report
+ * "populated 0" (bounded by timeout_ms) before removing the directories.
+ * @param containers Array of container structures
+ * @param count Number of containers
+ * @param timeout_ms Maximum time to wait for the cgroups to empty
+ * @return MC_OK on success, MC_ERR_CGROUP if any cgroup could not be removed
  */
-int container_get(const char *id_or_name, container_t **container);
+int cgroup_cleanup_many(container_t **containers, int count, int timeout_ms);
+
+/* ===== CPU Placement Functions ===== */
 
 /**
- * List all containers
- * @param containers Output array of containers
- * @param count Output count
- * @return MC_OK on success, error code on failure
+ * Parse a cpuset list ("0-3,8,10-11", as in cpuset.cpus)
+ * @param list List string ("" is the empty set)
+ * @param set Output set
+ * @return MC_OK on success, MC_ERR_INVALID if malformed or out of range
  */
-int container_list(container_t ***containers, int *count);
+int cpuset_parse(const char *list, cpu_set_t *set);
 
 /**
- * Execute command in running container
- * @param container Container structure
- * @param cmd Command to execute
- * @param cmd_count Number of command arguments
- * @return MC_OK on success, error code on failure
+ * Format a set as a cpuset list with ranges
+ * @param set Set to format
+ * @param buf Output buffer
+ * @param size Buffer size
+ * @return MC_OK on success, MC_ERR_INVALID if buf is too small
  */
-int container_exec(container_t *container, char **cmd, int cmd_count);
+int cpuset_format(const cpu_set_t *set, char *buf, size_t size);
 
 /**
- * Get container metrics
- * @param container Container structure
- * @param metrics Output metrics structure
+ * Read the CPU topology from /sys (online CPUs, SMT siblings, NUMA nodes)
+ * CPUs outside the kernelsight cgroup's cpuset.cpus.effective are left out.
+ * @param topo Output topology
+ * @return MC_OK on success, MC_ERR_IO if the online CPUs cannot be read
+ */
+int topology_load(cpu_topology_t *topo);
+
+/**
+ * Collect the placements recorded by existing containers
+ * @param usage Output usage
+ * @param exclude_id Container whose record is left out (NULL = none)
  * @return MC_OK on success, error code on failure
  */
-int container_metrics(container_t *container, container_metrics_t *metrics);
+int cpu_usage_load(cpu_usage_t *usage, const char *exclude_id);
 
 /**
- * Free container structure
- * @param container Container structure to free
+ * Choose CPUs for a container
+ * Exclusive placements take count whole physical cores with no other
+ * placed container on them, one CPU per core, holding the SMT siblings
+ * idle.  Shared placements take the least loaded CPUs outside held
+ * cores, spread over distinct physical cores.  Both prefer a single NUMA
+ * node (best fit for exclusive, least loaded for shared).
+ * @param topo Host topology
+ * @param usage Existing placements
+ * @param count Number of CPUs
+ * @param exclusive Nonzero for an exclusive placement
+ * @param cpus Output CPUs
+ * @param held Output CPUs withheld from others (CPUs plus siblings; empty if shared)
+ * @param nodes Output NUMA nodes of cpus
+ * @return MC_OK on success, MC_ERR_INVALID if the request cannot be met
  */
-void container_free(container_t *container);
+int cpu_place(const cpu_topology_t *topo, const cpu_usage_t *usage, int count, int exclusive,
+              cpu_set_t *cpus, cpu_set_t *held, cpu_set_t *nodes);
 
-/* ===== Utility Functions ===== */
+/**
+ * Place a container's CPUs and record the placement in its state directory
+ * With cpuset_count set and cpuset_cpus empty, fills cpuset_cpus and
+ * cpuset_mems from cpu_place(); an explicit cpuset_cpus is only recorded.
+ * Placements are serialized across processes by a lock file.
+ * @param container Container with state_dir set
+ * @return MC_OK on success (or nothing to place), error code on failure
+ */
+int container_place_cpus(container_t *container);
 
 /**
- * Generate random container ID
- * @param id Output buffer (must be at least 65 bytes)
+ * Update a container's placement record after a cpuset change
+ * Fields not in the mask and the exclusive flag keep their recorded
+ * values; the record goes away once both lists are empty.
+ * @param container Container whose limits hold the new lists
+ * @param fields MC_LIMIT_CPUSET and/or MC_LIMIT_CPUSET_MEMS
+ * @return MC_OK on success, error code on failure
+ */
+int container_record_cpuset(container_t *container, unsigned int fields);
+
+/* ===== Memory Reclaim Functions ===== */
+
+/**
+ * Fill a policy with the defaults: idle below 1% CPU, hands off above
+ * 10% memory pressure or 200 refaults/s, 2% of usage per tick from idle
+ * containers, usage kept under 90% of memory.high, 1MB to 16MB a step
+ * @param policy Policy to fill
  */
-void generate_container_id(char *id);
+void reclaim_policy_default(reclaim_policy_t *policy);
 
 /**
- * Get state directory for containers
- * @return Path to state directory
+ * Decide how much to reclaim from a container after a sample
+ * A container near its memory.high (or throttled there since the last
+ * tick) is trimmed back under the headroom, so its allocations stop
+ * stalling in direct reclaim; an idle one gives up a slice of its cold
+ * memory.  Nothing is taken from a container under memory pressure,
+ * refaulting its cache, or below its memory.low/memory.min.  A target
+ * above max_step_bytes is cut to it: the rest follows on later ticks.
+ * @param policy Reclaim policy
+ * @param metrics Sample just taken (needs rates: the first sample only primes)
+ * @param limits The container's limits
+ * @param state Per-container engine state (updated)
+ * @return Bytes to reclaim, 0 for none
  */
-const char *get_state_dir(void);
+long reclaim_plan(const reclaim_policy_t *policy, const container_metrics_t *metrics,
+                  const resource_limits_t *limits, reclaim_state_t *state);
 
 /**
- * Get error message for error code
- * @param err Error code
- * @return Error message string
+ * Ask the kernel to reclaim memory from a cgroup (memory.reclaim, 5.19+)
+ * @param container Container structure
+ * @param bytes Bytes to reclaim
+ * @param reclaimed Output: drop of memory.current (may be NULL)
+ * @return MC_OK, also when the kernel reclaimed less than asked;
+ *         MC_ERR_NOT_FOUND without memory.reclaim, other error codes on failure
  */
-const char *mc_strerror(mc_error_t err);
+int cgroup_reclaim(container_t *container, long bytes, long *reclaimed);
 
 /**
- * Log message with level
- * @param level Log level (0=debug, 1=info, 2=warn, 3=error)
- * @param fmt Format string
+ * Run a reclaim step for a container: plan, reclaim, account
+ * @param container Container structure
+ * @param policy Reclaim policy
+ * @param metrics Sample just taken
+ * @param state Per-container engine state (updated)
+ * @return Bytes reclaimed (0 if nothing was planned), error code on failure
+ */
+long reclaim_step(container_t *container, const reclaim_policy_t *policy,
+                  const container_metrics_t *metrics, reclaim_state_t *state);
+
+/* ===== Metrics Sampler Functions ===== */
+
+/* Opaque sampler handle holding a container's open cgroup files */
+typedef struct cgroup_sampler cgroup_sampler_t;
+
+/**
+ * Open a metrics sampler that keeps the container's cgroup files open
+ * @param container Container structure
+ * @param sampler Output sampler handle
+ * @return MC_OK on success, error code on failure
+ */
+int cgroup_sampler_open(container_t *container, cgroup_sampler_t **sampler);
+
+/**
+ * Open a metrics sampler for a cgroup directory
+ * @param cgroup_path Cgroup directory
+ * @param pid Container init PID for network counters (0 = none)
+ * @param sampler Output sampler handle
+ * @return MC_OK on success, error code on failure
+ */
+int cgroup_sampler_open_path(const char *cgroup_path, pid_t pid,
+                             cgroup_sampler_t **sampler);
+
+/**
+ * Take one sample by re-reading the cached cgroup files
+ * CPU percentage and rates are computed against the previous sample
+ * taken from the same sampler; they are zero on the first call.
+ * @param sampler Sampler handle
+ * @param metrics Output metrics structure
+ * @return MC_OK on success, error code on failure
+ */
+int cgroup_sampler_read(cgroup_sampler_t *sampler, container_metrics_t *metrics);
+
+/**
+ * Sample many containers in one call
+ * @param samplers Array of sampler handles
+ * @param count Number of samplers
+ * @param metrics Output array of count metrics structures
+ * @return MC_OK on success, MC_ERR_INVALID if any sampler was NULL
+ */
+int cgroup_sampler_read_many(cgroup_sampler_t **samplers, int count,
+                             container_metrics_t *metrics);
+
+/**
+ * Close a sampler and its cached file descriptors
+ * @param sampler Sampler handle
+ */
+void cgroup_sampler_close(cgroup_sampler_t *sampler);
+
+/* ===== Metrics Export Functions ===== */
+
+/**
+ * Create a metrics segment for writing, replacing any previous one
+ * Readers still mapping an old segment see writer_pid 0 and reopen.
+ * @param name shm_open() name (NULL = MC_METRICS_SHM_NAME)
+ * @param interval_ms Sampling interval recorded in the header
+ * @param shm Output handle
+ * @return MC_OK on success, error code on failure
+ */
+int metrics_shm_create(const char *name, int interval_ms, metrics_shm_t **shm);
+
+/**
+ * Map an existing metrics segment read-only
+ * @param name shm_open() name (NULL = MC_METRICS_SHM_NAME)
+ * @param shm Output handle
+ * @return MC_OK on success, MC_ERR_NOT_FOUND if no writer created one,
+ *         MC_ERR_INVALID if its layout does not match this build
+ */
+int metrics_shm_open(const char *name, metrics_shm_t **shm);
+
+/**
+ * Claim a slot for a container (writer)
+ * @param shm Writer handle
+ * @param id Container ID
+ * @return Slot index, or MC_ERR_MEMORY if all slots are in use
+ */
+int metrics_shm_claim(metrics_shm_t *shm, const char *id);
+
+/**
+ * Append a sample to a claimed slot (writer)
+ * @param shm Writer handle
+ * @param slot Slot index from metrics_shm_claim()
+ * @param metrics Sample to publish
+ */
+void metrics_shm_publish(metrics_shm_t *shm, int slot, const container_metrics_t *metrics);
+
+/**
+ * Release a slot; readers stop finding the container (writer)
+ * @param shm Writer handle
+ * @param slot Slot index from metrics_shm_claim()
+ */
+void metrics_shm_release(metrics_shm_t *shm, int slot);
+
+/**
+ * Copy the most recent samples of a container, oldest first
+ * Lock-free: retries while the writer is updating the slot, a bounded
+ * number of times, and gives up early if the writer has died mid-update.
+ * @param shm Reader or writer handle
+ * @param id Container ID
+ * @param samples Output array
+ * @param max Capacity of samples (at most MC_METRICS_HISTORY are kept)
+ * @return Number of samples copied, MC_ERR_NOT_FOUND if the container is not exported,
+ *         MC_ERR_IO if a slot stayed mid-update
+ */
+int metrics_shm_read(metrics_shm_t *shm, const char *id, metrics_sample_t *samples, int max);
+
+/**
+ * Get the segment header
+ * @param shm Handle
+ * @return Mapped header (live; fields change as the writer runs)
+ */
+const metrics_shm_header_t *metrics_shm_header(const metrics_shm_t *shm);
+
+/**
+ * Unmap a segment; a writer also marks it closed and unlinks it
+ * @param shm Handle
+ */
+void metrics_shm_close(metrics_shm_t *shm);
+
+/* ===== Event Functions ===== */
+
+/**
+ * Open a pidfd for a process
+ * @param pid Process ID
+ * @return pidfd on success, -1 on failure (errno set)
+ */
+int proc_open_pidfd(pid_t pid);
+
+/**
+ * Send a signal through a pidfd
+ * @param pidfd Process file descriptor
+ * @param sig Signal number
+ * @return MC_OK on success, MC_ERR_NOT_FOUND if the process is gone
+ */
+int proc_signal(int pidfd, int sig);
+
+/**
+ * Wait for the process behind a pidfd to exit
+ * @param pidfd Process file descriptor
+ * @param timeout_ms Timeout in milliseconds (-1 = forever)
+ * @return MC_OK once exited, MC_ERR_PROCESS on timeout
+ */
+int proc_wait_exit(int pidfd, int timeout_ms);
+
+/**
+ * Create an event loop
+ * @param loop Output event loop handle
+ * @return MC_OK on success, error code on failure
+ */
+int event_loop_create(event_loop_t **loop);
+
+/**
+ * Get the epoll fd of the loop, for embedding in another poller
+ * @param loop Event loop
+ * @return File descriptor that becomes readable when events are pending
+ */
+int event_loop_fd(event_loop_t *loop);
+
+/**
+ * Watch a container for exit, cgroup depopulation and OOM kills
+ * @param loop Event loop
+ * @param container Container structure
+ * @param cb Callback invoked from event_loop_run_once()
+ * @param userdata Opaque pointer passed to the callback
+ * @return MC_OK on success, error code on failure
+ */
+int event_loop_watch(event_loop_t *loop, container_t *container,
+                     container_event_cb_t cb, void *userdata);
+
+/**
+ * Watch a cgroup (and optionally a process) by path
+ * @param loop Event loop
+ * @param id Container ID reported in events
+ * @param cgroup_path Cgroup directory
+ * @param pid Process to watch for exit (0 = none)
+ * @param cb Callback invoked from event_loop_run_once()
+ * @param userdata Opaque pointer passed to the callback
+ * @return MC_OK on success, error code on failure
+ */
+int event_loop_watch_cgroup(event_loop_t *loop, const char *id, const char *cgroup_path,
+                            pid_t pid, container_event_cb_t cb, void *userdata);
+
+/**
+ * Stop watching a container (safe to call from a callback)
+ * @param loop Event loop
+ * @param id Container ID
+ * @return MC_OK on success, MC_ERR_NOT_FOUND if not watched
+ */
+int event_loop_unwatch(event_loop_t *loop, const char *id);
+
+/**
+ * Add a kernel PSI trigger to a watched container
+ * Fires CONTAINER_EVENT_PRESSURE (at most once per window) when tasks were
+ * stalled on the resource for stall_us within any window_us interval.
+ * Triggers go away with the watch.
+ * @param loop Event loop
+ * @param id Container ID of an existing watch
+ * @param resource Resource to monitor
+ * @param full Trigger on "full" (all tasks stalled) instead of "some"
+ * @param stall_us Stall threshold in microseconds
+ * @param window_us Window in microseconds (500ms-10s, a multiple of 2s
+ *                  without CAP_SYS_RESOURCE)
+ * @return MC_OK on success, MC_ERR_NOT_FOUND if not watched, error code on failure
+ */
+int event_loop_watch_pressure(event_loop_t *loop, const char *id, psi_resource_t resource,
+                              int full, long stall_us, long window_us);
+
+/**
+ * Wait for events and dispatch callbacks
+ * @param loop Event loop
+ * @param timeout_ms Timeout in milliseconds (-1 = forever, 0 = non-blocking)
+ * @return Number of events dispatched, or error code on failure
+ */
+int event_loop_run_once(event_loop_t *loop, int timeout_ms);
+
+/**
+ * Destroy an event loop and all its watches
+ * @param loop Event loop
+ */
+void event_loop_destroy(event_loop_t *loop);
+
+/* ===== Filesystem Functions ===== */
+
+/**
+ * Set up container filesystem
+ * @param container Container structure
+ * @return MC_OK on success, error code on failure
+ */
+int fs_setup(container_t *container);
+
+/**
+ * Mount a copy-on-write overlay rootfs for a container
+ * Stacks config.image (read-only, shared) under per-container upper and
+ * work directories in state_dir, mounts the result at state_dir/merged
+ * and points config.rootfs at it. Idempotent if already mounted.
+ * @param container Container structure
+ * @return MC_OK on success, error code on failure
+ */
+int fs_setup_overlay(container_t *container);
+
+/**
+ * Set up mount namespace and pivot root
+ * @param rootfs Path to rootfs
+ * @return MC_OK on success, error code on failure
+ */
+int fs_pivot_root(const char *rootfs);
+
+/**
+ * Choose how container roots are set up (default FS_ROOT_AUTO)
+ * @param mode Root setup mode
+ */
+void fs_set_root_mode(fs_root_mode_t mode);
+
+/**
+ * Resolve the root setup mode in effect
+ * The first call that may use the mount API prepares the seed mount
+ * namespace: the only full walk of the host mount table the process does.
+ * @return FS_ROOT_MOUNT_API or FS_ROOT_LEGACY
+ */
+fs_root_mode_t fs_root_mode(void);
+
+/**
+ * Clone a rootfs tree for fs_pivot_root_tree() (mount API path)
+ * Runs in the parent; only the rootfs subtree is made private.
+ * @param rootfs Path to rootfs
+ * @return Detached mount fd on success, error code on failure
+ */
+int fs_open_root_tree(const char *rootfs);
+
+/**
+ * Make a cloned rootfs tree the root of a new mount namespace
+ * Runs in a child cloned without CLONE_NEWNS: joins a copy of the seed
+ * namespace, attaches the tree and pivots into it.
+ * @param tree_fd Fd returned by fs_open_root_tree() (consumed)
+ * @return MC_OK on success, error code on failure
+ */
+int fs_pivot_root_tree(int tree_fd);
+
+/**
+ * Mount essential filesystems (/proc, /sys, /dev)
+ * @return MC_OK on success, error code on failure
+ */
+int fs_mount_essentials(void);
+
+/**
+ * Mount essential filesystems, recording how long each step took
+ * @param timing Output per-step timing (may be NULL)
+ * @return MC_OK on success, MC_ERR_FILESYSTEM if any step failed
+ */
+int fs_mount_essentials_timed(fs_mount_timing_t *timing);
+
+/**
+ * Build the /dev template once per process
+ * Call before cloning container processes: children that inherit it
+ * attach /dev in two syscalls instead of creating every node.
+ * @return MC_OK if the template is available, error code otherwise
+ */
+int fs_prepare_essentials(void);
+
+/**
+ * Cleanup filesystem mounts
+ * @param container Container structure
+ * @return MC_OK on success, error code on failure
+ */
+int fs_cleanup(container_t *container);
+
+/**
+ * Create a directory and any missing parents (mkdir -p without a shell)
+ * @param dirfd Directory relative paths start from (AT_FDCWD = cwd)
+ * @param path Directory to create; existing directories are fine
+ * @param mode Mode for created directories
+ * @return MC_OK on success, error code on failure
+ */
+int fs_mkdir_p(int dirfd, const char *path, mode_t mode);
+
+/**
+ * Remove a directory tree (rm -rf without a shell)
+ * Symlinks are removed, never followed, and the walk does not descend
+ * into other mounts still attached below the tree.
+ * @param dirfd Directory relative paths start from (AT_FDCWD = cwd)
+ * @param path Tree to remove; a missing path is not an error
+ * @return MC_OK on success, error code on failure
+ */
+int fs_remove_tree(int dirfd, const char *path);
+
+/**
+ * Read the latency counters of fs_mkdir_p() or fs_remove_tree()
+ * @param op Operation
+ * @param stats Output counters
+ */
+void fs_op_stats(fs_op_t op, fs_op_stats_t *stats);
+
+/* ===== Layer Store Functions ===== */
+
+/**
+ * Import a layer tarball (plain or gzip) into the content-addressed store
+ * The tarball is hashed and linked (or copied) into the store; it is only
+ * extracted when a container first uses it. Importing twice is a no-op.
+ * @param tarball Path to the layer tarball
+ * @param digest Output buffer for the sha256 hex digest (65 bytes)
+ * @return MC_OK on success, error code on failure
+ */
+int layer_import(const char *tarball, char *digest);
+
+/**
+ * Extract a stored layer if it has not been extracted yet
+ * @param digest Layer digest
+ * @return MC_OK on success, error code on failure
+ */
+int layer_ensure(const char *digest);
+
+/**
+ * Extract several stored layers in parallel
+ * @param digests Layer digests
+ * @param count Number of digests
+ * @return MC_OK on success, first error code on failure
+ */
+int layer_ensure_many(const char **digests, int count);
+
+/**
+ * Take a reference on a stored layer
+ * @param digest Layer digest
+ * @return New reference count, or error code on failure
+ */
+int layer_ref(const char *digest);
+
+/**
+ * Drop a reference on a stored layer
+ * @param digest Layer digest
+ * @return New reference count, or error code on failure
+ */
+int layer_unref(const char *digest);
+
+/**
+ * Build an overlay lowerdir list (top layer first) from layer digests
+ * @param digests Layer digests, base first
+ * @param count Number of digests
+ * @param out Output buffer
+ * @param size Size of the output buffer
+ * @return MC_OK on success, error code on failure
+ */
+int layer_build_lowerdir(const char **digests, int count, char *out, size_t size);
+
+/**
+ * Drop one reference on every store layer named in a lowerdir list
+ * @param lowerdir Colon-separated lowerdir list
+ * @return MC_OK on success, error code on failure
+ */
+int layer_release_lowerdir(const char *lowerdir);
+
+/* ===== State Index Functions ===== */
+
+/**
+ * Replace the state index with the given containers
+ * @param containers Containers to index
+ * @param count Number of containers
+ * @return MC_OK on success, error code on failure
+ */
+int state_index_rebuild(container_t **containers, int count);
+
+/**
+ * Insert or update a container's record in the state index
+ * @param container Container structure
+ * @return MC_OK on success, MC_ERR_NOT_FOUND if there is no index yet
+ */
+int state_index_put(const container_t *container);
+
+/**
+ * Remove a container's record from the state index
+ * @param id Container ID
+ * @return MC_OK on success, error code on failure
+ */
+int state_index_remove(const char *id);
+
+/**
+ * Look up a container by ID or name in the state index
+ * @param id_or_name Container ID or name
+ * @param container Output container structure (caller allocated)
+ * @return MC_OK on success, error code on failure
+ */
+int state_index_lookup(const char *id_or_name, container_t *container);
+
+/**
+ * List all containers in the state index
+ * @param containers Output array of containers
+ * @param count Output count
+ * @return MC_OK on success, error code on failure
+ */
+int state_index_list(container_t ***containers, int *count);
+
+/**
+ * Get the state index generation (changes on every update)
+ * @return Generation, or error code if there is no index
+ */
+long state_index_generation(void);
+
+/* ===== Container Cache Functions ===== */
+
+/**
+ * Look up a container in the in-process table (reloaded from the state
+ * index whenever its generation has changed)
+ * @param id_or_name Container ID or name
+ * @param container Output container structure (free with container_free)
+ * @return MC_OK on success, error code on failure
+ */
+int container_cache_get(const char *id_or_name, container_t **container);
+
+/**
+ * Apply a local create/update to the table
+ * @param container Container that was just written to the state index
+ * @param before State index generation read before the write
+ */
+void container_cache_update(const container_t *container, long before);
+
+/**
+ * Apply a local delete to the table
+ * @param id Container ID that was just removed from the state index
+ * @param before State index generation read before the removal
+ */
+void container_cache_remove(const char *id, long before);
+
+/**
+ * Drop the in-process table
+ */
+void container_cache_invalidate(void);
+
+/* ===== Checkpoint Functions ===== */
+
+/**
+ * Prepare an empty checkpoint image directory, <state_dir>/checkpoint
+ * With tmpfs set it is a symlink to a directory under /dev/shm.
+ * @param container Container structure
+ * @param tmpfs Keep the images in tmpfs
+ * @param dir Output path of the image directory
+ * @param size Size of dir
+ * @return MC_OK on success, error code on failure
+ */
+int checkpoint_prepare_dir(container_t *container, int tmpfs, char *dir, size_t size);
+
+/**
+ * Check whether a container has a complete checkpoint
+ * @param container Container structure
+ * @param dir Output path of the image directory (may be NULL)
+ * @param size Size of dir
+ * @return 1 if a restorable checkpoint exists, 0 otherwise
+ */
+int checkpoint_exists(const container_t *container, char *dir, size_t size);
+
+/**
+ * Dump a process tree with criu (the tree should already be frozen)
+ * @param pid Root of the tree (container init)
+ * @param cgroup_path Cgroup of the tree, used as criu's freezer
+ * @param dir Image directory
+ * @param leave_running Keep the tree running after the dump
+ * @return MC_OK on success, MC_ERR_NOT_FOUND without criu, MC_ERR_PROCESS if the dump failed
+ */
+int criu_dump(pid_t pid, const char *cgroup_path, const char *dir, int leave_running);
+
+/**
+ * Restore a process tree with criu as a child of the caller
+ * @param dir Image directory
+ * @param rootfs Root filesystem to restore the mount namespace onto
+ * @param cgroup_path Cgroup the restored tree is born in (NULL = caller's)
+ * @return PID of the restored root on success, error code on failure
+ */
+pid_t criu_restore(const char *dir, const char *rootfs, const char *cgroup_path);
+
+/* ===== Container Lifecycle Functions ===== */
+
+/**
+ * Create a new container
+ * @param config Container configuration
+ * @param container Output container structure
+ * @return MC_OK on success, error code on failure
+ */
+int container_create(container_config_t *config, container_t **container);
+
+/**
+ * Start a container
+ * Returns once the child is cloned and released; it does not wait for
+ * the exec (see container_trace_poll()).
+ * @param container Container structure
+ * @return MC_OK on success, error code on failure
+ */
+int container_start(container_t *container);
+
+/**
+ * Create several containers, running the setup in parallel workers
+ * @param configs Configurations (an empty id is assigned one)
+ * @param count Number of configurations
+ * @param containers Output array of count entries (NULL where creation failed)
+ * @return Number of containers created, or an error code for bad arguments
+ */
+int container_create_batch(container_config_t *configs, int count, container_t **containers);
+
+/**
+ * Start several containers: rootfs setup runs in parallel workers, the
+ * clones are issued from the calling thread
+ * @param containers Containers to start (NULL entries are skipped)
+ * @param count Number of containers
+ * @param results Optional output array of per-container MC_* results
+ * @return Number of containers started, or an error code for bad arguments
+ */
+int container_start_batch(container_t **containers, int count, int *results);
+
+/**
+ * Stop a container
+ * @param container Container structure
+ * @param timeout Timeout in seconds before SIGKILL
+ * @return MC_OK on success, error code on failure
+ */
+int container_stop(container_t *container, int timeout);
+
+/**
+ * Delete a container
+ * @param container Container structure
+ * @return MC_OK on success, error code on failure
+ */
+int container_delete(container_t *container);
+
+/**
+ * Change resource limits of a created or running container
+ * @param container Container structure
+ * @param limits New limits (values <= 0 lift a limit)
+ * @param fields MC_LIMIT_* mask of the fields to apply
+ * @return MC_OK on success, error code on failure
+ */
+int container_update_limits(container_t *container, const resource_limits_t *limits,
+                            unsigned int fields);
+
+/**
+ * Freeze a running container and wait until the kernel reports it frozen
+ * @param container Container structure
+ * @return MC_OK on success, error code on failure
+ */
+int container_pause(container_t *container);
+
+/**
+ * Thaw a paused container and wait until it runs again
+ * @param container Container structure
+ * @return MC_OK on success, error code on failure
+ */
+int container_resume(container_t *container);
+
+/* container_checkpoint() flags */
+#define MC_CHECKPOINT_LEAVE_RUNNING 0x1   /* Keep the container running after the dump */
+#define MC_CHECKPOINT_TMPFS 0x2           /* Keep images in /dev/shm (same-host restarts) */
+
+/**
+ * Checkpoint a running or paused container with CRIU
+ * Freezes the cgroup, then dumps the process tree into
+ * <state_dir>/checkpoint.  Unless MC_CHECKPOINT_LEAVE_RUNNING is given,
+ * the container is stopped afterwards.  Needs the criu binary (PATH, or
+ * KERNELSIGHT_CRIU).
+ * @param container Container structure
+ * @param flags MC_CHECKPOINT_* flags
+ * @return MC_OK on success, MC_ERR_NOT_FOUND without criu, error code on failure
+ */
+int container_checkpoint(container_t *container, unsigned int flags);
+
+/**
+ * Restore a stopped container from its checkpoint
+ * The process tree comes back in fresh namespaces, inside the container
+ * cgroup with the recorded limits, as a child of the caller.
+ * @param container Container structure (state stopped or created)
+ * @return MC_OK on success, MC_ERR_NOT_FOUND without a checkpoint or criu,
+ *         MC_ERR_CGROUP if the limits cannot be applied, error code on failure
+ */
+int container_restore(container_t *container);
+
+/**
+ * Pick up the startup trace of a container this process started
+ * container_start() does not wait for the child to exec; its trace is
+ * read without blocking here (container_get() does it too) and saved
+ * with the state once the child exec'd or died.
+ * @param container Container structure
+ * @return 1 while the child is still starting, MC_OK otherwise
+ */
+int container_trace_poll(container_t *container);
+
+/**
+ * Remove a container's checkpoint images, if any
+ * @param container Container structure
+ */
+void container_checkpoint_discard(container_t *container);
+
+/**
+ * Get container by ID or name
+ * @param id_or_name Container ID or name
+ * @param container Output container structure
+ * @return MC_OK on success, error code on failure
+ */
+int container_get(const char *id_or_name, container_t **container);
+
+/**
+ * List all containers
+ * @param containers Output array of containers
+ * @param count Output count
+ * @return MC_OK on success, error code on failure
+ */
+int container_list(container_t ***containers, int *count);
+
+/**
+ * Execute command in running container
+ * @param container Container structure
+ * @param cmd Command to execute
+ * @param cmd_count Number of command arguments
+ * @return MC_OK on success, error code on failure
+ */
+int container_exec(container_t *container, char **cmd, int cmd_count);
+
+/**
+ * Get container metrics
+ * @param container Container structure
+ * @param metrics Output metrics structure
+ * @return MC_OK on success, error code on failure
+ */
+int container_metrics(container_t *container, container_metrics_t *metrics);
+
+/**
+ * Record that a running container's init process has exited
+ * @param container Container structure
+ * @param status waitpid() status, or -1 if unknown
+ * @return MC_OK on success, error code on failure
+ */
+int container_mark_exited(container_t *container, int status);
+
+/**
+ * Free container structure
+ * @param container Container structure to free
+ */
+void container_free(container_t *container);
+
+/* ===== Daemon Functions ===== */
+
+/**
+ * Run the runtime daemon until SIGTERM/SIGINT
+ * Keeps containers, samplers and the event loop in memory and serves the
+ * binary control protocol on a Unix socket.
+ * @param socket_path Socket path (NULL = <state_dir>/runtime.sock)
+ * @return MC_OK on clean shutdown, error code on failure
+ */
+int daemon_run(const char *socket_path);
+
+/**
+ * Set how often the daemon samples its running containers into the
+ * shared-memory metrics segment (call before daemon_run())
+ * @param interval_ms Interval in milliseconds (default 1000, 0 = no export)
+ */
+void daemon_set_metrics_interval(int interval_ms);
+
+/**
+ * Turn on proactive reclaim of the daemon's running containers; it runs
+ * on the metrics tick, so it needs the metrics export (call before
+ * daemon_run())
+ * @param policy Policy to use (NULL = off, the default)
+ */
+void daemon_set_reclaim(const reclaim_policy_t *policy);
+
+/**
+ * Keep a pool of pre-forked zygotes for a rootfs, so daemon starts of
+ * containers using it skip the clone and root setup (call before
+ * daemon_run()).  The pool is refilled after each start.
+ * @param rootfs Path to rootfs
+ * @param size Number of zygotes to keep parked (0 = no pool, the default)
+ */
+void daemon_set_zygotes(const char *rootfs, int size);
+
+/**
+ * Connect to a running daemon
+ * @param socket_path Socket path (NULL = default)
+ * @param client Output client handle
+ * @return MC_OK on success, MC_ERR_NOT_FOUND if no daemon is listening
+ */
+int daemon_client_open(const char *socket_path, daemon_client_t **client);
+
+/**
+ * Send a raw request without waiting for the reply (pipelining)
+ * @param client Client handle
+ * @param op Request opcode
+ * @param payload Request payload
+ * @param len Payload length
+ * @return Request sequence number, or error code on failure
+ */
+int daemon_client_send(daemon_client_t *client, daemon_op_t op, const void *payload,
+                       uint32_t len);
+
+/**
+ * Send a request that targets one container, without waiting
+ * @param client Client handle
+ * @param op START, STOP, DELETE, GET, STATS, PAUSE or RESUME
+ * @param id_or_name Container ID or name
+ * @param arg Operation argument (STOP: timeout in seconds)
+ * @return Request sequence number, or error code on failure
+ */
+int daemon_client_send_target(daemon_client_t *client, daemon_op_t op,
+                              const char *id_or_name, int arg);
+
+/**
+ * Receive the next reply (replies arrive in request order)
+ * @param client Client handle
+ * @param reply Output reply
+ * @return MC_OK on success, error code on failure
+ */
+int daemon_client_recv(daemon_client_t *client, daemon_reply_t *reply);
+
+/**
+ * Start, stop, delete, pause or resume a container through the daemon
+ * @param client Client handle
+ * @param op DAEMON_OP_START, STOP, DELETE, PAUSE or RESUME
+ * @param id_or_name Container ID or name
+ * @param arg Operation argument (STOP: timeout in seconds)
+ * @return MC_OK on success, error code on failure
+ */
+int daemon_client_op(daemon_client_t *client, daemon_op_t op, const char *id_or_name, int arg);
+
+/**
+ * Create a container through the daemon
+ * @param client Client handle
+ * @param config Container configuration
+ * @param id Output buffer for the container ID (65 bytes, may be NULL)
+ * @return MC_OK on success, error code on failure
+ */
+int daemon_client_create(daemon_client_t *client, const container_config_t *config, char *id);
+
+/**
+ * Get a container through the daemon
+ * @param client Client handle
+ * @param id_or_name Container ID or name
+ * @param container Output container structure (free with container_free)
+ * @return MC_OK on success, error code on failure
+ */
+int daemon_client_get(daemon_client_t *client, const char *id_or_name, container_t **container);
+
+/**
+ * List containers through the daemon
+ * @param client Client handle
+ * @param containers Output array of containers
+ * @param count Output count
+ * @return MC_OK on success, error code on failure
+ */
+int daemon_client_list(daemon_client_t *client, container_t ***containers, int *count);
+
+/**
+ * Sample a container's metrics through the daemon's cached sampler
+ * @param client Client handle
+ * @param id_or_name Container ID or name
+ * @param metrics Output metrics structure
+ * @return MC_OK on success, error code on failure
+ */
+int daemon_client_stats(daemon_client_t *client, const char *id_or_name,
+                        container_metrics_t *metrics);
+
+/**
+ * Change a container's resource limits through the daemon
+ * @param client Client handle
+ * @param id_or_name Container ID or name
+ * @param limits New limits
+ * @param fields MC_LIMIT_* mask of the fields to apply
+ * @return MC_OK on success, error code on failure
+ */
+int daemon_client_update(daemon_client_t *client, const char *id_or_name,
+                         const resource_limits_t *limits, unsigned int fields);
+
+/**
+ * Fetch the daemon's library counters
+ * @param client Client handle
+ * @param counters Output snapshot
+ * @return MC_OK on success, error code on failure
+ */
+int daemon_client_counters(daemon_client_t *client, mc_counters_t *counters);
+
+/**
+ * Close a daemon client
+ * @param client Client handle
+ */
+void daemon_client_close(daemon_client_t *client);
+
+/* ===== Trace and Counter Functions ===== */
+
+/**
+ * Name of a startup phase ("clone", "pivot_root", ...)
+ * @param phase Phase
+ * @return Static string
+ */
+const char *startup_phase_name(startup_phase_t phase);
+
+/**
+ * Format a startup trace as "clone 80us, ..., exec 300us (total 700us)"
+ * @param trace Startup trace
+ * @param buf Output buffer
+ * @param size Buffer size
+ * @return Length the full string needs, like snprintf()
+ */
+int startup_trace_format(const startup_trace_t *trace, char *buf, size_t size);
+
+/**
+ * Current CLOCK_MONOTONIC time in nanoseconds
+ * @return Time in ns
+ */
+long mc_now_ns(void);
+
+/**
+ * Count one operation
+ * @param counter Operation
+ * @param failed Non-zero if it failed
+ */
+void mc_counter_inc(mc_counter_t counter, int failed);
+
+/**
+ * Record a latency observation
+ * @param hist Operation
+ * @param ns Latency in nanoseconds
+ */
+void mc_histogram_observe(mc_histogram_t hist, long ns);
+
+/**
+ * Copy the process-wide counters
+ * @param counters Output snapshot
+ */
+void mc_counters_snapshot(mc_counters_t *counters);
+
+/**
+ * Format counters in the Prometheus text exposition format
+ * @param counters Snapshot to format
+ * @param buf Output buffer
+ * @param size Buffer size
+ * @return Length the full text needs, like snprintf()
+ */
+int mc_counters_format_prometheus(const mc_counters_t *counters, char *buf, size_t size);
+
+/* ===== Utility Functions ===== */
+
+/**
+ * Generate a random container ID (64 hex characters from getrandom())
+ * Thread-safe.
+ * @param id Output buffer (must be at least 65 bytes)
+ * @return MC_OK on success, MC_ERR_IO if no randomness was available
+ */
+int generate_container_id(char *id);
+
+/**
+ * Get state directory for containers
+ * @return Path to state directory
+ */
+const char *get_state_dir(void);
+
+/**
+ * Get error message for error code
+ * @param err Error code
+ * @return Error message string
+ */
+const char *mc_strerror(mc_error_t err);
+
+/* Log levels */
+#define MC_LOG_DEBUG 0
+#define MC_LOG_INFO 1
+#define MC_LOG_WARN 2
+#define MC_LOG_ERROR 3
+
+/* Calls below this level compile away (make LOG_LEVEL=n) */
+#ifndef MC_LOG_COMPILE_LEVEL
+#define MC_LOG_COMPILE_LEVEL MC_LOG_DEBUG
+#endif
+
+/**
+ * Log message with level
+ *
+ * The message is queued and written to stderr by a background thread;
+ * the caller never blocks on the write.  In container children the line
+ * is written directly.  Messages longer than about 220 bytes are cut.
+ * @param level Log level (0=debug, 1=info, 2=warn, 3=error)
+ * @param fmt Format string
+ */
+void mc_log(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/* Set by mc_log_mute(); checked before the arguments are evaluated */
+extern int mc_log_muted;
+
+#define mc_log(level, ...) \
+    ((level) >= MC_LOG_COMPILE_LEVEL && !mc_log_muted ? mc_log((level), __VA_ARGS__) : (void)0)
+
+/**
+ * Drop all further messages of this process
+ *
+ * For clone()d children before exec, where formatting a message is not
+ * async-signal-safe.  Not for CLONE_VM children: they would mute the parent.
+ */
+void mc_log_mute(void);
+
+/**
+ * Set the runtime log level (default info, or KERNELSIGHT_LOG_LEVEL)
+ * @param level Lowest level written; clamped to 0-3
+ */
+void mc_log_set_level(int level);
+
+/**
+ * Get the runtime log level
+ * @return Lowest level written
+ */
+int mc_log_get_level(void);
+
+/**
+ * Write out all queued log messages before returning
  */
-void mc_log(int level, const char *fmt, ...);
+void mc_log_flush(void);
 
 #endif /* MINICONTAINER_H */
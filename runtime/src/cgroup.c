@@ -5,11 +5,18 @@
 
 #define _GNU_SOURCE
 #include "../include/container.h"
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/sysmacros.h>
 
 /* Cgroup v2 base path */
 #define CGROUP_ROOT "/sys/fs/cgroup"
 #define MINICONTAINER_CGROUP "kernelsight"
 
+/* Upper bound on waiting for a killed cgroup to empty */
+#define CGROUP_CLEANUP_TIMEOUT_MS 5000
+
 /**
  * Check if cgroup v2 is available
  */
@@ -21,50 +28,6 @@ static int cgroup_v2_available(void) {
     return stat(path, &st) == 0;
 }
 
-/**
- * Read a value from a cgroup file
- */
-static long read_cgroup_value(const char *path) {
-    FILE *fp = fopen(path, "r");
-    if (!fp) {
-        return -1;
-    }
-    
-    long value = 0;
-    if (fscanf(fp, "%ld", &value) != 1) {
-        fclose(fp);
-        return -1;
-    }
-    
-    fclose(fp);
-    return value;
-}
-
-/**
- * Read a string from a cgroup file
- */
-static int read_cgroup_string(const char *path, char *buf, size_t size) {
-    FILE *fp = fopen(path, "r");
-    if (!fp) {
-        return MC_ERR_IO;
-    }
-    
-    if (fgets(buf, size, fp) == NULL) {
-        fclose(fp);
-        return MC_ERR_IO;
-    }
-    
-    fclose(fp);
-    
-    /* Remove trailing newline */
-    size_t len = strlen(buf);
-    if (len > 0 && buf[len - 1] == '\n') {
-        buf[len - 1] = '\0';
-    }
-    
-    return MC_OK;
-}
-
 /**
  * Write a value to a cgroup file
  */
@@ -72,11 +35,14 @@ static int write_cgroup_value(const char *path, const char *value) {
     int fd = open(path, O_WRONLY);
     if (fd < 0) {
         mc_log(3, "Failed to open %s: %s", path, strerror(errno));
+        mc_counter_inc(MC_COUNTER_CGROUP_WRITE, 1);
         return MC_ERR_IO;
     }
     
     ssize_t len = strlen(value);
-    if (write(fd, value, len) != len) {
+    int failed = write(fd, value, len) != len;
+    mc_counter_inc(MC_COUNTER_CGROUP_WRITE, failed);
+    if (failed) {
         mc_log(3, "Failed to write to %s: %s", path, strerror(errno));
         close(fd);
         return MC_ERR_IO;
@@ -86,62 +52,97 @@ static int write_cgroup_value(const char *path, const char *value) {
     return MC_OK;
 }
 
+/**
+ * Enable the runtime's controllers in a subtree_control file, writing only
+ * those not already listed
+ */
+static void enable_controllers(const char *path) {
+    static const char *controllers[] = {"cpu", "cpuset", "memory", "pids", "io"};
+    char enabled[512] = "";
+    
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        ssize_t n = read(fd, enabled, sizeof(enabled) - 1);
+        enabled[n > 0 ? n : 0] = '\0';
+        close(fd);
+    }
+    
+    for (size_t i = 0; i < sizeof(controllers) / sizeof(controllers[0]); i++) {
+        size_t len = strlen(controllers[i]);
+        int found = 0;
+        for (char *p = enabled; (p = strstr(p, controllers[i])) != NULL; p += len) {
+            if ((p == enabled || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\n' || !p[len])) {
+                found = 1;
+                break;
+            }
+        }
+        if (found) {
+            continue;
+        }
+    
+        char value[32];
+        snprintf(value, sizeof(value), "+%s", controllers[i]);
+        if (write_cgroup_value(path, value) != MC_OK) {
+            mc_log(2, "Could not enable controller %s in %s", controllers[i], path);
+        }
+    }
+}
+
+/* The hierarchy is set up once per process; container cgroups are then
+ * created relative to an open fd of the kernelsight cgroup */
+static pthread_once_t hierarchy_once = PTHREAD_ONCE_INIT;
+static int hierarchy_ret = MC_ERR_CGROUP;
+static int hierarchy_fd = -1;
+
 /**
  * Create the kernelsight cgroup hierarchy
  */
-static int cgroup_create_hierarchy(void) {
+static void cgroup_create_hierarchy(void) {
     char path[PATH_MAX];
     
+    if (!cgroup_v2_available()) {
+        mc_log(3, "Cgroup v2 is not available");
+        return;
+    }
+    
     /* Create base kernelsight cgroup */
     snprintf(path, sizeof(path), "%s/%s", CGROUP_ROOT, MINICONTAINER_CGROUP);
     if (mkdir(path, 0755) != 0 && errno != EEXIST) {
         mc_log(3, "Failed to create cgroup directory %s: %s", path, strerror(errno));
-        return MC_ERR_CGROUP;
+        return;
     }
     
-    /* Enable controllers in the base cgroup */
-    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", CGROUP_ROOT);
-    
-    /* Try to enable each controller */
-    const char *controllers[] = {"+cpu", "+memory", "+pids", "+io"};
-    for (size_t i = 0; i < sizeof(controllers) / sizeof(controllers[0]); i++) {
-        if (write_cgroup_value(path, controllers[i]) != MC_OK) {
-            mc_log(2, "Could not enable controller %s (may already be enabled)", controllers[i]);
-        }
+    hierarchy_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (hierarchy_fd < 0) {
+        mc_log(3, "Failed to open cgroup directory %s: %s", path, strerror(errno));
+        return;
     }
     
-    /* Enable controllers in kernelsight cgroup */
-    snprintf(path, sizeof(path), "%s/%s/cgroup.subtree_control", 
+    /* Enable controllers in the root and in the kernelsight cgroup */
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", CGROUP_ROOT);
+    enable_controllers(path);
+    snprintf(path, sizeof(path), "%s/%s/cgroup.subtree_control",
              CGROUP_ROOT, MINICONTAINER_CGROUP);
-    for (size_t i = 0; i < sizeof(controllers) / sizeof(controllers[0]); i++) {
-        if (write_cgroup_value(path, controllers[i]) != MC_OK) {
-            mc_log(2, "Could not enable controller %s in kernelsight cgroup", controllers[i]);
-        }
-    }
+    enable_controllers(path);
     
-    return MC_OK;
+    hierarchy_ret = MC_OK;
 }
 
 /**
  * Initialize cgroup for container
  */
 int cgroup_init(container_t *container) {
-    if (!cgroup_v2_available()) {
-        mc_log(3, "Cgroup v2 is not available");
-        return MC_ERR_CGROUP;
-    }
-    
     /* Create hierarchy if needed */
-    int ret = cgroup_create_hierarchy();
-    if (ret != MC_OK) {
-        return ret;
+    pthread_once(&hierarchy_once, cgroup_create_hierarchy);
+    if (hierarchy_ret != MC_OK) {
+        return hierarchy_ret;
     }
     
     /* Create container-specific cgroup */
     snprintf(container->cgroup_path, sizeof(container->cgroup_path),
              "%s/%s/%s", CGROUP_ROOT, MINICONTAINER_CGROUP, container->config.id);
     
-    if (mkdir(container->cgroup_path, 0755) != 0 && errno != EEXIST) {
+    if (mkdirat(hierarchy_fd, container->config.id, 0755) != 0 && errno != EEXIST) {
         mc_log(3, "Failed to create container cgroup: %s", strerror(errno));
         return MC_ERR_CGROUP;
     }
@@ -150,6 +151,147 @@ int cgroup_init(container_t *container) {
     return MC_OK;
 }
 
+/**
+ * Build the path of a file in a container's cgroup; one that does not fit
+ * comes back empty, so opening it fails instead of hitting another file
+ */
+static void cgroup_file(char *path, size_t size, const container_t *container, const char *file) {
+    int n = snprintf(path, size, "%s/%s", container->cgroup_path, file);
+    if (n < 0 || (size_t)n >= size) path[0] = '\0';
+}
+
+/**
+ * Format an io.max line ("max" for unset fields, so a rewrite also lifts
+ * limits that were dropped)
+ */
+static void format_io_max(const io_device_limit_t *io, char *buf, size_t size) {
+    const long values[] = { io->rbps, io->wbps, io->riops, io->wiops };
+    const char *keys[] = { "rbps", "wbps", "riops", "wiops" };
+    int len = snprintf(buf, size, "%u:%u", io->major, io->minor);
+    
+    for (int i = 0; i < 4 && len > 0 && (size_t)len < size; i++) {
+        if (values[i] > 0) {
+            len += snprintf(buf + len, size - len, " %s=%ld", keys[i], values[i]);
+        } else {
+            len += snprintf(buf + len, size - len, " %s=max", keys[i]);
+        }
+    }
+}
+
+/**
+ * Convert Docker-style shares (2-262144, default 1024) to cgroup v2
+ * cpu.weight (1-10000, default 100)
+ */
+static int shares_to_weight(int shares) {
+    int weight = (shares * 100) / 1024;
+    if (weight < 1) weight = 1;
+    if (weight > 10000) weight = 10000;
+    return weight;
+}
+
+/**
+ * Parse an IO throttle: "MAJ:MIN" or a block device path, followed by
+ * any of rbps=, wbps=, riops=, wiops= (values may use K/M/G suffixes)
+ */
+int cgroup_parse_io_max(const char *spec, io_device_limit_t *io) {
+    char device[PATH_MAX];
+    
+    if (!spec || !io) {
+        return MC_ERR_INVALID;
+    }
+    memset(io, 0, sizeof(*io));
+    
+    size_t len = strcspn(spec, " ,");
+    if (len == 0 || len >= sizeof(device)) {
+        return MC_ERR_INVALID;
+    }
+    memcpy(device, spec, len);
+    device[len] = '\0';
+    
+    if (device[0] == '/') {
+        struct stat st;
+        if (stat(device, &st) != 0 || !S_ISBLK(st.st_mode)) {
+            mc_log(3, "Not a block device: %s", device);
+            return MC_ERR_INVALID;
+        }
+        io->major = major(st.st_rdev);
+        io->minor = minor(st.st_rdev);
+    } else if (sscanf(device, "%u:%u", &io->major, &io->minor) != 2) {
+        return MC_ERR_INVALID;
+    }
+    
+    for (const char *p = spec + len; *p; ) {
+        p += strspn(p, " ,");
+        if (!*p) break;
+    
+        long *field = NULL;
+        size_t key_len = strcspn(p, "=");
+        if (key_len == 4 && strncmp(p, "rbps", 4) == 0) field = &io->rbps;
+        else if (key_len == 4 && strncmp(p, "wbps", 4) == 0) field = &io->wbps;
+        else if (key_len == 5 && strncmp(p, "riops", 5) == 0) field = &io->riops;
+        else if (key_len == 5 && strncmp(p, "wiops", 5) == 0) field = &io->wiops;
+        if (!field || p[key_len] != '=') {
+            return MC_ERR_INVALID;
+        }
+    
+        char *end;
+        long value = strtol(p + key_len + 1, &end, 10);
+        switch (*end) {
+            case 'K': case 'k': value <<= 10; end++; break;
+            case 'M': case 'm': value <<= 20; end++; break;
+            case 'G': case 'g': value <<= 30; end++; break;
+        }
+        if (end == p + key_len + 1 || value < 0 || (*end && *end != ' ' && *end != ',')) {
+            return MC_ERR_INVALID;
+        }
+        *field = value;
+        p = end;
+    }
+    return MC_OK;
+}
+
+/**
+ * Parse a PSI file ("some avg10=.. avg60=.. avg300=.. total=..", then an
+ * optional "full" line); keys it does not know are skipped
+ */
+int cgroup_parse_pressure(const char *buf, psi_stats_t *psi) {
+    int lines = 0;
+    
+    if (!buf || !psi) {
+        return MC_ERR_INVALID;
+    }
+    memset(psi, 0, sizeof(*psi));
+    
+    for (const char *p = buf; *p; ) {
+        double *avg10, *avg60;
+        long *total;
+        if (strncmp(p, "some ", 5) == 0) {
+            avg10 = &psi->some_avg10;
+            avg60 = &psi->some_avg60;
+            total = &psi->some_total_us;
+        } else if (strncmp(p, "full ", 5) == 0) {
+            avg10 = &psi->full_avg10;
+            avg60 = &psi->full_avg60;
+            total = &psi->full_total_us;
+        } else {
+            break;
+        }
+        p += 5;
+    
+        while (*p && *p != '\n') {
+            p += strspn(p, " ");
+            char *end = (char *)p;
+            if (strncmp(p, "avg10=", 6) == 0) *avg10 = strtod(p + 6, &end);
+            else if (strncmp(p, "avg60=", 6) == 0) *avg60 = strtod(p + 6, &end);
+            else if (strncmp(p, "total=", 6) == 0) *total = strtol(p + 6, &end, 10);
+            p = end + strcspn(end, " \n");
+        }
+        if (*p) p++;
+        lines++;
+    }
+    return lines > 0 ? MC_OK : MC_ERR_INVALID;
+}
+
 /**
  * Apply resource limits to cgroup
  */
@@ -160,7 +302,7 @@ int cgroup_apply_limits(container_t *container) {
     
     /* Apply memory limit */
     if (limits->memory_limit_bytes > 0) {
-        snprintf(path, sizeof(path), "%s/memory.max", container->cgroup_path);
+        cgroup_file(path, sizeof(path), container, "memory.max");
         snprintf(value, sizeof(value), "%ld", limits->memory_limit_bytes);
         if (write_cgroup_value(path, value) != MC_OK) {
             mc_log(2, "Could not set memory limit");
@@ -170,7 +312,7 @@ int cgroup_apply_limits(container_t *container) {
         
         /* Apply swap limit */
         if (limits->memory_swap_bytes >= 0) {
-            snprintf(path, sizeof(path), "%s/memory.swap.max", container->cgroup_path);
+            cgroup_file(path, sizeof(path), container, "memory.swap.max");
             snprintf(value, sizeof(value), "%ld", limits->memory_swap_bytes);
             if (write_cgroup_value(path, value) != MC_OK) {
                 mc_log(2, "Could not set swap limit");
@@ -178,10 +320,35 @@ int cgroup_apply_limits(container_t *container) {
         }
     }
     
+    /* Apply memory.high (throttle and reclaim before the hard limit) */
+    if (limits->memory_high_bytes > 0) {
+        cgroup_file(path, sizeof(path), container, "memory.high");
+        snprintf(value, sizeof(value), "%ld", limits->memory_high_bytes);
+        if (write_cgroup_value(path, value) != MC_OK) {
+            mc_log(2, "Could not set memory.high");
+        }
+    }
+    
+    /* Apply memory.min/memory.low (reclaim leaves this much alone) */
+    if (limits->memory_min_bytes > 0) {
+        cgroup_file(path, sizeof(path), container, "memory.min");
+        snprintf(value, sizeof(value), "%ld", limits->memory_min_bytes);
+        if (write_cgroup_value(path, value) != MC_OK) {
+            mc_log(2, "Could not set memory.min");
+        }
+    }
+    if (limits->memory_low_bytes > 0) {
+        cgroup_file(path, sizeof(path), container, "memory.low");
+        snprintf(value, sizeof(value), "%ld", limits->memory_low_bytes);
+        if (write_cgroup_value(path, value) != MC_OK) {
+            mc_log(2, "Could not set memory.low");
+        }
+    }
+    
     /* Apply CPU limit */
     if (limits->cpu_quota_us > 0) {
         int period = limits->cpu_period_us > 0 ? limits->cpu_period_us : 100000;
-        snprintf(path, sizeof(path), "%s/cpu.max", container->cgroup_path);
+        cgroup_file(path, sizeof(path), container, "cpu.max");
         snprintf(value, sizeof(value), "%d %d", limits->cpu_quota_us, period);
         if (write_cgroup_value(path, value) != MC_OK) {
             mc_log(2, "Could not set CPU limit");
@@ -192,22 +359,32 @@ int cgroup_apply_limits(container_t *container) {
     
     /* Apply CPU weight (shares) */
     if (limits->cpu_shares > 0) {
-        /* Convert shares (Docker-style) to weight (cgroup v2 style) */
-        /* shares: 2-262144, default 1024 -> weight: 1-10000, default 100 */
-        int weight = (limits->cpu_shares * 100) / 1024;
-        if (weight < 1) weight = 1;
-        if (weight > 10000) weight = 10000;
-        
-        snprintf(path, sizeof(path), "%s/cpu.weight", container->cgroup_path);
-        snprintf(value, sizeof(value), "%d", weight);
+        cgroup_file(path, sizeof(path), container, "cpu.weight");
+        snprintf(value, sizeof(value), "%d", shares_to_weight(limits->cpu_shares));
         if (write_cgroup_value(path, value) != MC_OK) {
             mc_log(2, "Could not set CPU weight");
         }
     }
     
+    /* Apply CPU and NUMA placement */
+    if (limits->cpuset_cpus[0]) {
+        cgroup_file(path, sizeof(path), container, "cpuset.cpus");
+        if (write_cgroup_value(path, limits->cpuset_cpus) != MC_OK) {
+            mc_log(2, "Could not set cpuset.cpus");
+        } else {
+            mc_log(1, "Set cpuset.cpus: %s", limits->cpuset_cpus);
+        }
+    }
+    if (limits->cpuset_mems[0]) {
+        cgroup_file(path, sizeof(path), container, "cpuset.mems");
+        if (write_cgroup_value(path, limits->cpuset_mems) != MC_OK) {
+            mc_log(2, "Could not set cpuset.mems");
+        }
+    }
+    
     /* Apply PID limit */
     if (limits->pids_max > 0) {
-        snprintf(path, sizeof(path), "%s/pids.max", container->cgroup_path);
+        cgroup_file(path, sizeof(path), container, "pids.max");
         snprintf(value, sizeof(value), "%d", limits->pids_max);
         if (write_cgroup_value(path, value) != MC_OK) {
             mc_log(2, "Could not set PID limit");
@@ -216,9 +393,264 @@ int cgroup_apply_limits(container_t *container) {
         }
     }
     
+    /* Apply IO weight */
+    if (limits->io_weight > 0) {
+        int weight = limits->io_weight > 10000 ? 10000 : limits->io_weight;
+        cgroup_file(path, sizeof(path), container, "io.weight");
+        snprintf(value, sizeof(value), "default %d", weight);
+        if (write_cgroup_value(path, value) != MC_OK) {
+            mc_log(2, "Could not set IO weight");
+        }
+    }
+    
+    /* Apply per-device IO throttles, one io.max line per device */
+    int io_count = limits->io_device_count;
+    if (io_count > MC_IO_MAX_DEVICES) io_count = MC_IO_MAX_DEVICES;
+    cgroup_file(path, sizeof(path), container, "io.max");
+    for (int i = 0; i < io_count; i++) {
+        const io_device_limit_t *io = &limits->io_devices[i];
+        format_io_max(io, value, sizeof(value));
+        if (write_cgroup_value(path, value) != MC_OK) {
+            mc_log(2, "Could not set IO limit for %u:%u", io->major, io->minor);
+        } else {
+            mc_log(1, "Set IO limit: %s", value);
+        }
+    }
+    
+    return MC_OK;
+}
+
+/**
+ * Write one limit file of a live cgroup
+ */
+static int set_limit(container_t *container, const char *file, const char *value) {
+    char path[PATH_MAX];
+    cgroup_file(path, sizeof(path), container, file);
+    
+    if (write_cgroup_value(path, value) != MC_OK) {
+        mc_log(2, "Could not set %s to \"%s\"", file, value);
+        return MC_ERR_CGROUP;
+    }
+    mc_log(0, "Set %s: %s", file, value);
     return MC_OK;
 }
 
+/**
+ * Write a byte/count limit, "max" when not positive
+ */
+static int set_limit_long(container_t *container, const char *file, long value) {
+    char buf[32];
+    if (value > 0) {
+        snprintf(buf, sizeof(buf), "%ld", value);
+    } else {
+        snprintf(buf, sizeof(buf), "max");
+    }
+    return set_limit(container, file, buf);
+}
+
+/** Write a memory protection; unlike limits, lifting one means 0, not "max" */
+static int set_protection(container_t *container, const char *file, long value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%ld", value > 0 ? value : 0);
+    return set_limit(container, file, buf);
+}
+
+static const io_device_limit_t *find_io_device(const resource_limits_t *limits,
+                                               unsigned int major, unsigned int minor) {
+    for (int i = 0; i < limits->io_device_count && i < MC_IO_MAX_DEVICES; i++) {
+        if (limits->io_devices[i].major == major && limits->io_devices[i].minor == minor) {
+            return &limits->io_devices[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Read the devices io.max currently throttles (the kernel lists only those)
+ * @return Number of devices, or -1 if io.max could not be read
+ */
+static int read_io_max_devices(container_t *container, io_device_limit_t *devs, int max) {
+    char path[PATH_MAX], line[256];
+    cgroup_file(path, sizeof(path), container, "io.max");
+    
+    FILE *fp = fopen(path, "r");
+    mc_counter_inc(MC_COUNTER_CGROUP_READ, !fp);
+    if (!fp) return -1;
+    int n = 0;
+    while (n < max && fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%u:%u", &devs[n].major, &devs[n].minor) == 2) n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+/**
+ * Rewrite only the io.max lines that changed; devices the cgroup throttles
+ * that are not in the new list are reset
+ */
+static int update_io_max(container_t *container, const resource_limits_t *limits) {
+    resource_limits_t *cur = &container->config.limits;
+    io_device_limit_t live[MC_IO_MAX_DEVICES * 4];
+    char value[128];
+    int ret = MC_OK;
+    int count = limits->io_device_count > MC_IO_MAX_DEVICES ? MC_IO_MAX_DEVICES
+                                                            : limits->io_device_count;
+    
+    /* The file, not our record, says what is throttled now */
+    int live_count = read_io_max_devices(container, live, sizeof(live) / sizeof(live[0]));
+    if (live_count < 0) {
+        memcpy(live, cur->io_devices, sizeof(cur->io_devices));
+        live_count = cur->io_device_count > MC_IO_MAX_DEVICES ? MC_IO_MAX_DEVICES
+                                                              : cur->io_device_count;
+    }
+    for (int i = 0; i < live_count; i++) {
+        if (!find_io_device(limits, live[i].major, live[i].minor)) {
+            io_device_limit_t reset = { .major = live[i].major, .minor = live[i].minor };
+            format_io_max(&reset, value, sizeof(value));
+            if (set_limit(container, "io.max", value) != MC_OK) ret = MC_ERR_CGROUP;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        const io_device_limit_t *io = &limits->io_devices[i];
+        const io_device_limit_t *old = find_io_device(cur, io->major, io->minor);
+        if (container->limits_known && old && memcmp(old, io, sizeof(*io)) == 0) continue;
+        format_io_max(io, value, sizeof(value));
+        if (set_limit(container, "io.max", value) != MC_OK) ret = MC_ERR_CGROUP;
+    }
+    
+    if (ret == MC_OK) {
+        memcpy(cur->io_devices, limits->io_devices, sizeof(cur->io_devices[0]) * count);
+        cur->io_device_count = count;
+    }
+    return ret;
+}
+
+/**
+ * Update limits of a live cgroup, writing only the files that change
+ */
+int cgroup_update_limits(container_t *container, const resource_limits_t *limits,
+                         unsigned int fields) {
+    char value[64];
+    int ret = MC_OK;
+    
+    if (!container || !limits || !container->cgroup_path[0]) {
+        return MC_ERR_INVALID;
+    }
+    resource_limits_t *cur = &container->config.limits;
+    
+    /* Unrecorded limits (state from an older version): write every field */
+    int known = container->limits_known;
+    
+    /* memory.high first: lowering both limits then throttles before it OOMs */
+    if ((fields & MC_LIMIT_MEMORY_HIGH) &&
+        (!known || limits->memory_high_bytes != cur->memory_high_bytes)) {
+        if (set_limit_long(container, "memory.high", limits->memory_high_bytes) == MC_OK) {
+            cur->memory_high_bytes = limits->memory_high_bytes;
+        } else {
+            ret = MC_ERR_CGROUP;
+        }
+    }
+    if ((fields & MC_LIMIT_MEMORY) && (!known || limits->memory_limit_bytes != cur->memory_limit_bytes)) {
+        if (set_limit_long(container, "memory.max", limits->memory_limit_bytes) == MC_OK) {
+            cur->memory_limit_bytes = limits->memory_limit_bytes;
+        } else {
+            ret = MC_ERR_CGROUP;
+        }
+    }
+    if ((fields & MC_LIMIT_MEMORY_MIN) && (!known || limits->memory_min_bytes != cur->memory_min_bytes)) {
+        if (set_protection(container, "memory.min", limits->memory_min_bytes) == MC_OK) {
+            cur->memory_min_bytes = limits->memory_min_bytes;
+        } else {
+            ret = MC_ERR_CGROUP;
+        }
+    }
+    if ((fields & MC_LIMIT_MEMORY_LOW) && (!known || limits->memory_low_bytes != cur->memory_low_bytes)) {
+        if (set_protection(container, "memory.low", limits->memory_low_bytes) == MC_OK) {
+            cur->memory_low_bytes = limits->memory_low_bytes;
+        } else {
+            ret = MC_ERR_CGROUP;
+        }
+    }
+    if ((fields & MC_LIMIT_SWAP) && (!known || limits->memory_swap_bytes != cur->memory_swap_bytes)) {
+        /* Unlike the other limits, 0 is a real value here (no swap) */
+        if (limits->memory_swap_bytes >= 0) {
+            snprintf(value, sizeof(value), "%ld", limits->memory_swap_bytes);
+        } else {
+            snprintf(value, sizeof(value), "max");
+        }
+        if (set_limit(container, "memory.swap.max", value) == MC_OK) {
+            cur->memory_swap_bytes = limits->memory_swap_bytes;
+        } else {
+            ret = MC_ERR_CGROUP;
+        }
+    }
+    if (fields & MC_LIMIT_CPU) {
+        int period = limits->cpu_period_us > 0 ? limits->cpu_period_us : 100000;
+        int cur_period = cur->cpu_period_us > 0 ? cur->cpu_period_us : 100000;
+        int quota = limits->cpu_quota_us > 0 ? limits->cpu_quota_us : 0;
+        int cur_quota = cur->cpu_quota_us > 0 ? cur->cpu_quota_us : 0;
+        if (!known || quota != cur_quota || period != cur_period) {
+            if (quota > 0) {
+                snprintf(value, sizeof(value), "%d %d", quota, period);
+            } else {
+                snprintf(value, sizeof(value), "max %d", period);
+            }
+            if (set_limit(container, "cpu.max", value) == MC_OK) {
+                cur->cpu_quota_us = limits->cpu_quota_us;
+                cur->cpu_period_us = period;
+            } else {
+                ret = MC_ERR_CGROUP;
+            }
+        }
+    }
+    if ((fields & MC_LIMIT_CPU_WEIGHT) && (!known || limits->cpu_shares != cur->cpu_shares)) {
+        snprintf(value, sizeof(value), "%d",
+                 limits->cpu_shares > 0 ? shares_to_weight(limits->cpu_shares) : 100);
+        if (set_limit(container, "cpu.weight", value) == MC_OK) {
+            cur->cpu_shares = limits->cpu_shares;
+        } else {
+            ret = MC_ERR_CGROUP;
+        }
+    }
+    /* An empty list goes back to the parent's CPUs/nodes */
+    if ((fields & MC_LIMIT_CPUSET_MEMS) &&
+        (!known || strcmp(limits->cpuset_mems, cur->cpuset_mems) != 0)) {
+        if (set_limit(container, "cpuset.mems", limits->cpuset_mems[0] ? limits->cpuset_mems : "\n") == MC_OK) {
+            snprintf(cur->cpuset_mems, sizeof(cur->cpuset_mems), "%s", limits->cpuset_mems);
+        } else {
+            ret = MC_ERR_CGROUP;
+        }
+    }
+    if ((fields & MC_LIMIT_CPUSET) && (!known || strcmp(limits->cpuset_cpus, cur->cpuset_cpus) != 0)) {
+        if (set_limit(container, "cpuset.cpus", limits->cpuset_cpus[0] ? limits->cpuset_cpus : "\n") == MC_OK) {
+            snprintf(cur->cpuset_cpus, sizeof(cur->cpuset_cpus), "%s", limits->cpuset_cpus);
+        } else {
+            ret = MC_ERR_CGROUP;
+        }
+    }
+    if ((fields & MC_LIMIT_PIDS) && (!known || limits->pids_max != cur->pids_max)) {
+        if (set_limit_long(container, "pids.max", limits->pids_max) == MC_OK) {
+            cur->pids_max = limits->pids_max;
+        } else {
+            ret = MC_ERR_CGROUP;
+        }
+    }
+    if ((fields & MC_LIMIT_IO_WEIGHT) && (!known || limits->io_weight != cur->io_weight)) {
+        int weight = limits->io_weight > 10000 ? 10000 : limits->io_weight;
+        snprintf(value, sizeof(value), "default %d", weight > 0 ? weight : 100);
+        if (set_limit(container, "io.weight", value) == MC_OK) {
+            cur->io_weight = limits->io_weight;
+        } else {
+            ret = MC_ERR_CGROUP;
+        }
+    }
+    if ((fields & MC_LIMIT_IO_MAX) && update_io_max(container, limits) != MC_OK) {
+        ret = MC_ERR_CGROUP;
+    }
+    
+    return ret;
+}
+
 /**
  * Add process to cgroup
  */
@@ -226,7 +658,7 @@ int cgroup_add_pid(container_t *container, pid_t pid) {
     char path[PATH_MAX];
     char value[32];
     
-    snprintf(path, sizeof(path), "%s/cgroup.procs", container->cgroup_path);
+    cgroup_file(path, sizeof(path), container, "cgroup.procs");
     snprintf(value, sizeof(value), "%d", pid);
     
     int ret = write_cgroup_value(path, value);
@@ -241,59 +673,21 @@ int cgroup_add_pid(container_t *container, pid_t pid) {
 
 /**
  * Get container metrics from cgroup
+ * One-shot sample; long-lived callers should keep a cgroup_sampler_t
  */
 int cgroup_get_metrics(container_t *container, container_metrics_t *metrics) {
-    char path[PATH_MAX];
-    char buf[1024];
+    cgroup_sampler_t *sampler;
     
     memset(metrics, 0, sizeof(*metrics));
     
-    /* Memory usage */
-    snprintf(path, sizeof(path), "%s/memory.current", container->cgroup_path);
-    metrics->memory_usage_bytes = read_cgroup_value(path);
-    
-    /* Memory max usage */
-    snprintf(path, sizeof(path), "%s/memory.peak", container->cgroup_path);
-    metrics->memory_max_usage_bytes = read_cgroup_value(path);
-    
-    /* Memory limit */
-    snprintf(path, sizeof(path), "%s/memory.max", container->cgroup_path);
-    if (read_cgroup_string(path, buf, sizeof(buf)) == MC_OK) {
-        if (strcmp(buf, "max") == 0) {
-            metrics->memory_limit_bytes = -1;  /* Unlimited */
-        } else {
-            metrics->memory_limit_bytes = atol(buf);
-        }
-    }
-    
-    /* CPU usage */
-    snprintf(path, sizeof(path), "%s/cpu.stat", container->cgroup_path);
-    FILE *fp = fopen(path, "r");
-    if (fp) {
-        while (fgets(buf, sizeof(buf), fp)) {
-            long value;
-            if (sscanf(buf, "usage_usec %ld", &value) == 1) {
-                metrics->cpu_usage_ns = value * 1000;  /* Convert to nanoseconds */
-            }
-        }
-        fclose(fp);
-    }
-    
-    /* PID count */
-    snprintf(path, sizeof(path), "%s/pids.current", container->cgroup_path);
-    metrics->pids_current = (int)read_cgroup_value(path);
-    
-    /* PID limit */
-    snprintf(path, sizeof(path), "%s/pids.max", container->cgroup_path);
-    if (read_cgroup_string(path, buf, sizeof(buf)) == MC_OK) {
-        if (strcmp(buf, "max") == 0) {
-            metrics->pids_limit = -1;  /* Unlimited */
-        } else {
-            metrics->pids_limit = atoi(buf);
-        }
+    int ret = cgroup_sampler_open(container, &sampler);
+    if (ret != MC_OK) {
+        return ret;
     }
     
-    return MC_OK;
+    ret = cgroup_sampler_read(sampler, metrics);
+    cgroup_sampler_close(sampler);
+    return ret;
 }
 
 /**
@@ -301,7 +695,7 @@ int cgroup_get_metrics(container_t *container, container_metrics_t *metrics) {
  */
 int cgroup_freeze(container_t *container) {
     char path[PATH_MAX];
-    snprintf(path, sizeof(path), "%s/cgroup.freeze", container->cgroup_path);
+    cgroup_file(path, sizeof(path), container, "cgroup.freeze");
     return write_cgroup_value(path, "1");
 }
 
@@ -310,16 +704,79 @@ int cgroup_freeze(container_t *container) {
  */
 int cgroup_unfreeze(container_t *container) {
     char path[PATH_MAX];
-    snprintf(path, sizeof(path), "%s/cgroup.freeze", container->cgroup_path);
+    cgroup_file(path, sizeof(path), container, "cgroup.freeze");
     return write_cgroup_value(path, "0");
 }
 
+/**
+ * Read one key of an open cgroup.events file
+ * Reading also re-arms poll() notification for the descriptor.
+ */
+static int read_events_key(int fd, const char *key) {
+    char buf[256];
+    long value = -1;
+    
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    
+    cgroup_stat_key_t k = { key, (unsigned short)strlen(key), 0 };
+    return cgroup_parse_keyed(buf, &k, 1, &value, 0) > 0 ? (int)value : -1;
+}
+
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Wait for cgroup.events "frozen" to reach the requested value
+ */
+int cgroup_wait_frozen(container_t *container, int frozen, int timeout_ms) {
+    char path[PATH_MAX];
+    cgroup_file(path, sizeof(path), container, "cgroup.events");
+    
+    struct pollfd pfd = { .fd = open(path, O_RDONLY | O_CLOEXEC), .events = POLLPRI };
+    if (pfd.fd < 0) {
+        return MC_ERR_CGROUP;
+    }
+    
+    int ret = MC_ERR_PROCESS;
+    long deadline = now_ms() + timeout_ms;
+    for (;;) {
+        int state = read_events_key(pfd.fd, "frozen");
+        if (state < 0) {
+            ret = MC_ERR_CGROUP;  /* No freezer (kernel < 5.2) or cgroup gone */
+            break;
+        }
+        if (state == frozen) {
+            ret = MC_OK;
+            break;
+        }
+    
+        long remaining = deadline - now_ms();
+        if (remaining <= 0) {
+            break;
+        }
+        if (poll(&pfd, 1, (int)remaining) < 0 && errno != EINTR) {
+            ret = MC_ERR_IO;
+            break;
+        }
+    }
+    
+    close(pfd.fd);
+    return ret;
+}
+
 /**
  * Kill all processes in cgroup
  */
 int cgroup_kill_all(container_t *container) {
     char path[PATH_MAX];
-    snprintf(path, sizeof(path), "%s/cgroup.kill", container->cgroup_path);
+    cgroup_file(path, sizeof(path), container, "cgroup.kill");
     
     /* cgroup.kill might not exist in all kernels */
     if (access(path, W_OK) == 0) {
@@ -327,7 +784,7 @@ int cgroup_kill_all(container_t *container) {
     }
     
     /* Fallback: read PIDs and kill them */
-    snprintf(path, sizeof(path), "%s/cgroup.procs", container->cgroup_path);
+    cgroup_file(path, sizeof(path), container, "cgroup.procs");
     FILE *fp = fopen(path, "r");
     if (!fp) {
         return MC_ERR_IO;
@@ -343,26 +800,94 @@ int cgroup_kill_all(container_t *container) {
 }
 
 /**
- * Cleanup cgroup for container
+ * Cleanup cgroups of many containers
+ * Kills everything first, then waits for all cgroups to empty together.
  */
-int cgroup_cleanup(container_t *container) {
-    if (strlen(container->cgroup_path) == 0) {
+int cgroup_cleanup_many(container_t **containers, int count, int timeout_ms) {
+    if (count <= 0) {
         return MC_OK;
     }
     
-    /* Kill all processes first */
-    cgroup_kill_all(container);
+    struct pollfd *pfds = calloc(count, sizeof(*pfds));
+    if (!pfds) {
+        return MC_ERR_MEMORY;
+    }
     
-    /* Wait a bit for processes to die */
-    usleep(100000);  /* 100ms */
+    /* Kill all processes first so they die in parallel */
+    for (int i = 0; i < count; i++) {
+        pfds[i].fd = -1;
+        if (containers[i] && containers[i]->cgroup_path[0]) {
+            cgroup_kill_all(containers[i]);
+        }
+    }
     
-    /* Remove the cgroup directory */
-    if (rmdir(container->cgroup_path) != 0 && errno != ENOENT) {
-        mc_log(2, "Could not remove cgroup %s: %s", 
-               container->cgroup_path, strerror(errno));
-        return MC_ERR_CGROUP;
+    /* Open cgroup.events and note which cgroups are still populated */
+    int pending = 0;
+    for (int i = 0; i < count; i++) {
+        char path[PATH_MAX];
+        if (!containers[i] || !containers[i]->cgroup_path[0]) continue;
+        
+        cgroup_file(path, sizeof(path), containers[i], "cgroup.events");
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;  /* Already gone */
+        
+        if (read_events_key(fd, "populated") == 0) {
+            close(fd);
+            continue;
+        }
+        pfds[i].fd = fd;
+        pfds[i].events = POLLPRI;
+        pending++;
     }
     
-    mc_log(1, "Removed cgroup: %s", container->cgroup_path);
-    return MC_OK;
+    /* Wait until every cgroup reports "populated 0" or the deadline passes */
+    long deadline = now_ms() + timeout_ms;
+    while (pending > 0) {
+        long remaining = deadline - now_ms();
+        if (remaining <= 0) {
+            mc_log(2, "Timed out waiting for %d cgroup(s) to empty", pending);
+            break;
+        }
+    
+        if (poll(pfds, count, (int)remaining) < 0 && errno != EINTR) {
+            break;
+        }
+    
+        for (int i = 0; i < count; i++) {
+            if (pfds[i].fd < 0 || !(pfds[i].revents & (POLLPRI | POLLERR))) continue;
+            if (read_events_key(pfds[i].fd, "populated") != 0) continue;
+            close(pfds[i].fd);
+            pfds[i].fd = -1;
+            pending--;
+        }
+    }
+    
+    /* Remove the cgroup directories */
+    int ret = MC_OK;
+    for (int i = 0; i < count; i++) {
+        if (pfds[i].fd >= 0) close(pfds[i].fd);
+        if (!containers[i] || !containers[i]->cgroup_path[0]) continue;
+        
+        if (rmdir(containers[i]->cgroup_path) != 0 && errno != ENOENT) {
+            mc_log(2, "Could not remove cgroup %s: %s",
+                   containers[i]->cgroup_path, strerror(errno));
+            ret = MC_ERR_CGROUP;
+            continue;
+        }
+        mc_log(1, "Removed cgroup: %s", containers[i]->cgroup_path);
+    }
+    
+    free(pfds);
+    return ret;
+}
+
+/**
+ * Cleanup cgroup for container
+ */
+int cgroup_cleanup(container_t *container) {
+    if (strlen(container->cgroup_path) == 0) {
+        return MC_OK;
+    }
+    
+    return cgroup_cleanup_many(&container, 1, CGROUP_CLEANUP_TIMEOUT_MS);
 }
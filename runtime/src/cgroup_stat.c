@@ -0,0 +1,192 @@
+/*
+ * KernelSight - Linux Container Runtime
+ * cgroup_stat.c - Allocation-free parser for cgroup stat files
+ *
+ * cpu.stat, memory.stat, memory.events and io.stat are all "key value" or
+ * "device key=value..." text.  Each file is described by a table of keys
+ * mapping to long fields of a fixed struct, and parsed in a single pass.
+ * The tables follow the order the kernel prints keys in, so the lookup
+ * cursor normally hits on the first comparison; keys the table does not
+ * know (newer kernels) cost one scan of the table and are skipped.
+ */
+
+#define _GNU_SOURCE
+#include "../include/container.h"
+#include <stddef.h>
+
+#define STAT_KEY(type, field) { #field, sizeof(#field) - 1, offsetof(type, field) }
+
+static const cgroup_stat_key_t cpu_stat_keys[] = {
+    STAT_KEY(cpu_stat_t, usage_usec),
+    STAT_KEY(cpu_stat_t, user_usec),
+    STAT_KEY(cpu_stat_t, system_usec),
+    STAT_KEY(cpu_stat_t, nr_periods),
+    STAT_KEY(cpu_stat_t, nr_throttled),
+    STAT_KEY(cpu_stat_t, throttled_usec),
+    STAT_KEY(cpu_stat_t, nr_bursts),
+    STAT_KEY(cpu_stat_t, burst_usec),
+};
+
+static const cgroup_stat_key_t memory_stat_keys[] = {
+    STAT_KEY(memory_stat_t, anon),
+    STAT_KEY(memory_stat_t, file),
+    STAT_KEY(memory_stat_t, kernel),
+    STAT_KEY(memory_stat_t, kernel_stack),
+    STAT_KEY(memory_stat_t, pagetables),
+    STAT_KEY(memory_stat_t, percpu),
+    STAT_KEY(memory_stat_t, sock),
+    STAT_KEY(memory_stat_t, vmalloc),
+    STAT_KEY(memory_stat_t, shmem),
+    STAT_KEY(memory_stat_t, zswap),
+    STAT_KEY(memory_stat_t, zswapped),
+    STAT_KEY(memory_stat_t, file_mapped),
+    STAT_KEY(memory_stat_t, file_dirty),
+    STAT_KEY(memory_stat_t, file_writeback),
+    STAT_KEY(memory_stat_t, swapcached),
+    STAT_KEY(memory_stat_t, anon_thp),
+    STAT_KEY(memory_stat_t, file_thp),
+    STAT_KEY(memory_stat_t, shmem_thp),
+    STAT_KEY(memory_stat_t, inactive_anon),
+    STAT_KEY(memory_stat_t, active_anon),
+    STAT_KEY(memory_stat_t, inactive_file),
+    STAT_KEY(memory_stat_t, active_file),
+    STAT_KEY(memory_stat_t, unevictable),
+    STAT_KEY(memory_stat_t, slab_reclaimable),
+    STAT_KEY(memory_stat_t, slab_unreclaimable),
+    STAT_KEY(memory_stat_t, slab),
+    STAT_KEY(memory_stat_t, workingset_refault_anon),
+    STAT_KEY(memory_stat_t, workingset_refault_file),
+    STAT_KEY(memory_stat_t, workingset_activate_anon),
+    STAT_KEY(memory_stat_t, workingset_activate_file),
+    STAT_KEY(memory_stat_t, workingset_restore_anon),
+    STAT_KEY(memory_stat_t, workingset_restore_file),
+    STAT_KEY(memory_stat_t, workingset_nodereclaim),
+    STAT_KEY(memory_stat_t, pgscan),
+    STAT_KEY(memory_stat_t, pgsteal),
+    STAT_KEY(memory_stat_t, pgfault),
+    STAT_KEY(memory_stat_t, pgmajfault),
+    STAT_KEY(memory_stat_t, pgrefill),
+    STAT_KEY(memory_stat_t, pgactivate),
+    STAT_KEY(memory_stat_t, pgdeactivate),
+    STAT_KEY(memory_stat_t, pglazyfree),
+    STAT_KEY(memory_stat_t, pglazyfreed),
+    STAT_KEY(memory_stat_t, thp_fault_alloc),
+    STAT_KEY(memory_stat_t, thp_collapse_alloc),
+};
+
+static const cgroup_stat_key_t memory_events_keys[] = {
+    STAT_KEY(memory_events_t, low),
+    STAT_KEY(memory_events_t, high),
+    STAT_KEY(memory_events_t, max),
+    STAT_KEY(memory_events_t, oom),
+    STAT_KEY(memory_events_t, oom_kill),
+    STAT_KEY(memory_events_t, oom_group_kill),
+};
+
+static const cgroup_stat_key_t io_stat_keys[] = {
+    STAT_KEY(io_stat_t, rbytes),
+    STAT_KEY(io_stat_t, wbytes),
+    STAT_KEY(io_stat_t, rios),
+    STAT_KEY(io_stat_t, wios),
+    STAT_KEY(io_stat_t, dbytes),
+    STAT_KEY(io_stat_t, dios),
+};
+
+#define NKEYS(table) ((int)(sizeof(table) / sizeof((table)[0])))
+
+/**
+ * Find a key, starting at the slot after the previous match
+ */
+static int find_key(const cgroup_stat_key_t *keys, int nkeys, int *cursor,
+                    const char *key, size_t len) {
+    for (int n = 0, i = *cursor; n < nkeys; n++, i = i + 1 < nkeys ? i + 1 : 0) {
+        if (keys[i].len == len && memcmp(keys[i].key, key, len) == 0) {
+            *cursor = i + 1 < nkeys ? i + 1 : 0;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Parse a decimal number and advance past it ("max" and junk give 0)
+ */
+static long parse_long(const char **pp) {
+    const char *p = *pp;
+    int neg = *p == '-';
+    long value = 0;
+    
+    if (neg) p++;
+    while (*p >= '0' && *p <= '9') {
+        value = value * 10 + (*p++ - '0');
+    }
+    *pp = p;
+    return neg ? -value : value;
+}
+
+int cgroup_parse_keyed(const char *buf, const cgroup_stat_key_t *keys, int nkeys,
+                       void *out, int nested) {
+    int cursor = 0, stored = 0;
+    
+    if (!buf || !keys || !out || nkeys <= 0) {
+        return MC_ERR_INVALID;
+    }
+    
+    const char *p = buf;
+    while (*p) {
+        /* Nested files start the line with the device ("8:0 ") */
+        if (nested) {
+            while (*p && *p != ' ' && *p != '\n') p++;
+        }
+    
+        /* One "key value" (flat) or several "key=value" (nested) */
+        while (*p && *p != '\n') {
+            while (*p == ' ') p++;
+            const char *key = p;
+            while (*p && *p != ' ' && *p != '=' && *p != '\n') p++;
+            size_t len = (size_t)(p - key);
+            if (*p == ' ' || *p == '=') p++;
+    
+            int i = len ? find_key(keys, nkeys, &cursor, key, len) : -1;
+            long value = parse_long(&p);
+            if (i >= 0) {
+                long *field = (long *)((char *)out + keys[i].offset);
+                *field = nested ? *field + value : value;
+                stored++;
+            }
+    
+            /* Skip whatever is left of the token (fractions, "max", ...) */
+            while (*p && *p != ' ' && *p != '\n') p++;
+            if (!nested) {
+                while (*p && *p != '\n') p++;
+            }
+        }
+        if (*p == '\n') p++;
+    }
+    
+    return stored;
+}
+
+int cgroup_parse_cpu_stat(const char *buf, cpu_stat_t *stat) {
+    if (!stat) return MC_ERR_INVALID;
+    memset(stat, 0, sizeof(*stat));
+    return cgroup_parse_keyed(buf, cpu_stat_keys, NKEYS(cpu_stat_keys), stat, 0);
+}
+
+int cgroup_parse_memory_stat(const char *buf, memory_stat_t *stat) {
+    if (!stat) return MC_ERR_INVALID;
+    memset(stat, 0, sizeof(*stat));
+    return cgroup_parse_keyed(buf, memory_stat_keys, NKEYS(memory_stat_keys), stat, 0);
+}
+
+int cgroup_parse_memory_events(const char *buf, memory_events_t *events) {
+    if (!events) return MC_ERR_INVALID;
+    memset(events, 0, sizeof(*events));
+    return cgroup_parse_keyed(buf, memory_events_keys, NKEYS(memory_events_keys), events, 0);
+}
+
+int cgroup_parse_io_stat(const char *buf, io_stat_t *stat) {
+    if (!stat) return MC_ERR_INVALID;
+    memset(stat, 0, sizeof(*stat));
+    return cgroup_parse_keyed(buf, io_stat_keys, NKEYS(io_stat_keys), stat, 1);
+}
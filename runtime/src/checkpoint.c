@@ -0,0 +1,193 @@
+/*
+ * KernelSight - Linux Container Runtime
+ * checkpoint.c - Checkpoint/restore through CRIU
+ *
+ * criu is run as a separate binary (no libcriu dependency).  Images live
+ * in <state_dir>/checkpoint, or in tmpfs behind a symlink there, so a
+ * same-host restore reads the pages straight from memory.  Dumps run
+ * against a cgroup the caller has already frozen and leave cgroups to
+ * us; restores are born inside the container cgroup, so the restored
+ * tree inherits it and its limits.
+ */
+
+#define _GNU_SOURCE
+#include "../include/container.h"
+
+#define CRIU_DEFAULT "criu"
+#define CHECKPOINT_DIR_NAME "checkpoint"
+#define CHECKPOINT_TMPFS_ROOT "/dev/shm/kernelsight-checkpoints"
+
+/* Written by criu last: its presence marks a complete dump */
+#define CHECKPOINT_INVENTORY "inventory.img"
+#define RESTORE_PIDFILE "restore.pid"
+
+/* Both directions: options every service-style container needs */
+#define CRIU_COMMON_ARGS "--manage-cgroups=ignore", "--file-locks", "--tcp-established", "--ext-unix-sk"
+
+static const char *criu_binary(void) {
+    const char *path = getenv("KERNELSIGHT_CRIU");
+    return path && path[0] ? path : CRIU_DEFAULT;
+}
+
+/** @return MC_OK, MC_ERR_INVALID if the path does not fit */
+static int checkpoint_dir(const container_t *c, char *buf, size_t size) {
+    int n = snprintf(buf, size, "%s/" CHECKPOINT_DIR_NAME, c->state_dir);
+    return n >= 0 && (size_t)n < size ? MC_OK : MC_ERR_INVALID;
+}
+
+/**
+ * Run criu and wait for it; with cgroup_path it starts inside that cgroup
+ * @return criu's exit status, or error code if it could not be started
+ */
+static int run_criu(char *const argv[], const char *cgroup_path) {
+    int cgroup_fd = -1, procs_fd = -1, in_cgroup = 0;
+    pid_t pid = -1;
+    
+    if (cgroup_path) {
+        char procs[PATH_MAX];
+        snprintf(procs, sizeof(procs), "%s/cgroup.procs", cgroup_path);
+        cgroup_fd = open(cgroup_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        procs_fd = open(procs, O_WRONLY | O_CLOEXEC);
+        if (cgroup_fd >= 0) {
+            pid = ns_clone_into_cgroup(0, cgroup_fd);
+            in_cgroup = pid >= 0;
+        }
+    }
+    if (pid < 0) pid = fork();
+    mc_counter_inc(MC_COUNTER_CLONE, pid < 0);
+    
+    if (pid == 0) {
+        /* Without clone3 the join is one write of our own PID */
+        if (!in_cgroup && procs_fd >= 0 && write(procs_fd, "0", 1) != 1) _exit(126);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    if (cgroup_fd >= 0) close(cgroup_fd);
+    if (procs_fd >= 0) close(procs_fd);
+    if (pid < 0) {
+        mc_log(3, "Could not start criu: %s", strerror(errno));
+        return MC_ERR_PROCESS;
+    }
+    
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return MC_ERR_PROCESS;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/** Map a criu exit status to an error code, logging where to look */
+static int criu_result(int status, const char *what, const char *dir, const char *log) {
+    if (status == 0) return MC_OK;
+    if (status == 127) {
+        mc_log(3, "criu not found (%s); install it or set KERNELSIGHT_CRIU", criu_binary());
+        return MC_ERR_NOT_FOUND;
+    }
+    if (status < 0) return status;
+    mc_log(3, "criu %s failed (status %d), see %s/%s", what, status, dir, log);
+    return MC_ERR_PROCESS;
+}
+
+void container_checkpoint_discard(container_t *c) {
+    char dir[PATH_MAX], target[PATH_MAX];
+    struct stat st;
+    
+    if (!c || checkpoint_dir(c, dir, sizeof(dir)) != MC_OK) return;
+    if (lstat(dir, &st) != 0) return;
+    
+    if (S_ISLNK(st.st_mode)) {
+        ssize_t len = readlink(dir, target, sizeof(target) - 1);
+        if (len > 0) {
+            target[len] = '\0';
+            fs_remove_tree(AT_FDCWD, target);
+        }
+        unlink(dir);
+    } else {
+        fs_remove_tree(AT_FDCWD, dir);
+    }
+}
+
+int checkpoint_prepare_dir(container_t *c, int tmpfs, char *dir, size_t size) {
+    if (!c || !dir) return MC_ERR_INVALID;
+    
+    container_checkpoint_discard(c);
+    if (checkpoint_dir(c, dir, size) != MC_OK) return MC_ERR_INVALID;
+    if (!tmpfs) {
+        return fs_mkdir_p(AT_FDCWD, dir, 0700);
+    }
+    
+    char target[PATH_MAX];
+    snprintf(target, sizeof(target), CHECKPOINT_TMPFS_ROOT "/%s", c->config.id);
+    int ret = fs_mkdir_p(AT_FDCWD, target, 0700);
+    if (ret != MC_OK) return ret;
+    if (symlink(target, dir) != 0) {
+        mc_log(3, "Failed to link %s to %s: %s", dir, target, strerror(errno));
+        fs_remove_tree(AT_FDCWD, target);
+        return MC_ERR_FILESYSTEM;
+    }
+    return MC_OK;
+}
+
+int checkpoint_exists(const container_t *c, char *dir, size_t size) {
+    char path[PATH_MAX], buf[PATH_MAX];
+    
+    if (!c) return 0;
+    if (!dir) {
+        dir = buf;
+        size = sizeof(buf);
+    }
+    if (checkpoint_dir(c, dir, size) != MC_OK ||
+        snprintf(path, sizeof(path), "%s/" CHECKPOINT_INVENTORY, dir) >= (int)sizeof(path)) {
+        return 0;
+    }
+    return access(path, R_OK) == 0;
+}
+
+int criu_dump(pid_t pid, const char *cgroup_path, const char *dir, int leave_running) {
+    char pid_arg[16];
+    
+    if (pid <= 0 || !cgroup_path || !dir) return MC_ERR_INVALID;
+    snprintf(pid_arg, sizeof(pid_arg), "%d", pid);
+    
+    char *argv[] = {
+        (char *)criu_binary(), "dump", "--tree", pid_arg, "--images-dir", (char *)dir,
+        "--log-file", "dump.log", "--freeze-cgroup", (char *)cgroup_path, CRIU_COMMON_ARGS,
+        leave_running ? "--leave-running" : NULL, NULL,
+    };
+    int ret = criu_result(run_criu(argv, NULL), "dump", dir, "dump.log");
+    
+    /* A failed dump may leave a partial image set behind; keep only the log */
+    if (ret != MC_OK) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/" CHECKPOINT_INVENTORY, dir);
+        unlink(path);
+    }
+    return ret;
+}
+
+pid_t criu_restore(const char *dir, const char *rootfs, const char *cgroup_path) {
+    char pidfile[PATH_MAX];
+    
+    if (!dir || !rootfs || !rootfs[0]) return MC_ERR_INVALID;
+    snprintf(pidfile, sizeof(pidfile), "%s/" RESTORE_PIDFILE, dir);
+    unlink(pidfile);
+    
+    /* Detached + sibling: criu exits and the restored root is our child */
+    char *argv[] = {
+        (char *)criu_binary(), "restore", "--images-dir", (char *)dir,
+        "--log-file", "restore.log", "--restore-detached", "--restore-sibling",
+        "--pidfile", pidfile, "--root", (char *)rootfs, CRIU_COMMON_ARGS, NULL,
+    };
+    int ret = criu_result(run_criu(argv, cgroup_path), "restore", dir, "restore.log");
+    if (ret != MC_OK) return ret;
+    
+    FILE *f = fopen(pidfile, "re");
+    int pid = 0;
+    if (!f || fscanf(f, "%d", &pid) != 1 || pid <= 0) {
+        mc_log(3, "criu restore left no usable %s", pidfile);
+        if (f) fclose(f);
+        return MC_ERR_PROCESS;
+    }
+    fclose(f);
+    return pid;
+}
@@ -7,20 +7,22 @@
 #include <time.h>
 #include <stdarg.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <sys/random.h>
+#include <poll.h>
 
 #define STATE_DIR "/var/lib/kernelsight"
 
-static int log_level = 1;
+/* How long an exiting process waits for its starts to reach exec, so
+ * their traces are saved */
+#define STARTUP_TRACE_EXIT_WAIT_MS 1000
+
+/* Upper bound on batch worker threads */
+#define BATCH_MAX_WORKERS 16
+
+/* How long pause/resume wait for cgroup.events to report the new state */
+#define FREEZE_TIMEOUT_MS 5000
 
-void mc_log(int level, const char *fmt, ...) {
-    if (level < log_level) return;
-    const char *levels[] = {"DEBUG", "INFO", "WARN", "ERROR"};
-    va_list ap; va_start(ap, fmt);
-    fprintf(stderr, "[%s] ", levels[level]);
-    vfprintf(stderr, fmt, ap);
-    fprintf(stderr, "\n");
-    va_end(ap);
-}
 
 const char *mc_strerror(mc_error_t err) {
     switch(err) {
@@ -39,105 +41,908 @@ const char *mc_strerror(mc_error_t err) {
     }
 }
 
-void generate_container_id(char *id) {
-    srand(time(NULL) ^ getpid());
-    for (int i = 0; i < 12; i++) {
-        sprintf(id + i, "%x", rand() % 16);
+int generate_container_id(char *id) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned char bytes[32];
+    size_t got = 0;
+    
+    /* getrandom() needs no seeding or shared state, unlike rand() */
+    while (got < sizeof(bytes)) {
+        ssize_t n = getrandom(bytes + got, sizeof(bytes) - got, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            mc_log(3, "getrandom failed: %s", strerror(errno));
+            id[0] = '\0';
+            return MC_ERR_IO;
+        }
+        got += n;
+    }
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        id[2 * i] = hex[bytes[i] >> 4];
+        id[2 * i + 1] = hex[bytes[i] & 15];
     }
-    id[12] = '\0';
+    id[2 * sizeof(bytes)] = '\0';
+    return MC_OK;
 }
 
 const char *get_state_dir(void) { return STATE_DIR; }
 
+static int ensure_state_index(void);
+
+/* <state_dir>/containers, opened once; container directories are created
+ * relative to it */
+static pthread_once_t containers_once = PTHREAD_ONCE_INIT;
+static int containers_fd = -1;
+
+static void open_containers_dir(void) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/containers", STATE_DIR);
+    fs_mkdir_p(AT_FDCWD, path, 0755);
+    containers_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+static int create_state_dir(container_t *c) {
+    pthread_once(&containers_once, open_containers_dir);
+    
+    int ret = containers_fd >= 0 ? fs_mkdir_p(containers_fd, c->config.id, 0755)
+                                 : fs_mkdir_p(AT_FDCWD, c->state_dir, 0755);
+    if (ret != MC_OK) {
+        mc_log(3, "Failed to create state directory %s: %s", c->state_dir, strerror(errno));
+        return MC_ERR_FILESYSTEM;
+    }
+    return MC_OK;
+}
+
+static int save_container_state(container_t *c);
+static void trace_forget(const char *id);
+
+/* Startup traces of children that had not exec'd when their start
+ * returned.  One reader thread polls the pipes, so the exec is timed when
+ * it happens; the finished trace goes back to the container on its next
+ * lookup or save in this process.  Only the mutex holder reads or closes
+ * a pipe; every change wakes the reader to rebuild its poll set. */
+typedef struct {
+    char id[65];
+    int fd;                       /* Trace pipe, -1 once read to the end */
+    startup_trace_t trace;
+} pending_trace_t;
+
+static pending_trace_t *pending_traces;
+static int pending_count, pending_cap;
+static pthread_mutex_t pending_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t pending_once = PTHREAD_ONCE_INIT;
+static int pending_wake[2] = { -1, -1 };
+static pid_t pending_owner;       /* Process that runs the trace reader */
+
+static void pending_changed(void) {
+    if (pending_wake[1] >= 0 && write(pending_wake[1], "x", 1) < 0) {
+        /* Full: the reader has a wakeup queued already */
+    }
+}
+
+static void pending_remove(int i) {
+    if (pending_traces[i].fd >= 0) close(pending_traces[i].fd);
+    pending_traces[i] = pending_traces[--pending_count];
+}
+
+/**
+ * Wait up to timeout_ms (-1 = no limit) for a trace pipe or the wakeup
+ * pipe, then read what arrived; reads never block
+ * @return Traces still being reported
+ */
+static int pending_poll(struct pollfd **fds, int *fds_cap, int timeout_ms) {
+    char buf[64];
+    
+    pthread_mutex_lock(&pending_mutex);
+    if (pending_count + 1 > *fds_cap) {
+        struct pollfd *grown = realloc(*fds, sizeof(**fds) * (pending_count + 1));
+        if (grown) {
+            *fds = grown;
+            *fds_cap = pending_count + 1;
+        }
+    }
+    int n = 0;
+    if (*fds) {
+        (*fds)[n++] = (struct pollfd){ .fd = pending_wake[0], .events = POLLIN };
+        for (int i = 0; i < pending_count && n < *fds_cap; i++) {
+            if (pending_traces[i].fd >= 0) {
+                (*fds)[n++] = (struct pollfd){ .fd = pending_traces[i].fd, .events = POLLIN };
+            }
+        }
+    }
+    pthread_mutex_unlock(&pending_mutex);
+    if (!*fds) return n;
+    if (n == 1 && timeout_ms >= 0) return 0;
+    
+    if (poll(*fds, n, timeout_ms) > 0) {
+        while (pending_wake[0] >= 0 && read(pending_wake[0], buf, sizeof(buf)) > 0);
+    }
+    
+    /* A pipe may have been read to the end (and its number reused) since
+     * the poll set was built: look each one up again */
+    int left = 0;
+    pthread_mutex_lock(&pending_mutex);
+    for (int k = 1; k < n; k++) {
+        if (!(*fds)[k].revents) continue;
+        for (int i = 0; i < pending_count; i++) {
+            pending_trace_t *p = &pending_traces[i];
+            if (p->fd == (*fds)[k].fd) {
+                if (ns_trace_read(p->fd, &p->trace) != 1) p->fd = -1;
+                break;
+            }
+        }
+    }
+    for (int i = 0; i < pending_count; i++) left += pending_traces[i].fd >= 0;
+    pthread_mutex_unlock(&pending_mutex);
+    return left;
+}
+
+static void *trace_reader(void *arg) {
+    struct pollfd *fds = NULL;
+    int fds_cap = 0;
+    (void)arg;
+    
+    for (;;) {
+        pending_poll(&fds, &fds_cap, -1);
+        if (!fds) sleep(1);
+    }
+    return NULL;
+}
+
+/**
+ * A short-lived caller (the CLI) exits right after a start: give the
+ * children a moment to exec and save their traces
+ */
+static void trace_flush_at_exit(void) {
+    /* A forked child inherits the hook but not the traces' owner */
+    if (pending_owner != getpid()) {
+        return;
+    }
+    
+    struct pollfd *fds = NULL;
+    int fds_cap = 0;
+    long deadline = mc_now_ns() + (long)STARTUP_TRACE_EXIT_WAIT_MS * 1000000L;
+    
+    for (;;) {
+        long remaining_ms = (deadline - mc_now_ns()) / 1000000L;
+        if (remaining_ms <= 0 || pending_poll(&fds, &fds_cap, (int)remaining_ms) == 0) break;
+    }
+    free(fds);
+    
+    for (;;) {
+        char id[65];
+        pthread_mutex_lock(&pending_mutex);
+        if (!pending_count) {
+            pthread_mutex_unlock(&pending_mutex);
+            break;
+        }
+        snprintf(id, sizeof(id), "%s", pending_traces[0].id);
+        pthread_mutex_unlock(&pending_mutex);
+        
+        /* The lookup takes the trace and saves it (or it is still running) */
+        container_t *c;
+        if (container_get(id, &c) == MC_OK) {
+            if (container_trace_poll(c) == 1) trace_forget(id);
+            container_free(c);
+        } else {
+            trace_forget(id);
+        }
+    }
+}
+
+static void trace_reader_start(void) {
+    pthread_t thread;
+    pthread_attr_t attr;
+    
+    pending_owner = getpid();
+    atexit(trace_flush_at_exit);
+    if (pipe2(pending_wake, O_CLOEXEC | O_NONBLOCK) != 0) {
+        pending_wake[0] = pending_wake[1] = -1;
+        return;
+    }
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, trace_reader, NULL) != 0) {
+        /* Traces are then read on lookup only, and exec times run late */
+        mc_log(2, "Could not start the startup trace reader");
+        close(pending_wake[0]);
+        close(pending_wake[1]);
+        pending_wake[0] = pending_wake[1] = -1;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/**
+ * Keep reading a start's trace after container_start() returned
+ */
+static void trace_defer(const container_t *c, int trace_fd) {
+    pthread_once(&pending_once, trace_reader_start);
+    pthread_mutex_lock(&pending_mutex);
+    
+    /* A restart replaces what is left of the previous trace */
+    for (int i = 0; i < pending_count; i++) {
+        if (strcmp(pending_traces[i].id, c->config.id) == 0) {
+            pending_remove(i);
+            break;
+        }
+    }
+    if (pending_count == pending_cap) {
+        int cap = pending_cap ? pending_cap * 2 : 16;
+        pending_trace_t *grown = realloc(pending_traces, sizeof(pending_trace_t) * cap);
+        if (!grown) {
+            pthread_mutex_unlock(&pending_mutex);
+            close(trace_fd);
+            return;
+        }
+        pending_traces = grown;
+        pending_cap = cap;
+    }
+    pending_trace_t *p = &pending_traces[pending_count++];
+    snprintf(p->id, sizeof(p->id), "%s", c->config.id);
+    p->fd = trace_fd;
+    p->trace = c->startup;
+    
+    pthread_mutex_unlock(&pending_mutex);
+    pending_changed();
+}
+
+/**
+ * Take what the child has reported into c->startup
+ * @return 1 while it is still starting, 0 once the trace is final, -1 if
+ *         this process has no trace pending for c
+ */
+static int trace_refresh(container_t *c) {
+    if (!__atomic_load_n(&pending_count, __ATOMIC_RELAXED)) return -1;
+    
+    pthread_mutex_lock(&pending_mutex);
+    int i = 0;
+    while (i < pending_count && strcmp(pending_traces[i].id, c->config.id) != 0) i++;
+    if (i == pending_count) {
+        pthread_mutex_unlock(&pending_mutex);
+        return -1;
+    }
+    
+    pending_trace_t *p = &pending_traces[i];
+    if (p->fd >= 0 && ns_trace_read(p->fd, &p->trace) != 1) p->fd = -1;
+    c->startup = p->trace;
+    if (p->fd >= 0) {
+        pthread_mutex_unlock(&pending_mutex);
+        return 1;
+    }
+    pending_remove(i);
+    pthread_mutex_unlock(&pending_mutex);
+    
+    char breakdown[256];
+    if (!c->startup.complete) mc_log(2, "Container %s did not reach exec", c->config.name);
+    startup_trace_format(&c->startup, breakdown, sizeof(breakdown));
+    mc_log(0, "Startup %s: %s", c->config.name, breakdown);
+    return 0;
+}
+
+/**
+ * Drop the pending trace of a deleted container
+ */
+static void trace_forget(const char *id) {
+    pthread_mutex_lock(&pending_mutex);
+    for (int i = 0; i < pending_count; i++) {
+        if (strcmp(pending_traces[i].id, id) == 0) {
+            pending_remove(i);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pending_mutex);
+    pending_changed();
+}
+
+int container_trace_poll(container_t *c) {
+    if (!c) return MC_ERR_INVALID;
+    int ret = trace_refresh(c);
+    if (ret == 0) save_container_state(c);
+    return ret == 1 ? 1 : MC_OK;
+}
+
+/* Scalar fields of resource_limits_t, as "limit.<key>=value" lines of state.txt */
+static const struct {
+    const char *key;
+    size_t offset;
+    int is_long;
+} limit_keys[] = {
+    {"memory", offsetof(resource_limits_t, memory_limit_bytes), 1},
+    {"memory_swap", offsetof(resource_limits_t, memory_swap_bytes), 1},
+    {"memory_high", offsetof(resource_limits_t, memory_high_bytes), 1},
+    {"memory_low", offsetof(resource_limits_t, memory_low_bytes), 1},
+    {"memory_min", offsetof(resource_limits_t, memory_min_bytes), 1},
+    {"cpu_shares", offsetof(resource_limits_t, cpu_shares), 0},
+    {"cpu_quota_us", offsetof(resource_limits_t, cpu_quota_us), 0},
+    {"cpu_period_us", offsetof(resource_limits_t, cpu_period_us), 0},
+    {"pids", offsetof(resource_limits_t, pids_max), 0},
+    {"io_weight", offsetof(resource_limits_t, io_weight), 0},
+    {"cpuset_count", offsetof(resource_limits_t, cpuset_count), 0},
+    {"cpuset_exclusive", offsetof(resource_limits_t, cpuset_exclusive), 0},
+};
+
+/**
+ * Write the limits the cgroup was given; "limits=1" marks them as known
+ * (state.txt from older versions has none, and their limits are lost)
+ */
+static void save_limits(FILE *fp, const resource_limits_t *l) {
+    fprintf(fp, "limits=1\n");
+    for (size_t i = 0; i < sizeof(limit_keys) / sizeof(limit_keys[0]); i++) {
+        const char *field = (const char *)l + limit_keys[i].offset;
+        long value = limit_keys[i].is_long ? *(const long *)field : *(const int *)field;
+        if (value) fprintf(fp, "limit.%s=%ld\n", limit_keys[i].key, value);
+    }
+    for (int i = 0; i < l->io_device_count && i < MC_IO_MAX_DEVICES; i++) {
+        const io_device_limit_t *io = &l->io_devices[i];
+        fprintf(fp, "limit.io_max=%u:%u %ld %ld %ld %ld\n", io->major, io->minor,
+                io->rbps, io->wbps, io->riops, io->wiops);
+    }
+    if (l->cpuset_cpus[0]) fprintf(fp, "limit.cpuset_cpus=%s\n", l->cpuset_cpus);
+    if (l->cpuset_mems[0]) fprintf(fp, "limit.cpuset_mems=%s\n", l->cpuset_mems);
+}
+
+/**
+ * Parse one "limit.<key>=value" line written by save_limits()
+ */
+static void load_limit(const char *line, resource_limits_t *l) {
+    const char *eq = strchr(line, '=');
+    if (!eq) return;
+    size_t key_len = eq - line;
+    const char *value = eq + 1;
+    
+    if (key_len == 6 && strncmp(line, "io_max", 6) == 0) {
+        if (l->io_device_count >= MC_IO_MAX_DEVICES) return;
+        io_device_limit_t *io = &l->io_devices[l->io_device_count];
+        if (sscanf(value, "%u:%u %ld %ld %ld %ld", &io->major, &io->minor,
+                   &io->rbps, &io->wbps, &io->riops, &io->wiops) == 6) {
+            l->io_device_count++;
+        }
+        return;
+    }
+    if (key_len == 11 && strncmp(line, "cpuset_cpus", 11) == 0) {
+        snprintf(l->cpuset_cpus, sizeof(l->cpuset_cpus), "%.*s", (int)strcspn(value, "\n"), value);
+        return;
+    }
+    if (key_len == 11 && strncmp(line, "cpuset_mems", 11) == 0) {
+        snprintf(l->cpuset_mems, sizeof(l->cpuset_mems), "%.*s", (int)strcspn(value, "\n"), value);
+        return;
+    }
+    for (size_t i = 0; i < sizeof(limit_keys) / sizeof(limit_keys[0]); i++) {
+        if (strlen(limit_keys[i].key) != key_len || strncmp(line, limit_keys[i].key, key_len)) {
+            continue;
+        }
+        char *field = (char *)l + limit_keys[i].offset;
+        long v = strtol(value, NULL, 10);
+        if (limit_keys[i].is_long) *(long *)field = v;
+        else *(int *)field = (int)v;
+        return;
+    }
+}
+
 static int save_container_state(container_t *c) {
-    char path[PATH_MAX], state_name[32];
-    snprintf(path, sizeof(path), "%s/state.txt", c->state_dir);
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/state.txt", c->state_dir) >= (int)sizeof(path)) {
+        return MC_ERR_INVALID;
+    }
+    /* Never write back an older copy of a trace that is still being read */
+    trace_refresh(c);
+    
     FILE *fp = fopen(path, "w");
+    mc_counter_inc(MC_COUNTER_STATE_WRITE, !fp);
     if (!fp) return MC_ERR_IO;
     
     const char *states[] = {"created", "running", "stopped", "paused", "deleted"};
     fprintf(fp, "id=%s\nname=%s\nstate=%s\npid=%d\n", 
             c->config.id, c->config.name, states[c->state], c->pid);
+    if (c->config.image[0]) fprintf(fp, "image=%s\n", c->config.image);
+    if (c->config.rootfs[0]) fprintf(fp, "rootfs=%s\n", c->config.rootfs);
+    if (c->limits_known) save_limits(fp, &c->config.limits);
     fclose(fp);
+    
+    long generation = state_index_generation();
+    if (ensure_state_index() != MC_OK || state_index_put(c) != MC_OK) {
+        mc_log(2, "Could not update state index for %s", c->config.id);
+    }
+    container_cache_update(c, generation);
     return MC_OK;
 }
 
 int container_create(container_config_t *config, container_t **out) {
+    long start_ns = mc_now_ns();
     container_t *c = calloc(1, sizeof(container_t));
     if (!c) return MC_ERR_MEMORY;
     
     memcpy(&c->config, config, sizeof(container_config_t));
     
-    if (strlen(c->config.id) == 0) generate_container_id(c->config.id);
+    if (strlen(c->config.id) == 0 && generate_container_id(c->config.id) != MC_OK) {
+        free(c);
+        return MC_ERR_IO;
+    }
+    if (strlen(c->config.hostname) == 0) {
+        /* IDs are 64 characters: unnamed containers get the short form */
+        if (c->config.name[0]) snprintf(c->config.hostname, sizeof(c->config.hostname), "%s", c->config.name);
+        else snprintf(c->config.hostname, sizeof(c->config.hostname), "%.12s", c->config.id);
+    }
     if (strlen(c->config.name) == 0) strncpy(c->config.name, c->config.id, sizeof(c->config.name)-1);
-    if (strlen(c->config.hostname) == 0) strncpy(c->config.hostname, c->config.name, sizeof(c->config.hostname)-1);
     
     snprintf(c->state_dir, sizeof(c->state_dir), "%s/containers/%s", STATE_DIR, c->config.id);
+    int ret = create_state_dir(c);
+    if (ret != MC_OK) {
+        free(c);
+        return ret;
+    }
     
-    char cmd[PATH_MAX];
-    snprintf(cmd, sizeof(cmd), "mkdir -p %s", c->state_dir);
-    system(cmd);
+    /* CPUs come before the cgroup, which is created with them */
+    ret = container_place_cpus(c);
+    if (ret != MC_OK) {
+        fs_remove_tree(AT_FDCWD, c->state_dir);
+        free(c);
+        return ret;
+    }
+    
+    /* Layered image: extract missing layers and stack them as the image */
+    if (config->layer_count > 0) {
+        ret = layer_build_lowerdir(config->layers, config->layer_count,
+                                   c->config.image, sizeof(c->config.image));
+        if (ret == MC_OK) ret = layer_ensure_many(config->layers, config->layer_count);
+        
+        /* A layer we hold no reference on must not be released by delete */
+        int refs = 0;
+        while (ret == MC_OK && refs < config->layer_count) {
+            int r = layer_ref(config->layers[refs]);
+            if (r < 0) {
+                mc_log(3, "Could not reference layer %s", config->layers[refs]);
+                ret = r;
+            } else {
+                refs++;
+            }
+        }
+        if (ret != MC_OK) {
+            while (refs > 0) layer_unref(config->layers[--refs]);
+            fs_remove_tree(AT_FDCWD, c->state_dir);  /* Holds the cpuset record */
+            free(c);
+            return ret;
+        }
+    }
+    /* The digests live on in config.image; don't keep the caller's array */
+    c->config.layers = NULL;
+    c->config.layer_count = 0;
     
     c->state = CONTAINER_CREATED;
     c->created_at = time(NULL);
+    c->limits_known = 1;
     
     if (cgroup_init(c) != MC_OK) mc_log(2, "Could not initialize cgroup");
     if (cgroup_apply_limits(c) != MC_OK) mc_log(2, "Could not apply limits");
     
     save_container_state(c);
     mc_log(1, "Created container: %s (%s)", c->config.name, c->config.id);
+    mc_histogram_observe(MC_HIST_CREATE, mc_now_ns() - start_ns);
     *out = c;
     return MC_OK;
 }
 
-int container_start(container_t *c) {
+/**
+ * Per-container start work that is safe on any thread
+ */
+static int container_prepare(container_t *c) {
     if (c->state == CONTAINER_RUNNING) return MC_ERR_INVALID;
     
-    pid_t pid = ns_create(&c->config);
-    if (pid < 0) return pid;
+    /* Copy-on-write rootfs over a shared image */
+    return fs_setup_overlay(c);
+}
+
+/**
+ * Create the init process and record it as running; trace_fd receives
+ * the startup trace pipe to pass to container_finish_start()
+ */
+static int container_spawn(container_t *c, int *trace_fd) {
+    *trace_fd = -1;
+    memset(&c->startup, 0, sizeof(c->startup));
+    memset(&c->net, 0, sizeof(c->net));
+    c->startup.failed_phase = -1;
+    
+    /* Warm path: a parked zygote only needs cgroup attach + exec */
+    pid_t pid = MC_ERR_NOT_FOUND;
+    zygote_pool_t *pool = zygote_pool_find(&c->config);
+    if (pool) pid = zygote_pool_spawn(pool, c);
+    
+    /* The pool only makes starts faster: any failure there gets a cold start */
+    if (pid < 0 && pid != MC_ERR_NOT_FOUND) {
+        mc_log(2, "Zygote start of %s failed (%s), starting it cold", c->config.name,
+               mc_strerror(pid));
+        memset(&c->net, 0, sizeof(c->net));
+    }
+    if (pid < 0) {
+        /* Born inside the cgroup when clone3 supports it */
+        int in_cgroup = 0;
+        int cgroup_fd = open(c->cgroup_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        pid = ns_create_traced(&c->config, cgroup_fd, &in_cgroup, &c->startup, trace_fd, &c->net);
+        if (cgroup_fd >= 0) close(cgroup_fd);
+        if (pid < 0) return pid;
+        if (!in_cgroup) cgroup_add_pid(c, pid);
+    }
+    net_lease_save(c->state_dir, &c->net);
     
     c->pid = pid;
     c->state = CONTAINER_RUNNING;
     c->started_at = time(NULL);
+    return MC_OK;
+}
+
+/**
+ * Persist the started state; the trace is read on later, not waited for
+ */
+static void container_finish_start(container_t *c, int trace_fd) {
+    if (trace_fd >= 0) trace_defer(c, trace_fd);
     
-    cgroup_add_pid(c, pid);
     save_container_state(c);
-    mc_log(1, "Started container: %s (PID %d)", c->config.name, pid);
+    mc_log(1, "Started container: %s (PID %d)", c->config.name, c->pid);
+}
+
+int container_start(container_t *c) {
+    long start_ns = mc_now_ns();
+    int trace_fd;
+    int ret = container_prepare(c);
+    if (ret == MC_OK) ret = container_spawn(c, &trace_fd);
+    if (ret != MC_OK) return ret;
+    
+    container_finish_start(c, trace_fd);
+    mc_histogram_observe(MC_HIST_START, mc_now_ns() - start_ns);
     return MC_OK;
 }
 
-int container_stop(container_t *c, int timeout) {
-    if (c->state != CONTAINER_RUNNING) return MC_OK;
+/* Work shared by the threads of a batch */
+typedef struct {
+    container_config_t *configs;  /* Create: input configurations */
+    container_t **containers;     /* Create: output, start: input */
+    int *results;
+    int count;
+    int next;                     /* Next item to take */
+} batch_t;
+
+static void *batch_worker(void *arg) {
+    batch_t *b = arg;
+    
+    for (;;) {
+        int i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+        if (i >= b->count) break;
     
-    kill(c->pid, SIGTERM);
-    for (int i = 0; i < timeout * 10; i++) {
-        if (waitpid(c->pid, &c->exit_code, WNOHANG) > 0) {
-            c->state = CONTAINER_STOPPED;
-            c->stopped_at = time(NULL);
-            save_container_state(c);
-            return MC_OK;
+        if (b->configs) {
+            int ret = container_create(&b->configs[i], &b->containers[i]);
+            if (ret != MC_OK) b->containers[i] = NULL;
+            b->results[i] = ret;
+        } else {
+            b->results[i] = b->containers[i] ? container_prepare(b->containers[i]) : MC_ERR_INVALID;
         }
-        usleep(100000);
     }
-    kill(c->pid, SIGKILL);
-    waitpid(c->pid, &c->exit_code, 0);
+    return NULL;
+}
+
+/**
+ * Run a batch on a pool of worker threads (the caller works too)
+ */
+static void run_batch(batch_t *b) {
+    pthread_t threads[BATCH_MAX_WORKERS];
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = b->count - 1;
+    int started = 0;
+    
+    if (workers > BATCH_MAX_WORKERS) workers = BATCH_MAX_WORKERS;
+    if (cpus > 0 && workers > cpus - 1) workers = (int)cpus - 1;
+    
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&threads[started], NULL, batch_worker, b) == 0) started++;
+    }
+    batch_worker(b);
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+}
+
+int container_create_batch(container_config_t *configs, int count, container_t **containers) {
+    if (!configs || !containers || count <= 0) return MC_ERR_INVALID;
+    
+    int *results = calloc(count, sizeof(int));
+    if (!results) return MC_ERR_MEMORY;
+    
+    batch_t b = { .configs = configs, .containers = containers, .results = results, .count = count };
+    run_batch(&b);
+    
+    int created = 0;
+    for (int i = 0; i < count; i++) created += results[i] == MC_OK;
+    free(results);
+    
+    mc_log(1, "Created %d/%d containers", created, count);
+    return created;
+}
+
+int container_start_batch(container_t **containers, int count, int *results) {
+    if (!containers || count <= 0) return MC_ERR_INVALID;
+    
+    int *res = results ? results : calloc(count, sizeof(int));
+    if (!res) return MC_ERR_MEMORY;
+    
+    /* Mounts and cgroup work in parallel */
+    batch_t b = { .containers = containers, .results = res, .count = count };
+    run_batch(&b);
+    
+    /* The clones themselves are issued from this thread once the pool has
+     * drained: a raw clone()/clone3() from a multi-threaded process gives
+     * the child a copy of locks (malloc, stdio) other threads may hold */
+    int *trace_fds = malloc(sizeof(int) * count);
+    if (!trace_fds) {
+        if (!results) free(res);
+        return MC_ERR_MEMORY;
+    }
+    for (int i = 0; i < count; i++) {
+        trace_fds[i] = -1;
+        if (res[i] == MC_OK) res[i] = container_spawn(containers[i], &trace_fds[i]);
+    }
+    
+    /* All children run their setup concurrently; collect afterwards */
+    int started = 0;
+    for (int i = 0; i < count; i++) {
+        if (res[i] == MC_OK) container_finish_start(containers[i], trace_fds[i]);
+        started += res[i] == MC_OK;
+    }
+    
+    free(trace_fds);
+    if (!results) free(res);
+    mc_log(1, "Started %d/%d containers", started, count);
+    return started;
+}
+
+static void mark_stopped(container_t *c) {
     c->state = CONTAINER_STOPPED;
     c->stopped_at = time(NULL);
+    /* The veth pair went away with the network namespace */
+    memset(&c->net, 0, sizeof(c->net));
+    net_lease_save(c->state_dir, &c->net);
     save_container_state(c);
+}
+
+int container_mark_exited(container_t *c, int status) {
+    if (!c) return MC_ERR_INVALID;
+    if (c->state != CONTAINER_RUNNING && c->state != CONTAINER_PAUSED) return MC_OK;
+    
+    /* -1: exited but was not our child, the status is unknown */
+    if (status >= 0) c->exit_code = status;
+    mark_stopped(c);
     return MC_OK;
 }
 
+/**
+ * Signal the init and wait for it to go, escalating to SIGKILL
+ */
+static int stop_init(container_t *c, int timeout) {
+    /* Frozen tasks cannot act on SIGTERM: thaw first */
+    if (c->state == CONTAINER_PAUSED) {
+        cgroup_unfreeze(c);
+        c->state = CONTAINER_RUNNING;
+    }
+    if (c->state != CONTAINER_RUNNING) return MC_OK;
+    
+    int pidfd = proc_open_pidfd(c->pid);
+    if (pidfd < 0 && errno == ESRCH) {
+        /* Already gone (and reaped by someone else) */
+        mark_stopped(c);
+        return MC_OK;
+    }
+    
+    if (pidfd >= 0) {
+        /* Returns as soon as the process exits, no polling interval;
+         * MC_ERR_NOT_FOUND from a signal means it is already gone */
+        int ret = proc_signal(pidfd, SIGTERM);
+        if (ret == MC_OK) ret = proc_wait_exit(pidfd, timeout * 1000);
+        if (ret != MC_OK && ret != MC_ERR_NOT_FOUND) {
+            ret = proc_signal(pidfd, SIGKILL);
+            if (ret == MC_OK) ret = proc_wait_exit(pidfd, -1);
+        }
+        close(pidfd);
+        if (ret != MC_OK && ret != MC_ERR_NOT_FOUND) {
+            mc_log(3, "Could not stop container %s (PID %d)", c->config.name, c->pid);
+            return ret;
+        }
+        /* Reap if it is our child; ECHILD otherwise */
+        waitpid(c->pid, &c->exit_code, WNOHANG);
+        mark_stopped(c);
+        return MC_OK;
+    }
+    
+    /* Fallback for kernels without pidfd_open (< 5.3) */
+    if (kill(c->pid, SIGTERM) == 0) {
+        for (int i = 0; i < timeout * 10; i++) {
+            if (waitpid(c->pid, &c->exit_code, WNOHANG) > 0 || kill(c->pid, 0) != 0) {
+                mark_stopped(c);
+                return MC_OK;
+            }
+            usleep(100000);
+        }
+    }
+    if (kill(c->pid, SIGKILL) != 0 && errno != ESRCH) {
+        int err = errno;
+        mc_log(3, "Could not stop container %s (PID %d): %s", c->config.name, c->pid,
+               strerror(err));
+        return err == EPERM ? MC_ERR_PERMISSION : MC_ERR_PROCESS;
+    }
+    waitpid(c->pid, &c->exit_code, 0);
+    mark_stopped(c);
+    return MC_OK;
+}
+
+int container_stop(container_t *c, int timeout) {
+    if (c->state != CONTAINER_RUNNING && c->state != CONTAINER_PAUSED) return MC_OK;
+    
+    long start_ns = mc_now_ns();
+    int ret = stop_init(c, timeout);
+    mc_histogram_observe(MC_HIST_STOP, mc_now_ns() - start_ns);
+    return ret;
+}
+
 int container_delete(container_t *c) {
-    if (c->state == CONTAINER_RUNNING) container_stop(c, 10);
+    long start_ns = mc_now_ns();
+    if (c->state == CONTAINER_RUNNING || c->state == CONTAINER_PAUSED) {
+        int ret = container_stop(c, 10);
+        if (ret != MC_OK) return ret;
+    }
+    trace_forget(c->config.id);
     cgroup_cleanup(c);
+    container_checkpoint_discard(c);
     fs_cleanup(c);
+    if (c->config.image[0]) layer_release_lowerdir(c->config.image);
+    long generation = state_index_generation();
+    state_index_remove(c->config.id);
+    container_cache_remove(c->config.id, generation);
     
-    char cmd[PATH_MAX];
-    snprintf(cmd, sizeof(cmd), "rm -rf %s", c->state_dir);
-    system(cmd);
+    if (fs_remove_tree(AT_FDCWD, c->state_dir) != MC_OK) {
+        mc_log(2, "Could not fully remove %s", c->state_dir);
+    }
     
     c->state = CONTAINER_DELETED;
     mc_log(1, "Deleted container: %s", c->config.name);
+    mc_histogram_observe(MC_HIST_DELETE, mc_now_ns() - start_ns);
+    return MC_OK;
+}
+
+int container_update_limits(container_t *c, const resource_limits_t *limits,
+                            unsigned int fields) {
+    if (!c || !limits) return MC_ERR_INVALID;
+    if (c->state != CONTAINER_CREATED && c->state != CONTAINER_RUNNING &&
+        c->state != CONTAINER_PAUSED) {
+        return MC_ERR_INVALID;
+    }
+    int ret = cgroup_update_limits(c, limits, fields);
+    
+    /* A cpuset set by hand replaces the placement; record it for the placer */
+    if (ret == MC_OK && (fields & (MC_LIMIT_CPUSET | MC_LIMIT_CPUSET_MEMS)) &&
+        container_record_cpuset(c, fields) != MC_OK) {
+        mc_log(2, "Could not record the cpuset of %s", c->config.name);
+    }
+    
+    /* Fields that were written are in config.limits even when others failed */
+    save_container_state(c);
+    return ret;
+}
+
+int container_pause(container_t *c) {
+    if (!c) return MC_ERR_INVALID;
+    if (c->state == CONTAINER_PAUSED) return MC_OK;
+    if (c->state != CONTAINER_RUNNING) return MC_ERR_INVALID;
+    
+    int ret = cgroup_freeze(c);
+    if (ret == MC_OK) ret = cgroup_wait_frozen(c, 1, FREEZE_TIMEOUT_MS);
+    if (ret != MC_OK) {
+        mc_log(3, "Could not freeze container %s", c->config.name);
+        cgroup_unfreeze(c);
+        return ret;
+    }
+    
+    c->state = CONTAINER_PAUSED;
+    save_container_state(c);
+    mc_log(1, "Paused container: %s", c->config.name);
+    return MC_OK;
+}
+
+int container_resume(container_t *c) {
+    if (!c) return MC_ERR_INVALID;
+    if (c->state == CONTAINER_RUNNING) return MC_OK;
+    if (c->state != CONTAINER_PAUSED) return MC_ERR_INVALID;
+    
+    int ret = cgroup_unfreeze(c);
+    if (ret == MC_OK) ret = cgroup_wait_frozen(c, 0, FREEZE_TIMEOUT_MS);
+    if (ret != MC_OK) {
+        mc_log(3, "Could not thaw container %s", c->config.name);
+        return ret;
+    }
+    
+    c->state = CONTAINER_RUNNING;
+    save_container_state(c);
+    mc_log(1, "Resumed container: %s", c->config.name);
+    return MC_OK;
+}
+
+int container_checkpoint(container_t *c, unsigned int flags) {
+    char dir[PATH_MAX];
+    
+    if (!c) return MC_ERR_INVALID;
+    if (c->state != CONTAINER_RUNNING && c->state != CONTAINER_PAUSED) return MC_ERR_INVALID;
+    
+    long start_ns = mc_now_ns();
+    int leave_running = !!(flags & MC_CHECKPOINT_LEAVE_RUNNING);
+    int ret = checkpoint_prepare_dir(c, !!(flags & MC_CHECKPOINT_TMPFS), dir, sizeof(dir));
+    if (ret != MC_OK) return ret;
+    
+    /* Quiesce first so the dump sees a single instant */
+    int was_paused = c->state == CONTAINER_PAUSED;
+    if (!was_paused) {
+        ret = cgroup_freeze(c);
+        if (ret == MC_OK) ret = cgroup_wait_frozen(c, 1, FREEZE_TIMEOUT_MS);
+        if (ret != MC_OK) {
+            mc_log(3, "Could not freeze container %s for checkpoint", c->config.name);
+            cgroup_unfreeze(c);
+            container_checkpoint_discard(c);
+            return ret;
+        }
+    }
+    
+    ret = criu_dump(c->pid, c->cgroup_path, dir, leave_running);
+    
+    /* A paused container that keeps running stays paused; otherwise thaw,
+     * also so that a later restore does not land in a frozen cgroup */
+    if (!(was_paused && leave_running && ret == MC_OK)) cgroup_unfreeze(c);
+    if (ret != MC_OK) {
+        if (was_paused) cgroup_freeze(c);
+        return ret;
+    }
+    
+    if (!leave_running) {
+        /* criu killed the tree: reap it if it is our child */
+        waitpid(c->pid, &c->exit_code, 0);
+        mark_stopped(c);
+    }
+    mc_log(1, "Checkpointed container %s to %s in %ldms", c->config.name, dir,
+           (mc_now_ns() - start_ns) / 1000000);
+    return MC_OK;
+}
+
+int container_restore(container_t *c) {
+    char dir[PATH_MAX];
+    
+    if (!c) return MC_ERR_INVALID;
+    if (c->state != CONTAINER_STOPPED && c->state != CONTAINER_CREATED) return MC_ERR_INVALID;
+    if (!checkpoint_exists(c, dir, sizeof(dir))) {
+        mc_log(3, "No checkpoint for container %s", c->config.name);
+        return MC_ERR_NOT_FOUND;
+    }
+    
+    long start_ns = mc_now_ns();
+    int ret = container_prepare(c);
+    if (ret != MC_OK) return ret;
+    
+    /* Without its recorded limits the restored process would run unlimited */
+    if (!c->limits_known) {
+        mc_log(3, "Limits of %s were not recorded (state from an older version); "
+               "it is restored without them, set them again with update", c->config.name);
+    }
+    
+    /* The cgroup may be gone or still frozen from the dump */
+    if (cgroup_init(c) != MC_OK || cgroup_apply_limits(c) != MC_OK) {
+        mc_log(3, "Could not set up the cgroup of %s, not restoring it without its limits",
+               c->config.name);
+        return MC_ERR_CGROUP;
+    }
+    cgroup_unfreeze(c);
+    
+    pid_t pid = criu_restore(dir, c->config.rootfs, c->cgroup_path);
+    if (pid < 0) return pid;
+    
+    c->pid = pid;
+    c->state = CONTAINER_RUNNING;
+    c->started_at = time(NULL);
+    memset(&c->startup, 0, sizeof(c->startup));
+    c->startup.failed_phase = -1;
+    save_container_state(c);
+    mc_log(1, "Restored container %s (PID %d) in %ldms", c->config.name, pid,
+           (mc_now_ns() - start_ns) / 1000000);
     return MC_OK;
 }
 
@@ -149,7 +954,10 @@ void container_free(container_t *c) {
     if (c) free(c);
 }
 
-int container_list(container_t ***containers, int *count) {
+/**
+ * Load every state.txt under the state directory (used to seed the index)
+ */
+static int scan_state_dir(container_t ***containers, int *count) {
     char path[PATH_MAX];
     snprintf(path, sizeof(path), "%s/containers", STATE_DIR);
     
@@ -158,34 +966,53 @@ int container_list(container_t ***containers, int *count) {
     
     int n = 0, cap = 16;
     container_t **list = malloc(sizeof(container_t*) * cap);
+    if (!list) { closedir(dir); return MC_ERR_MEMORY; }
     
     struct dirent *ent;
     while ((ent = readdir(dir))) {
         if (ent->d_name[0] == '.') continue;
         
         char state_path[PATH_MAX];
-        snprintf(state_path, sizeof(state_path), "%s/%s/state.txt", path, ent->d_name);
+        if (snprintf(state_path, sizeof(state_path), "%s/%s/state.txt", path, ent->d_name) >=
+            (int)sizeof(state_path)) {
+            continue;
+        }
         
         FILE *fp = fopen(state_path, "r");
         if (!fp) continue;
         
         container_t *c = calloc(1, sizeof(container_t));
-        char line[256];
+        char line[PATH_MAX + 16];
         while (fgets(line, sizeof(line), fp)) {
             if (strncmp(line, "id=", 3) == 0) sscanf(line, "id=%64s", c->config.id);
             if (strncmp(line, "name=", 5) == 0) sscanf(line, "name=%255s", c->config.name);
             if (strncmp(line, "pid=", 4) == 0) sscanf(line, "pid=%d", &c->pid);
+            if (strncmp(line, "limits=1", 8) == 0) c->limits_known = 1;
+            if (strncmp(line, "limit.", 6) == 0) load_limit(line + 6, &c->config.limits);
+            if (strncmp(line, "image=", 6) == 0) {
+                snprintf(c->config.image, sizeof(c->config.image), "%.*s",
+                         (int)sizeof(c->config.image) - 1, line + 6);
+                c->config.image[strcspn(c->config.image, "\n")] = '\0';
+            }
+            if (strncmp(line, "rootfs=", 7) == 0) {
+                snprintf(c->config.rootfs, sizeof(c->config.rootfs), "%.*s",
+                         (int)sizeof(c->config.rootfs) - 1, line + 7);
+                c->config.rootfs[strcspn(c->config.rootfs, "\n")] = '\0';
+            }
             if (strncmp(line, "state=", 6) == 0) {
                 char state[32];
                 if (sscanf(line, "state=%31s", state) == 1) {
                     if (!strcmp(state,"running")) c->state = CONTAINER_RUNNING;
                     else if (!strcmp(state,"stopped")) c->state = CONTAINER_STOPPED;
+                    else if (!strcmp(state,"paused")) c->state = CONTAINER_PAUSED;
                     else c->state = CONTAINER_CREATED;
                 }
             }
         }
         fclose(fp);
-        snprintf(c->state_dir, sizeof(c->state_dir), "%s/%s", path, ent->d_name);
+        /* state_path fitted, so its directory does */
+        snprintf(c->state_dir, sizeof(c->state_dir), "%.*s",
+                 (int)(strlen(state_path) - strlen("/state.txt")), state_path);
         snprintf(c->cgroup_path, sizeof(c->cgroup_path), "/sys/fs/cgroup/kernelsight/%s", c->config.id);
         
         if (n >= cap) { cap *= 2; list = realloc(list, sizeof(container_t*) * cap); }
@@ -196,11 +1023,125 @@ int container_list(container_t ***containers, int *count) {
     return MC_OK;
 }
 
+/**
+ * Seed the state index from the state.txt files if it does not exist yet
+ */
+static int ensure_state_index(void) {
+    static pthread_mutex_t rebuild_mutex = PTHREAD_MUTEX_INITIALIZER;
+    if (state_index_generation() >= 0) return MC_OK;
+    
+    /* A second rebuild from an older scan would drop records put since */
+    pthread_mutex_lock(&rebuild_mutex);
+    int ret = MC_OK;
+    if (state_index_generation() < 0) {
+        container_t **list; int n;
+        ret = scan_state_dir(&list, &n);
+        if (ret == MC_OK) {
+            ret = state_index_rebuild(list, n);
+            for (int i = 0; i < n; i++) container_free(list[i]);
+            free(list);
+        }
+    }
+    pthread_mutex_unlock(&rebuild_mutex);
+    return ret;
+}
+
+int container_get(const char *id_or_name, container_t **container) {
+    if (!id_or_name || !container) return MC_ERR_INVALID;
+    
+    int ret = ensure_state_index();
+    if (ret != MC_OK) return ret;
+    
+    /* Served from the in-process table while the index is unchanged */
+    ret = container_cache_get(id_or_name, container);
+    if (ret == MC_ERR_NOT_FOUND) return ret;
+    if (ret != MC_OK) {
+        container_t *c = malloc(sizeof(container_t));
+        if (!c) return MC_ERR_MEMORY;
+        ret = state_index_lookup(id_or_name, c);
+        if (ret != MC_OK) {
+            free(c);
+            return ret;
+        }
+        *container = c;
+    }
+    
+    /* A start from this process may still owe the trace */
+    container_trace_poll(*container);
+    return MC_OK;
+}
+
+int container_list(container_t ***containers, int *count) {
+    if (ensure_state_index() == MC_OK && state_index_list(containers, count) == MC_OK) {
+        return MC_OK;
+    }
+    /* No usable index (e.g. read-only state dir): scan directly */
+    return scan_state_dir(containers, count);
+}
+
+/* Namespaces an exec'd command joins (the PID namespace would only
+ * apply to its children) */
+#define EXEC_NS_FLAGS (CLONE_NEWNS | CLONE_NEWUTS | CLONE_NEWIPC | CLONE_NEWCGROUP)
+
+/* Shared with the exec child, which runs in our address space */
+typedef struct {
+    char **cmd;
+    int pidfd;                    /* Container init, -1 = use /proc/<pid>/ns */
+    pid_t pid;
+    int procs_fd;                 /* Container cgroup.procs, -1 = none */
+    const sigset_t *mask;         /* Caller's signal mask, restored before exec */
+    int ret;                      /* Set by the child if it did not exec */
+    int err;                      /* errno of the failure; with ret MC_OK, of chdir("/") */
+} exec_args_t;
+
+/**
+ * vfork-style exec child: the parent is suspended until we exec or exit,
+ * so we may only write to our own stack and args
+ */
+static int exec_child(void *arg) {
+    exec_args_t *a = arg;
+    struct sigaction sa;
+    
+    /* The parent's handlers must not run on this side of the vfork */
+    for (int sig = 1; sig < _NSIG; sig++) {
+        if (sigaction(sig, NULL, &sa) == 0 && sa.sa_handler != SIG_DFL && sa.sa_handler != SIG_IGN) {
+            sa.sa_handler = SIG_DFL;
+            sigaction(sig, &sa, NULL);
+        }
+    }
+    
+    /* Join the cgroup first, while its path still resolves from our namespace */
+    if (a->procs_fd >= 0 && write(a->procs_fd, "0", 1) != 1) {
+        a->ret = MC_ERR_CGROUP;
+        a->err = errno;
+        _exit(127);
+    }
+    if (ns_enter_pidfd(a->pidfd, a->pid, EXEC_NS_FLAGS) != MC_OK) {
+        a->ret = MC_ERR_NAMESPACE;
+        a->err = errno;
+        _exit(127);
+    }
+    /* Not fatal; the parent logs it, as we must not */
+    if (chdir("/") != 0) {
+        a->err = errno;
+    }
+    
+    pthread_sigmask(SIG_SETMASK, a->mask, NULL);
+    execvp(a->cmd[0], a->cmd);
+    a->ret = MC_ERR_PROCESS;
+    a->err = errno;
+    _exit(127);
+}
+
 /**
  * Execute command in a running container's namespace
- * Uses setns() to enter the container's namespaces for true isolation
+ * The child shares our address space until it execs (no page table
+ * copy), joins the cgroup with one write and every namespace with one
+ * setns() on the init process's pidfd.
  */
 int container_exec(container_t *c, char **cmd, int cmd_count) {
+    char procs_path[PATH_MAX];
+    
     if (!c || !cmd || cmd_count <= 0) {
         return MC_ERR_INVALID;
     }
@@ -211,63 +1152,61 @@ int container_exec(container_t *c, char **cmd, int cmd_count) {
         return MC_ERR_PROCESS;
     }
     
-    /* Verify the container process still exists */
-    if (kill(c->pid, 0) != 0) {
+    /* The pidfd also pins the process: no PID reuse between check and setns */
+    int pidfd = proc_open_pidfd(c->pid);
+    if ((pidfd < 0 && errno != ENOSYS) || (pidfd < 0 && kill(c->pid, 0) != 0)) {
         mc_log(3, "Container process %d not found", c->pid);
         return MC_ERR_NOT_FOUND;
     }
     
-    pid_t exec_pid = fork();
+    int procs_fits = snprintf(procs_path, sizeof(procs_path), "%s/cgroup.procs",
+                              c->cgroup_path) < (int)sizeof(procs_path);
+    exec_args_t args = {
+        .cmd = cmd,
+        .pidfd = pidfd,
+        .pid = c->pid,
+        .procs_fd = procs_fits ? open(procs_path, O_WRONLY | O_CLOEXEC) : -1,
+        .ret = MC_OK,
+    };
+        
+    char *stack = ns_stack_get(STACK_SIZE);
+    if (!stack) {
+        if (args.procs_fd >= 0) close(args.procs_fd);
+        if (pidfd >= 0) close(pidfd);
+        return MC_ERR_MEMORY;
+    }
+        
+    mc_log(1, "Executing command in container %s: %s", c->config.name, cmd[0]);
+        
+    /* No signal may be handled in the child before it resets the handlers */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    args.mask = &old;
+    pid_t exec_pid = clone(exec_child, stack, CLONE_VM | CLONE_VFORK | SIGCHLD, &args);
+    int clone_errno = errno;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    
+    /* Back here only once the child has exec'd or exited */
+    ns_stack_put(stack, STACK_SIZE);
+    if (args.procs_fd >= 0) close(args.procs_fd);
+    if (pidfd >= 0) close(pidfd);
+    
+    mc_counter_inc(MC_COUNTER_CLONE, exec_pid < 0);
     if (exec_pid < 0) {
-        mc_log(3, "fork() failed: %s", strerror(errno));
+        mc_log(3, "clone() failed: %s", strerror(clone_errno));
         return MC_ERR_PROCESS;
     }
+    if (args.ret != MC_OK) {
+        mc_log(3, "exec in container %s failed (%s): %s", c->config.name,
+               mc_strerror(args.ret), strerror(args.err));
+        waitpid(exec_pid, NULL, 0);
+        return args.ret;
+    }
     
-    if (exec_pid == 0) {
-        /* Child process - enter namespaces and execute command */
-        
-        /* Define namespace flags to enter (order matters!) */
-        int ns_flags = CLONE_NEWNS | CLONE_NEWUTS | CLONE_NEWIPC | CLONE_NEWCGROUP;
-        
-        /* Enter each namespace of the container's init process */
-        /* Note: PID namespace entry is special - new process gets PID 1 in that namespace */
-        
-        /* Enter mount namespace first */
-        if (ns_enter(c->pid, CLONE_NEWNS) != MC_OK) {
-            mc_log(3, "Failed to enter mount namespace");
-            /* Continue anyway - might work without it */
-        }
-        
-        /* Enter UTS namespace */
-        if (ns_enter(c->pid, CLONE_NEWUTS) != MC_OK) {
-            mc_log(3, "Failed to enter UTS namespace");
-        }
-        
-        /* Enter IPC namespace */
-        if (ns_enter(c->pid, CLONE_NEWIPC) != MC_OK) {
-            mc_log(3, "Failed to enter IPC namespace");
-        }
-        
-        /* Enter cgroup namespace */
-        if (ns_enter(c->pid, CLONE_NEWCGROUP) != MC_OK) {
-            mc_log(3, "Failed to enter cgroup namespace");
-        }
-        
-        /* Add this process to the container's cgroup */
-        cgroup_add_pid(c, getpid());
-        
-        /* Change to root directory (inside container's mount namespace) */
-        if (chdir("/") != 0) {
-            mc_log(2, "Failed to chdir to /");
-        }
-        
-        /* Execute the command */
-        mc_log(1, "Executing command in container %s: %s", c->config.name, cmd[0]);
-        execvp(cmd[0], cmd);
-        
-        /* If execvp returns, it failed */
-        mc_log(3, "execvp failed: %s", strerror(errno));
-        _exit(127);
+    if (args.err != 0) {
+        mc_log(2, "exec in container %s: failed to chdir to /: %s", c->config.name,
+               strerror(args.err));
     }
     
     /* Parent process - wait for child */
@@ -0,0 +1,345 @@
+/*
+ * KernelSight - Linux Container Runtime
+ * container_cache.c - In-process container lookup table
+ *
+ * Long-lived users of the library (the Python API, the daemon) look the
+ * same containers up over and over.  This keeps a process-local copy of
+ * the state index in an open-addressing hash table keyed by id and by
+ * name.  The table is tagged with the index generation it reflects:
+ * checking that it is current is a single load from the shared mapping,
+ * local create/delete update it in place, and a change made by another
+ * process causes a reload on the next lookup.  One mutex serialises
+ * access so the batch workers can share it.
+ */
+
+#define _GNU_SOURCE
+#include "../include/container.h"
+#include <stdint.h>
+#include <pthread.h>
+
+#define CACHE_MIN_BUCKETS 64
+
+/* Bucket values: 0 = empty, otherwise entry index + 1 */
+#define CACHE_EMPTY 0u
+#define CACHE_TOMBSTONE 0xffffffffu
+
+static struct {
+    long generation;              /* Index generation reflected (-1 = stale) */
+    container_t **entries;
+    int count;
+    int cap;
+    uint32_t *by_id;
+    uint32_t *by_name;
+    uint32_t nbuckets;            /* Buckets per table (power of two) */
+    uint32_t used;                /* Occupied buckets incl. tombstones */
+} cache = { .generation = -1 };
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t cache_hash(const char *key) {
+    uint32_t h = 2166136261u;  /* FNV-1a */
+    for (; *key; key++) {
+        h ^= (unsigned char)*key;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static const char *entry_key(int i, int by_name) {
+    return by_name ? cache.entries[i]->config.name : cache.entries[i]->config.id;
+}
+
+/**
+ * Copy the persisted part of a container (what the state index keeps);
+ * command, environment and layer pointers belong to the caller
+ */
+static void cache_copy(container_t *dst, const container_t *src) {
+    memset(dst, 0, sizeof(*dst));
+    memcpy(dst->config.id, src->config.id, sizeof(dst->config.id));
+    memcpy(dst->config.name, src->config.name, sizeof(dst->config.name));
+    memcpy(dst->config.image, src->config.image, sizeof(dst->config.image));
+    memcpy(dst->config.rootfs, src->config.rootfs, sizeof(dst->config.rootfs));
+    dst->config.limits = src->config.limits;
+    dst->limits_known = src->limits_known;
+    dst->state = src->state;
+    dst->pid = src->pid;
+    dst->exit_code = src->exit_code;
+    memcpy(dst->cgroup_path, src->cgroup_path, sizeof(dst->cgroup_path));
+    memcpy(dst->state_dir, src->state_dir, sizeof(dst->state_dir));
+    dst->created_at = src->created_at;
+    dst->started_at = src->started_at;
+    dst->stopped_at = src->stopped_at;
+    dst->startup = src->startup;
+}
+
+/**
+ * Find the bucket whose entry has this key (or -1)
+ */
+static long cache_find(uint32_t *table, const char *key, int by_name) {
+    uint32_t mask = cache.nbuckets - 1;
+    
+    for (uint32_t i = 0, b = cache_hash(key) & mask; i < cache.nbuckets; i++, b = (b + 1) & mask) {
+        uint32_t v = table[b];
+        if (v == CACHE_EMPTY) {
+            return -1;
+        }
+        if (v != CACHE_TOMBSTONE && strcmp(entry_key(v - 1, by_name), key) == 0) {
+            return b;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Find the bucket holding a specific entry index (or -1)
+ */
+static long cache_find_entry(uint32_t *table, int entry, int by_name) {
+    uint32_t mask = cache.nbuckets - 1;
+    
+    for (uint32_t i = 0, b = cache_hash(entry_key(entry, by_name)) & mask; i < cache.nbuckets;
+         i++, b = (b + 1) & mask) {
+        if (table[b] == CACHE_EMPTY) {
+            return -1;
+        }
+        if (table[b] == (uint32_t)entry + 1) {
+            return b;
+        }
+    }
+    return -1;
+}
+
+static void cache_insert(uint32_t *table, const char *key, int entry) {
+    uint32_t mask = cache.nbuckets - 1;
+    
+    for (uint32_t b = cache_hash(key) & mask; ; b = (b + 1) & mask) {
+        if (table[b] == CACHE_EMPTY || table[b] == CACHE_TOMBSTONE) {
+            if (table[b] == CACHE_EMPTY && table == cache.by_id) {
+                cache.used++;
+            }
+            table[b] = entry + 1;
+            return;
+        }
+    }
+}
+
+/**
+ * Rebuild both tables with room for at least count entries
+ */
+static int cache_rehash(int count) {
+    uint32_t nbuckets = CACHE_MIN_BUCKETS;
+    while (nbuckets < (uint32_t)count * 2) {
+        nbuckets <<= 1;
+    }
+    
+    uint32_t *tables = calloc(2 * (size_t)nbuckets, sizeof(uint32_t));
+    if (!tables) {
+        return MC_ERR_MEMORY;
+    }
+    
+    free(cache.by_id);  /* by_name shares the allocation */
+    cache.by_id = tables;
+    cache.by_name = tables + nbuckets;
+    cache.nbuckets = nbuckets;
+    cache.used = 0;
+    
+    for (int i = 0; i < cache.count; i++) {
+        cache_insert(cache.by_id, cache.entries[i]->config.id, i);
+        cache_insert(cache.by_name, cache.entries[i]->config.name, i);
+    }
+    return MC_OK;
+}
+
+static void cache_clear(void) {
+    for (int i = 0; i < cache.count; i++) {
+        container_free(cache.entries[i]);
+    }
+    free(cache.entries);
+    free(cache.by_id);
+    memset(&cache, 0, sizeof(cache));
+    cache.generation = -1;
+}
+
+/**
+ * Reload the whole table from the state index
+ */
+static int cache_load(long generation) {
+    container_t **list;
+    int count;
+    
+    cache_clear();
+    int ret = state_index_list(&list, &count);
+    if (ret != MC_OK) {
+        return ret;
+    }
+    
+    cache.entries = list;
+    cache.count = count;
+    cache.cap = count;
+    ret = cache_rehash(count);
+    if (ret != MC_OK) {
+        cache_clear();
+        return ret;
+    }
+    
+    /* Tagged with the generation read before listing: a concurrent change
+     * makes the tag stale and forces another reload, never a stale hit */
+    cache.generation = generation;
+    return MC_OK;
+}
+
+/**
+ * Look up under cache_mutex
+ */
+static int cache_get_locked(const char *id_or_name, container_t **container) {
+    long generation = state_index_generation();
+    if (generation < 0) {
+        return (int)generation;
+    }
+    if (generation != cache.generation) {
+        int ret = cache_load(generation);
+        if (ret != MC_OK) {
+            return ret;
+        }
+    }
+    
+    long b = cache_find(cache.by_id, id_or_name, 0);
+    uint32_t *table = cache.by_id;
+    if (b < 0) {
+        b = cache_find(cache.by_name, id_or_name, 1);
+        table = cache.by_name;
+    }
+    if (b < 0) {
+        return MC_ERR_NOT_FOUND;
+    }
+    
+    container_t *c = malloc(sizeof(container_t));
+    if (!c) {
+        return MC_ERR_MEMORY;
+    }
+    memcpy(c, cache.entries[table[b] - 1], sizeof(container_t));
+    *container = c;
+    return MC_OK;
+}
+
+int container_cache_get(const char *id_or_name, container_t **container) {
+    if (!id_or_name || !container) {
+        return MC_ERR_INVALID;
+    }
+    
+    pthread_mutex_lock(&cache_mutex);
+    int ret = cache_get_locked(id_or_name, container);
+    pthread_mutex_unlock(&cache_mutex);
+    return ret;
+}
+
+/**
+ * Can a local change made at generation "before" be applied in place?
+ */
+static int cache_follows(long before) {
+    if (cache.generation < 0 || cache.generation != before ||
+        state_index_generation() != before + 1) {
+        cache.generation = -1;  /* Someone else changed it too: reload */
+        return 0;
+    }
+    cache.generation = before + 1;
+    return 1;
+}
+
+static void cache_update_locked(const container_t *container, long before) {
+    if (!cache_follows(before)) {
+        return;
+    }
+    
+    long b = cache_find(cache.by_id, container->config.id, 0);
+    if (b >= 0) {
+        int i = cache.by_id[b] - 1;
+        if (strcmp(cache.entries[i]->config.name, container->config.name) != 0) {
+            long nb = cache_find_entry(cache.by_name, i, 1);
+            if (nb >= 0) cache.by_name[nb] = CACHE_TOMBSTONE;
+            cache_copy(cache.entries[i], container);
+            cache_insert(cache.by_name, container->config.name, i);
+        } else {
+            cache_copy(cache.entries[i], container);
+        }
+        return;
+    }
+    
+    /* New entry */
+    if (cache.count >= cache.cap) {
+        int cap = cache.cap ? cache.cap * 2 : 16;
+        container_t **entries = realloc(cache.entries, sizeof(container_t *) * cap);
+        if (!entries) {
+            cache.generation = -1;
+            return;
+        }
+        cache.entries = entries;
+        cache.cap = cap;
+    }
+    container_t *c = malloc(sizeof(container_t));
+    if (!c) {
+        cache.generation = -1;
+        return;
+    }
+    cache_copy(c, container);
+    cache.entries[cache.count++] = c;
+    
+    if ((cache.used + 1) * 4 > cache.nbuckets * 3) {
+        if (cache_rehash(cache.count) != MC_OK) cache.generation = -1;
+        return;
+    }
+    cache_insert(cache.by_id, c->config.id, cache.count - 1);
+    cache_insert(cache.by_name, c->config.name, cache.count - 1);
+}
+
+void container_cache_update(const container_t *container, long before) {
+    if (!container) {
+        return;
+    }
+    
+    pthread_mutex_lock(&cache_mutex);
+    cache_update_locked(container, before);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+static void cache_remove_locked(const char *id, long before) {
+    if (!cache_follows(before)) {
+        return;
+    }
+    
+    long b = cache_find(cache.by_id, id, 0);
+    if (b < 0) {
+        return;
+    }
+    int i = cache.by_id[b] - 1;
+    
+    cache.by_id[b] = CACHE_TOMBSTONE;
+    long nb = cache_find_entry(cache.by_name, i, 1);
+    if (nb >= 0) cache.by_name[nb] = CACHE_TOMBSTONE;
+    container_free(cache.entries[i]);
+    
+    /* Move the last entry into the hole and repoint its buckets */
+    int last = --cache.count;
+    if (i != last) {
+        long lb = cache_find_entry(cache.by_id, last, 0);
+        long ln = cache_find_entry(cache.by_name, last, 1);
+        cache.entries[i] = cache.entries[last];
+        if (lb >= 0) cache.by_id[lb] = i + 1;
+        if (ln >= 0) cache.by_name[ln] = i + 1;
+    }
+}
+
+void container_cache_remove(const char *id, long before) {
+    if (!id) {
+        return;
+    }
+    
+    pthread_mutex_lock(&cache_mutex);
+    cache_remove_locked(id, before);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+void container_cache_invalidate(void) {
+    pthread_mutex_lock(&cache_mutex);
+    cache_clear();
+    pthread_mutex_unlock(&cache_mutex);
+}
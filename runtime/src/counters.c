@@ -0,0 +1,143 @@
+/*
+ * KernelSight - Linux Container Runtime
+ * counters.c - Library counters and startup trace formatting
+ *
+ * Counters are process-wide and cumulative: relaxed atomic adds on a
+ * static block, cheap enough for the sampler hot path.  Histograms use
+ * power-of-two microsecond buckets so observing a value is a bit scan,
+ * and are turned into the cumulative form Prometheus expects only when
+ * formatted.  Work done in container children (their mounts, setns) is
+ * not visible here; the startup trace covers that part.
+ */
+
+#define _GNU_SOURCE
+#include "../include/container.h"
+#include <time.h>
+
+static mc_counters_t counters;
+
+static const char *const counter_names[MC_COUNTER_COUNT] = {
+    "clone", "mount", "cgroup_write", "cgroup_read", "signal", "state_write",
+};
+
+static const char *const histogram_names[MC_HIST_COUNT] = {
+    "container_create", "container_start", "container_stop", "container_delete",
+    "startup", "sampler_read",
+};
+
+static const char *const phase_names[STARTUP_PHASE_COUNT] = {
+    "clone", "user_ns", "network", "sync_wait", "uts", "pivot_root", "mounts", "env", "exec",
+};
+
+long mc_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void mc_counter_inc(mc_counter_t counter, int failed) {
+    if ((unsigned int)counter >= MC_COUNTER_COUNT) return;
+    __atomic_fetch_add(&counters.calls[counter], 1, __ATOMIC_RELAXED);
+    if (failed) __atomic_fetch_add(&counters.failures[counter], 1, __ATOMIC_RELAXED);
+}
+
+void mc_histogram_observe(mc_histogram_t hist, long ns) {
+    if ((unsigned int)hist >= MC_HIST_COUNT || ns < 0) return;
+    mc_histogram_data_t *h = &counters.latency[hist];
+    
+    /* Bucket k holds values up to 2^k us */
+    unsigned long us = (unsigned long)ns / 1000;
+    int bucket = us <= 1 ? 0 : 64 - __builtin_clzl(us - 1);
+    if (bucket >= MC_HIST_BUCKETS) bucket = MC_HIST_BUCKETS - 1;
+    
+    __atomic_fetch_add(&h->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum_ns, (unsigned long)ns, __ATOMIC_RELAXED);
+}
+
+void mc_counters_snapshot(mc_counters_t *out) {
+    if (!out) return;
+    
+    /* Field by field: each value is consistent, the set is approximate */
+    const unsigned long *src = (const unsigned long *)&counters;
+    unsigned long *dst = (unsigned long *)out;
+    for (size_t i = 0; i < sizeof(counters) / sizeof(unsigned long); i++) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
+
+/* snprintf() into the remains of a buffer, tracking the full length */
+#define APPEND(...) \
+    do { \
+        int n_ = snprintf(size > (size_t)len ? buf + len : NULL, \
+                          size > (size_t)len ? size - len : 0, __VA_ARGS__); \
+        if (n_ > 0) len += n_; \
+    } while (0)
+
+int mc_counters_format_prometheus(const mc_counters_t *c, char *buf, size_t size) {
+    int len = 0;
+    
+    if (!c) return MC_ERR_INVALID;
+    if (!buf) size = 0;
+    
+    APPEND("# HELP kernelsight_operations_total Library operations attempted.\n"
+           "# TYPE kernelsight_operations_total counter\n");
+    for (int i = 0; i < MC_COUNTER_COUNT; i++) {
+        APPEND("kernelsight_operations_total{op=\"%s\"} %lu\n", counter_names[i], c->calls[i]);
+    }
+    APPEND("# HELP kernelsight_operation_failures_total Library operations that failed.\n"
+           "# TYPE kernelsight_operation_failures_total counter\n");
+    for (int i = 0; i < MC_COUNTER_COUNT; i++) {
+        APPEND("kernelsight_operation_failures_total{op=\"%s\"} %lu\n",
+               counter_names[i], c->failures[i]);
+    }
+    
+    APPEND("# HELP kernelsight_latency_seconds Latency of library operations.\n"
+           "# TYPE kernelsight_latency_seconds histogram\n");
+    for (int i = 0; i < MC_HIST_COUNT; i++) {
+        const mc_histogram_data_t *h = &c->latency[i];
+        unsigned long cumulative = 0;
+        for (int b = 0; b < MC_HIST_BUCKETS - 1; b++) {
+            cumulative += h->buckets[b];
+            APPEND("kernelsight_latency_seconds_bucket{op=\"%s\",le=\"%g\"} %lu\n",
+                   histogram_names[i], (double)(1UL << b) / 1e6, cumulative);
+        }
+        APPEND("kernelsight_latency_seconds_bucket{op=\"%s\",le=\"+Inf\"} %lu\n",
+               histogram_names[i], h->count);
+        APPEND("kernelsight_latency_seconds_sum{op=\"%s\"} %.9f\n",
+               histogram_names[i], h->sum_ns / 1e9);
+        APPEND("kernelsight_latency_seconds_count{op=\"%s\"} %lu\n",
+               histogram_names[i], h->count);
+    }
+    
+    return len;
+}
+
+const char *startup_phase_name(startup_phase_t phase) {
+    if ((unsigned int)phase >= STARTUP_PHASE_COUNT) return "unknown";
+    return phase_names[phase];
+}
+
+int startup_trace_format(const startup_trace_t *t, char *buf, size_t size) {
+    int len = 0;
+    
+    if (!t) return MC_ERR_INVALID;
+    if (!buf) size = 0;
+    if (size) buf[0] = '\0';
+    
+    for (int i = 0; i < STARTUP_PHASE_COUNT; i++) {
+        if (!t->duration_ns[i] && !t->start_ns[i]) continue;
+        APPEND("%s%s %ldus", len ? ", " : "", phase_names[i], t->duration_ns[i] / 1000);
+    }
+    if (len == 0) {
+        /* Never started, or started from a zygote */
+        APPEND("not traced");
+    } else if (t->complete) {
+        APPEND(" (total %ldus)", t->total_ns / 1000);
+    } else if (t->failed_phase >= 0) {
+        APPEND(" (failed in %s)", startup_phase_name(t->failed_phase));
+    } else {
+        APPEND(" (incomplete)");
+    }
+    return len;
+}
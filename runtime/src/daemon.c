@@ -0,0 +1,1578 @@
+/*
+ * KernelSight - Linux Container Runtime
+ * daemon.c - Long-running runtime daemon and its control socket client
+ *
+ * The daemon keeps containers (including their command and environment,
+ * which are not persisted), cgroup samplers and the event loop in memory,
+ * and serves requests on a Unix stream socket.  Every message is a
+ * fixed 12-byte frame header followed by a payload of header.len bytes:
+ *
+ *   uint32 len | uint32 seq | uint16 op | int16 status
+ *
+ * Requests may be pipelined: the daemon handles every complete frame it
+ * has buffered and answers in order, echoing op and seq, with status set
+ * to an mc_error_t.  All integers are in host byte order (the socket is
+ * local).
+ *
+ * START, STOP, DELETE, PAUSE and RESUME can block for seconds (a stop
+ * waits out its timeout), so they run on a small pool of worker threads
+ * and the loop sends the reply when the worker signals an eventfd.  The
+ * connection reads no further requests until then, which keeps its
+ * replies in order, and a request for a container with a job in flight
+ * waits for that job.
+ *
+ * A timerfd on the same epoll loop samples running containers into the
+ * shared-memory metrics segment (metrics_shm.c), so readers need neither
+ * the socket nor the cgroup files.
+ */
+
+#define _GNU_SOURCE
+#include "../include/container.h"
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#define DAEMON_SOCKET_NAME "runtime.sock"
+#define DAEMON_MAX_PAYLOAD (1 << 20)
+#define DAEMON_MAX_EVENTS 64
+#define DAEMON_READ_SIZE 65536
+#define DAEMON_WORKERS 4
+
+typedef struct {
+    uint32_t len;                 /* Payload bytes following the header */
+    uint32_t seq;                 /* Request sequence number, echoed back */
+    uint16_t op;                  /* daemon_op_t */
+    int16_t status;               /* Reply: mc_error_t */
+} daemon_frame_t;
+
+/* io.max entry inside a wire_limits_t */
+typedef struct {
+    uint32_t major;
+    uint32_t minor;
+    int64_t rbps;
+    int64_t wbps;
+    int64_t riops;
+    int64_t wiops;
+} wire_io_limit_t;
+
+/* resource_limits_t as carried by CREATE and UPDATE */
+typedef struct {
+    int64_t memory_limit_bytes;
+    int64_t memory_swap_bytes;
+    int64_t memory_high_bytes;
+    int32_t cpu_shares;
+    int32_t cpu_quota_us;
+    int32_t cpu_period_us;
+    int32_t pids_max;
+    int32_t io_weight;
+    uint32_t io_device_count;
+    wire_io_limit_t io_devices[MC_IO_MAX_DEVICES];
+    int32_t cpuset_count;
+    int32_t cpuset_exclusive;
+    char cpuset_cpus[MC_CPUSET_LEN];
+    char cpuset_mems[MC_CPUSET_LEN];
+    int64_t memory_low_bytes;
+    int64_t memory_min_bytes;
+} wire_limits_t;
+
+/* CREATE payload, followed by NUL-terminated strings: id, name, hostname,
+ * rootfs, image, cmd[cmd_count], env[env_count], layers[layer_count] */
+typedef struct {
+    wire_limits_t limits;
+    int32_t enable_network;
+    int32_t enable_user_ns;
+    uint32_t cmd_count;
+    uint32_t env_count;
+    uint32_t layer_count;
+    uint32_t reserved;
+} wire_create_t;
+
+/* UPDATE payload, followed by the id or name */
+typedef struct {
+    wire_limits_t limits;
+    uint32_t fields;              /* MC_LIMIT_* mask */
+    uint32_t reserved;
+} wire_update_t;
+
+/* START/STOP/DELETE/GET/STATS/PAUSE/RESUME payload, followed by the id or name */
+typedef struct {
+    int32_t arg;                  /* STOP: timeout in seconds */
+} wire_target_t;
+
+/* GET/LIST reply record */
+typedef struct {
+    int32_t state;
+    int32_t pid;
+    int32_t exit_code;
+    int32_t reserved;
+    int64_t created_at;
+    int64_t started_at;
+    int64_t stopped_at;
+    char id[65];
+    char name[256];
+    char pad[7];
+    int64_t startup_ns[STARTUP_PHASE_COUNT]; /* Phase durations of the last start */
+    int64_t startup_total_ns;
+    int32_t startup_complete;
+    int32_t startup_failed_phase;
+} wire_container_t;
+
+/* ===== Shared helpers ===== */
+
+static void default_socket_path(char *buf, size_t size, const char *path) {
+    if (path && path[0]) {
+        snprintf(buf, size, "%s", path);
+    } else {
+        snprintf(buf, size, "%s/%s", get_state_dir(), DAEMON_SOCKET_NAME);
+    }
+}
+
+static int fill_sockaddr(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        return MC_ERR_INVALID;
+    }
+    strcpy(addr->sun_path, path);
+    return MC_OK;
+}
+
+static void limits_to_wire(const resource_limits_t *l, wire_limits_t *w) {
+    memset(w, 0, sizeof(*w));
+    w->memory_limit_bytes = l->memory_limit_bytes;
+    w->memory_swap_bytes = l->memory_swap_bytes;
+    w->memory_high_bytes = l->memory_high_bytes;
+    w->memory_low_bytes = l->memory_low_bytes;
+    w->memory_min_bytes = l->memory_min_bytes;
+    w->cpu_shares = l->cpu_shares;
+    w->cpu_quota_us = l->cpu_quota_us;
+    w->cpu_period_us = l->cpu_period_us;
+    w->pids_max = l->pids_max;
+    w->io_weight = l->io_weight;
+    w->cpuset_count = l->cpuset_count;
+    w->cpuset_exclusive = l->cpuset_exclusive;
+    snprintf(w->cpuset_cpus, sizeof(w->cpuset_cpus), "%s", l->cpuset_cpus);
+    snprintf(w->cpuset_mems, sizeof(w->cpuset_mems), "%s", l->cpuset_mems);
+    for (int i = 0; i < l->io_device_count && i < MC_IO_MAX_DEVICES; i++) {
+        const io_device_limit_t *io = &l->io_devices[i];
+        w->io_devices[w->io_device_count++] = (wire_io_limit_t){
+            .major = io->major, .minor = io->minor,
+            .rbps = io->rbps, .wbps = io->wbps, .riops = io->riops, .wiops = io->wiops,
+        };
+    }
+}
+
+static void limits_from_wire(const wire_limits_t *w, resource_limits_t *l) {
+    memset(l, 0, sizeof(*l));
+    l->memory_limit_bytes = w->memory_limit_bytes;
+    l->memory_swap_bytes = w->memory_swap_bytes;
+    l->memory_high_bytes = w->memory_high_bytes;
+    l->memory_low_bytes = w->memory_low_bytes;
+    l->memory_min_bytes = w->memory_min_bytes;
+    l->cpu_shares = w->cpu_shares;
+    l->cpu_quota_us = w->cpu_quota_us;
+    l->cpu_period_us = w->cpu_period_us;
+    l->pids_max = w->pids_max;
+    l->io_weight = w->io_weight;
+    l->cpuset_count = w->cpuset_count;
+    l->cpuset_exclusive = w->cpuset_exclusive;
+    snprintf(l->cpuset_cpus, sizeof(l->cpuset_cpus), "%.*s", (int)sizeof(w->cpuset_cpus) - 1, w->cpuset_cpus);
+    snprintf(l->cpuset_mems, sizeof(l->cpuset_mems), "%.*s", (int)sizeof(w->cpuset_mems) - 1, w->cpuset_mems);
+    l->io_device_count = w->io_device_count > MC_IO_MAX_DEVICES ? MC_IO_MAX_DEVICES
+                                                                : (int)w->io_device_count;
+    for (int i = 0; i < l->io_device_count; i++) {
+        l->io_devices[i] = (io_device_limit_t){
+            .major = w->io_devices[i].major, .minor = w->io_devices[i].minor,
+            .rbps = w->io_devices[i].rbps, .wbps = w->io_devices[i].wbps,
+            .riops = w->io_devices[i].riops, .wiops = w->io_devices[i].wiops,
+        };
+    }
+}
+
+static void container_to_wire(const container_t *c, wire_container_t *w) {
+    memset(w, 0, sizeof(*w));
+    w->state = c->state;
+    w->pid = c->pid;
+    w->exit_code = c->exit_code;
+    w->created_at = c->created_at;
+    w->started_at = c->started_at;
+    w->stopped_at = c->stopped_at;
+    for (int i = 0; i < STARTUP_PHASE_COUNT; i++) w->startup_ns[i] = c->startup.duration_ns[i];
+    w->startup_total_ns = c->startup.total_ns;
+    w->startup_complete = c->startup.complete;
+    w->startup_failed_phase = c->startup.failed_phase;
+    snprintf(w->id, sizeof(w->id), "%s", c->config.id);
+    snprintf(w->name, sizeof(w->name), "%s", c->config.name);
+}
+
+static container_t *container_from_wire(const wire_container_t *w) {
+    container_t *c = calloc(1, sizeof(container_t));
+    if (!c) {
+        return NULL;
+    }
+    c->state = (container_state_t)w->state;
+    c->pid = w->pid;
+    c->exit_code = w->exit_code;
+    c->created_at = w->created_at;
+    c->started_at = w->started_at;
+    c->stopped_at = w->stopped_at;
+    for (int i = 0; i < STARTUP_PHASE_COUNT; i++) c->startup.duration_ns[i] = w->startup_ns[i];
+    c->startup.total_ns = w->startup_total_ns;
+    c->startup.complete = w->startup_complete;
+    c->startup.failed_phase = w->startup_failed_phase;
+    snprintf(c->config.id, sizeof(c->config.id), "%.64s", w->id);
+    snprintf(c->config.name, sizeof(c->config.name), "%.255s", w->name);
+    snprintf(c->state_dir, sizeof(c->state_dir), "%s/containers/%s", get_state_dir(), c->config.id);
+    snprintf(c->cgroup_path, sizeof(c->cgroup_path), "/sys/fs/cgroup/kernelsight/%s", c->config.id);
+    return c;
+}
+
+/* ===== Server ===== */
+
+/* A container managed by the daemon */
+typedef struct {
+    container_t *c;
+    char *strings;                /* Owned copy of cmd/env strings */
+    char **argv;                  /* cmd and env pointer arrays (one allocation) */
+    cgroup_sampler_t *sampler;    /* Opened on first STATS or metrics tick */
+    int metrics_slot;             /* Slot in the metrics segment, -1 = none */
+    reclaim_state_t reclaim;      /* Proactive reclaim engine state */
+    long generation;              /* State index generation when last synced */
+    int busy;                     /* A worker owns c until its job is finished */
+    int exit_pending;             /* Exited while busy: applied when the job finishes */
+    int exit_status;
+} daemon_entry_t;
+
+struct daemon_job;
+
+/* A connected client */
+typedef struct daemon_conn {
+    int fd;
+    char *in;
+    size_t in_len, in_cap;
+    char *out;
+    size_t out_len, out_cap;
+    struct daemon_job *job;       /* In flight: no more requests until it replies */
+    int stalled;                  /* Next request targets a busy container */
+    struct daemon_conn *prev, *next;
+} daemon_conn_t;
+
+/* A lifecycle request handed to the workers */
+typedef struct daemon_job {
+    struct daemon_job *next;
+    daemon_conn_t *conn;          /* NULL once the client went away */
+    daemon_frame_t req;           /* Echoed in the reply */
+    container_t *c;
+    int arg;
+    int result;
+} daemon_job_t;
+
+typedef struct {
+    int epfd;
+    int listen_fd;
+    event_loop_t *events;
+    daemon_entry_t *entries;
+    int count, cap;
+    int metrics_timer;            /* timerfd driving the metrics export, -1 = off */
+    metrics_shm_t *metrics;
+    daemon_conn_t *conns;         /* Every open connection */
+    int job_event;                /* eventfd: a job finished (or a signal came in) */
+    pthread_t workers[DAEMON_WORKERS];
+    int worker_count;
+    pthread_mutex_t job_mutex;    /* Guards the job lists and workers_stopping */
+    pthread_cond_t job_cond;
+    daemon_job_t *jobs, *jobs_tail; /* Queued, oldest first */
+    daemon_job_t *done;           /* Finished, waiting for the loop */
+    int workers_stopping;
+    zygote_pool_t *zygotes;       /* Pre-forked zygotes, NULL = none */
+} daemon_t;
+
+static volatile sig_atomic_t daemon_stopping;
+static int daemon_wake_fd = -1;
+
+static int metrics_interval_ms = 1000;
+
+void daemon_set_metrics_interval(int interval_ms) {
+    metrics_interval_ms = interval_ms > 0 ? interval_ms : 0;
+}
+
+static reclaim_policy_t reclaim_policy;
+static int reclaim_enabled;
+
+void daemon_set_reclaim(const reclaim_policy_t *policy) {
+    reclaim_enabled = policy != NULL;
+    if (policy) reclaim_policy = *policy;
+}
+
+static char zygote_rootfs[PATH_MAX];
+static int zygote_count;
+
+void daemon_set_zygotes(const char *rootfs, int size) {
+    zygote_count = rootfs && size > 0 ? size : 0;
+    if (zygote_count) snprintf(zygote_rootfs, sizeof(zygote_rootfs), "%s", rootfs);
+}
+
+static void daemon_signal(int sig) {
+    (void)sig;
+    daemon_stopping = 1;
+    
+    /* Any thread may take the signal: wake the loop out of epoll_wait() */
+    uint64_t one = 1;
+    if (daemon_wake_fd >= 0 && write(daemon_wake_fd, &one, sizeof(one)) < 0) {
+        /* Counter full: the loop is awake anyway */
+    }
+}
+
+static daemon_entry_t *entry_find(daemon_t *d, const char *id_or_name) {
+    for (int i = 0; i < d->count; i++) {
+        if (strcmp(d->entries[i].c->config.id, id_or_name) == 0) {
+            return &d->entries[i];
+        }
+    }
+    for (int i = 0; i < d->count; i++) {
+        if (strcmp(d->entries[i].c->config.name, id_or_name) == 0) {
+            return &d->entries[i];
+        }
+    }
+    return NULL;
+}
+
+static daemon_entry_t *entry_add(daemon_t *d, container_t *c) {
+    if (d->count >= d->cap) {
+        int cap = d->cap ? d->cap * 2 : 64;
+        daemon_entry_t *entries = realloc(d->entries, sizeof(*entries) * cap);
+        if (!entries) {
+            return NULL;
+        }
+        d->entries = entries;
+        d->cap = cap;
+    }
+    daemon_entry_t *e = &d->entries[d->count++];
+    memset(e, 0, sizeof(*e));
+    e->c = c;
+    e->metrics_slot = -1;
+    e->generation = state_index_generation();
+    return e;
+}
+
+static void entry_remove(daemon_t *d, daemon_entry_t *e) {
+    if (e->metrics_slot >= 0) metrics_shm_release(d->metrics, e->metrics_slot);
+    cgroup_sampler_close(e->sampler);
+    free(e->strings);
+    free(e->argv);
+    container_free(e->c);
+    *e = d->entries[--d->count];
+}
+
+/**
+ * Resolve a container, loading it from the state index if this daemon has
+ * not seen it yet, and refreshing it if another process changed the index
+ */
+static daemon_entry_t *entry_get(daemon_t *d, const char *id_or_name) {
+    daemon_entry_t *e = entry_find(d, id_or_name);
+    long generation = state_index_generation();
+    
+    if (e && e->generation == generation) {
+        /* A start of ours may have exec'd since */
+        container_trace_poll(e->c);
+        return e;
+    }
+    
+    container_t *c;
+    if (container_get(id_or_name, &c) != MC_OK) {
+        if (e) entry_remove(d, e);  /* Deleted behind our back */
+        return NULL;
+    }
+    
+    if (!e) {
+        e = entry_add(d, c);
+        if (!e) container_free(c);
+        return e;
+    }
+    
+    /* Keep our command/environment, take the persisted state */
+    e->c->state = c->state;
+    e->c->pid = c->pid;
+    e->c->exit_code = c->exit_code;
+    e->c->started_at = c->started_at;
+    e->c->stopped_at = c->stopped_at;
+    e->c->startup = c->startup;
+    e->generation = generation;
+    container_free(c);
+    return e;
+}
+
+static void on_container_event(const container_event_t *event, void *userdata) {
+    daemon_t *d = userdata;
+    daemon_entry_t *e = entry_find(d, event->container_id);
+    
+    switch (event->type) {
+        case CONTAINER_EVENT_EXIT:
+            mc_log(1, "Container %s exited (status %d)", event->container_id, event->exit_status);
+            if (e && e->busy) {
+                e->exit_pending = 1;
+                e->exit_status = event->exit_status;
+            } else if (e && (e->c->state == CONTAINER_RUNNING || e->c->state == CONTAINER_PAUSED)) {
+                container_mark_exited(e->c, event->exit_status);
+                e->generation = state_index_generation();
+            }
+            event_loop_unwatch(d->events, event->container_id);
+            break;
+        case CONTAINER_EVENT_OOM:
+            mc_log(2, "Container %s: OOM kill (%ld total)", event->container_id, event->oom_kills);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Append a reply frame to a connection's output buffer
+ */
+static int conn_reply(daemon_conn_t *conn, const daemon_frame_t *req, int status,
+                      const void *data, uint32_t len) {
+    size_t need = conn->out_len + sizeof(daemon_frame_t) + len;
+    if (need > conn->out_cap) {
+        size_t cap = conn->out_cap ? conn->out_cap : 4096;
+        while (cap < need) cap *= 2;
+        char *out = realloc(conn->out, cap);
+        if (!out) {
+            return MC_ERR_MEMORY;
+        }
+        conn->out = out;
+        conn->out_cap = cap;
+    }
+    
+    daemon_frame_t *f = (daemon_frame_t *)(conn->out + conn->out_len);
+    f->len = len;
+    f->seq = req->seq;
+    f->op = req->op;
+    f->status = (int16_t)status;
+    if (len) memcpy(f + 1, data, len);
+    conn->out_len = need;
+    return MC_OK;
+}
+
+/**
+ * Pull the next NUL-terminated string out of a payload
+ */
+static const char *next_string(const char **p, const char *end) {
+    const char *s = *p;
+    const char *nul = s < end ? memchr(s, '\0', end - s) : NULL;
+    if (!nul) {
+        return NULL;
+    }
+    *p = nul + 1;
+    return s;
+}
+
+static int handle_create(daemon_t *d, daemon_conn_t *conn, const daemon_frame_t *req,
+                         const char *payload) {
+    const char *end = payload + req->len;
+    wire_create_t w;
+    container_config_t config = {0};
+    
+    if (req->len < sizeof(w)) {
+        return conn_reply(conn, req, MC_ERR_INVALID, NULL, 0);
+    }
+    memcpy(&w, payload, sizeof(w));
+    if (w.cmd_count > 4096 || w.env_count > 4096 || w.layer_count > 256) {
+        return conn_reply(conn, req, MC_ERR_INVALID, NULL, 0);
+    }
+    
+    /* Strings are copied once and owned by the entry */
+    size_t strings_len = req->len - sizeof(w);
+    char *strings = malloc(strings_len + 1);
+    char **argv = calloc(w.cmd_count + w.env_count + w.layer_count + 2, sizeof(char *));
+    if (!strings || !argv) {
+        free(strings);
+        free(argv);
+        return conn_reply(conn, req, MC_ERR_MEMORY, NULL, 0);
+    }
+    memcpy(strings, payload + sizeof(w), strings_len);
+    strings[strings_len] = '\0';
+    
+    const char *p = strings;
+    end = strings + strings_len;
+    const char *fields[5];
+    int ok = 1;
+    for (int i = 0; i < 5 && ok; i++) {
+        ok = (fields[i] = next_string(&p, end)) != NULL;
+    }
+    char **cmd = argv;
+    char **env = argv + w.cmd_count + 1;
+    const char **layers = (const char **)(env + w.env_count + 1);
+    for (uint32_t i = 0; i < w.cmd_count && ok; i++) ok = (cmd[i] = (char *)next_string(&p, end)) != NULL;
+    for (uint32_t i = 0; i < w.env_count && ok; i++) ok = (env[i] = (char *)next_string(&p, end)) != NULL;
+    for (uint32_t i = 0; i < w.layer_count && ok; i++) ok = (layers[i] = next_string(&p, end)) != NULL;
+    if (!ok) {
+        free(strings);
+        free(argv);
+        return conn_reply(conn, req, MC_ERR_INVALID, NULL, 0);
+    }
+    
+    snprintf(config.id, sizeof(config.id), "%s", fields[0]);
+    snprintf(config.name, sizeof(config.name), "%s", fields[1]);
+    snprintf(config.hostname, sizeof(config.hostname), "%s", fields[2]);
+    snprintf(config.rootfs, sizeof(config.rootfs), "%s", fields[3]);
+    snprintf(config.image, sizeof(config.image), "%s", fields[4]);
+    config.cmd = w.cmd_count ? cmd : NULL;
+    config.cmd_count = w.cmd_count;
+    config.env = w.env_count ? env : NULL;
+    config.env_count = w.env_count;
+    config.layers = w.layer_count ? layers : NULL;
+    config.layer_count = w.layer_count;
+    limits_from_wire(&w.limits, &config.limits);
+    config.enable_network = w.enable_network;
+    config.enable_user_ns = w.enable_user_ns;
+    
+    container_t *c;
+    int ret = container_create(&config, &c);
+    daemon_entry_t *e = NULL;
+    if (ret == MC_OK) {
+        /* container_create() keeps cmd/env pointers: they live in strings */
+        e = entry_add(d, c);
+        if (!e) {
+            container_free(c);
+            ret = MC_ERR_MEMORY;
+        }
+    }
+    if (!e) {
+        free(strings);
+        free(argv);
+        return conn_reply(conn, req, ret, NULL, 0);
+    }
+    e->strings = strings;
+    e->argv = argv;
+    
+    return conn_reply(conn, req, MC_OK, c->config.id, strlen(c->config.id) + 1);
+}
+
+/**
+ * Queue a lifecycle request for the workers; the connection waits for it
+ */
+static int job_submit(daemon_t *d, daemon_conn_t *conn, const daemon_frame_t *req,
+                      daemon_entry_t *e, int arg) {
+    daemon_job_t *job = calloc(1, sizeof(*job));
+    if (!job) {
+        return conn_reply(conn, req, MC_ERR_MEMORY, NULL, 0);
+    }
+    job->conn = conn;
+    job->req = *req;
+    job->c = e->c;
+    job->arg = arg;
+    e->busy = 1;
+    conn->job = job;
+    
+    pthread_mutex_lock(&d->job_mutex);
+    if (d->jobs_tail) {
+        d->jobs_tail->next = job;
+    } else {
+        d->jobs = job;
+    }
+    d->jobs_tail = job;
+    pthread_cond_signal(&d->job_cond);
+    pthread_mutex_unlock(&d->job_mutex);
+    return MC_OK;
+}
+
+static int handle_target(daemon_t *d, daemon_conn_t *conn, const daemon_frame_t *req,
+                         const char *payload) {
+    wire_target_t w;
+    const char *name = payload + sizeof(w);
+    
+    if (req->len <= sizeof(w) || payload[req->len - 1] != '\0') {
+        return conn_reply(conn, req, MC_ERR_INVALID, NULL, 0);
+    }
+    memcpy(&w, payload, sizeof(w));
+    
+    /* A worker owns the container: not even a refresh until it is done */
+    daemon_entry_t *e = entry_find(d, name);
+    if (e && e->busy) {
+        return 1;
+    }
+    e = entry_get(d, name);
+    if (!e) {
+        return conn_reply(conn, req, MC_ERR_NOT_FOUND, NULL, 0);
+    }
+    
+    int ret = MC_OK;
+    switch (req->op) {
+        case DAEMON_OP_STOP:
+        case DAEMON_OP_DELETE:
+            /* Our own kill is not an exit to report */
+            event_loop_unwatch(d->events, e->c->config.id);
+            return job_submit(d, conn, req, e, w.arg);
+        case DAEMON_OP_START:
+        case DAEMON_OP_PAUSE:
+        case DAEMON_OP_RESUME:
+            return job_submit(d, conn, req, e, w.arg);
+        case DAEMON_OP_GET: {
+            wire_container_t wc;
+            container_to_wire(e->c, &wc);
+            return conn_reply(conn, req, MC_OK, &wc, sizeof(wc));
+        }
+        case DAEMON_OP_STATS: {
+            container_metrics_t m;
+            if (!e->sampler) {
+                ret = cgroup_sampler_open(e->c, &e->sampler);
+            }
+            if (ret == MC_OK) {
+                ret = cgroup_sampler_read(e->sampler, &m);
+            }
+            if (ret == MC_OK) {
+                m.reclaim_bytes = e->reclaim.reclaim_bytes;
+                m.reclaim_count = e->reclaim.reclaim_count;
+            }
+            return conn_reply(conn, req, ret, &m, ret == MC_OK ? sizeof(m) : 0);
+        }
+        default:
+            return conn_reply(conn, req, MC_ERR_INVALID, NULL, 0);
+    }
+}
+
+static int handle_update(daemon_t *d, daemon_conn_t *conn, const daemon_frame_t *req,
+                         const char *payload) {
+    wire_update_t w;
+    resource_limits_t limits;
+    
+    if (req->len <= sizeof(w) || payload[req->len - 1] != '\0') {
+        return conn_reply(conn, req, MC_ERR_INVALID, NULL, 0);
+    }
+    memcpy(&w, payload, sizeof(w));
+    
+    daemon_entry_t *e = entry_find(d, payload + sizeof(w));
+    if (e && e->busy) {
+        return 1;
+    }
+    e = entry_get(d, payload + sizeof(w));
+    if (!e) {
+        return conn_reply(conn, req, MC_ERR_NOT_FOUND, NULL, 0);
+    }
+    
+    /* Diffed against the limits this daemon applied, which survive in e->c */
+    limits_from_wire(&w.limits, &limits);
+    return conn_reply(conn, req, container_update_limits(e->c, &limits, w.fields), NULL, 0);
+}
+
+static int handle_list(daemon_conn_t *conn, const daemon_frame_t *req) {
+    container_t **list;
+    int count;
+    
+    int ret = container_list(&list, &count);
+    if (ret != MC_OK) {
+        return conn_reply(conn, req, ret, NULL, 0);
+    }
+    
+    wire_container_t *records = count ? malloc(sizeof(*records) * count) : NULL;
+    if (count && !records) {
+        ret = MC_ERR_MEMORY;
+        count = 0;
+    }
+    for (int i = 0; i < count; i++) {
+        container_to_wire(list[i], &records[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        container_free(list[i]);
+    }
+    free(list);
+    
+    ret = conn_reply(conn, req, ret, records, sizeof(*records) * count);
+    free(records);
+    return ret;
+}
+
+/**
+ * Handle one request
+ * @return MC_OK once it is answered or queued for a worker, 1 if it targets
+ *         a busy container and must be retried, error code on failure
+ */
+static int handle_frame(daemon_t *d, daemon_conn_t *conn, const daemon_frame_t *req,
+                        const char *payload) {
+    switch (req->op) {
+        case DAEMON_OP_PING:
+            return conn_reply(conn, req, MC_OK, NULL, 0);
+        case DAEMON_OP_CREATE:
+            return handle_create(d, conn, req, payload);
+        case DAEMON_OP_LIST:
+            return handle_list(conn, req);
+        case DAEMON_OP_START:
+        case DAEMON_OP_STOP:
+        case DAEMON_OP_DELETE:
+        case DAEMON_OP_GET:
+        case DAEMON_OP_STATS:
+        case DAEMON_OP_PAUSE:
+        case DAEMON_OP_RESUME:
+            return handle_target(d, conn, req, payload);
+        case DAEMON_OP_UPDATE:
+            return handle_update(d, conn, req, payload);
+        case DAEMON_OP_COUNTERS: {
+            mc_counters_t counters;
+            mc_counters_snapshot(&counters);
+            return conn_reply(conn, req, MC_OK, &counters, sizeof(counters));
+        }
+        default:
+            return conn_reply(conn, req, MC_ERR_INVALID, NULL, 0);
+    }
+}
+
+/**
+ * Write as much buffered output as the socket takes
+ */
+static int conn_flush(daemon_t *d, daemon_conn_t *conn) {
+    size_t off = 0;
+    while (off < conn->out_len) {
+        ssize_t n = send(conn->fd, conn->out + off, conn->out_len - off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN) break;
+            if (errno == EINTR) continue;
+            return MC_ERR_IO;
+        }
+        off += n;
+    }
+    memmove(conn->out, conn->out + off, conn->out_len - off);
+    conn->out_len -= off;
+    
+    /* Wait for writability only while output is pending, and leave further
+     * requests in the socket while one is waiting */
+    struct epoll_event ev = {
+        .events = (conn->job || conn->stalled ? 0 : EPOLLIN) | (conn->out_len ? EPOLLOUT : 0),
+        .data.ptr = conn,
+    };
+    epoll_ctl(d->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+    return MC_OK;
+}
+
+/**
+ * Handle buffered frames (pipelined requests) until one has to wait
+ * @return MC_OK to keep the connection, error code to drop it
+ */
+static int conn_process(daemon_t *d, daemon_conn_t *conn) {
+    size_t off = 0;
+    int ret = MC_OK;
+    
+    conn->stalled = 0;
+    while (!conn->job && conn->in_len - off >= sizeof(daemon_frame_t)) {
+        daemon_frame_t req;
+        memcpy(&req, conn->in + off, sizeof(req));
+        if (req.len > DAEMON_MAX_PAYLOAD) {
+            ret = MC_ERR_INVALID;
+            break;
+        }
+        if (conn->in_len - off - sizeof(req) < req.len) {
+            break;
+        }
+        int handled = handle_frame(d, conn, &req, conn->in + off + sizeof(req));
+        if (handled < 0) {
+            ret = MC_ERR_MEMORY;
+            break;
+        }
+        if (handled > 0) {
+            conn->stalled = 1;  /* Left in the buffer for the retry */
+            break;
+        }
+        off += sizeof(req) + req.len;
+    }
+    memmove(conn->in, conn->in + off, conn->in_len - off);
+    conn->in_len -= off;
+    return ret;
+}
+
+/**
+ * Read what is available and handle every complete frame
+ * @return MC_OK to keep the connection, error code to drop it
+ */
+static int conn_readable(daemon_t *d, daemon_conn_t *conn) {
+    while (!conn->job && !conn->stalled) {
+        if (conn->in_cap - conn->in_len < DAEMON_READ_SIZE) {
+            size_t cap = conn->in_cap ? conn->in_cap * 2 : DAEMON_READ_SIZE * 2;
+            if (cap > DAEMON_MAX_PAYLOAD * 2 + DAEMON_READ_SIZE) {
+                return MC_ERR_INVALID;
+            }
+            char *in = realloc(conn->in, cap);
+            if (!in) {
+                return MC_ERR_MEMORY;
+            }
+            conn->in = in;
+            conn->in_cap = cap;
+        }
+    
+        ssize_t n = recv(conn->fd, conn->in + conn->in_len, conn->in_cap - conn->in_len, 0);
+        if (n == 0) {
+            return MC_ERR_IO;  /* Peer closed */
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) break;
+            return MC_ERR_IO;
+        }
+        conn->in_len += n;
+    
+        int ret = conn_process(d, conn);
+        if (ret != MC_OK) {
+            return ret;
+        }
+    }
+    
+    return conn_flush(d, conn);
+}
+
+static void conn_close(daemon_t *d, daemon_conn_t *conn) {
+    if (conn->job) conn->job->conn = NULL;  /* It finishes without a reply */
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        d->conns = conn->next;
+    }
+    if (conn->next) conn->next->prev = conn->prev;
+    epoll_ctl(d->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+static void daemon_accept(daemon_t *d) {
+    for (;;) {
+        int fd = accept4(d->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        daemon_conn_t *conn = calloc(1, sizeof(*conn));
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+        if (!conn || epoll_ctl(d->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->next = d->conns;
+        if (d->conns) d->conns->prev = conn;
+        d->conns = conn;
+    }
+}
+
+/**
+ * Pick up a connection's buffered requests again after a wait
+ */
+static void conn_resume(daemon_t *d, daemon_conn_t *conn) {
+    if (conn_process(d, conn) != MC_OK || conn_flush(d, conn) != MC_OK) {
+        conn_close(d, conn);
+    }
+}
+
+static int job_run(daemon_job_t *job) {
+    switch (job->req.op) {
+        case DAEMON_OP_START:
+            return container_start(job->c);
+        case DAEMON_OP_STOP:
+            return container_stop(job->c, job->arg > 0 ? job->arg : 10);
+        case DAEMON_OP_DELETE:
+            return container_delete(job->c);
+        case DAEMON_OP_PAUSE:
+            return container_pause(job->c);
+        case DAEMON_OP_RESUME:
+            return container_resume(job->c);
+        default:
+            return MC_ERR_INVALID;
+    }
+}
+
+/**
+ * Worker thread: run queued jobs until the daemon stops and the queue is empty
+ */
+static void *daemon_worker(void *arg) {
+    daemon_t *d = arg;
+    uint64_t one = 1;
+    
+    pthread_mutex_lock(&d->job_mutex);
+    for (;;) {
+        while (!d->jobs && !d->workers_stopping) {
+            pthread_cond_wait(&d->job_cond, &d->job_mutex);
+        }
+        daemon_job_t *job = d->jobs;
+        if (!job) {
+            break;
+        }
+        d->jobs = job->next;
+        if (!d->jobs) d->jobs_tail = NULL;
+        pthread_mutex_unlock(&d->job_mutex);
+        
+        job->result = job_run(job);
+        
+        pthread_mutex_lock(&d->job_mutex);
+        job->next = d->done;
+        d->done = job;
+        if (write(d->job_event, &one, sizeof(one)) < 0) {
+            /* Counter full: the loop has a wakeup queued already */
+        }
+    }
+    pthread_mutex_unlock(&d->job_mutex);
+    return NULL;
+}
+
+/**
+ * Hand a finished job's container back to the loop and send its reply
+ */
+static void job_finish(daemon_t *d, daemon_job_t *job) {
+    daemon_entry_t *e = NULL;
+    for (int i = 0; i < d->count && !e; i++) {
+        if (d->entries[i].c == job->c) e = &d->entries[i];
+    }
+    
+    if (e && job->req.op == DAEMON_OP_DELETE) {
+        entry_remove(d, e);
+    } else if (e) {
+        e->busy = 0;
+        if (job->req.op == DAEMON_OP_START && job->result == MC_OK &&
+            event_loop_watch(d->events, e->c, on_container_event, d) != MC_OK) {
+            mc_log(2, "Could not watch container %s", e->c->config.id);
+        }
+        if (e->exit_pending) {
+            e->exit_pending = 0;
+            if (e->c->state == CONTAINER_RUNNING || e->c->state == CONTAINER_PAUSED) {
+                container_mark_exited(e->c, e->exit_status);
+            }
+        }
+        e->generation = state_index_generation();
+    }
+    
+    /* The loop thread owns the zygotes: they die with the thread that cloned them */
+    if (d->zygotes && job->req.op == DAEMON_OP_START) {
+        zygote_pool_refill(d->zygotes);
+    }
+    
+    daemon_conn_t *conn = job->conn;
+    if (conn) {
+        conn->job = NULL;
+        if (conn_reply(conn, &job->req, job->result, NULL, 0) == MC_OK) {
+            conn_resume(d, conn);
+        } else {
+            conn_close(d, conn);
+        }
+    }
+    free(job);
+}
+
+/**
+ * Finish every job the workers completed, then retry the requests that
+ * waited for a busy container
+ */
+static void daemon_finish_jobs(daemon_t *d) {
+    uint64_t count;
+    
+    if (read(d->job_event, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        return;
+    }
+    pthread_mutex_lock(&d->job_mutex);
+    daemon_job_t *done = d->done;
+    d->done = NULL;
+    pthread_mutex_unlock(&d->job_mutex);
+    
+    while (done) {
+        daemon_job_t *job = done;
+        done = job->next;
+        job_finish(d, job);
+    }
+    
+    daemon_conn_t *next;
+    for (daemon_conn_t *conn = d->conns; conn; conn = next) {
+        next = conn->next;
+        if (conn->stalled) conn_resume(d, conn);
+    }
+}
+
+/**
+ * Start the worker pool; the eventfd also carries signal wakeups, since a
+ * worker may be the thread that takes SIGTERM
+ */
+static int daemon_start_workers(daemon_t *d) {
+    d->job_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (d->job_event < 0) {
+        return MC_ERR_IO;
+    }
+    daemon_wake_fd = d->job_event;
+    
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &d->job_event };
+    epoll_ctl(d->epfd, EPOLL_CTL_ADD, d->job_event, &ev);
+    
+    for (int i = 0; i < DAEMON_WORKERS; i++) {
+        if (pthread_create(&d->workers[d->worker_count], NULL, daemon_worker, d) == 0) {
+            d->worker_count++;
+        }
+    }
+    return d->worker_count > 0 ? MC_OK : MC_ERR_PROCESS;
+}
+
+/**
+ * Let the workers drain the queue (a container is never left half-started)
+ * and drop the finished jobs
+ */
+static void daemon_stop_workers(daemon_t *d) {
+    pthread_mutex_lock(&d->job_mutex);
+    d->workers_stopping = 1;
+    pthread_cond_broadcast(&d->job_cond);
+    pthread_mutex_unlock(&d->job_mutex);
+    for (int i = 0; i < d->worker_count; i++) {
+        pthread_join(d->workers[i], NULL);
+    }
+    
+    while (d->done) {
+        daemon_job_t *job = d->done;
+        d->done = job->next;
+        free(job);
+    }
+    daemon_wake_fd = -1;
+    if (d->job_event >= 0) close(d->job_event);
+}
+
+/**
+ * Park the zygotes configured with daemon_set_zygotes(); called on the
+ * loop thread, which lives as long as the pool
+ */
+static void daemon_start_zygotes(daemon_t *d) {
+    if (zygote_count <= 0) {
+        return;
+    }
+    if (zygote_pool_create(zygote_rootfs, 0, zygote_count, &d->zygotes) != MC_OK) {
+        mc_log(2, "Could not create the zygote pool for %s; starts stay cold", zygote_rootfs);
+        d->zygotes = NULL;
+    }
+}
+
+/**
+ * Metrics tick: sample every running container into the shared segment
+ */
+static void daemon_export_metrics(daemon_t *d) {
+    uint64_t expirations;
+    
+    if (read(d->metrics_timer, &expirations, sizeof(expirations)) < 0) {
+        return;
+    }
+    for (int i = 0; i < d->count; i++) {
+        daemon_entry_t *e = &d->entries[i];
+        if (e->busy || (e->c->state != CONTAINER_RUNNING && e->c->state != CONTAINER_PAUSED)) {
+            continue;
+        }
+        if (!e->sampler && cgroup_sampler_open(e->c, &e->sampler) != MC_OK) {
+            continue;
+        }
+        if (e->metrics_slot < 0) {
+            e->metrics_slot = metrics_shm_claim(d->metrics, e->c->config.id);
+            if (e->metrics_slot < 0) continue;  /* All slots taken */
+        }
+    
+        container_metrics_t m;
+        if (cgroup_sampler_read(e->sampler, &m) == MC_OK) {
+            if (reclaim_enabled) {
+                reclaim_step(e->c, &reclaim_policy, &m, &e->reclaim);
+            }
+            m.reclaim_bytes = e->reclaim.reclaim_bytes;
+            m.reclaim_count = e->reclaim.reclaim_count;
+            metrics_shm_publish(d->metrics, e->metrics_slot, &m);
+        }
+    }
+}
+
+/**
+ * Create the metrics segment and the timerfd that drives it
+ */
+static void daemon_start_metrics(daemon_t *d) {
+    if (metrics_interval_ms <= 0 ||
+        metrics_shm_create(NULL, metrics_interval_ms, &d->metrics) != MC_OK) {
+        if (reclaim_enabled) mc_log(2, "Proactive reclaim runs on the metrics tick; it stays off");
+        return;
+    }
+    
+    d->metrics_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct itimerspec its = {
+        .it_interval = { metrics_interval_ms / 1000, (metrics_interval_ms % 1000) * 1000000L },
+    };
+    its.it_value = its.it_interval;
+    if (d->metrics_timer < 0 || timerfd_settime(d->metrics_timer, 0, &its, NULL) != 0) {
+        mc_log(2, "No metrics timer: %s", strerror(errno));
+        if (d->metrics_timer >= 0) close(d->metrics_timer);
+        d->metrics_timer = -1;
+        metrics_shm_close(d->metrics);
+        d->metrics = NULL;
+        return;
+    }
+    
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &d->metrics_timer };
+    epoll_ctl(d->epfd, EPOLL_CTL_ADD, d->metrics_timer, &ev);
+    mc_log(1, "Exporting metrics to %s every %dms%s", MC_METRICS_SHM_NAME, metrics_interval_ms,
+           reclaim_enabled ? ", proactive reclaim on" : "");
+}
+
+/**
+ * Watch containers that were already running when the daemon started
+ */
+static void daemon_adopt(daemon_t *d) {
+    container_t **list;
+    int count;
+    
+    if (container_list(&list, &count) != MC_OK) {
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        if ((list[i]->state == CONTAINER_RUNNING || list[i]->state == CONTAINER_PAUSED) &&
+            event_loop_watch(d->events, list[i], on_container_event, d) == MC_OK &&
+            entry_add(d, list[i])) {
+            continue;
+        }
+        container_free(list[i]);
+    }
+    free(list);
+}
+
+int daemon_run(const char *socket_path) {
+    char path[PATH_MAX];
+    struct sockaddr_un addr;
+    daemon_t d = {
+        .epfd = -1, .listen_fd = -1, .metrics_timer = -1, .job_event = -1,
+        .job_mutex = PTHREAD_MUTEX_INITIALIZER, .job_cond = PTHREAD_COND_INITIALIZER,
+    };
+    int ret = MC_OK;
+    
+    default_socket_path(path, sizeof(path), socket_path);
+    if (fill_sockaddr(&addr, path) != MC_OK) {
+        return MC_ERR_INVALID;
+    }
+    
+    /* Refuse to take over the socket of a daemon that is still alive */
+    daemon_client_t *probe;
+    if (daemon_client_open(path, &probe) == MC_OK) {
+        daemon_client_close(probe);
+        mc_log(3, "A daemon is already listening on %s", path);
+        return MC_ERR_EXISTS;
+    }
+    unlink(path);
+    
+    mkdir(get_state_dir(), 0755);
+    d.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    mode_t old_umask = umask(0077);
+    if (d.listen_fd < 0 || bind(d.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(d.listen_fd, 128) != 0) {
+        umask(old_umask);
+        mc_log(3, "Failed to listen on %s: %s", path, strerror(errno));
+        if (d.listen_fd >= 0) close(d.listen_fd);
+        return MC_ERR_IO;
+    }
+    umask(old_umask);
+    
+    d.epfd = epoll_create1(EPOLL_CLOEXEC);
+    ret = event_loop_create(&d.events);
+    if (d.epfd < 0 || ret != MC_OK) {
+        ret = d.epfd < 0 ? MC_ERR_IO : ret;
+        goto out;
+    }
+    
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &d.listen_fd };
+    epoll_ctl(d.epfd, EPOLL_CTL_ADD, d.listen_fd, &ev);
+    ev.data.ptr = d.events;
+    epoll_ctl(d.epfd, EPOLL_CTL_ADD, event_loop_fd(d.events), &ev);
+    
+    ret = daemon_start_workers(&d);
+    if (ret != MC_OK) {
+        mc_log(3, "Failed to start the daemon's worker threads");
+        goto out;
+    }
+    
+    /* Handlers rather than SIG_IGN or a blocked mask: exec resets handlers,
+     * so containers start with default dispositions.  Writes use
+     * MSG_NOSIGNAL instead of ignoring SIGPIPE for the same reason. */
+    struct sigaction sa = { .sa_handler = daemon_signal };
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    
+    daemon_adopt(&d);
+    daemon_start_metrics(&d);
+    daemon_start_zygotes(&d);
+    mc_log(1, "Daemon listening on %s", path);
+    
+    struct epoll_event events[DAEMON_MAX_EVENTS];
+    while (!daemon_stopping) {
+        int n = epoll_wait(d.epfd, events, DAEMON_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ret = MC_ERR_IO;
+            break;
+        }
+    
+        int jobs_done = 0;
+        for (int i = 0; i < n; i++) {
+            void *tag = events[i].data.ptr;
+            if (tag == &d.listen_fd) {
+                daemon_accept(&d);
+            } else if (tag == &d.job_event) {
+                jobs_done = 1;  /* May close connections later in this batch */
+            } else if (tag == d.events) {
+                event_loop_run_once(d.events, 0);
+            } else if (tag == &d.metrics_timer) {
+                daemon_export_metrics(&d);
+            } else {
+                daemon_conn_t *conn = tag;
+                int keep = MC_OK;
+                if ((events[i].events & (EPOLLHUP | EPOLLERR)) && (conn->job || conn->stalled)) {
+                    keep = MC_ERR_IO;  /* Gone while a request of its waits */
+                } else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    keep = conn_readable(&d, conn);
+                } else if (events[i].events & EPOLLOUT) {
+                    keep = conn_flush(&d, conn);
+                }
+                if (keep != MC_OK) {
+                    conn_close(&d, conn);
+                }
+            }
+        }
+        if (jobs_done) {
+            daemon_finish_jobs(&d);
+        }
+    }
+    mc_log(1, "Daemon shutting down");
+    
+out:
+    /* Containers keep running; only the daemon's state goes away */
+    while (d.conns) {
+        conn_close(&d, d.conns);
+    }
+    daemon_stop_workers(&d);
+    zygote_pool_destroy(d.zygotes);
+    while (d.count > 0) {
+        entry_remove(&d, &d.entries[d.count - 1]);
+    }
+    free(d.entries);
+    if (d.metrics_timer >= 0) close(d.metrics_timer);
+    metrics_shm_close(d.metrics);
+    event_loop_destroy(d.events);
+    if (d.epfd >= 0) close(d.epfd);
+    close(d.listen_fd);
+    unlink(path);
+    return ret;
+}
+
+/* ===== Client ===== */
+
+struct daemon_client {
+    int fd;
+    uint32_t next_seq;
+    char *buf;                    /* Reply payload buffer */
+    size_t cap;
+};
+
+int daemon_client_open(const char *socket_path, daemon_client_t **client) {
+    char path[PATH_MAX];
+    struct sockaddr_un addr;
+    
+    if (!client) {
+        return MC_ERR_INVALID;
+    }
+    default_socket_path(path, sizeof(path), socket_path);
+    if (fill_sockaddr(&addr, path) != MC_OK) {
+        return MC_ERR_INVALID;
+    }
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return MC_ERR_IO;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return MC_ERR_NOT_FOUND;  /* No daemon running */
+    }
+    
+    daemon_client_t *cl = calloc(1, sizeof(*cl));
+    if (!cl) {
+        close(fd);
+        return MC_ERR_MEMORY;
+    }
+    cl->fd = fd;
+    cl->next_seq = 1;
+    *client = cl;
+    return MC_OK;
+}
+
+int daemon_client_send(daemon_client_t *client, daemon_op_t op, const void *payload,
+                       uint32_t len) {
+    if (!client || len > DAEMON_MAX_PAYLOAD) {
+        return MC_ERR_INVALID;
+    }
+    
+    daemon_frame_t f = { .len = len, .seq = client->next_seq++, .op = (uint16_t)op };
+    struct iovec iov[2] = {
+        { .iov_base = &f, .iov_len = sizeof(f) },
+        { .iov_base = (void *)payload, .iov_len = len },
+    };
+    size_t total = sizeof(f) + len;
+    size_t sent = 0;
+    
+    while (sent < total) {
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+        ssize_t n = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return MC_ERR_IO;
+        }
+        sent += n;
+        /* Advance the iovecs past what was written */
+        for (int i = 0; i < 2 && n > 0; i++) {
+            size_t step = (size_t)n < iov[i].iov_len ? (size_t)n : iov[i].iov_len;
+            iov[i].iov_base = (char *)iov[i].iov_base + step;
+            iov[i].iov_len -= step;
+            n -= step;
+        }
+    }
+    return (int)(f.seq & 0x7fffffff);
+}
+
+static int read_full(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n == 0) {
+            return MC_ERR_IO;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return MC_ERR_IO;
+        }
+        p += n;
+        len -= n;
+    }
+    return MC_OK;
+}
+
+int daemon_client_recv(daemon_client_t *client, daemon_reply_t *reply) {
+    daemon_frame_t f;
+    
+    if (!client || !reply) {
+        return MC_ERR_INVALID;
+    }
+    if (read_full(client->fd, &f, sizeof(f)) != MC_OK || f.len > DAEMON_MAX_PAYLOAD) {
+        return MC_ERR_IO;
+    }
+    if (f.len > client->cap) {
+        char *buf = realloc(client->buf, f.len);
+        if (!buf) {
+            return MC_ERR_MEMORY;
+        }
+        client->buf = buf;
+        client->cap = f.len;
+    }
+    if (f.len && read_full(client->fd, client->buf, f.len) != MC_OK) {
+        return MC_ERR_IO;
+    }
+    
+    reply->seq = f.seq;
+    reply->op = (daemon_op_t)f.op;
+    reply->status = f.status;
+    reply->data = client->buf;
+    reply->len = f.len;
+    return MC_OK;
+}
+
+/**
+ * Send one request and wait for its reply
+ */
+static int client_call(daemon_client_t *client, daemon_op_t op, const void *payload,
+                       uint32_t len, daemon_reply_t *reply) {
+    int ret = daemon_client_send(client, op, payload, len);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = daemon_client_recv(client, reply);
+    return ret != MC_OK ? ret : reply->status;
+}
+
+int daemon_client_send_target(daemon_client_t *client, daemon_op_t op,
+                              const char *id_or_name, int arg) {
+    char payload[sizeof(wire_target_t) + 256];
+    
+    if (!id_or_name) {
+        return MC_ERR_INVALID;
+    }
+    size_t len = strlen(id_or_name) + 1;
+    if (len > sizeof(payload) - sizeof(wire_target_t)) {
+        return MC_ERR_INVALID;
+    }
+    wire_target_t w = { .arg = arg };
+    memcpy(payload, &w, sizeof(w));
+    memcpy(payload + sizeof(w), id_or_name, len);
+    return daemon_client_send(client, op, payload, sizeof(w) + len);
+}
+
+int daemon_client_op(daemon_client_t *client, daemon_op_t op, const char *id_or_name, int arg) {
+    daemon_reply_t reply;
+    int ret = daemon_client_send_target(client, op, id_or_name, arg);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = daemon_client_recv(client, &reply);
+    return ret != MC_OK ? ret : reply.status;
+}
+
+int daemon_client_create(daemon_client_t *client, const container_config_t *config, char *id) {
+    daemon_reply_t reply;
+    
+    if (!client || !config) {
+        return MC_ERR_INVALID;
+    }
+    
+    const char *fixed[5] = { config->id, config->name, config->hostname,
+                             config->rootfs, config->image };
+    size_t len = sizeof(wire_create_t);
+    for (int i = 0; i < 5; i++) len += strlen(fixed[i]) + 1;
+    for (int i = 0; i < config->cmd_count; i++) len += strlen(config->cmd[i]) + 1;
+    for (int i = 0; i < config->env_count; i++) len += strlen(config->env[i]) + 1;
+    for (int i = 0; i < config->layer_count; i++) len += strlen(config->layers[i]) + 1;
+    if (len > DAEMON_MAX_PAYLOAD) {
+        return MC_ERR_INVALID;
+    }
+    
+    char *payload = malloc(len);
+    if (!payload) {
+        return MC_ERR_MEMORY;
+    }
+    
+    wire_create_t w = {
+        .enable_network = config->enable_network,
+        .enable_user_ns = config->enable_user_ns,
+        .cmd_count = config->cmd_count,
+        .env_count = config->env_count,
+        .layer_count = config->layer_count,
+    };
+    limits_to_wire(&config->limits, &w.limits);
+    memcpy(payload, &w, sizeof(w));
+    char *p = payload + sizeof(w);
+    for (int i = 0; i < 5; i++) p = stpcpy(p, fixed[i]) + 1;
+    for (int i = 0; i < config->cmd_count; i++) p = stpcpy(p, config->cmd[i]) + 1;
+    for (int i = 0; i < config->env_count; i++) p = stpcpy(p, config->env[i]) + 1;
+    for (int i = 0; i < config->layer_count; i++) p = stpcpy(p, config->layers[i]) + 1;
+    
+    int ret = client_call(client, DAEMON_OP_CREATE, payload, len, &reply);
+    free(payload);
+    if (ret == MC_OK && id) {
+        snprintf(id, 65, "%.*s", (int)reply.len, (const char *)reply.data);
+    }
+    return ret;
+}
+
+int daemon_client_get(daemon_client_t *client, const char *id_or_name, container_t **container) {
+    daemon_reply_t reply;
+    int ret = daemon_client_send_target(client, DAEMON_OP_GET, id_or_name, 0);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = daemon_client_recv(client, &reply);
+    if (ret != MC_OK || reply.status != MC_OK) {
+        return ret != MC_OK ? ret : reply.status;
+    }
+    if (reply.len != sizeof(wire_container_t)) {
+        return MC_ERR_IO;
+    }
+    *container = container_from_wire(reply.data);
+    return *container ? MC_OK : MC_ERR_MEMORY;
+}
+
+int daemon_client_list(daemon_client_t *client, container_t ***containers, int *count) {
+    daemon_reply_t reply;
+    
+    if (!containers || !count) {
+        return MC_ERR_INVALID;
+    }
+    int ret = client_call(client, DAEMON_OP_LIST, NULL, 0, &reply);
+    if (ret != MC_OK) {
+        return ret;
+    }
+    
+    int n = reply.len / sizeof(wire_container_t);
+    container_t **list = n ? malloc(sizeof(container_t *) * n) : NULL;
+    if (n && !list) {
+        return MC_ERR_MEMORY;
+    }
+    const wire_container_t *records = reply.data;
+    for (int i = 0; i < n; i++) {
+        list[i] = container_from_wire(&records[i]);
+        if (!list[i]) {
+            while (i > 0) container_free(list[--i]);
+            free(list);
+            return MC_ERR_MEMORY;
+        }
+    }
+    *containers = list;
+    *count = n;
+    return MC_OK;
+}
+
+int daemon_client_stats(daemon_client_t *client, const char *id_or_name,
+                        container_metrics_t *metrics) {
+    daemon_reply_t reply;
+    int ret = daemon_client_send_target(client, DAEMON_OP_STATS, id_or_name, 0);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = daemon_client_recv(client, &reply);
+    if (ret != MC_OK || reply.status != MC_OK) {
+        return ret != MC_OK ? ret : reply.status;
+    }
+    if (reply.len != sizeof(*metrics)) {
+        return MC_ERR_IO;
+    }
+    memcpy(metrics, reply.data, sizeof(*metrics));
+    return MC_OK;
+}
+
+int daemon_client_counters(daemon_client_t *client, mc_counters_t *counters) {
+    daemon_reply_t reply;
+    
+    if (!counters) {
+        return MC_ERR_INVALID;
+    }
+    int ret = client_call(client, DAEMON_OP_COUNTERS, NULL, 0, &reply);
+    if (ret != MC_OK) {
+        return ret;
+    }
+    if (reply.len != sizeof(*counters)) {
+        return MC_ERR_IO;
+    }
+    memcpy(counters, reply.data, sizeof(*counters));
+    return MC_OK;
+}
+
+int daemon_client_update(daemon_client_t *client, const char *id_or_name,
+                         const resource_limits_t *limits, unsigned int fields) {
+    char payload[sizeof(wire_update_t) + 256];
+    daemon_reply_t reply;
+    
+    if (!id_or_name || !limits) {
+        return MC_ERR_INVALID;
+    }
+    size_t len = strlen(id_or_name) + 1;
+    if (len > sizeof(payload) - sizeof(wire_update_t)) {
+        return MC_ERR_INVALID;
+    }
+    wire_update_t w = { .fields = fields };
+    limits_to_wire(limits, &w.limits);
+    memcpy(payload, &w, sizeof(w));
+    memcpy(payload + sizeof(w), id_or_name, len);
+    
+    int ret = daemon_client_send(client, DAEMON_OP_UPDATE, payload, sizeof(w) + len);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = daemon_client_recv(client, &reply);
+    return ret != MC_OK ? ret : reply.status;
+}
+
+void daemon_client_close(daemon_client_t *client) {
+    if (!client) {
+        return;
+    }
+    close(client->fd);
+    free(client->buf);
+    free(client);
+}
@@ -0,0 +1,565 @@
+/*
+ * KernelSight - Linux Container Runtime
+ * events.c - Event-driven process exit and cgroup notifications
+ *
+ * Process exit is observed through pidfds, cgroup state changes through
+ * inotify on cgroup.events and memory.events (the kernel raises a modify
+ * event whenever their content changes).  PSI triggers are written to the
+ * cgroup's *.pressure files and signal EPOLLPRI once the stall threshold
+ * is crossed.  Everything is multiplexed on a single epoll fd so callers
+ * can embed the loop in their own poller.
+ */
+
+#define _GNU_SOURCE
+#include "../include/container.h"
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+
+/* Maximum events handled per epoll_wait() round */
+#define EVENT_BATCH 64
+
+/* PSI triggers per watch (some + full for each resource) */
+#define EVENT_MAX_TRIGGERS 6
+
+/* PSI trigger window bounds enforced by the kernel */
+#define PSI_WINDOW_MIN_US 500000
+#define PSI_WINDOW_MAX_US 10000000
+#define PSI_UNPRIV_WINDOW_US 2000000  /* Granularity without CAP_SYS_RESOURCE */
+
+/* What an epoll registration points at (first member of the target) */
+typedef enum {
+    EVENT_TAG_WATCH = 1,          /* event_watch_t: pidfd readable */
+    EVENT_TAG_PRESSURE            /* pressure_trigger_t: EPOLLPRI */
+} event_tag_t;
+
+struct event_watch;
+
+/* A kernel PSI trigger owned by a watch */
+typedef struct {
+    event_tag_t tag;
+    int fd;                       /* <resource>.pressure, holds the trigger */
+    psi_resource_t resource;
+    int full;
+    struct event_watch *watch;
+} pressure_trigger_t;
+
+/* A watched container */
+typedef struct event_watch {
+    event_tag_t tag;
+    char id[65];
+    char cgroup_path[PATH_MAX];
+    pid_t pid;
+    int pidfd;                    /* -1 once the process has exited */
+    int cgroup_events_fd;         /* cgroup.events, re-read with pread */
+    int memory_events_fd;         /* memory.events, re-read with pread */
+    int cgroup_events_wd;         /* inotify watch descriptors */
+    int memory_events_wd;
+    int populated;                /* Last seen "populated" value */
+    long oom_kills;               /* Last seen "oom_kill" count */
+    int removed;                  /* Unwatched while dispatching */
+    pressure_trigger_t *triggers[EVENT_MAX_TRIGGERS];
+    int trigger_count;
+    container_event_cb_t cb;
+    void *userdata;
+} event_watch_t;
+
+struct event_loop {
+    int epfd;
+    int inotify_fd;
+    event_watch_t **watches;
+    int count;
+    int cap;
+    int dispatching;
+};
+
+/* epoll tag for the inotify fd (watches are tagged with their pointer) */
+static char inotify_tag;
+
+static const char *const pressure_files[] = {
+    [PSI_CPU]    = "cpu.pressure",
+    [PSI_MEMORY] = "memory.pressure",
+    [PSI_IO]     = "io.pressure",
+};
+
+/* ===== pidfd helpers ===== */
+
+int proc_open_pidfd(pid_t pid) {
+    if (pid <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+}
+
+int proc_signal(int pidfd, int sig) {
+    int ret = (int)syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+    mc_counter_inc(MC_COUNTER_SIGNAL, ret != 0);
+    if (ret != 0) {
+        return errno == ESRCH ? MC_ERR_NOT_FOUND : MC_ERR_PROCESS;
+    }
+    return MC_OK;
+}
+
+int proc_wait_exit(int pidfd, int timeout_ms) {
+    struct pollfd pfd = { .fd = pidfd, .events = POLLIN };
+    
+    for (;;) {
+        int ret = poll(&pfd, 1, timeout_ms);
+        if (ret > 0) {
+            return MC_OK;
+        }
+        if (ret == 0) {
+            return MC_ERR_PROCESS;  /* Timed out */
+        }
+        if (errno != EINTR) {
+            return MC_ERR_IO;
+        }
+    }
+}
+
+/* ===== cgroup file parsing ===== */
+
+/**
+ * Re-read a flat-keyed cgroup file and extract one key
+ */
+static long read_event_key(int fd, const char *key) {
+    char buf[512];
+    long value = -1;
+    
+    if (fd < 0) {
+        return -1;
+    }
+    
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    
+    cgroup_stat_key_t k = { key, (unsigned short)strlen(key), 0 };
+    return cgroup_parse_keyed(buf, &k, 1, &value, 0) > 0 ? value : -1;
+}
+
+/* ===== Event loop ===== */
+
+static void trigger_close(event_loop_t *loop, pressure_trigger_t *t) {
+    if (t->fd >= 0) {
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, t->fd, NULL);
+        close(t->fd);
+        t->fd = -1;
+    }
+}
+
+static void watch_free(event_loop_t *loop, event_watch_t *w) {
+    for (int i = 0; i < w->trigger_count; i++) {
+        trigger_close(loop, w->triggers[i]);
+        free(w->triggers[i]);
+    }
+    if (w->pidfd >= 0) {
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, w->pidfd, NULL);
+        close(w->pidfd);
+    }
+    if (w->cgroup_events_wd >= 0) {
+        inotify_rm_watch(loop->inotify_fd, w->cgroup_events_wd);
+    }
+    if (w->memory_events_wd >= 0) {
+        inotify_rm_watch(loop->inotify_fd, w->memory_events_wd);
+    }
+    if (w->cgroup_events_fd >= 0) close(w->cgroup_events_fd);
+    if (w->memory_events_fd >= 0) close(w->memory_events_fd);
+    free(w);
+}
+
+static void dispatch(event_watch_t *w, container_event_type_t type, int status,
+                     const pressure_trigger_t *t, double avg10) {
+    container_event_t ev = {0};
+    
+    ev.type = type;
+    snprintf(ev.container_id, sizeof(ev.container_id), "%s", w->id);
+    ev.pid = w->pid;
+    ev.exit_status = status;
+    ev.oom_kills = w->oom_kills;
+    if (t) {
+        ev.psi_resource = t->resource;
+        ev.psi_full = t->full;
+        ev.psi_avg10 = avg10;
+    }
+    
+    if (w->cb) {
+        w->cb(&ev, w->userdata);
+    }
+}
+
+int event_loop_create(event_loop_t **loop) {
+    event_loop_t *l = calloc(1, sizeof(*l));
+    if (!l) {
+        return MC_ERR_MEMORY;
+    }
+    
+    l->epfd = epoll_create1(EPOLL_CLOEXEC);
+    l->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (l->epfd < 0 || l->inotify_fd < 0) {
+        mc_log(3, "Failed to create event loop: %s", strerror(errno));
+        if (l->epfd >= 0) close(l->epfd);
+        if (l->inotify_fd >= 0) close(l->inotify_fd);
+        free(l);
+        return MC_ERR_IO;
+    }
+    
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &inotify_tag };
+    if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->inotify_fd, &ev) != 0) {
+        mc_log(3, "Failed to register inotify fd: %s", strerror(errno));
+        close(l->epfd);
+        close(l->inotify_fd);
+        free(l);
+        return MC_ERR_IO;
+    }
+    
+    *loop = l;
+    return MC_OK;
+}
+
+int event_loop_fd(event_loop_t *loop) {
+    return loop ? loop->epfd : -1;
+}
+
+int event_loop_watch_cgroup(event_loop_t *loop, const char *id, const char *cgroup_path,
+                            pid_t pid, container_event_cb_t cb, void *userdata) {
+    char path[PATH_MAX];
+    
+    if (!loop || !id || !cgroup_path) {
+        return MC_ERR_INVALID;
+    }
+    
+    event_watch_t *w = calloc(1, sizeof(*w));
+    if (!w) {
+        return MC_ERR_MEMORY;
+    }
+    
+    w->tag = EVENT_TAG_WATCH;
+    snprintf(w->id, sizeof(w->id), "%s", id);
+    snprintf(w->cgroup_path, sizeof(w->cgroup_path), "%s", cgroup_path);
+    w->pid = pid;
+    w->cb = cb;
+    w->userdata = userdata;
+    w->cgroup_events_wd = -1;
+    w->memory_events_wd = -1;
+    
+    /* Process exit */
+    w->pidfd = pid > 0 ? proc_open_pidfd(pid) : -1;
+    if (w->pidfd >= 0) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = w };
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, w->pidfd, &ev) != 0) {
+            close(w->pidfd);
+            w->pidfd = -1;
+        }
+    } else if (pid > 0) {
+        mc_log(2, "pidfd_open(%d) failed: %s", pid, strerror(errno));
+    }
+    
+    /* cgroup.events: populated / frozen */
+    snprintf(path, sizeof(path), "%s/cgroup.events", cgroup_path);
+    w->cgroup_events_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (w->cgroup_events_fd >= 0) {
+        w->cgroup_events_wd = inotify_add_watch(loop->inotify_fd, path, IN_MODIFY);
+        w->populated = (int)read_event_key(w->cgroup_events_fd, "populated");
+    }
+    
+    /* memory.events: oom_kill */
+    snprintf(path, sizeof(path), "%s/memory.events", cgroup_path);
+    w->memory_events_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (w->memory_events_fd >= 0) {
+        w->memory_events_wd = inotify_add_watch(loop->inotify_fd, path, IN_MODIFY);
+        w->oom_kills = read_event_key(w->memory_events_fd, "oom_kill");
+    }
+    
+    if (w->pidfd < 0 && w->cgroup_events_wd < 0 && w->memory_events_wd < 0) {
+        mc_log(3, "Nothing to watch for container %s", id);
+        watch_free(loop, w);
+        return MC_ERR_NOT_FOUND;
+    }
+    
+    if (loop->count >= loop->cap) {
+        int cap = loop->cap ? loop->cap * 2 : 16;
+        event_watch_t **watches = realloc(loop->watches, sizeof(*watches) * cap);
+        if (!watches) {
+            watch_free(loop, w);
+            return MC_ERR_MEMORY;
+        }
+        loop->watches = watches;
+        loop->cap = cap;
+    }
+    loop->watches[loop->count++] = w;
+    
+    mc_log(0, "Watching container %s (pidfd %d)", id, w->pidfd);
+    return MC_OK;
+}
+
+int event_loop_watch(event_loop_t *loop, container_t *container,
+                     container_event_cb_t cb, void *userdata) {
+    if (!container) {
+        return MC_ERR_INVALID;
+    }
+    return event_loop_watch_cgroup(loop, container->config.id, container->cgroup_path,
+                                   container->state == CONTAINER_RUNNING ||
+                                   container->state == CONTAINER_PAUSED ? container->pid : 0,
+                                   cb, userdata);
+}
+
+/**
+ * Remove watches flagged during dispatch
+ */
+static void compact_watches(event_loop_t *loop) {
+    int n = 0;
+    for (int i = 0; i < loop->count; i++) {
+        if (loop->watches[i]->removed) {
+            watch_free(loop, loop->watches[i]);
+        } else {
+            loop->watches[n++] = loop->watches[i];
+        }
+    }
+    loop->count = n;
+}
+
+int event_loop_unwatch(event_loop_t *loop, const char *id) {
+    if (!loop || !id) {
+        return MC_ERR_INVALID;
+    }
+    
+    for (int i = 0; i < loop->count; i++) {
+        if (!loop->watches[i]->removed && strcmp(loop->watches[i]->id, id) == 0) {
+            loop->watches[i]->removed = 1;
+            if (!loop->dispatching) {
+                compact_watches(loop);
+            }
+            return MC_OK;
+        }
+    }
+    
+    return MC_ERR_NOT_FOUND;
+}
+
+int event_loop_watch_pressure(event_loop_t *loop, const char *id, psi_resource_t resource,
+                              int full, long stall_us, long window_us) {
+    char path[PATH_MAX];
+    char spec[64];
+    
+    if (!loop || !id || resource < PSI_CPU || resource > PSI_IO || stall_us <= 0 ||
+        stall_us > window_us || window_us < PSI_WINDOW_MIN_US || window_us > PSI_WINDOW_MAX_US) {
+        return MC_ERR_INVALID;
+    }
+    
+    event_watch_t *w = NULL;
+    for (int i = 0; i < loop->count; i++) {
+        if (!loop->watches[i]->removed && strcmp(loop->watches[i]->id, id) == 0) {
+            w = loop->watches[i];
+            break;
+        }
+    }
+    if (!w) {
+        return MC_ERR_NOT_FOUND;
+    }
+    if (w->trigger_count >= EVENT_MAX_TRIGGERS) {
+        return MC_ERR_INVALID;
+    }
+    
+    pressure_trigger_t *t = calloc(1, sizeof(*t));
+    if (!t) {
+        return MC_ERR_MEMORY;
+    }
+    t->tag = EVENT_TAG_PRESSURE;
+    t->resource = resource;
+    t->full = full ? 1 : 0;
+    t->watch = w;
+    
+    /* The trigger lives as long as this fd stays open */
+    if (snprintf(path, sizeof(path), "%s/%s", w->cgroup_path, pressure_files[resource]) >=
+        (int)sizeof(path)) {
+        free(t);
+        return MC_ERR_INVALID;
+    }
+    t->fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (t->fd < 0) {
+        int err = errno;
+        mc_log(3, "Cannot open %s: %s", path, strerror(err));
+        free(t);
+        return err == ENOENT ? MC_ERR_NOT_FOUND : MC_ERR_CGROUP;
+    }
+    
+    /* The kernel expects the terminating NUL to be part of the write */
+    int len = snprintf(spec, sizeof(spec), "%s %ld %ld", t->full ? "full" : "some",
+                       stall_us, window_us);
+    if (write(t->fd, spec, len + 1) < 0) {
+        int err = errno;
+        mc_log(3, "Cannot set PSI trigger \"%s\" on %s: %s", spec, path, strerror(err));
+        if (err == EINVAL && window_us % PSI_UNPRIV_WINDOW_US != 0) {
+            mc_log(2, "Without CAP_SYS_RESOURCE the window must be a multiple of 2s");
+        }
+        close(t->fd);
+        free(t);
+        return err == EPERM ? MC_ERR_PERMISSION : MC_ERR_CGROUP;
+    }
+    
+    struct epoll_event ev = { .events = EPOLLPRI, .data.ptr = t };
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, t->fd, &ev) != 0) {
+        mc_log(3, "Failed to register PSI trigger: %s", strerror(errno));
+        close(t->fd);
+        free(t);
+        return MC_ERR_IO;
+    }
+    
+    w->triggers[w->trigger_count++] = t;
+    mc_log(0, "PSI trigger \"%s\" on %s for container %s", spec, pressure_files[resource], id);
+    return MC_OK;
+}
+
+/**
+ * Handle a readable pidfd: the process has exited
+ */
+static int handle_exit(event_loop_t *loop, event_watch_t *w) {
+    int status = -1;
+    
+    /* Reap it if it is our child; otherwise only report the exit */
+    if (waitpid(w->pid, &status, WNOHANG) <= 0) {
+        status = -1;
+    }
+    
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, w->pidfd, NULL);
+    close(w->pidfd);
+    w->pidfd = -1;
+    
+    dispatch(w, CONTAINER_EVENT_EXIT, status, NULL, 0);
+    return 1;
+}
+
+/**
+ * Drain inotify and re-read the cgroup files that changed
+ */
+static int handle_inotify(event_loop_t *loop) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int dispatched = 0;
+    
+    for (;;) {
+        ssize_t len = read(loop->inotify_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            break;
+        }
+    
+        for (char *p = buf; p < buf + len; ) {
+            struct inotify_event *ie = (struct inotify_event *)p;
+            p += sizeof(*ie) + ie->len;
+    
+            for (int i = 0; i < loop->count; i++) {
+                event_watch_t *w = loop->watches[i];
+                if (w->removed) continue;
+    
+                if (ie->wd == w->cgroup_events_wd) {
+                    int populated = (int)read_event_key(w->cgroup_events_fd, "populated");
+                    if (populated == 0 && w->populated != 0) {
+                        w->populated = populated;
+                        dispatch(w, CONTAINER_EVENT_UNPOPULATED, -1, NULL, 0);
+                        dispatched++;
+                    } else if (populated >= 0) {
+                        w->populated = populated;
+                    }
+                    break;
+                }
+    
+                if (ie->wd == w->memory_events_wd) {
+                    long oom_kills = read_event_key(w->memory_events_fd, "oom_kill");
+                    if (oom_kills > w->oom_kills) {
+                        w->oom_kills = oom_kills;
+                        dispatch(w, CONTAINER_EVENT_OOM, -1, NULL, 0);
+                        dispatched++;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    
+    return dispatched;
+}
+
+/**
+ * Handle EPOLLPRI on a PSI trigger; EPOLLERR means the cgroup went away
+ */
+static int handle_pressure(event_loop_t *loop, pressure_trigger_t *t, uint32_t events) {
+    char buf[256];
+    psi_stats_t psi;
+    
+    if (events & EPOLLERR) {
+        trigger_close(loop, t);
+        return 0;
+    }
+    
+    /* Report the current average alongside the event */
+    double avg10 = 0;
+    ssize_t n = pread(t->fd, buf, sizeof(buf) - 1, 0);
+    if (n > 0) {
+        buf[n] = '\0';
+        if (cgroup_parse_pressure(buf, &psi) == MC_OK) {
+            avg10 = t->full ? psi.full_avg10 : psi.some_avg10;
+        }
+    }
+    
+    dispatch(t->watch, CONTAINER_EVENT_PRESSURE, -1, t, avg10);
+    return 1;
+}
+
+int event_loop_run_once(event_loop_t *loop, int timeout_ms) {
+    struct epoll_event events[EVENT_BATCH];
+    
+    if (!loop) {
+        return MC_ERR_INVALID;
+    }
+    
+    int n = epoll_wait(loop->epfd, events, EVENT_BATCH, timeout_ms);
+    if (n < 0) {
+        return errno == EINTR ? 0 : MC_ERR_IO;
+    }
+    
+    int dispatched = 0;
+    loop->dispatching = 1;
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.ptr == &inotify_tag) {
+            dispatched += handle_inotify(loop);
+        } else if (*(event_tag_t *)events[i].data.ptr == EVENT_TAG_PRESSURE) {
+            pressure_trigger_t *t = events[i].data.ptr;
+            if (!t->watch->removed && t->fd >= 0) {
+                dispatched += handle_pressure(loop, t, events[i].events);
+            }
+        } else {
+            event_watch_t *w = events[i].data.ptr;
+            if (!w->removed && w->pidfd >= 0) {
+                dispatched += handle_exit(loop, w);
+            }
+        }
+    }
+    loop->dispatching = 0;
+    compact_watches(loop);
+    
+    return dispatched;
+}
+
+void event_loop_destroy(event_loop_t *loop) {
+    if (!loop) {
+        return;
+    }
+    
+    for (int i = 0; i < loop->count; i++) {
+        watch_free(loop, loop->watches[i]);
+    }
+    free(loop->watches);
+    close(loop->inotify_fd);
+    close(loop->epfd);
+    free(loop);
+}
@@ -6,14 +6,176 @@
 #include "../include/container.h"
 #include <sys/mount.h>
 #include <sys/sysmacros.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <linux/openat2.h>
 
-static int mkdir_p(const char *path, mode_t mode) {
+/* Latency counters for the native tree operations, FS_OP_* order */
+static fs_op_stats_t op_stats[2];
+
+static long elapsed_ns(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec);
+}
+
+static void op_record(fs_op_t op, const struct timespec *start, int ok, unsigned long entries) {
+    fs_op_stats_t *st = &op_stats[op];
+    long ns = elapsed_ns(start);
+    
+    __atomic_add_fetch(&st->calls, 1, __ATOMIC_RELAXED);
+    if (!ok) __atomic_add_fetch(&st->errors, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&st->entries, entries, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&st->total_ns, ns, __ATOMIC_RELAXED);
+    long max = __atomic_load_n(&st->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&st->max_ns, &max, ns, 0,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void fs_op_stats(fs_op_t op, fs_op_stats_t *stats) {
+    if (op != FS_OP_MKDIR && op != FS_OP_REMOVE) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    stats->calls = __atomic_load_n(&op_stats[op].calls, __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&op_stats[op].errors, __ATOMIC_RELAXED);
+    stats->entries = __atomic_load_n(&op_stats[op].entries, __ATOMIC_RELAXED);
+    stats->total_ns = __atomic_load_n(&op_stats[op].total_ns, __ATOMIC_RELAXED);
+    stats->max_ns = __atomic_load_n(&op_stats[op].max_ns, __ATOMIC_RELAXED);
+}
+
+int fs_mkdir_p(int dirfd, const char *path, mode_t mode) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    /* Common case: only the leaf is missing */
+    if (mkdirat(dirfd, path, mode) == 0) {
+        op_record(FS_OP_MKDIR, &start, 1, 1);
+        return MC_OK;
+    }
+    if (errno == EEXIST) {
+        op_record(FS_OP_MKDIR, &start, 1, 0);
+        return MC_OK;
+    }
+    if (errno != ENOENT) {
+        op_record(FS_OP_MKDIR, &start, 0, 0);
+        return MC_ERR_IO;
+    }
+    
+    /* Create each missing component in turn */
     char tmp[PATH_MAX];
+    unsigned long created = 0;
+    int ret = MC_OK;
     snprintf(tmp, sizeof(tmp), "%s", path);
-    for (char *p = tmp + 1; *p; p++) {
-        if (*p == '/') { *p = 0; mkdir(tmp, mode); *p = '/'; }
+    for (char *p = tmp + 1; ; p++) {
+        if (*p != '/' && *p != '\0') continue;
+        char c = *p;
+        *p = '\0';
+        if (mkdirat(dirfd, tmp, mode) == 0) {
+            created++;
+        } else if (errno != EEXIST) {
+            ret = MC_ERR_IO;
+            break;
+        }
+        *p = c;
+        if (c == '\0') break;
+    }
+    
+    op_record(FS_OP_MKDIR, &start, ret == MC_OK, created);
+    return ret;
+}
+
+/**
+ * Open a subdirectory for removal without following symlinks or crossing
+ * into another mount (openat2; O_NOFOLLOW on kernels without it)
+ */
+static int open_subdir(int dirfd, const char *name) {
+    static int no_openat2;
+    
+    if (!__atomic_load_n(&no_openat2, __ATOMIC_RELAXED)) {
+        struct open_how how = {
+            .flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC,
+            .resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS | RESOLVE_NO_XDEV,
+        };
+        int fd = syscall(SYS_openat2, dirfd, name, &how, sizeof(how));
+        if (fd >= 0 || errno != ENOSYS) return fd;
+        __atomic_store_n(&no_openat2, 1, __ATOMIC_RELAXED);
+    }
+    return openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+}
+
+/**
+ * Remove everything below an open directory (takes ownership of fd)
+ */
+static int remove_contents(int fd, unsigned long *removed) {
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+        return -1;
+    }
+    
+    int ret = 0;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+    
+        int is_dir = de->d_type == DT_DIR;
+        if (de->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = fstatat(dirfd(dir), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                     S_ISDIR(st.st_mode);
+        }
+    
+        if (is_dir) {
+            int sub = open_subdir(dirfd(dir), de->d_name);
+            if (sub < 0) {
+                /* EXDEV: something is still mounted here, leave it alone */
+                mc_log(2, "Not removing %s: %s", de->d_name, strerror(errno));
+                ret = -1;
+                continue;
+            }
+            if (remove_contents(sub, removed) != 0) ret = -1;
+        }
+    
+        if (unlinkat(dirfd(dir), de->d_name, is_dir ? AT_REMOVEDIR : 0) == 0) {
+            (*removed)++;
+        } else if (errno != ENOENT) {
+            ret = -1;
+        }
+    }
+    closedir(dir);
+    return ret;
+}
+
+int fs_remove_tree(int dirfd, const char *path) {
+    struct timespec start;
+    unsigned long removed = 0;
+    int ret = MC_OK;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    int fd = openat(dirfd, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOTDIR || errno == ELOOP) {
+            /* A file or symlink: remove just that */
+            if (unlinkat(dirfd, path, 0) == 0) removed++;
+            else if (errno != ENOENT) ret = MC_ERR_FILESYSTEM;
+        } else if (errno != ENOENT) {
+            ret = MC_ERR_FILESYSTEM;
+        }
+    } else {
+        if (remove_contents(fd, &removed) != 0) ret = MC_ERR_FILESYSTEM;
+        if (unlinkat(dirfd, path, AT_REMOVEDIR) == 0) removed++;
+        else if (errno != ENOENT) ret = MC_ERR_FILESYSTEM;
     }
-    return mkdir(tmp, mode) == 0 || errno == EEXIST ? MC_OK : MC_ERR_IO;
+    
+    op_record(FS_OP_REMOVE, &start, ret == MC_OK, removed);
+    return ret;
+}
+
+static int mkdir_p(const char *path, mode_t mode) {
+    return fs_mkdir_p(AT_FDCWD, path, mode);
 }
 
 static int dir_exists(const char *path) {
@@ -22,8 +184,10 @@ static int dir_exists(const char *path) {
 }
 
 int fs_pivot_root(const char *rootfs) {
+    static const char old_root[] = "/.old_root";
     char put_old[PATH_MAX];
-    if (!rootfs || !dir_exists(rootfs)) {
+    size_t len = rootfs ? strlen(rootfs) : 0;
+    if (!rootfs || len + sizeof(old_root) > sizeof(put_old) || !dir_exists(rootfs)) {
         mc_log(3, "Rootfs does not exist: %s", rootfs ? rootfs : "(null)");
         return MC_ERR_FILESYSTEM;
     }
@@ -40,8 +204,10 @@ int fs_pivot_root(const char *rootfs) {
         return MC_ERR_FILESYSTEM;
     }
     
-    snprintf(put_old, sizeof(put_old), "%s/.old_root", rootfs);
-    mkdir_p(put_old, 0700);
+    /* No snprintf(): this runs in the clone()d child */
+    memcpy(put_old, rootfs, len);
+    memcpy(put_old + len, old_root, sizeof(old_root));
+    mkdir(put_old, 0700);
     
     /* Switch root filesystem */
     if (syscall(SYS_pivot_root, rootfs, put_old) != 0) {
@@ -64,37 +230,402 @@ int fs_pivot_root(const char *rootfs) {
     return MC_OK;
 }
 
+/**
+ * Create the /dev skeleton (nodes, standard symlinks, mount points) below
+ * an open directory; returns the number of entries that failed
+ */
+static int dev_populate(int dirfd) {
+    static const struct { const char *name; mode_t mode; unsigned int major, minor; } devs[] = {
+        {"null", S_IFCHR | 0666, 1, 3}, {"zero", S_IFCHR | 0666, 1, 5},
+        {"full", S_IFCHR | 0666, 1, 7}, {"random", S_IFCHR | 0666, 1, 8},
+        {"urandom", S_IFCHR | 0666, 1, 9}, {"tty", S_IFCHR | 0666, 5, 0},
+        {"console", S_IFCHR | 0600, 5, 1},
+    };
+    static const char *links[][2] = {
+        {"/proc/self/fd", "fd"}, {"/proc/self/fd/0", "stdin"},
+        {"/proc/self/fd/1", "stdout"}, {"/proc/self/fd/2", "stderr"},
+        {"pts/ptmx", "ptmx"},
+    };
+    int failed = 0;
+    
+    for (size_t i = 0; i < sizeof(devs) / sizeof(devs[0]); i++) {
+        /* Explicit chmod: mknod modes are filtered through the umask */
+        if ((mknodat(dirfd, devs[i].name, devs[i].mode, makedev(devs[i].major, devs[i].minor)) != 0 &&
+             errno != EEXIST) ||
+            fchmodat(dirfd, devs[i].name, devs[i].mode & 07777, 0) != 0) {
+            failed++;
+        }
+    }
+    for (size_t i = 0; i < sizeof(links) / sizeof(links[0]); i++) {
+        if (symlinkat(links[i][0], dirfd, links[i][1]) != 0 && errno != EEXIST) failed++;
+    }
+    if (mkdirat(dirfd, "pts", 0755) != 0 && errno != EEXIST) failed++;
+    if (mkdirat(dirfd, "shm", 0755) != 0 && errno != EEXIST) failed++;
+    return failed;
+}
+
+/* /dev template: a detached, read-only tmpfs holding the skeleton, built
+ * once in the runtime process.  Children inherit the fd across clone()
+ * and attach a clone of it with two syscalls.  Clones share one
+ * superblock, hence read-only; /dev/pts and /dev/shm are mounted fresh
+ * per container on top. */
+static pthread_once_t dev_template_once = PTHREAD_ONCE_INIT;
+static int dev_template_fd = -1;
+
+static void dev_template_build(void) {
+    int fs = fsopen("tmpfs", FSOPEN_CLOEXEC);
+    if (fs < 0) {
+        mc_log(0, "fsopen() unavailable (%s), /dev is built per container", strerror(errno));
+        return;
+    }
+    if (fsconfig(fs, FSCONFIG_SET_STRING, "mode", "755", 0) != 0 ||
+        fsconfig(fs, FSCONFIG_SET_STRING, "size", "64k", 0) != 0 ||
+        fsconfig(fs, FSCONFIG_CMD_CREATE, NULL, NULL, 0) != 0) {
+        mc_log(2, "Could not create /dev template: %s", strerror(errno));
+        close(fs);
+        return;
+    }
+    int mnt = fsmount(fs, FSMOUNT_CLOEXEC, MOUNT_ATTR_NOSUID | MOUNT_ATTR_NOEXEC);
+    close(fs);
+    if (mnt < 0) {
+        mc_log(2, "Could not mount /dev template: %s", strerror(errno));
+        return;
+    }
+    
+    struct mount_attr attr = { .attr_set = MOUNT_ATTR_RDONLY };
+    if (dev_populate(mnt) != 0 || mount_setattr(mnt, "", AT_EMPTY_PATH, &attr, sizeof(attr)) != 0) {
+        mc_log(2, "Could not populate /dev template");
+        close(mnt);
+        return;
+    }
+    dev_template_fd = mnt;
+    mc_log(0, "Built /dev template");
+}
+
+int fs_prepare_essentials(void) {
+    pthread_once(&dev_template_once, dev_template_build);
+    return dev_template_fd >= 0 ? MC_OK : MC_ERR_NOT_FOUND;
+}
+
+/**
+ * mount() that creates a missing mount point; logs and returns -1 on failure
+ */
+static int mount_at(const char *source, const char *target, const char *type,
+                    unsigned long flags, const char *data, mode_t mode) {
+    if (mount(source, target, type, flags, data) == 0) return 0;
+    if (errno == ENOENT && mkdir(target, mode) == 0 &&
+        mount(source, target, type, flags, data) == 0) {
+        return 0;
+    }
+    mc_log(2, "Failed to mount %s on %s: %s", type, target, strerror(errno));
+    return -1;
+}
+
+/**
+ * Attach a private clone of the /dev template at /dev
+ */
+static int dev_attach_template(void) {
+    int fd = open_tree(dev_template_fd, "", OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_EMPTY_PATH);
+    if (fd < 0) return -1;
+    
+    int ret = move_mount(fd, "", AT_FDCWD, "/dev", MOVE_MOUNT_F_EMPTY_PATH);
+    if (ret != 0 && errno == ENOENT && mkdir("/dev", 0755) == 0) {
+        ret = move_mount(fd, "", AT_FDCWD, "/dev", MOVE_MOUNT_F_EMPTY_PATH);
+    }
+    close(fd);
+    return ret;
+}
+
+/**
+ * Build /dev in place: a tmpfs populated node by node
+ */
+static int dev_build(void) {
+    if (mount_at("tmpfs", "/dev", "tmpfs", MS_NOSUID | MS_NOEXEC, "mode=755", 0755) != 0) {
+        return -1;
+    }
+    int fd = open("/dev", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    int failed = dev_populate(fd);
+    close(fd);
+    return failed ? -1 : 0;
+}
+
+int fs_mount_essentials_timed(fs_mount_timing_t *timing) {
+    fs_mount_timing_t t = {0};
+    struct timespec start, step;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    step = start;
+    if (mount_at("proc", "/proc", "proc", MS_NOSUID | MS_NOEXEC | MS_NODEV, NULL, 0555) != 0) {
+        t.failures++;
+    }
+    t.proc_ns = elapsed_ns(&step);
+    
+    clock_gettime(CLOCK_MONOTONIC, &step);
+    if (mount_at("sysfs", "/sys", "sysfs", MS_NOSUID | MS_NOEXEC | MS_NODEV | MS_RDONLY,
+                 NULL, 0555) != 0) {
+        t.failures++;
+    }
+    t.sys_ns = elapsed_ns(&step);
+    
+    clock_gettime(CLOCK_MONOTONIC, &step);
+    if (dev_template_fd >= 0 && dev_attach_template() == 0) {
+        t.dev_template = 1;
+    } else if (dev_build() != 0) {
+        t.failures++;
+    }
+    t.dev_ns = elapsed_ns(&step);
+    
+    clock_gettime(CLOCK_MONOTONIC, &step);
+    if (mount_at("devpts", "/dev/pts", "devpts", MS_NOSUID | MS_NOEXEC,
+                 "newinstance,ptmxmode=0666", 0755) != 0) {
+        t.failures++;
+    }
+    if (mount_at("shm", "/dev/shm", "tmpfs", MS_NOSUID | MS_NOEXEC | MS_NODEV,
+                 "mode=1777", 01777) != 0) {
+        t.failures++;
+    }
+    t.devfs_ns = elapsed_ns(&step);
+    
+    clock_gettime(CLOCK_MONOTONIC, &step);
+    if (mount_at("tmpfs", "/tmp", "tmpfs", MS_NOSUID | MS_NODEV, "mode=1777", 01777) != 0) {
+        t.failures++;
+    }
+    t.tmp_ns = elapsed_ns(&step);
+    
+    t.total_ns = elapsed_ns(&start);
+    if (timing) *timing = t;
+    return t.failures ? MC_ERR_FILESYSTEM : MC_OK;
+}
+
 int fs_mount_essentials(void) {
-    mkdir_p("/proc", 0555); mkdir_p("/sys", 0555);
-    mkdir_p("/dev", 0755); mkdir_p("/dev/pts", 0755);
-    mkdir_p("/dev/shm", 1777); mkdir_p("/tmp", 01777);
+    return fs_mount_essentials_timed(NULL);
+}
+
+/* Root setup mode (fs_root_mode_t), AUTO until set */
+static int root_mode = FS_ROOT_AUTO;
+
+/* Seed mount namespace for the mount API path: a private namespace whose
+ * only mount is a small read-only tmpfs with a "rootfs" mount point.
+ * Children join it and unshare from there, so they neither copy nor
+ * re-propagate the host mount table.  Built once per process; the single
+ * MS_REC | MS_PRIVATE walk happens in the short-lived helper that makes it. */
+static pthread_once_t root_seed_once = PTHREAD_ONCE_INIT;
+static int root_seed_fd = -1;
+
+/**
+ * Body of the seed helper (async-signal-safe calls only: the caller may be
+ * multi-threaded); exits non-zero on failure
+ */
+static void root_seed_helper(int ready_fd, int hold_fd) {
+    if (unshare(CLONE_NEWNS) != 0 || mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) != 0) {
+        _exit(1);
+    }
     
-    mount("proc", "/proc", "proc", MS_NOSUID | MS_NOEXEC | MS_NODEV, NULL);
-    mount("sysfs", "/sys", "sysfs", MS_NOSUID | MS_NOEXEC | MS_NODEV | MS_RDONLY, NULL);
+    int fs = fsopen("tmpfs", FSOPEN_CLOEXEC);
+    if (fs < 0 || fsconfig(fs, FSCONFIG_SET_STRING, "size", "4k", 0) != 0 ||
+        fsconfig(fs, FSCONFIG_CMD_CREATE, NULL, NULL, 0) != 0) {
+        _exit(1);
+    }
+    int mnt = fsmount(fs, FSMOUNT_CLOEXEC, MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV | MOUNT_ATTR_NOEXEC);
+    struct mount_attr attr = { .attr_set = MOUNT_ATTR_RDONLY };
+    if (mnt < 0 || mkdirat(mnt, "rootfs", 0755) != 0 ||
+        mount_setattr(mnt, "", AT_EMPTY_PATH, &attr, sizeof(attr)) != 0) {
+        _exit(1);
+    }
     
-    if (mount("devtmpfs", "/dev", "devtmpfs", MS_NOSUID | MS_NOEXEC, NULL) != 0)
-        mount("tmpfs", "/dev", "tmpfs", MS_NOSUID | MS_NOEXEC, "mode=755");
+    /* Make the tmpfs the namespace root; /proc is merely a directory that
+     * exists everywhere to attach it on first */
+    if (move_mount(mnt, "", AT_FDCWD, "/proc", MOVE_MOUNT_F_EMPTY_PATH) != 0 ||
+        chdir("/proc") != 0 || syscall(SYS_pivot_root, ".", ".") != 0 ||
+        umount2(".", MNT_DETACH) != 0 || chdir("/") != 0) {
+        _exit(1);
+    }
     
-    mount("devpts", "/dev/pts", "devpts", MS_NOSUID | MS_NOEXEC, "newinstance,ptmxmode=0666");
-    mount("shm", "/dev/shm", "tmpfs", MS_NOSUID | MS_NOEXEC | MS_NODEV, "mode=1777");
-    mount("tmpfs", "/tmp", "tmpfs", MS_NOSUID | MS_NODEV, "mode=1777");
+    /* Ready: hold the namespace until the parent has opened it */
+    char c = 0;
+    if (write(ready_fd, &c, 1) != 1) _exit(1);
+    while (read(hold_fd, &c, 1) < 0 && errno == EINTR) {
+    }
+    _exit(0);
+}
+
+static void root_seed_build(void) {
+    int ready[2], hold[2];
+    if (pipe2(ready, O_CLOEXEC) != 0) return;
+    if (pipe2(hold, O_CLOEXEC) != 0) {
+        close(ready[0]);
+        close(ready[1]);
+        return;
+    }
     
-    struct { const char *name; mode_t mode; dev_t dev; } devs[] = {
-        {"/dev/null", S_IFCHR|0666, makedev(1,3)}, {"/dev/zero", S_IFCHR|0666, makedev(1,5)},
-        {"/dev/random", S_IFCHR|0666, makedev(1,8)}, {"/dev/urandom", S_IFCHR|0666, makedev(1,9)},
-        {"/dev/tty", S_IFCHR|0666, makedev(5,0)}, {"/dev/console", S_IFCHR|0600, makedev(5,1)},
-    };
-    for (size_t i = 0; i < sizeof(devs)/sizeof(devs[0]); i++)
-        mknod(devs[i].name, devs[i].mode, devs[i].dev);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(ready[0]);
+        close(hold[1]);
+        root_seed_helper(ready[1], hold[0]);
+    }
+    close(ready[1]);
+    close(hold[0]);
     
-    symlink("/proc/self/fd", "/dev/fd");
-    symlink("/proc/self/fd/0", "/dev/stdin");
-    symlink("/proc/self/fd/1", "/dev/stdout");
-    symlink("/proc/self/fd/2", "/dev/stderr");
+    char c;
+    if (pid > 0 && read(ready[0], &c, 1) == 1) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/ns/mnt", pid);
+        root_seed_fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    close(ready[0]);
+    close(hold[1]);  /* Lets the helper exit; the fd keeps the namespace */
+    if (pid > 0) waitpid(pid, NULL, 0);
+    
+    if (root_seed_fd < 0) {
+        mc_log(0, "Mount API root setup unavailable, using pivot_root on the rootfs");
+    } else {
+        mc_log(0, "Prepared seed mount namespace");
+    }
+}
+
+void fs_set_root_mode(fs_root_mode_t mode) {
+    __atomic_store_n(&root_mode, mode, __ATOMIC_RELAXED);
+}
+
+fs_root_mode_t fs_root_mode(void) {
+    fs_root_mode_t mode = __atomic_load_n(&root_mode, __ATOMIC_RELAXED);
+    if (mode == FS_ROOT_LEGACY) {
+        return FS_ROOT_LEGACY;
+    }
+    
+    pthread_once(&root_seed_once, root_seed_build);
+    return root_seed_fd >= 0 ? FS_ROOT_MOUNT_API : FS_ROOT_LEGACY;
+}
+
+int fs_open_root_tree(const char *rootfs) {
+    if (!rootfs || !rootfs[0]) {
+        return MC_ERR_INVALID;
+    }
+    
+    int fd = open_tree(AT_FDCWD, rootfs, OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_RECURSIVE);
+    mc_counter_inc(MC_COUNTER_MOUNT, fd < 0);
+    if (fd < 0) {
+        mc_log(3, "open_tree(%s) failed: %s", rootfs, strerror(errno));
+        return MC_ERR_FILESYSTEM;
+    }
+    
+    /* Only the rootfs subtree is walked, not the whole host table */
+    struct mount_attr attr = { .propagation = MS_PRIVATE };
+    if (mount_setattr(fd, "", AT_EMPTY_PATH | AT_RECURSIVE, &attr, sizeof(attr)) != 0) {
+        mc_log(3, "Failed to make %s private: %s", rootfs, strerror(errno));
+        close(fd);
+        return MC_ERR_FILESYSTEM;
+    }
+    return fd;
+}
+
+int fs_pivot_root_tree(int tree_fd) {
+    if (tree_fd < 0 || root_seed_fd < 0) {
+        return MC_ERR_INVALID;
+    }
+    
+    /* A fresh copy of the one-mount seed namespace */
+    if (setns(root_seed_fd, CLONE_NEWNS) != 0 || unshare(CLONE_NEWNS) != 0) {
+        mc_log(3, "Failed to enter seed mount namespace: %s", strerror(errno));
+        return MC_ERR_NAMESPACE;
+    }
+    
+    if (move_mount(tree_fd, "", AT_FDCWD, "/rootfs", MOVE_MOUNT_F_EMPTY_PATH) != 0) {
+        mc_log(3, "Failed to attach rootfs: %s", strerror(errno));
+        return MC_ERR_FILESYSTEM;
+    }
+    close(tree_fd);
+    
+    /* pivot_root(".", ".") stacks the old root on the new one, so the
+     * rootfs needs no .old_root directory */
+    if (chdir("/rootfs") != 0 || syscall(SYS_pivot_root, ".", ".") != 0) {
+        mc_log(3, "pivot_root failed: %s", strerror(errno));
+        return MC_ERR_FILESYSTEM;
+    }
+    if (umount2(".", MNT_DETACH) != 0) {
+        mc_log(2, "umount of seed root failed: %s", strerror(errno));
+    }
+    if (chdir("/") != 0) {
+        mc_log(3, "chdir to / failed: %s", strerror(errno));
+        return MC_ERR_FILESYSTEM;
+    }
+    
+    mc_log(1, "pivot_root completed successfully");
+    return MC_OK;
+}
+
+/* True if path is a mount point on a different device from its parent */
+static int is_mounted(const char *path, const char *parent) {
+    struct stat st, parent_st;
+    return stat(path, &st) == 0 && stat(parent, &parent_st) == 0 &&
+           st.st_dev != parent_st.st_dev;
+}
+
+int fs_setup_overlay(container_t *container) {
+    char upper[PATH_MAX], work[PATH_MAX], merged[PATH_MAX];
+    char opts[3 * PATH_MAX + 64];
+    
+    if (!container->config.image[0]) {
+        return MC_OK;  /* Plain rootfs */
+    }
+    
+    /* The image may be a colon-separated stack of layers */
+    char lower[PATH_MAX];
+    for (const char *p = container->config.image; *p; ) {
+        size_t len = strcspn(p, ":");
+        snprintf(lower, sizeof(lower), "%.*s", (int)len, p);
+        if (!dir_exists(lower)) {
+            mc_log(3, "ERROR: Image does not exist: %s", lower);
+            return MC_ERR_FILESYSTEM;
+        }
+        p += len;
+        if (*p == ':') p++;
+    }
+    
+    if (snprintf(upper, sizeof(upper), "%s/upper", container->state_dir) >= (int)sizeof(upper) ||
+        snprintf(work, sizeof(work), "%s/work", container->state_dir) >= (int)sizeof(work) ||
+        snprintf(merged, sizeof(merged), "%s/merged", container->state_dir) >= (int)sizeof(merged)) {
+        mc_log(3, "State directory path too long: %s", container->state_dir);
+        return MC_ERR_FILESYSTEM;
+    }
+    
+    if (mkdir_p(upper, 0755) != MC_OK || mkdir_p(work, 0700) != MC_OK ||
+        mkdir_p(merged, 0755) != MC_OK) {
+        mc_log(3, "Failed to create overlay directories in %s: %s",
+               container->state_dir, strerror(errno));
+        return MC_ERR_FILESYSTEM;
+    }
+    
+    /* Restarting a stopped container reuses the existing mount */
+    if (!is_mounted(merged, container->state_dir)) {
+        int len = snprintf(opts, sizeof(opts), "lowerdir=%s,upperdir=%s,workdir=%s",
+                           container->config.image, upper, work);
+        if (len >= (int)sizeof(opts)) {
+            return MC_ERR_INVALID;
+        }
+        
+        int ret = mount("overlay", merged, "overlay", 0, opts);
+        mc_counter_inc(MC_COUNTER_MOUNT, ret != 0);
+        if (ret != 0) {
+            mc_log(3, "Failed to mount overlay rootfs: %s", strerror(errno));
+            return MC_ERR_FILESYSTEM;
+        }
+        mc_log(1, "Mounted overlay rootfs %s (lower %s)", merged, container->config.image);
+    }
+    
+    snprintf(container->config.rootfs, sizeof(container->config.rootfs), "%s", merged);
     return MC_OK;
 }
 
 int fs_setup(container_t *container) {
+    /* Overlay images provide the rootfs themselves */
+    int ret = fs_setup_overlay(container);
+    if (ret != MC_OK) {
+        return ret;
+    }
+    
     if (!container->config.rootfs[0]) {
         mc_log(3, "ERROR: No rootfs specified - refusing to run without filesystem isolation!");
         return MC_ERR_FILESYSTEM;  /* REQUIRE rootfs for safety */
@@ -105,7 +636,7 @@ int fs_setup(container_t *container) {
     }
     
     /* Perform full filesystem isolation using pivot_root */
-    int ret = fs_pivot_root(container->config.rootfs);
+    ret = fs_pivot_root(container->config.rootfs);
     if (ret != MC_OK) {
         mc_log(3, "ERROR: pivot_root failed - cannot ensure filesystem isolation!");
         return ret;
@@ -124,8 +655,10 @@ int fs_setup(container_t *container) {
 int fs_cleanup(container_t *container) {
     if (container->state_dir[0]) {
         char merged[PATH_MAX];
-        snprintf(merged, sizeof(merged), "%s/merged", container->state_dir);
-        umount2(merged, MNT_DETACH);
+        if (snprintf(merged, sizeof(merged), "%s/merged", container->state_dir) < (int)sizeof(merged) &&
+            umount2(merged, MNT_DETACH) == 0) {
+            mc_log(1, "Unmounted overlay rootfs %s", merged);
+        }
     }
     return MC_OK;
 }
@@ -0,0 +1,889 @@
+/*
+ * KernelSight - Linux Container Runtime
+ * layers.c - Content-addressed image layer store
+ *
+ * Layers live under <state_dir>/layers/<sha256>/:
+ *   blob     the imported tarball (hard link when possible)
+ *   rootfs/  extracted contents, created lazily on first use
+ *   refs     number of containers using the layer
+ *   lock     flock() target serializing extraction and refcounting
+ *
+ * Extraction streams the (optionally gzip-compressed) tarball through a
+ * bounded buffer straight into the layer directory; independent layers
+ * are extracted in parallel.  OCI whiteouts are converted to overlayfs
+ * whiteouts so the layers can be stacked as overlay lowerdirs.
+ */
+
+#define _GNU_SOURCE
+#include "../include/container.h"
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <zlib.h>
+
+/* Bounded I/O buffer for hashing, copying and extraction */
+#define LAYER_BUF_SIZE (64 * 1024)
+
+/* Maximum number of layers extracted concurrently */
+#define LAYER_MAX_PARALLEL 4
+
+#define TAR_BLOCK 512
+
+/* ===== SHA-256 ===== */
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t block[64];
+    size_t used;
+} sha256_ctx_t;
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_transform(sha256_ctx_t *ctx, const uint8_t *data) {
+    uint32_t w[64], a, b, c, d, e, f, g, h;
+    
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)data[i * 4] << 24 | (uint32_t)data[i * 4 + 1] << 16 |
+               (uint32_t)data[i * 4 + 2] << 8 | data[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    
+    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3];
+    e = ctx->state[4]; f = ctx->state[5]; g = ctx->state[6]; h = ctx->state[7];
+    
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) +
+                      sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+}
+
+static void sha256_init(sha256_ctx_t *ctx) {
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(ctx->state, init, sizeof(init));
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+static void sha256_update(sha256_ctx_t *ctx, const uint8_t *data, size_t len) {
+    ctx->length += len;
+    while (len > 0) {
+        size_t n = 64 - ctx->used;
+        if (n > len) n = len;
+        memcpy(ctx->block + ctx->used, data, n);
+        ctx->used += n;
+        data += n;
+        len -= n;
+        if (ctx->used == 64) {
+            sha256_transform(ctx, ctx->block);
+            ctx->used = 0;
+        }
+    }
+}
+
+static void sha256_final_hex(sha256_ctx_t *ctx, char *hex) {
+    uint64_t bits = ctx->length * 8;
+    uint8_t pad = 0x80;
+    
+    sha256_update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->used != 56) {
+        sha256_update(ctx, &pad, 1);
+    }
+    for (int i = 7; i >= 0; i--) {
+        uint8_t byte = (uint8_t)(bits >> (i * 8));
+        sha256_update(ctx, &byte, 1);
+    }
+    
+    for (int i = 0; i < 8; i++) {
+        sprintf(hex + i * 8, "%08x", ctx->state[i]);
+    }
+    hex[64] = '\0';
+}
+
+/* ===== Layer paths and locking ===== */
+
+static void layer_path(char *buf, size_t size, const char *digest, const char *leaf) {
+    snprintf(buf, size, "%s/layers/%s%s%s", get_state_dir(), digest,
+             leaf ? "/" : "", leaf ? leaf : "");
+}
+
+static int valid_digest(const char *digest) {
+    if (!digest || strlen(digest) != 64) {
+        return 0;
+    }
+    for (int i = 0; i < 64; i++) {
+        if (!((digest[i] >= '0' && digest[i] <= '9') || (digest[i] >= 'a' && digest[i] <= 'f'))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Take an exclusive lock on the layer (returns the lock fd)
+ */
+static int layer_lock(const char *digest) {
+    char path[PATH_MAX];
+    layer_path(path, sizeof(path), digest, "lock");
+    
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    if (flock(fd, LOCK_EX) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void layer_unlock(int fd) {
+    if (fd >= 0) {
+        flock(fd, LOCK_UN);
+        close(fd);
+    }
+}
+
+/* ===== Import ===== */
+
+/**
+ * Copy a file through a bounded buffer
+ */
+static int copy_file(const char *src, const char *dst) {
+    char *buf = malloc(LAYER_BUF_SIZE);
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+    int out = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    int ret = MC_OK;
+    
+    if (!buf || in < 0 || out < 0) {
+        ret = buf ? MC_ERR_IO : MC_ERR_MEMORY;
+        goto done;
+    }
+    
+    ssize_t n;
+    while ((n = read(in, buf, LAYER_BUF_SIZE)) > 0) {
+        if (write(out, buf, n) != n) {
+            ret = MC_ERR_IO;
+            break;
+        }
+    }
+    if (n < 0) ret = MC_ERR_IO;
+    
+done:
+    if (in >= 0) close(in);
+    if (out >= 0) close(out);
+    if (ret != MC_OK) unlink(dst);
+    free(buf);
+    return ret;
+}
+
+int layer_import(const char *tarball, char *digest) {
+    char path[PATH_MAX], blob[PATH_MAX];
+    
+    if (!tarball || !digest) {
+        return MC_ERR_INVALID;
+    }
+    
+    /* Hash the blob (digest of the tarball as stored, like OCI) */
+    int fd = open(tarball, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        mc_log(3, "Failed to open layer %s: %s", tarball, strerror(errno));
+        return MC_ERR_NOT_FOUND;
+    }
+    
+    uint8_t *buf = malloc(LAYER_BUF_SIZE);
+    if (!buf) {
+        close(fd);
+        return MC_ERR_MEMORY;
+    }
+    
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    ssize_t n;
+    while ((n = read(fd, buf, LAYER_BUF_SIZE)) > 0) {
+        sha256_update(&ctx, buf, n);
+    }
+    close(fd);
+    free(buf);
+    if (n < 0) {
+        return MC_ERR_IO;
+    }
+    sha256_final_hex(&ctx, digest);
+    
+    /* Deduplicate: a layer with this digest is already stored */
+    snprintf(path, sizeof(path), "%s/layers", get_state_dir());
+    mkdir(get_state_dir(), 0755);
+    mkdir(path, 0700);
+    
+    layer_path(path, sizeof(path), digest, NULL);
+    if (mkdir(path, 0755) != 0) {
+        if (errno == EEXIST) {
+            mc_log(1, "Layer %.12s already stored", digest);
+            return MC_OK;
+        }
+        mc_log(3, "Failed to create layer directory %s: %s", path, strerror(errno));
+        return MC_ERR_FILESYSTEM;
+    }
+    
+    /* Hard link when on the same filesystem, copy otherwise */
+    layer_path(blob, sizeof(blob), digest, "blob");
+    if (link(tarball, blob) != 0 && copy_file(tarball, blob) != MC_OK) {
+        mc_log(3, "Failed to store layer blob: %s", strerror(errno));
+        rmdir(path);
+        return MC_ERR_IO;
+    }
+    
+    mc_log(1, "Imported layer %s", digest);
+    return MC_OK;
+}
+
+/* ===== Tar extraction ===== */
+
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+} tar_header_t;
+
+typedef struct {
+    gzFile in;
+    int rootfd;                   /* Layer rootfs directory */
+    char *buf;                    /* LAYER_BUF_SIZE bounded buffer */
+    char long_name[PATH_MAX];     /* GNU 'L' / pax path for the next entry */
+    char long_link[PATH_MAX];     /* GNU 'K' / pax linkpath for the next entry */
+    char parent_path[PATH_MAX];   /* Cached parent directory of the last entry */
+    int parent_fd;
+} tar_reader_t;
+
+static long tar_number(const char *field, size_t len) {
+    /* GNU base-256 encoding for large values */
+    if ((unsigned char)field[0] & 0x80) {
+        long value = field[0] & 0x7f;
+        for (size_t i = 1; i < len; i++) {
+            value = (value << 8) | (unsigned char)field[i];
+        }
+        return value;
+    }
+    
+    long value = 0;
+    for (size_t i = 0; i < len && field[i]; i++) {
+        if (field[i] >= '0' && field[i] <= '7') {
+            value = value * 8 + (field[i] - '0');
+        }
+    }
+    return value;
+}
+
+static int tar_read(tar_reader_t *t, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        int n = gzread(t->in, p, len > INT32_MAX ? INT32_MAX : (unsigned)len);
+        if (n <= 0) {
+            return MC_ERR_IO;
+        }
+        p += n;
+        len -= n;
+    }
+    return MC_OK;
+}
+
+/**
+ * Skip (or copy into out_fd) an entry's data plus block padding
+ */
+static int tar_data(tar_reader_t *t, long size, int out_fd) {
+    long padded = (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+    long remaining = padded;
+    
+    while (remaining > 0) {
+        size_t chunk = remaining > LAYER_BUF_SIZE ? LAYER_BUF_SIZE : (size_t)remaining;
+        if (tar_read(t, t->buf, chunk) != MC_OK) {
+            return MC_ERR_IO;
+        }
+        if (out_fd >= 0) {
+            long data_left = size - (padded - remaining);
+            size_t data = data_left < (long)chunk ? (size_t)(data_left > 0 ? data_left : 0) : chunk;
+            if (data > 0 && write(out_fd, t->buf, data) != (ssize_t)data) {
+                return MC_ERR_IO;
+            }
+        }
+        remaining -= chunk;
+    }
+    return MC_OK;
+}
+
+/**
+ * Read a metadata entry (GNU long name, pax header) into a string
+ */
+static int tar_string(tar_reader_t *t, long size, char *out, size_t out_size) {
+    if (size <= 0 || size > LAYER_BUF_SIZE - 1) {
+        return tar_data(t, size, -1);
+    }
+    long padded = (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+    if (padded > LAYER_BUF_SIZE || tar_read(t, t->buf, padded) != MC_OK) {
+        return MC_ERR_IO;
+    }
+    t->buf[size] = '\0';
+    if (out) {
+        snprintf(out, out_size, "%s", t->buf);
+    }
+    return MC_OK;
+}
+
+/**
+ * Apply the path/linkpath keys of a pax extended header of size bytes,
+ * as read into t->buf by tar_string()
+ */
+static void tar_pax(tar_reader_t *t, long size) {
+    if (size <= 0 || size > LAYER_BUF_SIZE - 1) {
+        return;  /* Skipped by tar_string(), t->buf holds something else */
+    }
+    
+    char *p = t->buf;
+    char *buf_end = t->buf + size;
+    while (p < buf_end && *p) {
+        /* "<len> <key>=<value>\n", len counting the whole record */
+        char *end;
+        long len = strtol(p, &end, 10);
+        if (len <= 0 || len > buf_end - p || *end != ' ') break;
+    
+        char *record_end = p + len;
+        char *key = end + 1;
+        char *eq = key < record_end ? memchr(key, '=', record_end - key) : NULL;
+        if (!eq || eq + 1 >= record_end) break;
+    
+        size_t value_len = record_end - (eq + 1) - 1;  /* Drop the newline */
+        if (value_len < PATH_MAX) {
+            if (strncmp(key, "path=", 5) == 0) {
+                memcpy(t->long_name, eq + 1, value_len);
+                t->long_name[value_len] = '\0';
+            } else if (strncmp(key, "linkpath=", 9) == 0) {
+                memcpy(t->long_link, eq + 1, value_len);
+                t->long_link[value_len] = '\0';
+            }
+        }
+        p = record_end;
+    }
+}
+
+/**
+ * Normalize an entry path; rejects absolute escapes and ".." components
+ */
+static int tar_clean_path(char *path) {
+    char *src = path;
+    while (*src == '/' || (src[0] == '.' && src[1] == '/')) {
+        src += src[0] == '/' ? 1 : 2;
+    }
+    memmove(path, src, strlen(src) + 1);
+    
+    size_t len = strlen(path);
+    while (len > 0 && path[len - 1] == '/') {
+        path[--len] = '\0';
+    }
+    if (len == 0 || strcmp(path, ".") == 0) {
+        return 0;  /* The root itself */
+    }
+    
+    for (char *c = path; c; c = strchr(c, '/')) {
+        if (*c == '/') c++;
+        if (c[0] == '.' && c[1] == '.' && (c[2] == '/' || c[2] == '\0')) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Open the parent directory of path inside the layer without following
+ * symlinks, creating missing directories.  The last parent is cached since
+ * tarballs list entries directory by directory.
+ * @return Parent dirfd owned by the reader, or -1; *leaf points into path
+ */
+static int tar_parent(tar_reader_t *t, char *path, char **leaf) {
+    char *slash = strrchr(path, '/');
+    *leaf = slash ? slash + 1 : path;
+    
+    size_t parent_len = slash ? (size_t)(slash - path) : 0;
+    if (t->parent_fd >= 0 && strlen(t->parent_path) == parent_len &&
+        strncmp(t->parent_path, path, parent_len) == 0) {
+        return t->parent_fd;
+    }
+    
+    if (t->parent_fd >= 0 && t->parent_fd != t->rootfd) {
+        close(t->parent_fd);
+    }
+    t->parent_fd = -1;
+    
+    int fd = t->rootfd;
+    char component[NAME_MAX + 1];
+    for (char *p = path; p < path + parent_len; ) {
+        char *next = memchr(p, '/', path + parent_len - p);
+        size_t len = next ? (size_t)(next - p) : (size_t)(path + parent_len - p);
+        if (len > NAME_MAX) {
+            goto fail;
+        }
+        memcpy(component, p, len);
+        component[len] = '\0';
+    
+        int child = openat(fd, component, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (child < 0 && errno == ENOENT) {
+            mkdirat(fd, component, 0755);
+            child = openat(fd, component, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        }
+        if (fd != t->rootfd) close(fd);
+        if (child < 0) {
+            return -1;  /* Symlink or non-directory in the way */
+        }
+        fd = child;
+        p += len + 1;
+    }
+    
+    memcpy(t->parent_path, path, parent_len);
+    t->parent_path[parent_len] = '\0';
+    t->parent_fd = fd;
+    return fd;
+    
+fail:
+    if (fd != t->rootfd) close(fd);
+    return -1;
+}
+
+/**
+ * Create one entry; remove whatever is in the way first
+ */
+static int tar_entry(tar_reader_t *t, tar_header_t *h, char *path, const char *link, long size) {
+    char *leaf;
+    int dirfd = tar_parent(t, path, &leaf);
+    if (dirfd < 0) {
+        mc_log(2, "Skipping unsafe layer entry %s", path);
+        return tar_data(t, size, -1);
+    }
+    
+    mode_t mode = (mode_t)tar_number(h->mode, sizeof(h->mode)) & 07777;
+    uid_t uid = (uid_t)tar_number(h->uid, sizeof(h->uid));
+    gid_t gid = (gid_t)tar_number(h->gid, sizeof(h->gid));
+    int ret = MC_OK;
+    
+    /* OCI whiteouts become overlayfs whiteouts */
+    if (strncmp(leaf, ".wh.", 4) == 0) {
+        if (strcmp(leaf, ".wh..wh..opq") == 0) {
+            char proc[64];
+            snprintf(proc, sizeof(proc), "/proc/self/fd/%d", dirfd);
+            setxattr(proc, "trusted.overlay.opaque", "y", 1, 0);
+        } else {
+            unlinkat(dirfd, leaf + 4, 0);
+            mknodat(dirfd, leaf + 4, S_IFCHR | 0000, makedev(0, 0));
+        }
+        return tar_data(t, size, -1);
+    }
+    
+    if (h->typeflag != '5') {
+        unlinkat(dirfd, leaf, 0);
+    }
+    
+    switch (h->typeflag) {
+        case '0': case '\0': case '7': {
+            int fd = openat(dirfd, leaf, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+            ret = tar_data(t, size, fd);
+            if (fd >= 0) {
+                fchown(fd, uid, gid);
+                fchmod(fd, mode);
+                struct timespec times[2] = {
+                    { .tv_nsec = UTIME_OMIT },
+                    { .tv_sec = tar_number(h->mtime, sizeof(h->mtime)) },
+                };
+                futimens(fd, times);
+                close(fd);
+            }
+            return ret;
+        }
+        case '5': {
+            /* Not fchmodat(): it would follow an earlier symlink out of the layer */
+            int fd = -1;
+            if (mkdirat(dirfd, leaf, 0755) == 0 || errno == EEXIST) {
+                fd = openat(dirfd, leaf, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            }
+            if (fd < 0 && (errno == ENOTDIR || errno == ELOOP) && unlinkat(dirfd, leaf, 0) == 0 &&
+                mkdirat(dirfd, leaf, 0755) == 0) {
+                fd = openat(dirfd, leaf, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            }
+            if (fd < 0 || fchmod(fd, mode) != 0) ret = MC_ERR_FILESYSTEM;
+            if (fd >= 0) close(fd);
+            break;
+        }
+        case '2':
+            if (symlinkat(link, dirfd, leaf) != 0) ret = MC_ERR_FILESYSTEM;
+            break;
+        case '1': {
+            /* Hard link targets are resolved inside the layer as well */
+            char target[PATH_MAX];
+            snprintf(target, sizeof(target), "%s", link);
+            if (tar_clean_path(target) <= 0) {
+                ret = MC_ERR_FILESYSTEM;
+                break;
+            }
+            char saved_leaf[NAME_MAX + 1];
+            snprintf(saved_leaf, sizeof(saved_leaf), "%s", leaf);
+            char *target_leaf;
+            int target_dir = tar_parent(t, target, &target_leaf);
+            int link_dir = target_dir >= 0 ? dup(target_dir) : -1;
+            dirfd = tar_parent(t, path, &leaf);
+            if (link_dir < 0 || dirfd < 0 ||
+                linkat(link_dir, target_leaf, dirfd, saved_leaf, 0) != 0) {
+                ret = MC_ERR_FILESYSTEM;
+            }
+            if (link_dir >= 0) close(link_dir);
+            break;
+        }
+        case '3': case '4': case '6': {
+            mode_t type = h->typeflag == '3' ? S_IFCHR : h->typeflag == '4' ? S_IFBLK : S_IFIFO;
+            dev_t dev = makedev(tar_number(h->devmajor, sizeof(h->devmajor)),
+                                tar_number(h->devminor, sizeof(h->devminor)));
+            if (mknodat(dirfd, leaf, type | mode, dev) != 0) ret = MC_ERR_FILESYSTEM;
+            break;
+        }
+        default:
+            mc_log(0, "Skipping unsupported layer entry type '%c': %s", h->typeflag, path);
+            return tar_data(t, size, -1);
+    }
+    
+    if (ret == MC_OK) {
+        fchownat(dirfd, leaf, uid, gid, AT_SYMLINK_NOFOLLOW);
+    } else {
+        mc_log(0, "Could not create layer entry %s: %s", path, strerror(errno));
+    }
+    return tar_data(t, size, -1);
+}
+
+/**
+ * Stream a tarball into a directory
+ */
+static int tar_extract(const char *tarball, const char *dest) {
+    tar_reader_t t;
+    tar_header_t h;
+    char path[PATH_MAX];
+    int ret = MC_OK;
+    
+    memset(&t, 0, sizeof(t));
+    t.parent_fd = -1;
+    t.rootfd = open(dest, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    t.in = gzopen(tarball, "rb");  /* Reads plain tar transparently */
+    t.buf = malloc(LAYER_BUF_SIZE);
+    
+    if (t.rootfd < 0 || !t.in || !t.buf) {
+        ret = t.buf ? MC_ERR_IO : MC_ERR_MEMORY;
+        goto done;
+    }
+    gzbuffer(t.in, LAYER_BUF_SIZE);
+    
+    for (;;) {
+        if (tar_read(&t, &h, sizeof(h)) != MC_OK) {
+            ret = MC_ERR_IO;
+            break;
+        }
+    
+        /* End of archive is marked with zero blocks */
+        if (h.name[0] == '\0') {
+            break;
+        }
+    
+        unsigned long sum = 0;
+        for (size_t i = 0; i < sizeof(h); i++) {
+            unsigned char c = ((unsigned char *)&h)[i];
+            sum += (i >= offsetof(tar_header_t, chksum) &&
+                    i < offsetof(tar_header_t, chksum) + sizeof(h.chksum)) ? ' ' : c;
+        }
+        if (sum != (unsigned long)tar_number(h.chksum, sizeof(h.chksum))) {
+            mc_log(3, "Corrupt tar header in %s", tarball);
+            ret = MC_ERR_IO;
+            break;
+        }
+    
+        long size = tar_number(h.size, sizeof(h.size));
+    
+        /* Metadata entries describe the next header */
+        if (h.typeflag == 'L' || h.typeflag == 'K') {
+            ret = tar_string(&t, size, h.typeflag == 'L' ? t.long_name : t.long_link, PATH_MAX);
+            if (ret != MC_OK) break;
+            continue;
+        }
+        if (h.typeflag == 'x' || h.typeflag == 'g') {
+            ret = tar_string(&t, size, NULL, 0);
+            if (ret != MC_OK) break;
+            if (h.typeflag == 'x') tar_pax(&t, size);
+            continue;
+        }
+    
+        if (t.long_name[0]) {
+            snprintf(path, sizeof(path), "%s", t.long_name);
+        } else if (h.prefix[0] && memcmp(h.magic, "ustar", 5) == 0) {
+            snprintf(path, sizeof(path), "%.155s/%.100s", h.prefix, h.name);
+        } else {
+            snprintf(path, sizeof(path), "%.100s", h.name);
+        }
+    
+        char link[PATH_MAX];
+        if (t.long_link[0]) {
+            snprintf(link, sizeof(link), "%s", t.long_link);
+        } else {
+            snprintf(link, sizeof(link), "%.100s", h.linkname);
+        }
+        t.long_name[0] = '\0';
+        t.long_link[0] = '\0';
+    
+        int clean = tar_clean_path(path);
+        if (clean <= 0) {
+            if (clean < 0) mc_log(2, "Skipping layer entry outside the root: %s", path);
+            ret = tar_data(&t, size, -1);
+        } else {
+            ret = tar_entry(&t, &h, path, link, size);
+        }
+        if (ret != MC_OK) break;
+    }
+    
+done:
+    if (t.parent_fd >= 0 && t.parent_fd != t.rootfd) close(t.parent_fd);
+    if (t.rootfd >= 0) close(t.rootfd);
+    if (t.in) gzclose(t.in);
+    free(t.buf);
+    return ret;
+}
+
+/* ===== Lazy extraction ===== */
+
+int layer_ensure(const char *digest) {
+    char rootfs[PATH_MAX], partial[PATH_MAX], blob[PATH_MAX];
+    struct stat st;
+    
+    if (!valid_digest(digest)) {
+        return MC_ERR_INVALID;
+    }
+    
+    layer_path(rootfs, sizeof(rootfs), digest, "rootfs");
+    if (stat(rootfs, &st) == 0) {
+        return MC_OK;  /* Already extracted */
+    }
+    
+    layer_path(blob, sizeof(blob), digest, "blob");
+    if (stat(blob, &st) != 0) {
+        mc_log(3, "Layer %s is not in the store", digest);
+        return MC_ERR_NOT_FOUND;
+    }
+    
+    int lock = layer_lock(digest);
+    if (lock < 0) {
+        return MC_ERR_IO;
+    }
+    
+    /* Someone else may have extracted it while we waited for the lock */
+    int ret = MC_OK;
+    if (stat(rootfs, &st) != 0) {
+        layer_path(partial, sizeof(partial), digest, "rootfs.partial");
+        fs_remove_tree(AT_FDCWD, partial);
+    
+        if (mkdir(partial, 0755) != 0) {
+            ret = MC_ERR_FILESYSTEM;
+        } else {
+            ret = tar_extract(blob, partial);
+        }
+    
+        if (ret == MC_OK && rename(partial, rootfs) != 0) {
+            ret = MC_ERR_FILESYSTEM;
+        }
+        if (ret == MC_OK) {
+            mc_log(1, "Extracted layer %.12s", digest);
+        } else {
+            mc_log(3, "Failed to extract layer %s", digest);
+        }
+    }
+    
+    layer_unlock(lock);
+    return ret;
+}
+
+typedef struct {
+    const char **digests;
+    int count;
+    int next;                     /* Next layer to extract */
+    int ret;                      /* First error seen */
+    pthread_mutex_t lock;
+} extract_job_t;
+
+static void *extract_worker(void *arg) {
+    extract_job_t *job = arg;
+    
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        int i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->count) {
+            break;
+        }
+    
+        int ret = layer_ensure(job->digests[i]);
+        if (ret != MC_OK) {
+            pthread_mutex_lock(&job->lock);
+            if (job->ret == MC_OK) job->ret = ret;
+            pthread_mutex_unlock(&job->lock);
+        }
+    }
+    return NULL;
+}
+
+int layer_ensure_many(const char **digests, int count) {
+    pthread_t threads[LAYER_MAX_PARALLEL];
+    extract_job_t job = { .digests = digests, .count = count, .ret = MC_OK };
+    int nthreads = count < LAYER_MAX_PARALLEL ? count : LAYER_MAX_PARALLEL;
+    int started = 0;
+    
+    if (count <= 1) {
+        return count == 1 ? layer_ensure(digests[0]) : MC_OK;
+    }
+    
+    pthread_mutex_init(&job.lock, NULL);
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, extract_worker, &job) == 0) {
+            started++;
+        }
+    }
+    if (started == 0) {
+        extract_worker(&job);  /* No threads: do it inline */
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&job.lock);
+    
+    return job.ret;
+}
+
+/* ===== Reference counting ===== */
+
+static int layer_adjust_refs(const char *digest, int delta) {
+    char path[PATH_MAX];
+    
+    if (!valid_digest(digest)) {
+        return MC_ERR_INVALID;
+    }
+    
+    int lock = layer_lock(digest);
+    if (lock < 0) {
+        return MC_ERR_NOT_FOUND;
+    }
+    
+    layer_path(path, sizeof(path), digest, "refs");
+    int refs = 0;
+    FILE *fp = fopen(path, "r");
+    if (fp) {
+        if (fscanf(fp, "%d", &refs) != 1) refs = 0;
+        fclose(fp);
+    }
+    
+    refs += delta;
+    if (refs < 0) refs = 0;
+    
+    int ret = refs;
+    fp = fopen(path, "w");
+    if (!fp || fprintf(fp, "%d\n", refs) < 0) ret = MC_ERR_IO;
+    if (fp && fclose(fp) != 0) ret = MC_ERR_IO;
+    
+    layer_unlock(lock);
+    return ret;
+}
+
+int layer_ref(const char *digest) {
+    return layer_adjust_refs(digest, 1);
+}
+
+int layer_unref(const char *digest) {
+    return layer_adjust_refs(digest, -1);
+}
+
+int layer_build_lowerdir(const char **digests, int count, char *out, size_t size) {
+    char path[PATH_MAX];
+    size_t used = 0;
+    
+    if (count <= 0 || !out || size == 0) {
+        return MC_ERR_INVALID;
+    }
+    
+    /* Overlay lists the top layer first; layers are given base first */
+    out[0] = '\0';
+    for (int i = count - 1; i >= 0; i--) {
+        if (!valid_digest(digests[i])) {
+            return MC_ERR_INVALID;
+        }
+        layer_path(path, sizeof(path), digests[i], "rootfs");
+        int n = snprintf(out + used, size - used, "%s%s", used ? ":" : "", path);
+        if (n < 0 || (size_t)n >= size - used) {
+            return MC_ERR_INVALID;
+        }
+        used += n;
+    }
+    return MC_OK;
+}
+
+int layer_release_lowerdir(const char *lowerdir) {
+    char prefix[PATH_MAX], digest[65];
+    
+    if (!lowerdir) {
+        return MC_ERR_INVALID;
+    }
+    
+    snprintf(prefix, sizeof(prefix), "%s/layers/", get_state_dir());
+    size_t prefix_len = strlen(prefix);
+    
+    /* Drop one reference for every store layer in the list */
+    for (const char *p = lowerdir; p && *p; ) {
+        if (strncmp(p, prefix, prefix_len) == 0 && strlen(p + prefix_len) >= 64) {
+            memcpy(digest, p + prefix_len, 64);
+            digest[64] = '\0';
+            if (valid_digest(digest)) {
+                layer_unref(digest);
+            }
+        }
+        p = strchr(p, ':');
+        if (p) p++;
+    }
+    return MC_OK;
+}
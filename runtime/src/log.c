@@ -0,0 +1,270 @@
+/*
+ * KernelSight - Linux Container Runtime
+ * log.c - Asynchronous logger
+ *
+ * mc_log() formats the message into a fixed-size record and publishes it
+ * in a bounded multi-producer ring (per-slot sequence numbers, so
+ * producers only contend on one CAS and never on a lock).  A background
+ * thread drains the ring and writes whole batches to stderr with a single
+ * write(2); it sleeps on a futex when the ring is empty.
+ *
+ * Container children (clone/fork before exec) have no drain thread: a
+ * process other than the one that owns the ring writes its line
+ * synchronously, also with one write(2).  When the ring is full, warnings
+ * and errors are written synchronously and lower levels are dropped and
+ * counted.  The runtime's own namespace children call mc_log_mute()
+ * instead: vsnprintf() is not async-signal-safe between clone and exec.
+ */
+
+#define _GNU_SOURCE
+#include "../include/container.h"
+#include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
+#include <linux/futex.h>
+
+#define LOG_RING_SLOTS 1024           /* Power of two */
+#define LOG_MSG_MAX 224
+#define LOG_LINE_MAX (LOG_MSG_MAX + 32)
+#define LOG_DRAIN_BATCH 64
+#define LOG_IDLE_WAIT_MS 100
+
+/* One message; seq == position: free, seq == position + 1: published */
+typedef struct {
+    unsigned long seq;
+    long ts_ns;                   /* CLOCK_REALTIME */
+    int level;
+    int len;
+    char msg[LOG_MSG_MAX];
+} log_record_t;
+
+static struct {
+    log_record_t *slots;
+    unsigned long head;           /* Next position to publish */
+    unsigned long tail;           /* Next position to drain (drain side only) */
+    unsigned long dropped;
+    int wake;                     /* Futex word, bumped to wake the drain thread */
+    int waiting;                  /* Drain thread is (about to be) asleep */
+    pid_t owner;                  /* Process that runs the drain thread */
+} ring;
+
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int log_level = MC_LOG_COMPILE_LEVEL > 1 ? MC_LOG_COMPILE_LEVEL : 1;
+int mc_log_muted;
+
+static const char *const level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+static long realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * "HH:MM:SS.uuuuuu [LEVEL] msg\n" (UTC: no tz lock, safe in children)
+ */
+static int format_line(char *line, size_t size, long ts_ns, int level, const char *msg, int len) {
+    long secs = ts_ns / 1000000000L;
+    long day = secs % 86400;
+    return snprintf(line, size, "%02ld:%02ld:%02ld.%06ld [%s] %.*s\n", day / 3600,
+                    day / 60 % 60, day % 60, ts_ns % 1000000000L / 1000,
+                    level_names[level], len, msg);
+}
+
+static void write_all(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDERR_FILENO, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+static void write_sync(long ts_ns, int level, const char *msg, int len) {
+    char line[LOG_LINE_MAX];
+    int n = format_line(line, sizeof(line), ts_ns, level, msg, len);
+    write_all(line, n < (int)sizeof(line) ? (size_t)n : sizeof(line) - 1);
+}
+
+/**
+ * Write out published records in batches; one consumer at a time
+ * @return Number of records written
+ */
+static int drain(void) {
+    char out[LOG_DRAIN_BATCH * LOG_LINE_MAX];
+    int total = 0;
+    
+    pthread_mutex_lock(&drain_mutex);
+    for (;;) {
+        size_t used = 0;
+        int batch = 0;
+    
+        unsigned long dropped = __atomic_exchange_n(&ring.dropped, 0, __ATOMIC_RELAXED);
+        if (dropped) {
+            char note[64];
+            int n = snprintf(note, sizeof(note), "%lu log messages dropped", dropped);
+            used += format_line(out, sizeof(out), realtime_ns(), 2, note, n);
+        }
+    
+        while (batch < LOG_DRAIN_BATCH) {
+            log_record_t *r = &ring.slots[ring.tail & (LOG_RING_SLOTS - 1)];
+            if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != ring.tail + 1) break;
+    
+            int n = format_line(out + used, sizeof(out) - used, r->ts_ns, r->level, r->msg, r->len);
+            used += (size_t)n < sizeof(out) - used ? (size_t)n : sizeof(out) - used - 1;
+            /* Hand the slot back for the next lap */
+            __atomic_store_n(&r->seq, ring.tail + LOG_RING_SLOTS, __ATOMIC_RELEASE);
+            ring.tail++;
+            batch++;
+        }
+    
+        if (used) write_all(out, used);
+        total += batch;
+        if (batch < LOG_DRAIN_BATCH) break;
+    }
+    pthread_mutex_unlock(&drain_mutex);
+    return total;
+}
+
+static int ring_empty(void) {
+    log_record_t *r = &ring.slots[ring.tail & (LOG_RING_SLOTS - 1)];
+    return __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != ring.tail + 1 &&
+           !__atomic_load_n(&ring.dropped, __ATOMIC_RELAXED);
+}
+
+static void *drain_thread(void *arg) {
+    (void)arg;
+    
+    for (;;) {
+        if (drain() > 0) continue;
+    
+        /* Announce the sleep, then re-check: a producer either sees the
+         * flag or published before the check */
+        int seen = __atomic_load_n(&ring.wake, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&ring.waiting, 1, __ATOMIC_SEQ_CST);
+        if (ring_empty()) {
+            struct timespec timeout = { 0, LOG_IDLE_WAIT_MS * 1000000L };
+            syscall(SYS_futex, &ring.wake, FUTEX_WAIT_PRIVATE, seen, &timeout, NULL, 0);
+        }
+        __atomic_store_n(&ring.waiting, 0, __ATOMIC_SEQ_CST);
+    }
+    return NULL;
+}
+
+static void flush_at_exit(void) {
+    /* A child that exits runs this too; its copy of the ring is not its own */
+    if (ring.owner == getpid()) drain();
+}
+
+static void log_init(void) {
+    const char *env = getenv("KERNELSIGHT_LOG_LEVEL");
+    if (env && env[0] >= '0' && env[0] <= '3' && !env[1]) log_level = env[0] - '0';
+    
+    ring.slots = calloc(LOG_RING_SLOTS, sizeof(log_record_t));
+    if (!ring.slots) return;
+    for (unsigned long i = 0; i < LOG_RING_SLOTS; i++) ring.slots[i].seq = i;
+    
+    /* The drain thread must not take signals meant for the caller */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t thread;
+    int ret = pthread_create(&thread, NULL, drain_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (ret != 0) {
+        free(ring.slots);
+        ring.slots = NULL;
+        return;
+    }
+    pthread_detach(thread);
+    ring.owner = getpid();
+    atexit(flush_at_exit);
+}
+
+/**
+ * Claim a slot, or NULL if the ring is full
+ */
+static log_record_t *ring_claim(unsigned long *pos) {
+    unsigned long p = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+    
+    for (;;) {
+        log_record_t *r = &ring.slots[p & (LOG_RING_SLOTS - 1)];
+        long diff = (long)(__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) - p);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring.head, &p, p + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *pos = p;
+                return r;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            p = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void (mc_log)(int level, const char *fmt, ...) {
+    if (mc_log_muted) return;
+    if (level < 0) level = 0;
+    if (level > 3) level = 3;
+    
+    pthread_once(&log_once, log_init);
+    if (level < __atomic_load_n(&log_level, __ATOMIC_RELAXED)) return;
+    
+    char msg[LOG_MSG_MAX];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    if (len < 0) return;
+    if (len >= (int)sizeof(msg)) len = sizeof(msg) - 1;
+    long ts_ns = realtime_ns();
+    
+    unsigned long pos;
+    log_record_t *r = NULL;
+    if (ring.slots && ring.owner == getpid()) r = ring_claim(&pos);
+    if (!r) {
+        /* Child process, no ring, or full: only drop what can be spared */
+        if (ring.slots && ring.owner == getpid() && level < 2) {
+            __atomic_fetch_add(&ring.dropped, 1, __ATOMIC_RELAXED);
+        } else {
+            write_sync(ts_ns, level, msg, len);
+        }
+        return;
+    }
+    
+    r->ts_ns = ts_ns;
+    r->level = level;
+    r->len = len;
+    memcpy(r->msg, msg, len);
+    __atomic_store_n(&r->seq, pos + 1, __ATOMIC_RELEASE);
+    
+    if (__atomic_load_n(&ring.waiting, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(&ring.wake, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &ring.wake, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+void mc_log_mute(void) {
+    mc_log_muted = 1;
+}
+
+void mc_log_set_level(int level) {
+    pthread_once(&log_once, log_init);
+    if (level < 0) level = 0;
+    if (level > 3) level = 3;
+    __atomic_store_n(&log_level, level, __ATOMIC_RELAXED);
+}
+
+int mc_log_get_level(void) {
+    pthread_once(&log_once, log_init);
+    return __atomic_load_n(&log_level, __ATOMIC_RELAXED);
+}
+
+void mc_log_flush(void) {
+    pthread_once(&log_once, log_init);
+    if (ring.slots && ring.owner == getpid()) drain();
+}
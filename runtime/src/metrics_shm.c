@@ -0,0 +1,257 @@
+/*
+ * KernelSight - Linux Container Runtime
+ * metrics_shm.c - Shared-memory metrics export
+ *
+ * The daemon's sampler publishes every running container's samples into
+ * a fixed-layout POSIX shared memory segment: a header followed by
+ * MC_METRICS_SLOTS slots, each a history ring of MC_METRICS_HISTORY
+ * samples.  There is a single writer; each slot is guarded by a seqlock,
+ * so readers (the Python backend maps the same layout) copy a slot
+ * without syscalls or locks and retry if the writer was inside it.
+ */
+
+#define _GNU_SOURCE
+#include "../include/container.h"
+#include <sys/mman.h>
+#include <time.h>
+
+/* Reader retries before yielding to a writer that holds a slot */
+#define SEQLOCK_SPINS 64
+
+/* Yields between checks that the writer is still alive, and in all: a
+ * writer killed inside a slot leaves its seq odd for good */
+#define SEQLOCK_CHECK_YIELDS 256
+#define SEQLOCK_MAX_YIELDS 4096
+
+struct metrics_shm {
+    metrics_shm_header_t *header;
+    metrics_slot_t *slots;
+    size_t size;
+    int writer;
+    char name[NAME_MAX];
+};
+
+static size_t segment_size(void) {
+    return sizeof(metrics_shm_header_t) + MC_METRICS_SLOTS * sizeof(metrics_slot_t);
+}
+
+static metrics_shm_t *shm_handle(const char *name, void *base, size_t size, int writer) {
+    metrics_shm_t *shm = calloc(1, sizeof(*shm));
+    if (!shm) return NULL;
+    shm->header = base;
+    shm->slots = (metrics_slot_t *)((char *)base + sizeof(metrics_shm_header_t));
+    shm->size = size;
+    shm->writer = writer;
+    snprintf(shm->name, sizeof(shm->name), "%s", name);
+    return shm;
+}
+
+int metrics_shm_create(const char *name, int interval_ms, metrics_shm_t **shm) {
+    if (!shm) return MC_ERR_INVALID;
+    if (!name) name = MC_METRICS_SHM_NAME;
+    
+    /* A fresh segment rather than truncating the old one under its readers */
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        mc_log(3, "Failed to create metrics segment %s: %s", name, strerror(errno));
+        return errno == EACCES ? MC_ERR_PERMISSION : MC_ERR_IO;
+    }
+    fchmod(fd, 0644);  /* Numeric usage only; readable by the dashboard */
+    
+    size_t size = segment_size();
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return MC_ERR_IO;
+    }
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        shm_unlink(name);
+        return MC_ERR_IO;
+    }
+    
+    metrics_shm_t *s = shm_handle(name, base, size, 1);
+    if (!s) {
+        munmap(base, size);
+        shm_unlink(name);
+        return MC_ERR_MEMORY;
+    }
+    
+    metrics_shm_header_t *h = s->header;
+    h->version = MC_METRICS_VERSION;
+    h->slot_count = MC_METRICS_SLOTS;
+    h->history = MC_METRICS_HISTORY;
+    h->slot_size = sizeof(metrics_slot_t);
+    h->sample_size = sizeof(metrics_sample_t);
+    h->interval_ms = interval_ms;
+    h->writer_pid = getpid();
+    /* Readers check the magic first: publish it after the layout */
+    __atomic_store_n(&h->magic, MC_METRICS_MAGIC, __ATOMIC_RELEASE);
+    
+    *shm = s;
+    return MC_OK;
+}
+
+int metrics_shm_open(const char *name, metrics_shm_t **shm) {
+    struct stat st;
+    
+    if (!shm) return MC_ERR_INVALID;
+    if (!name) name = MC_METRICS_SHM_NAME;
+    
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        return errno == ENOENT ? MC_ERR_NOT_FOUND :
+               errno == EACCES ? MC_ERR_PERMISSION : MC_ERR_IO;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < segment_size()) {
+        close(fd);
+        return MC_ERR_INVALID;
+    }
+    void *base = mmap(NULL, segment_size(), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return MC_ERR_IO;
+    
+    const metrics_shm_header_t *h = base;
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != MC_METRICS_MAGIC ||
+        h->version != MC_METRICS_VERSION || h->slot_count != MC_METRICS_SLOTS ||
+        h->history != MC_METRICS_HISTORY || h->slot_size != sizeof(metrics_slot_t) ||
+        h->sample_size != sizeof(metrics_sample_t)) {
+        munmap(base, segment_size());
+        return MC_ERR_INVALID;
+    }
+    
+    *shm = shm_handle(name, base, segment_size(), 0);
+    if (!*shm) {
+        munmap(base, segment_size());
+        return MC_ERR_MEMORY;
+    }
+    return MC_OK;
+}
+
+/** Enter a slot's write section: seq goes odd before any data store */
+static void slot_write_begin(metrics_slot_t *slot) {
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void slot_write_end(metrics_slot_t *slot) {
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+int metrics_shm_claim(metrics_shm_t *shm, const char *id) {
+    int free_slot = -1;
+    
+    if (!shm || !shm->writer || !id) return MC_ERR_INVALID;
+    
+    /* Slot state is only written here, by the single writer */
+    for (int i = 0; i < MC_METRICS_SLOTS; i++) {
+        if (!shm->slots[i].in_use) {
+            if (free_slot < 0) free_slot = i;
+        } else if (strcmp(shm->slots[i].id, id) == 0) {
+            return i;
+        }
+    }
+    if (free_slot < 0) return MC_ERR_MEMORY;
+    
+    metrics_slot_t *slot = &shm->slots[free_slot];
+    slot_write_begin(slot);
+    snprintf(slot->id, sizeof(slot->id), "%s", id);
+    slot->count = 0;
+    slot->in_use = 1;
+    slot_write_end(slot);
+    __atomic_fetch_add(&shm->header->generation, 1, __ATOMIC_RELEASE);
+    return free_slot;
+}
+
+void metrics_shm_publish(metrics_shm_t *shm, int slot_index, const container_metrics_t *metrics) {
+    struct timespec ts;
+    
+    if (!shm || !shm->writer || !metrics || slot_index < 0 || slot_index >= MC_METRICS_SLOTS) {
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int64_t now = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    
+    metrics_slot_t *slot = &shm->slots[slot_index];
+    slot_write_begin(slot);
+    metrics_sample_t *sample = &slot->samples[slot->count % MC_METRICS_HISTORY];
+    sample->timestamp_ns = now;
+    sample->metrics = *metrics;
+    slot->count++;
+    slot_write_end(slot);
+    __atomic_store_n(&shm->header->updated_ns, now, __ATOMIC_RELEASE);
+}
+
+void metrics_shm_release(metrics_shm_t *shm, int slot_index) {
+    if (!shm || !shm->writer || slot_index < 0 || slot_index >= MC_METRICS_SLOTS) return;
+    
+    metrics_slot_t *slot = &shm->slots[slot_index];
+    slot_write_begin(slot);
+    slot->in_use = 0;
+    slot->count = 0;
+    slot_write_end(slot);
+    __atomic_fetch_add(&shm->header->generation, 1, __ATOMIC_RELEASE);
+}
+
+/** Whether the process that writes the segment still exists */
+static int writer_alive(const metrics_shm_header_t *h) {
+    pid_t pid = __atomic_load_n(&h->writer_pid, __ATOMIC_ACQUIRE);
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+int metrics_shm_read(metrics_shm_t *shm, const char *id, metrics_sample_t *samples, int max) {
+    if (!shm || !id || (!samples && max > 0)) return MC_ERR_INVALID;
+    
+    for (int i = 0; i < MC_METRICS_SLOTS; i++) {
+        const metrics_slot_t *slot = &shm->slots[i];
+        int match, n, spins = 0;
+    
+        for (;;) {
+            uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            if (seq & 1) {
+                if (++spins % SEQLOCK_SPINS != 0) continue;
+                int yields = spins / SEQLOCK_SPINS;
+                if (yields >= SEQLOCK_MAX_YIELDS ||
+                    (yields % SEQLOCK_CHECK_YIELDS == 0 && !writer_alive(shm->header))) {
+                    return MC_ERR_IO;  /* Stuck mid-write: the segment will not settle */
+                }
+                sched_yield();
+                continue;
+            }
+    
+            n = 0;
+            match = slot->in_use && strncmp(slot->id, id, sizeof(slot->id)) == 0;
+            if (match) {
+                uint64_t count = slot->count;
+                n = count < MC_METRICS_HISTORY ? (int)count : MC_METRICS_HISTORY;
+                if (n > max) n = max;
+                /* Copies racing a write are discarded by the seq check below */
+                for (int k = 0; k < n; k++) {
+                    samples[k] = slot->samples[(count - n + k) % MC_METRICS_HISTORY];
+                }
+            }
+    
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) break;
+        }
+        if (match) return n;
+    }
+    return MC_ERR_NOT_FOUND;
+}
+
+const metrics_shm_header_t *metrics_shm_header(const metrics_shm_t *shm) {
+    return shm ? shm->header : NULL;
+}
+
+void metrics_shm_close(metrics_shm_t *shm) {
+    if (!shm) return;
+    
+    if (shm->writer) {
+        __atomic_store_n(&shm->header->writer_pid, 0, __ATOMIC_RELEASE);
+        shm_unlink(shm->name);
+    }
+    munmap(shm->header, shm->size);
+    free(shm);
+}
@@ -6,6 +6,35 @@
 #define _GNU_SOURCE
 #include "../include/container.h"
 #include <sys/prctl.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <poll.h>
+
+#ifndef SYS_clone3
+#define SYS_clone3 435
+#endif
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+/* struct clone_args as of Linux 5.7 (CLONE_ARGS_SIZE_VER2) */
+struct ns_clone_args {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+    uint64_t set_tid;
+    uint64_t set_tid_size;
+    uint64_t cgroup;
+};
+
+/* Idle clone() stacks kept for reuse */
+#define NS_STACK_CACHE 8
 
 /* Default namespace flags for container isolation */
 #define DEFAULT_NS_FLAGS (CLONE_NEWPID | CLONE_NEWNS | CLONE_NEWUTS | \
@@ -105,6 +134,118 @@ int ns_setup_user(pid_t pid, uid_t uid_host, uid_t uid_container,
     return MC_OK;
 }
 
+#define NS_DEFAULT_PATH "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin"
+
+/**
+ * Build the container's environment for execve(): the defaults, then the
+ * config's "KEY=value" entries, a later one replacing an earlier one.
+ * The strings are not copied; free() the returned array only.
+ */
+char **ns_build_envp(container_config_t *config) {
+    static char *const defaults[] = {
+        "PATH=" NS_DEFAULT_PATH, "TERM=xterm-256color", "HOME=/root",
+    };
+    size_t ndefaults = sizeof(defaults) / sizeof(defaults[0]);
+    size_t count = ndefaults;
+    
+    char **envp = calloc(ndefaults + (size_t)config->env_count + 1, sizeof(char *));
+    if (!envp) {
+        return NULL;
+    }
+    memcpy(envp, defaults, sizeof(defaults));
+    
+    for (int i = 0; i < config->env_count && config->env[i]; i++) {
+        char *eq = strchr(config->env[i], '=');
+        if (!eq || eq == config->env[i]) continue;
+        size_t key_len = (size_t)(eq - config->env[i]) + 1;
+        size_t j = 0;
+        while (j < count && strncmp(envp[j], config->env[i], key_len) != 0) j++;
+        envp[j] = config->env[i];
+        if (j == count) count++;
+    }
+    return envp;
+}
+
+/**
+ * execvp() against the PATH in envp rather than our own environment
+ * Only async-signal-safe calls: it runs in the clone()d child.
+ */
+static void ns_execvpe(const char *file, char *const argv[], char *const envp[]) {
+    if (strchr(file, '/')) {
+        execve(file, argv, envp);
+        return;
+    }
+    
+    const char *path = NS_DEFAULT_PATH;
+    for (int i = 0; envp[i]; i++) {
+        if (strncmp(envp[i], "PATH=", 5) == 0) {
+            path = envp[i] + 5;
+            break;
+        }
+    }
+    
+    char buf[PATH_MAX];
+    size_t file_len = strlen(file);
+    int eacces = 0;
+    for (const char *p = path; ; p++) {
+        const char *end = strchrnul(p, ':');
+        size_t dir_len = (size_t)(end - p);
+        if (dir_len + file_len + 2 <= sizeof(buf)) {
+            memcpy(buf, p, dir_len);
+            if (dir_len) buf[dir_len++] = '/';
+            memcpy(buf + dir_len, file, file_len + 1);
+            execve(buf, argv, envp);
+            
+            /* Like execvp(): try the next directory unless the file was
+             * found but could not be run */
+            if (errno == EACCES) {
+                eacces = 1;
+            } else if (errno != ENOENT && errno != ENOTDIR && errno != ESTALE &&
+                       errno != ENODEV && errno != ETIMEDOUT) {
+                return;
+            }
+        }
+        if (!*end) break;
+        p = end;
+    }
+    errno = eacces ? EACCES : ENOENT;
+}
+
+/**
+ * Exec the container's command (returns only on failure)
+ */
+int ns_exec_command(container_config_t *config, char *const envp[]) {
+    if (config->cmd_count > 0 && config->cmd[0]) {
+        ns_execvpe(config->cmd[0], config->cmd, envp);
+        return MC_ERR_PROCESS;
+    }
+    
+    /* Default to /bin/sh if no command specified */
+    char *default_cmd[] = {"/bin/sh", NULL};
+    execve(default_cmd[0], default_cmd, envp);
+    return MC_ERR_PROCESS;
+}
+
+/**
+ * Set up the container environment and exec its command
+ */
+int ns_exec(container_config_t *config) {
+    char **envp = ns_build_envp(config);
+    if (!envp) {
+        return MC_ERR_MEMORY;
+    }
+    
+    if (config->cmd_count > 0 && config->cmd[0]) {
+        mc_log(1, "Executing: %s", config->cmd[0]);
+    }
+    ns_exec_command(config, envp);
+    int err = errno;
+    mc_log(3, "Failed to exec: %s", strerror(err));
+    free(envp);
+    errno = err;
+    return MC_ERR_PROCESS;
+}
+
 /**
  * Container child process entry point
  * This runs inside the new namespaces
@@ -112,81 +253,256 @@ int ns_setup_user(pid_t pid, uid_t uid_host, uid_t uid_container,
 typedef struct {
     container_config_t *config;
     int sync_pipe[2];  /* Pipe for synchronization */
+    int root_fd;       /* Cloned rootfs tree (mount API path), -1 = legacy */
+    int trace_fd;      /* Write end of the trace pipe (close-on-exec), -1 = off */
+    char **envp;       /* Built by the parent: the child must not allocate */
 } child_args_t;
 
+/* One startup phase, as the child reports it over the trace pipe */
+typedef struct {
+    int32_t phase;
+    int32_t status;               /* MC_OK, or the error the phase failed with */
+    int64_t start_ns;
+    int64_t end_ns;               /* 0 = still running (exec) */
+} trace_record_t;
+
+/**
+ * Report a phase; records are smaller than PIPE_BUF, so each write is atomic
+ */
+static void trace_write(int fd, startup_phase_t phase, long start_ns, long end_ns, int status) {
+    if (fd < 0) return;
+    trace_record_t r = { .phase = phase, .status = status, .start_ns = start_ns, .end_ns = end_ns };
+    if (write(fd, &r, sizeof(r)) != (ssize_t)sizeof(r)) {
+        /* The parent stopped listening; startup goes on untraced */
+    }
+}
+
+/**
+ * Report a finished phase and return its end time (the next phase's start)
+ */
+static long trace_phase(int fd, startup_phase_t phase, long start_ns, int status) {
+    long now = mc_now_ns();
+    trace_write(fd, phase, start_ns, now, status);
+    return now;
+}
+
+/**
+ * Report why the child gives up, without formatting or allocation
+ */
+static void child_error(const char *what, int err) {
+    char buf[256], digits[12];
+    size_t len = 0, what_len = strlen(what), n = 0;
+    
+    if (what_len > sizeof(buf) - 48) what_len = sizeof(buf) - 48;
+    memcpy(buf, "[ERROR] Container child: ", 25);
+    len = 25;
+    memcpy(buf + len, what, what_len);
+    len += what_len;
+    if (err > 0) {
+        memcpy(buf + len, " (errno ", 8);
+        len += 8;
+        do {
+            digits[n++] = (char)('0' + err % 10);
+            err /= 10;
+        } while (err && n < sizeof(digits));
+        while (n) buf[len++] = digits[--n];
+        buf[len++] = ')';
+    }
+    buf[len++] = '\n';
+    if (write(STDERR_FILENO, buf, len) < 0) {
+        /* Nowhere left to report it */
+    }
+}
+
+/*
+ * Runs between clone() and exec in a copy of a multi-threaded process:
+ * another thread may have held the malloc or stdio locks at the clone,
+ * so everything here sticks to async-signal-safe calls.  The library
+ * helpers it shares with the parent keep their logging muted.
+ */
 static int container_child(void *arg) {
     child_args_t *args = (child_args_t *)arg;
     container_config_t *config = args->config;
+    int tfd = args->trace_fd;
+    long t = mc_now_ns();
     char buf;
     
+    mc_log_mute();
+    
     /* Wait for parent to set up user namespace mappings */
     close(args->sync_pipe[1]);
     if (read(args->sync_pipe[0], &buf, 1) != 1) {
-        mc_log(3, "Failed to read from sync pipe");
-        exit(1);
+        child_error("failed to read from sync pipe", errno);
+        trace_phase(tfd, STARTUP_SYNC_WAIT, t, MC_ERR_IO);
+        _exit(1);
     }
     close(args->sync_pipe[0]);
+    t = trace_phase(tfd, STARTUP_SYNC_WAIT, t, MC_OK);
     
     /* Set up UTS namespace (hostname) */
-    if (ns_setup_uts(config->hostname) != MC_OK) {
-        exit(1);
+    int ret = ns_setup_uts(config->hostname);
+    t = trace_phase(tfd, STARTUP_UTS, t, ret);
+    if (ret != MC_OK) {
+        child_error("failed to set hostname", errno);
+        _exit(1);
     }
     
     /* CRITICAL: Set up mount namespace and filesystem isolation */
     /* Rootfs is REQUIRED for safe container isolation */
     if (strlen(config->rootfs) == 0) {
-        mc_log(3, "FATAL: No rootfs specified - refusing to run without filesystem isolation!");
-        mc_log(3, "This is a security requirement to prevent host filesystem access.");
-        exit(1);
+        child_error("FATAL: no rootfs specified, refusing to run without filesystem isolation", 0);
+        _exit(1);
     }
     
-    if (fs_pivot_root(config->rootfs) != MC_OK) {
-        mc_log(3, "FATAL: pivot_root failed - cannot ensure filesystem isolation!");
-        exit(1);
+    ret = args->root_fd >= 0 ? fs_pivot_root_tree(args->root_fd)
+                             : fs_pivot_root(config->rootfs);
+    t = trace_phase(tfd, STARTUP_PIVOT_ROOT, t, ret);
+    if (ret != MC_OK) {
+        child_error("FATAL: pivot_root failed, cannot ensure filesystem isolation", errno);
+        _exit(1);
     }
     
+    /* Reported as done: the container still starts with a partial set */
     if (fs_mount_essentials() != MC_OK) {
-        mc_log(2, "Warning: Some essential mounts may have failed");
+        child_error("warning: some essential mounts failed", 0);
         /* Continue anyway - basic isolation is in place */
     }
+    t = trace_phase(tfd, STARTUP_MOUNTS, t, MC_OK);
+    
+    /* Closed by a successful exec: the parent times the exec to EOF */
+    trace_write(tfd, STARTUP_EXEC, t, 0, MC_OK);
+    ns_exec_command(config, args->envp);
+    int err = errno;
+    trace_phase(tfd, STARTUP_EXEC, t, MC_ERR_PROCESS);
+    child_error("failed to exec the command", err);
+    _exit(127);
+}
+
+/**
+ * fork()-like clone3() that places the child directly into a cgroup
+ * The child runs on a copy of the caller's stack; like after vfork() it
+ * must stick to async-signal-safe work before exec (glibc's cached
+ * thread state still describes the parent, and no malloc or stdio).
+ */
+pid_t ns_clone_into_cgroup(int flags, int cgroup_fd) {
+    struct ns_clone_args args;
     
-    /* Set environment variables */
-    clearenv();
-    setenv("PATH", "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin", 1);
-    setenv("TERM", "xterm-256color", 1);
-    setenv("HOME", "/root", 1);
+    memset(&args, 0, sizeof(args));
+    args.flags = (uint64_t)(unsigned int)flags | CLONE_INTO_CGROUP;
+    args.exit_signal = SIGCHLD;
+    args.cgroup = (uint64_t)cgroup_fd;
     
-    for (int i = 0; i < config->env_count && config->env[i]; i++) {
-        char *eq = strchr(config->env[i], '=');
-        if (eq) {
-            *eq = '\0';
-            setenv(config->env[i], eq + 1, 1);
-            *eq = '=';
+    return (pid_t)syscall(SYS_clone3, &args, sizeof(args));
+}
+
+/* Pool of mmap'd child stacks, each with a guard page below it */
+static struct {
+    char *base;                   /* Mapping (guard page first), NULL = free slot */
+    size_t len;                   /* Mapping length */
+    int busy;
+} stacks[NS_STACK_CACHE];
+static pthread_mutex_t stack_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t stack_mapping_len(size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (size == 0) size = STACK_SIZE;
+    return ((size + page - 1) & ~(page - 1)) + page;
+}
+
+void *ns_stack_get(size_t size) {
+    size_t len = stack_mapping_len(size);
+    
+    pthread_mutex_lock(&stack_mutex);
+    for (int i = 0; i < NS_STACK_CACHE; i++) {
+        if (stacks[i].base && !stacks[i].busy && stacks[i].len == len) {
+            stacks[i].busy = 1;
+            pthread_mutex_unlock(&stack_mutex);
+            return stacks[i].base + len;
         }
     }
+    pthread_mutex_unlock(&stack_mutex);
+    
+    /* Only touched pages cost memory; the guard page turns an overflow
+     * into SIGSEGV instead of silent corruption of a neighbouring mapping */
+    char *base = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        mc_log(3, "Failed to map clone stack: %s", strerror(errno));
+        return NULL;
+    }
+    if (mprotect(base, (size_t)sysconf(_SC_PAGESIZE), PROT_NONE) != 0) {
+        munmap(base, len);
+        return NULL;
+    }
     
-    /* Execute the command */
-    if (config->cmd_count > 0 && config->cmd[0]) {
-        mc_log(1, "Executing: %s", config->cmd[0]);
-        execvp(config->cmd[0], config->cmd);
-        mc_log(3, "Failed to exec: %s", strerror(errno));
-        exit(127);
+    pthread_mutex_lock(&stack_mutex);
+    for (int i = 0; i < NS_STACK_CACHE; i++) {
+        if (!stacks[i].base) {
+            stacks[i].base = base;
+            stacks[i].len = len;
+            stacks[i].busy = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&stack_mutex);
+    return base + len;
+}
+
+void ns_stack_put(void *top, size_t size) {
+    if (!top) {
+        return;
     }
     
-    /* Default to /bin/sh if no command specified */
-    char *default_cmd[] = {"/bin/sh", NULL};
-    execvp(default_cmd[0], default_cmd);
-    mc_log(3, "Failed to exec default shell: %s", strerror(errno));
-    exit(127);
+    size_t len = stack_mapping_len(size);
+    char *base = (char *)top - len;
+    
+    pthread_mutex_lock(&stack_mutex);
+    for (int i = 0; i < NS_STACK_CACHE; i++) {
+        if (stacks[i].base == base) {
+            stacks[i].busy = 0;
+            pthread_mutex_unlock(&stack_mutex);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&stack_mutex);
+    
+    /* Not cached (the pool was full when it was mapped) */
+    munmap(base, len);
+}
+
+/**
+ * Close what a failed ns_create_traced() opened
+ */
+static void child_args_close(child_args_t *args, int trace_read_fd) {
+    if (args->root_fd >= 0) close(args->root_fd);
+    if (args->trace_fd >= 0) close(args->trace_fd);
+    if (trace_read_fd >= 0) close(trace_read_fd);
+    close(args->sync_pipe[0]);
+    close(args->sync_pipe[1]);
+    free(args->envp);
 }
 
 /**
  * Create new namespaces for a container
- * Uses clone() with namespace flags
+ * Uses clone3() with CLONE_INTO_CGROUP when a cgroup fd is given, so the
+ * child is born inside its limits; falls back to clone() otherwise.
+ * With a trace, the child reports its phases over a close-on-exec pipe.
  */
-int ns_create(container_config_t *config) {
+int ns_create_traced(container_config_t *config, int cgroup_fd, int *in_cgroup,
+                     startup_trace_t *trace, int *trace_fd, net_lease_t *net) {
     child_args_t args;
     args.config = config;
+    args.trace_fd = -1;
+    int trace_pipe[2] = { -1, -1 };
+    pid_t pid = -1;
+    long t = mc_now_ns();
+    
+    if (in_cgroup) *in_cgroup = 0;
+    if (trace_fd) *trace_fd = -1;
+    if (trace) {
+        memset(trace, 0, sizeof(*trace));
+        trace->failed_phase = -1;
+    }
     
     /* Create synchronization pipe */
     if (pipe(args.sync_pipe) != 0) {
@@ -194,41 +510,127 @@ int ns_create(container_config_t *config) {
         return MC_ERR_IO;
     }
     
-    /* Allocate stack for child process */
-    char *stack = malloc(STACK_SIZE);
-    if (!stack) {
-        mc_log(3, "Failed to allocate stack");
+    /* The child execs with it as is */
+    long env_start = mc_now_ns();
+    args.envp = ns_build_envp(config);
+    long env_ns = mc_now_ns() - env_start;
+    if (!args.envp) {
         close(args.sync_pipe[0]);
         close(args.sync_pipe[1]);
         return MC_ERR_MEMORY;
     }
     
+    /* The exec closes the child's end: EOF marks the end of startup */
+    if (trace && trace_fd) {
+        if (pipe2(trace_pipe, O_CLOEXEC) == 0) {
+            args.trace_fd = trace_pipe[1];
+        } else {
+            mc_log(0, "No trace pipe (%s), starting untraced", strerror(errno));
+        }
+    }
+    
     /* Get namespace flags */
-    int flags = get_ns_flags(config) | SIGCHLD;
+    int flags = get_ns_flags(config);
+    
+    /* Inherited by the child for its /dev */
+    fs_prepare_essentials();
+    
+    /* Mount API root: the child joins the seed namespace instead of
+     * copying ours (a user namespace could not enter it) */
+    args.root_fd = -1;
+    if (!config->enable_user_ns && config->rootfs[0] && fs_root_mode() == FS_ROOT_MOUNT_API) {
+        args.root_fd = fs_open_root_tree(config->rootfs);
+        if (args.root_fd >= 0) flags &= ~CLONE_NEWNS;
+    }
+    
+    /* Queued lines go out before anything the child writes directly */
+    mc_log_flush();
+    
+    if (cgroup_fd >= 0) {
+        pid = ns_clone_into_cgroup(flags, cgroup_fd);
+        if (pid == 0) {
+            _exit(container_child(&args));
+        }
+        mc_counter_inc(MC_COUNTER_CLONE, pid < 0);
+        if (pid > 0) {
+            if (in_cgroup) *in_cgroup = 1;
+        } else {
+            /* ENOSYS (< 5.3), E2BIG/EINVAL (< 5.7) or filtered by seccomp */
+            mc_log(0, "clone3(CLONE_INTO_CGROUP) unavailable (%s), using clone()",
+                   strerror(errno));
+        }
+    }
     
-    /* Clone with new namespaces */
-    pid_t pid = clone(container_child, stack + STACK_SIZE, flags, &args);
     if (pid < 0) {
-        mc_log(3, "clone() failed: %s", strerror(errno));
-        free(stack);
-        close(args.sync_pipe[0]);
-        close(args.sync_pipe[1]);
-        return MC_ERR_NAMESPACE;
+        char *stack = ns_stack_get(STACK_SIZE);
+        if (!stack) {
+            child_args_close(&args, trace_pipe[0]);
+            return MC_ERR_MEMORY;
+        }
+    
+        /* Clone with new namespaces.  Without CLONE_VM the child runs on
+         * its own copy-on-write copy of the stack, so it goes straight
+         * back to the pool. */
+        pid = clone(container_child, stack, flags | SIGCHLD, &args);
+        ns_stack_put(stack, STACK_SIZE);
+        mc_counter_inc(MC_COUNTER_CLONE, pid < 0);
+        if (pid < 0) {
+            mc_log(3, "clone() failed: %s", strerror(errno));
+            child_args_close(&args, trace_pipe[0]);
+            return MC_ERR_NAMESPACE;
+        }
     }
     
     mc_log(1, "Created container process with PID: %d", pid);
+    if (args.root_fd >= 0) close(args.root_fd);
+    args.root_fd = -1;
+    if (args.trace_fd >= 0) close(args.trace_fd);
+    args.trace_fd = -1;
+    free(args.envp);
+    args.envp = NULL;
+    if (trace) {
+        trace->start_ns[STARTUP_ENV] = env_start;
+        trace->duration_ns[STARTUP_ENV] = env_ns;
+        trace->start_ns[STARTUP_CLONE] = t;
+        t = mc_now_ns();
+        trace->duration_ns[STARTUP_CLONE] = t - trace->start_ns[STARTUP_CLONE];
+    }
     
     /* Set up user namespace mappings if enabled */
     if (config->enable_user_ns) {
         int ret = ns_setup_user(pid, 
                                 config->uid_map_host, config->uid_map_container,
                                 config->gid_map_host, config->gid_map_container);
+        if (trace) {
+            trace->start_ns[STARTUP_USER_NS] = t;
+            trace->duration_ns[STARTUP_USER_NS] = mc_now_ns() - t;
+        }
         if (ret != MC_OK) {
             kill(pid, SIGKILL);
             waitpid(pid, NULL, 0);
-            free(stack);
-            close(args.sync_pipe[0]);
-            close(args.sync_pipe[1]);
+            if (trace) trace->failed_phase = STARTUP_USER_NS;
+            child_args_close(&args, trace_pipe[0]);
+            return ret;
+        }
+    }
+    
+    /* Plug the network in while the child still waits for its go */
+    if (net && config->enable_network) {
+        long net_start = mc_now_ns();
+        int ret = net_attach(pid, net);
+        if (trace) {
+            trace->start_ns[STARTUP_NETWORK] = net_start;
+            trace->duration_ns[STARTUP_NETWORK] = mc_now_ns() - net_start;
+        }
+        if (ret == MC_ERR_PERMISSION) {
+            /* Unprivileged callers keep the old isolated, empty namespace */
+            mc_log(2, "No permission to attach PID %d to %s, network stays isolated",
+                   pid, MC_NET_BRIDGE);
+        } else if (ret != MC_OK) {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+            if (trace) trace->failed_phase = STARTUP_NETWORK;
+            child_args_close(&args, trace_pipe[0]);
             return ret;
         }
     }
@@ -238,12 +640,95 @@ int ns_create(container_config_t *config) {
     write(args.sync_pipe[1], "x", 1);
     close(args.sync_pipe[1]);
     
-    /* Note: stack should not be freed while child is running */
-    /* In a real implementation, we would track this and free on container exit */
-    
+    if (trace_fd) *trace_fd = trace_pipe[0];
     return pid;  /* Return the child PID */
 }
 
+int ns_create_in_cgroup(container_config_t *config, int cgroup_fd, int *in_cgroup) {
+    return ns_create_traced(config, cgroup_fd, in_cgroup, NULL, NULL, NULL);
+}
+
+/**
+ * Close the trace once the pipe hit EOF: the exec closed it, or the child
+ * exited before it got there
+ */
+static int trace_finish(int trace_fd, startup_trace_t *trace) {
+    int last = STARTUP_NETWORK;
+    for (int p = STARTUP_SYNC_WAIT; p < STARTUP_PHASE_COUNT; p++) {
+        if (p != STARTUP_ENV && trace->start_ns[p]) last = p;
+    }
+    int exec_running = trace->start_ns[STARTUP_EXEC] && !trace->duration_ns[STARTUP_EXEC] &&
+                       trace->failed_phase < 0;
+    
+    if (exec_running) {
+        long now = mc_now_ns();
+        trace->duration_ns[STARTUP_EXEC] = now - trace->start_ns[STARTUP_EXEC];
+        trace->total_ns = now - trace->start_ns[STARTUP_CLONE];
+        trace->complete = 1;
+    } else if (trace->failed_phase < 0 && last + 1 < STARTUP_PHASE_COUNT) {
+        /* The environment is the parent's; after the mounts comes exec */
+        trace->failed_phase = last + 1 == STARTUP_ENV ? STARTUP_EXEC : last + 1;
+    }
+    
+    close(trace_fd);
+    if (trace->complete) mc_histogram_observe(MC_HIST_STARTUP, trace->total_ns);
+    return trace->complete ? MC_OK : MC_ERR_PROCESS;
+}
+
+int ns_trace_read(int trace_fd, startup_trace_t *trace) {
+    trace_record_t records[STARTUP_PHASE_COUNT * 2];
+    
+    if (trace_fd < 0 || !trace) {
+        if (trace_fd >= 0) close(trace_fd);
+        return MC_ERR_INVALID;
+    }
+    
+    for (;;) {
+        struct pollfd pfd = { .fd = trace_fd, .events = POLLIN };
+        int n = poll(&pfd, 1, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n == 0) return 1;
+        
+        ssize_t len = read(trace_fd, records, sizeof(records));
+        if (len < 0 && errno == EINTR) continue;
+        if (len <= 0) return trace_finish(trace_fd, trace);
+        
+        for (size_t i = 0; i < (size_t)len / sizeof(records[0]); i++) {
+            const trace_record_t *r = &records[i];
+            if (r->phase < 0 || r->phase >= STARTUP_PHASE_COUNT) continue;
+            trace->start_ns[r->phase] = r->start_ns;
+            trace->duration_ns[r->phase] = r->end_ns ? r->end_ns - r->start_ns : 0;
+            if (r->status != MC_OK) trace->failed_phase = r->phase;
+        }
+    }
+}
+
+int ns_trace_collect(int trace_fd, startup_trace_t *trace, int timeout_ms) {
+    long deadline = mc_now_ns() + (long)timeout_ms * 1000000L;
+    
+    for (;;) {
+        int ret = ns_trace_read(trace_fd, trace);
+        if (ret != 1) return ret;
+        
+        long remaining_ms = (deadline - mc_now_ns()) / 1000000L;
+        struct pollfd pfd = { .fd = trace_fd, .events = POLLIN };
+        int n = remaining_ms > 0 ? poll(&pfd, 1, (int)remaining_ms) : 0;
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            mc_log(2, "Startup trace timed out");
+            close(trace_fd);
+            return MC_ERR_PROCESS;
+        }
+    }
+}
+
+/**
+ * Create new namespaces for a container
+ */
+int ns_create(container_config_t *config) {
+    return ns_create_in_cgroup(config, -1, NULL);
+}
+
 /**
  * Enter an existing namespace
  */
@@ -306,3 +791,18 @@ int ns_enter_all(pid_t pid, int flags) {
     
     return MC_OK;
 }
+
+int ns_enter_pidfd(int pidfd, pid_t pid, int flags) {
+    if (pidfd >= 0) {
+        /* Every namespace in one call, atomically (Linux 5.8+) */
+        if (setns(pidfd, flags) == 0) {
+            return MC_OK;
+        }
+        if (errno != EINVAL) {
+            mc_log(3, "setns() through pidfd failed: %s", strerror(errno));
+            return MC_ERR_NAMESPACE;
+        }
+        /* Older kernels only take namespace fds */
+    }
+    return ns_enter_all(pid, flags);
+}
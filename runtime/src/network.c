@@ -0,0 +1,570 @@
+/*
+ * KernelSight - Linux Container Runtime
+ * network.c - Container networking over rtnetlink
+ *
+ * Containers with a network namespace are plugged into the MC_NET_BRIDGE
+ * bridge through a veth pair, configured with rtnetlink requests on our
+ * own socket instead of ip(8) processes.  The pair is created with its
+ * peer born inside the container namespace as eth0 and the host end
+ * ("ksh<n>") already on the bridge and up: moving a pre-made peer into a
+ * namespace waits for an RCU grace period, which costs several times more
+ * than the creation itself.  A second batch, sent from inside the
+ * namespace, sets the address, both links up and the default route.
+ * Pair n is given 10.88.0.0/16 + n + 2; the bridge holds 10.88.0.1, and
+ * the pair goes away with the namespace.
+ *
+ * Per-container counters come from the host ends: one RTM_GETLINK dump
+ * returns the stats of every link, cached briefly so that a sampler tick
+ * over all containers costs a single dump.
+ */
+
+#define _GNU_SOURCE
+#include "../include/container.h"
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/veth.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#define NET_HOST_PREFIX "ksh"
+#define NET_CONTAINER_IF "eth0"
+#define NET_SUBNET 0x0a580000u        /* 10.88.0.0 */
+#define NET_GATEWAY (NET_SUBNET + 1)
+#define NET_PREFIX_LEN 16
+#define NET_MAX_PAIRS 65000           /* Addresses .0.2 up to .253.234 */
+#define NET_RECORD "network"
+
+/* Pair numbers found taken before an attach gives up */
+#define NET_CREATE_TRIES 16
+/* Link stats younger than this are served from the last dump */
+#define NET_STATS_MAX_AGE_NS (200 * 1000000L)
+
+#define NL_BATCH_SIZE 4096
+#define NL_RECV_SIZE 65536
+
+/* Requests sent in one send(), acked one by one */
+typedef struct {
+    char buf[NL_BATCH_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+    struct nlmsghdr *cur;         /* Message being built */
+    int count;                    /* Messages (their seq is 1..count) */
+    int overflow;                 /* Something did not fit */
+} nl_batch_t;
+
+typedef void (*nl_reply_fn)(struct nlmsghdr *h, void *arg);
+
+/* Guards bridge_index and next_pair */
+static pthread_mutex_t net_lock = PTHREAD_MUTEX_INITIALIZER;
+static int bridge_index;
+static int next_pair = -1;        /* -1 = not yet seeded from the host links */
+
+/* Counters of the host ends from the last dump */
+typedef struct {
+    int pair;
+    long rx_bytes, tx_bytes;
+} link_stat_t;
+
+static struct {
+    pthread_mutex_t lock;
+    int sock;
+    long dumped_ns;
+    link_stat_t *links;
+    int count, cap;
+} link_cache = { PTHREAD_MUTEX_INITIALIZER, -1, 0, NULL, 0, 0 };
+
+static size_t nl_batch_len(const nl_batch_t *b) {
+    return b->cur ? (size_t)((char *)b->cur - b->buf) + NLMSG_ALIGN(b->cur->nlmsg_len) : 0;
+}
+
+/** Start the next message of a batch with its fixed header */
+static void nl_begin(nl_batch_t *b, int type, int flags, const void *hdr, size_t hdr_len) {
+    size_t off = nl_batch_len(b);
+    if (off + NLMSG_SPACE(hdr_len) > sizeof(b->buf)) {
+        b->overflow = 1;
+        return;
+    }
+    
+    struct nlmsghdr *h = (struct nlmsghdr *)(b->buf + off);
+    memset(h, 0, NLMSG_SPACE(hdr_len));
+    h->nlmsg_len = NLMSG_LENGTH(hdr_len);
+    h->nlmsg_type = type;
+    h->nlmsg_flags = NLM_F_REQUEST | flags;
+    h->nlmsg_seq = ++b->count;
+    memcpy(NLMSG_DATA(h), hdr, hdr_len);
+    b->cur = h;
+}
+
+/** Append an attribute to the current message */
+static struct rtattr *nl_attr(nl_batch_t *b, int type, const void *data, size_t len) {
+    if (b->overflow || !b->cur) {
+        b->overflow = 1;
+        return NULL;
+    }
+    
+    size_t off = NLMSG_ALIGN(b->cur->nlmsg_len);
+    if ((size_t)((char *)b->cur - b->buf) + off + RTA_SPACE(len) > sizeof(b->buf)) {
+        b->overflow = 1;
+        return NULL;
+    }
+    struct rtattr *a = (struct rtattr *)((char *)b->cur + off);
+    memset(a, 0, RTA_SPACE(len));
+    a->rta_type = type;
+    a->rta_len = RTA_LENGTH(len);
+    if (len) memcpy(RTA_DATA(a), data, len);
+    b->cur->nlmsg_len = off + RTA_SPACE(len);
+    return a;
+}
+
+static void nl_attr_str(nl_batch_t *b, int type, const char *s) {
+    nl_attr(b, type, s, strlen(s) + 1);
+}
+
+static void nl_attr_u32(nl_batch_t *b, int type, uint32_t v) {
+    nl_attr(b, type, &v, sizeof(v));
+}
+
+/** Close a nested attribute opened with nl_attr(b, type, NULL, 0) */
+static void nl_nest_end(nl_batch_t *b, struct rtattr *nest) {
+    if (nest && !b->overflow) {
+        nest->rta_len = (char *)b->cur + b->cur->nlmsg_len - (char *)nest;
+    }
+}
+
+static int nl_open(void) {
+    int sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (sock < 0) {
+        mc_log(3, "Could not open rtnetlink socket: %s", strerror(errno));
+    }
+    return sock;
+}
+
+/**
+ * Read replies until `pending` requests are answered, by an NLMSG_ERROR
+ * (ack or error) or the NLMSG_DONE of a dump; other messages go to fn
+ * @return 0, or the first -errno the kernel reported
+ */
+static int nl_wait(int sock, int pending, nl_reply_fn fn, void *arg) {
+    char *buf = malloc(NL_RECV_SIZE);
+    int err = 0;
+    
+    if (!buf) return -ENOMEM;
+    while (pending > 0) {
+        ssize_t n = recv(sock, buf, NL_RECV_SIZE, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            err = -errno;
+            break;
+        }
+        if (n == 0) {
+            err = -EIO;
+            break;
+        }
+    
+        for (struct nlmsghdr *h = (struct nlmsghdr *)buf; NLMSG_OK(h, n); h = NLMSG_NEXT(h, n)) {
+            if (h->nlmsg_type == NLMSG_ERROR) {
+                const struct nlmsgerr *e = NLMSG_DATA(h);
+                if (e->error && !err) err = e->error;
+                pending--;
+            } else if (h->nlmsg_type == NLMSG_DONE) {
+                pending--;
+            } else if (fn) {
+                fn(h, arg);
+            }
+        }
+    }
+    free(buf);
+    return err;
+}
+
+/**
+ * Send a batch with every request acked and wait for all of them
+ * @return 0, or the first -errno
+ */
+static int nl_exec(int sock, nl_batch_t *b, nl_reply_fn fn, void *arg) {
+    if (b->overflow) return -EMSGSIZE;
+    
+    for (char *p = b->buf; p < b->buf + nl_batch_len(b); ) {
+        struct nlmsghdr *h = (struct nlmsghdr *)p;
+        h->nlmsg_flags |= NLM_F_ACK;
+        p += NLMSG_ALIGN(h->nlmsg_len);
+    }
+    
+    size_t len = nl_batch_len(b);
+    if (send(sock, b->buf, len, 0) != (ssize_t)len) return -errno;
+    return nl_wait(sock, b->count, fn, arg);
+}
+
+/** Map a netlink -errno to an error code */
+static int nl_error(int err) {
+    switch (-err) {
+        case 0: return MC_OK;
+        case EPERM:
+        case EACCES: return MC_ERR_PERMISSION;
+        case EEXIST: return MC_ERR_EXISTS;
+        case ENODEV:
+        case ENOENT: return MC_ERR_NOT_FOUND;
+        case ENOMEM: return MC_ERR_MEMORY;
+        default: return MC_ERR_IO;
+    }
+}
+
+/** Pair number of a "<prefix><n>" interface name, -1 if it is not one */
+static int pair_number(const char *name, const char *prefix) {
+    size_t len = strlen(prefix);
+    if (!name || strncmp(name, prefix, len) != 0 || name[len] < '0' || name[len] > '9') return -1;
+    
+    char *end;
+    long n = strtol(name + len, &end, 10);
+    return *end == '\0' && n < NET_MAX_PAIRS ? (int)n : -1;
+}
+
+/** Name and stats of an RTM_NEWLINK message */
+static const char *link_attrs(struct nlmsghdr *h, struct rtnl_link_stats64 *stats, int *has_stats) {
+    struct ifinfomsg *ifi = NLMSG_DATA(h);
+    int len = h->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+    const char *name = NULL;
+    
+    *has_stats = 0;
+    if (h->nlmsg_type != RTM_NEWLINK || len < 0) return NULL;
+    for (struct rtattr *a = IFLA_RTA(ifi); RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+        if (a->rta_type == IFLA_IFNAME) {
+            name = RTA_DATA(a);
+        } else if (a->rta_type == IFLA_STATS64 && stats &&
+                   RTA_PAYLOAD(a) >= sizeof(*stats)) {
+            memcpy(stats, RTA_DATA(a), sizeof(*stats));
+            *has_stats = 1;
+        }
+    }
+    return name;
+}
+
+/** Dump every link of the socket's namespace, passing each to fn */
+static int nl_dump_links(int sock, nl_reply_fn fn, void *arg) {
+    nl_batch_t b = { .count = 0 };
+    struct ifinfomsg ifi = { .ifi_family = AF_UNSPEC };
+    
+    nl_begin(&b, RTM_GETLINK, NLM_F_DUMP, &ifi, sizeof(ifi));
+    size_t len = nl_batch_len(&b);
+    if (send(sock, b.buf, len, 0) != (ssize_t)len) return -errno;
+    return nl_wait(sock, 1, fn, arg);
+}
+
+/** Create the bridge if needed and make sure it has the gateway and is up */
+static int ensure_bridge(void) {
+    nl_batch_t b = { .count = 0 };
+    int sock = nl_open();
+    if (sock < 0) return MC_ERR_IO;
+    
+    int index = if_nametoindex(MC_NET_BRIDGE);
+    if (!index) {
+        struct ifinfomsg ifi = { .ifi_family = AF_UNSPEC };
+        nl_begin(&b, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, &ifi, sizeof(ifi));
+        nl_attr_str(&b, IFLA_IFNAME, MC_NET_BRIDGE);
+        struct rtattr *info = nl_attr(&b, IFLA_LINKINFO, NULL, 0);
+        nl_attr_str(&b, IFLA_INFO_KIND, "bridge");
+        nl_nest_end(&b, info);
+    
+        /* EEXIST: another process created it first */
+        int err = nl_exec(sock, &b, NULL, NULL);
+        if (err && err != -EEXIST) {
+            mc_log(3, "Failed to create bridge %s: %s", MC_NET_BRIDGE, strerror(-err));
+            close(sock);
+            return nl_error(err);
+        }
+        index = if_nametoindex(MC_NET_BRIDGE);
+    }
+    
+    /* Gateway address (replaced if present) and link up, in one batch */
+    memset(&b, 0, sizeof(b));
+    struct ifaddrmsg ifa = { .ifa_family = AF_INET, .ifa_prefixlen = NET_PREFIX_LEN,
+                             .ifa_index = index };
+    uint32_t gateway = htonl(NET_GATEWAY);
+    nl_begin(&b, RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE, &ifa, sizeof(ifa));
+    nl_attr(&b, IFA_LOCAL, &gateway, sizeof(gateway));
+    nl_attr(&b, IFA_ADDRESS, &gateway, sizeof(gateway));
+    struct ifinfomsg up = { .ifi_family = AF_UNSPEC, .ifi_index = index,
+                            .ifi_flags = IFF_UP, .ifi_change = IFF_UP };
+    nl_begin(&b, RTM_NEWLINK, 0, &up, sizeof(up));
+    
+    int err = index ? nl_exec(sock, &b, NULL, NULL) : -ENODEV;
+    close(sock);
+    if (err) {
+        mc_log(3, "Failed to configure bridge %s: %s", MC_NET_BRIDGE, strerror(-err));
+        return nl_error(err);
+    }
+    bridge_index = index;
+    return MC_OK;
+}
+
+int net_setup(void) {
+    pthread_mutex_lock(&net_lock);
+    int ret = bridge_index > 0 ? MC_OK : ensure_bridge();
+    pthread_mutex_unlock(&net_lock);
+    return ret;
+}
+
+/**
+ * Create pair n with its peer born inside the namespace as eth0 and the
+ * host end on the bridge and up
+ * @return 0, -EEXIST if the number is taken, or -errno
+ */
+static int create_pair(int sock, int n, int ns_fd) {
+    char host[IFNAMSIZ];
+    nl_batch_t b = { .count = 0 };
+    
+    snprintf(host, sizeof(host), NET_HOST_PREFIX "%d", n);
+    struct ifinfomsg ifi = { .ifi_family = AF_UNSPEC, .ifi_flags = IFF_UP, .ifi_change = IFF_UP };
+    nl_begin(&b, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, &ifi, sizeof(ifi));
+    nl_attr_str(&b, IFLA_IFNAME, host);
+    nl_attr_u32(&b, IFLA_MASTER, bridge_index);
+    struct rtattr *info = nl_attr(&b, IFLA_LINKINFO, NULL, 0);
+    nl_attr_str(&b, IFLA_INFO_KIND, "veth");
+    struct rtattr *data = nl_attr(&b, IFLA_INFO_DATA, NULL, 0);
+    struct ifinfomsg peer_ifi = { .ifi_family = AF_UNSPEC };
+    struct rtattr *peer = nl_attr(&b, VETH_INFO_PEER, &peer_ifi, sizeof(peer_ifi));
+    nl_attr_str(&b, IFLA_IFNAME, NET_CONTAINER_IF);
+    nl_attr_u32(&b, IFLA_NET_NS_FD, ns_fd);
+    nl_nest_end(&b, peer);
+    nl_nest_end(&b, data);
+    nl_nest_end(&b, info);
+    
+    return nl_exec(sock, &b, NULL, NULL);
+}
+
+static void mark_used(struct nlmsghdr *h, void *arg) {
+    int has_stats;
+    int n = pair_number(link_attrs(h, NULL, &has_stats), NET_HOST_PREFIX);
+    if (n >= 0 && n + 1 > *(int *)arg) *(int *)arg = n + 1;
+}
+
+/**
+ * Next pair number to try, round robin; the first call in a process
+ * starts after the highest pair on the host so it rarely collides
+ */
+static int next_pair_number(int sock) {
+    pthread_mutex_lock(&net_lock);
+    if (next_pair < 0) {
+        int start = 0;
+        nl_dump_links(sock, mark_used, &start);
+        next_pair = start;
+    }
+    int n = next_pair % NET_MAX_PAIRS;
+    next_pair = n + 1;
+    pthread_mutex_unlock(&net_lock);
+    return n;
+}
+
+/**
+ * Open an rtnetlink socket in another network namespace: the socket
+ * stays bound to the namespace it was created in
+ */
+static int nl_open_in(int ns_fd) {
+    int self = open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC);
+    int sock = -1;
+    
+    if (self < 0) return -1;
+    if (setns(ns_fd, CLONE_NEWNET) == 0) {
+        sock = nl_open();
+        /* Only this thread moved; staying would leak host work into the container */
+        if (setns(self, CLONE_NEWNET) != 0) {
+            mc_log(3, "Cannot return to the host network namespace: %s", strerror(errno));
+            abort();
+        }
+    } else {
+        mc_log(3, "Cannot enter container network namespace: %s", strerror(errno));
+    }
+    close(self);
+    return sock;
+}
+
+static void found_index(struct nlmsghdr *h, void *arg) {
+    if (h->nlmsg_type == RTM_NEWLINK) {
+        *(int *)arg = ((struct ifinfomsg *)NLMSG_DATA(h))->ifi_index;
+    }
+}
+
+/** Inside the namespace: address eth0, bring it and lo up, route via the bridge */
+static int configure_inside(int sock, int n) {
+    nl_batch_t b = { .count = 0 };
+    int index = 0;
+    
+    struct ifinfomsg query = { .ifi_family = AF_UNSPEC };
+    nl_begin(&b, RTM_GETLINK, 0, &query, sizeof(query));
+    nl_attr_str(&b, IFLA_IFNAME, NET_CONTAINER_IF);
+    int err = nl_exec(sock, &b, found_index, &index);
+    if (err) return err;
+    if (!index) return -ENODEV;
+    
+    memset(&b, 0, sizeof(b));
+    uint32_t addr = htonl(NET_SUBNET + n + 2), gateway = htonl(NET_GATEWAY);
+    struct ifaddrmsg ifa = { .ifa_family = AF_INET, .ifa_prefixlen = NET_PREFIX_LEN,
+                             .ifa_index = index };
+    nl_begin(&b, RTM_NEWADDR, NLM_F_CREATE | NLM_F_EXCL, &ifa, sizeof(ifa));
+    nl_attr(&b, IFA_LOCAL, &addr, sizeof(addr));
+    nl_attr(&b, IFA_ADDRESS, &addr, sizeof(addr));
+    
+    struct ifinfomsg up = { .ifi_family = AF_UNSPEC, .ifi_index = index,
+                            .ifi_flags = IFF_UP, .ifi_change = IFF_UP };
+    nl_begin(&b, RTM_NEWLINK, 0, &up, sizeof(up));
+    up.ifi_index = 1;  /* Loopback is ifindex 1 in every namespace */
+    nl_begin(&b, RTM_NEWLINK, 0, &up, sizeof(up));
+    
+    struct rtmsg rt = { .rtm_family = AF_INET, .rtm_table = RT_TABLE_MAIN,
+                        .rtm_protocol = RTPROT_BOOT, .rtm_scope = RT_SCOPE_UNIVERSE,
+                        .rtm_type = RTN_UNICAST };
+    nl_begin(&b, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_EXCL, &rt, sizeof(rt));
+    nl_attr(&b, RTA_GATEWAY, &gateway, sizeof(gateway));
+    nl_attr_u32(&b, RTA_OIF, index);
+    return nl_exec(sock, &b, NULL, NULL);
+}
+
+int net_attach(pid_t pid, net_lease_t *lease) {
+    char path[64];
+    
+    if (pid <= 0 || !lease) return MC_ERR_INVALID;
+    memset(lease, 0, sizeof(*lease));
+    int ret = net_setup();
+    if (ret != MC_OK) return ret;
+    
+    snprintf(path, sizeof(path), "/proc/%d/ns/net", pid);
+    int ns_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (ns_fd < 0) return MC_ERR_NOT_FOUND;
+    int sock = nl_open();
+    if (sock < 0) {
+        close(ns_fd);
+        return MC_ERR_IO;
+    }
+    
+    /* EEXIST: the number belongs to a running container (maybe another process's) */
+    int n = -1, err = -EEXIST;
+    for (int tries = 0; err == -EEXIST && tries < NET_CREATE_TRIES; tries++) {
+        n = next_pair_number(sock);
+        err = create_pair(sock, n, ns_fd);
+    }
+    close(sock);
+    if (err) {
+        close(ns_fd);
+        mc_log(3, "Failed to create a veth pair for PID %d: %s", pid, strerror(-err));
+        return nl_error(err);
+    }
+    
+    sock = nl_open_in(ns_fd);
+    close(ns_fd);
+    err = sock < 0 ? -EIO : configure_inside(sock, n);
+    if (sock >= 0) close(sock);
+    if (err) {
+        /* The pair goes away with the namespace when the caller kills the child */
+        mc_log(3, "Failed to configure the network of PID %d: %s", pid, strerror(-err));
+        return nl_error(err);
+    }
+    
+    uint32_t addr = NET_SUBNET + n + 2;
+    snprintf(lease->host_if, sizeof(lease->host_if), NET_HOST_PREFIX "%d", n);
+    snprintf(lease->address, sizeof(lease->address), "%u.%u.%u.%u/%d", addr >> 24,
+             (addr >> 16) & 0xff, (addr >> 8) & 0xff, addr & 0xff, NET_PREFIX_LEN);
+    mc_log(0, "PID %d attached to %s as %s (%s)", pid, MC_NET_BRIDGE, lease->address, lease->host_if);
+    return MC_OK;
+}
+
+int net_lease_save(const char *state_dir, const net_lease_t *lease) {
+    char path[PATH_MAX], tmp[PATH_MAX];
+    
+    if (!state_dir || !lease) return MC_ERR_INVALID;
+    snprintf(path, sizeof(path), "%s/" NET_RECORD, state_dir);
+    if (!lease->host_if[0]) {
+        unlink(path);
+        return MC_OK;
+    }
+    
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return MC_ERR_INVALID;
+    FILE *fp = fopen(tmp, "we");
+    if (!fp) return MC_ERR_IO;
+    fprintf(fp, "host_if=%s\naddress=%s\n", lease->host_if, lease->address);
+    if (fclose(fp) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return MC_ERR_IO;
+    }
+    return MC_OK;
+}
+
+int net_lease_load(const char *state_dir, net_lease_t *lease) {
+    char path[PATH_MAX], line[64];
+    
+    if (!state_dir || !lease) return MC_ERR_INVALID;
+    memset(lease, 0, sizeof(*lease));
+    snprintf(path, sizeof(path), "%s/" NET_RECORD, state_dir);
+    FILE *fp = fopen(path, "re");
+    if (!fp) return MC_ERR_NOT_FOUND;
+    
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "host_if=", 8) == 0) {
+            snprintf(lease->host_if, sizeof(lease->host_if), "%.*s",
+                     (int)sizeof(lease->host_if) - 1, line + 8);
+        } else if (strncmp(line, "address=", 8) == 0) {
+            snprintf(lease->address, sizeof(lease->address), "%.*s",
+                     (int)sizeof(lease->address) - 1, line + 8);
+        }
+    }
+    fclose(fp);
+    return lease->host_if[0] ? MC_OK : MC_ERR_NOT_FOUND;
+}
+
+static void cache_link(struct nlmsghdr *h, void *arg) {
+    struct rtnl_link_stats64 stats;
+    int has_stats;
+    const char *name = link_attrs(h, &stats, &has_stats);
+    int n = pair_number(name, NET_HOST_PREFIX);
+    
+    (void)arg;
+    if (n < 0 || !has_stats) return;
+    if (link_cache.count == link_cache.cap) {
+        int cap = link_cache.cap ? link_cache.cap * 2 : 64;
+        link_stat_t *links = realloc(link_cache.links, cap * sizeof(*links));
+        if (!links) return;
+        link_cache.links = links;
+        link_cache.cap = cap;
+    }
+    link_cache.links[link_cache.count++] = (link_stat_t){
+        .pair = n, .rx_bytes = (long)stats.rx_bytes, .tx_bytes = (long)stats.tx_bytes,
+    };
+}
+
+int net_link_stats(const char *host_if, long *rx_bytes, long *tx_bytes) {
+    int n = pair_number(host_if, NET_HOST_PREFIX);
+    if (n < 0 || !rx_bytes || !tx_bytes) return MC_ERR_INVALID;
+    
+    pthread_mutex_lock(&link_cache.lock);
+    long now = mc_now_ns();
+    int ret = MC_OK;
+    if (!link_cache.dumped_ns || now - link_cache.dumped_ns > NET_STATS_MAX_AGE_NS) {
+        if (link_cache.sock < 0) link_cache.sock = nl_open();
+        link_cache.count = 0;
+        int err = link_cache.sock < 0 ? -EIO : nl_dump_links(link_cache.sock, cache_link, NULL);
+        if (err) {
+            /* Replies of a half-read dump would confuse the next one */
+            if (link_cache.sock >= 0) close(link_cache.sock);
+            link_cache.sock = -1;
+            link_cache.dumped_ns = 0;
+            ret = nl_error(err);
+        } else {
+            link_cache.dumped_ns = now;
+        }
+    }
+    
+    if (ret == MC_OK) {
+        ret = MC_ERR_NOT_FOUND;
+        for (int i = 0; i < link_cache.count; i++) {
+            if (link_cache.links[i].pair == n) {
+                *rx_bytes = link_cache.links[i].rx_bytes;
+                *tx_bytes = link_cache.links[i].tx_bytes;
+                ret = MC_OK;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&link_cache.lock);
+    return ret;
+}
@@ -0,0 +1,174 @@
+/*
+ * KernelSight - Linux Container Runtime
+ * reclaim.c - Proactive memory reclaim
+ *
+ * memory.high and memory.max only act once a container is at its limit,
+ * and then its own allocations pay for the reclaim.  The daemon's reclaim
+ * engine works ahead of that: on every metrics tick it looks at each
+ * container's sample and asks the kernel, through memory.reclaim, to drop
+ * memory from containers that are idle or creeping up on memory.high.
+ * Pressure stall information and the refault rate tell it to back off: a
+ * container stalling on memory or faulting its cache back in is already
+ * short.  Reclaim aimed at a cgroup ignores that cgroup's own protection,
+ * so memory.low and memory.min are enforced here as the floor.
+ */
+
+#define _GNU_SOURCE
+#include "../include/container.h"
+
+/* Longest run of ticks sat out after steps that reclaimed little */
+#define RECLAIM_MAX_BACKOFF 64
+
+void reclaim_policy_default(reclaim_policy_t *policy) {
+    if (!policy) return;
+    policy->idle_cpu_percent = 1.0;
+    policy->pressure_limit = 10.0;
+    policy->refault_limit = 200.0;
+    policy->idle_step_percent = 2;
+    policy->high_headroom_percent = 90;
+    policy->min_step_bytes = 1024 * 1024;
+    policy->max_step_bytes = 16 * 1024 * 1024;
+}
+
+long reclaim_plan(const reclaim_policy_t *policy, const container_metrics_t *metrics,
+                  const resource_limits_t *limits, reclaim_state_t *state) {
+    if (!policy || !metrics || !limits || !state || state->disabled) return 0;
+    
+    long high_events = metrics->memory_events.high;
+    int throttled = state->primed && high_events > state->prev_high_events;
+    int primed = state->primed;
+    state->prev_high_events = high_events;
+    state->primed = 1;
+    
+    long usage = metrics->memory_usage_bytes;
+    if (!primed || metrics->sample_interval_ns <= 0 || usage <= 0) return 0;
+    
+    /* Already short of memory: what we take would come straight back as refaults */
+    if (metrics->memory_pressure.some_avg10 > policy->pressure_limit ||
+        metrics->workingset_refault_per_sec > policy->refault_limit) {
+        return 0;
+    }
+    
+    long target = 0;
+    if (limits->memory_high_bytes > 0) {
+        long mark = limits->memory_high_bytes / 100 * policy->high_headroom_percent;
+        if (usage > mark) target = usage - mark;
+        else if (throttled) target = policy->min_step_bytes;  /* Peaked above it since the last tick */
+        if (target > 0 && target < policy->min_step_bytes) target = policy->min_step_bytes;
+    }
+    
+    /* Idle containers shrink until a step falls under min_step_bytes */
+    if (target == 0 && metrics->cpu_usage_percent < policy->idle_cpu_percent) {
+        long step = usage / 100 * policy->idle_step_percent;
+        if (step >= policy->min_step_bytes) target = step;
+    }
+    
+    long floor = limits->memory_low_bytes > limits->memory_min_bytes ? limits->memory_low_bytes
+                                                                      : limits->memory_min_bytes;
+    if (floor > 0 && usage - target < floor) target = usage - floor;
+    
+    /* The write runs on the daemon's loop: take a large target in slices,
+     * one per tick, since the plan is redone from the next sample anyway */
+    if (policy->max_step_bytes > 0 && target > policy->max_step_bytes) {
+        target = policy->max_step_bytes;
+    }
+    return target > 0 ? target : 0;
+}
+
+/** Read a numeric cgroup file ("max" and errors give fallback) */
+static long read_cgroup_long(const container_t *c, const char *file, long fallback) {
+    char path[PATH_MAX], buf[32];
+    
+    if (snprintf(path, sizeof(path), "%s/%s", c->cgroup_path, file) >= (int)sizeof(path)) {
+        return fallback;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return fallback;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    mc_counter_inc(MC_COUNTER_CGROUP_READ, n <= 0);
+    if (n <= 0) return fallback;
+    buf[n] = '\0';
+    
+    char *end;
+    long value = strtol(buf, &end, 10);
+    return end == buf ? fallback : value;
+}
+
+int cgroup_reclaim(container_t *container, long bytes, long *reclaimed) {
+    char path[PATH_MAX], value[32];
+    
+    if (reclaimed) *reclaimed = 0;
+    if (!container || bytes <= 0 || !container->cgroup_path[0]) return MC_ERR_INVALID;
+    
+    if (snprintf(path, sizeof(path), "%s/memory.reclaim", container->cgroup_path) >=
+        (int)sizeof(path)) {
+        return MC_ERR_INVALID;
+    }
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT ? MC_ERR_NOT_FOUND : MC_ERR_CGROUP;
+    }
+    
+    long before = read_cgroup_long(container, "memory.current", -1);
+    int len = snprintf(value, sizeof(value), "%ld", bytes);
+    int err = write(fd, value, len) == len ? 0 : errno;
+    close(fd);
+    /* EAGAIN: the kernel reclaimed less than asked, which is not a failure */
+    mc_counter_inc(MC_COUNTER_CGROUP_WRITE, err && err != EAGAIN);
+    if (err && err != EAGAIN) {
+        mc_log(2, "memory.reclaim of %ld bytes failed for %s: %s", bytes,
+               container->config.name, strerror(err));
+        return MC_ERR_CGROUP;
+    }
+    
+    long after = read_cgroup_long(container, "memory.current", -1);
+    if (reclaimed && before >= 0 && after >= 0 && before > after) {
+        *reclaimed = before - after;
+    }
+    return MC_OK;
+}
+
+long reclaim_step(container_t *container, const reclaim_policy_t *policy,
+                  const container_metrics_t *metrics, reclaim_state_t *state) {
+    if (!container || !policy || !metrics || !state) return MC_ERR_INVALID;
+    
+    /* State from an older version has no limits: ask the cgroup */
+    resource_limits_t limits = container->config.limits;
+    if (!container->limits_known) {
+        limits.memory_high_bytes = read_cgroup_long(container, "memory.high", 0);
+        limits.memory_low_bytes = read_cgroup_long(container, "memory.low", 0);
+        limits.memory_min_bytes = read_cgroup_long(container, "memory.min", 0);
+    }
+    
+    long bytes = reclaim_plan(policy, metrics, &limits, state);
+    if (bytes <= 0) return 0;
+    if (state->skip_ticks > 0) {
+        state->skip_ticks--;
+        return 0;
+    }
+    
+    long reclaimed;
+    int ret = cgroup_reclaim(container, bytes, &reclaimed);
+    if (ret == MC_ERR_NOT_FOUND) {
+        mc_log(2, "No memory.reclaim for %s (kernel < 5.19), not reclaiming it",
+               container->config.name);
+        state->disabled = 1;
+        return ret;
+    }
+    if (ret != MC_OK) return ret;
+    
+    state->reclaim_bytes += reclaimed;
+    state->reclaim_count++;
+    
+    /* Mostly unreclaimable (e.g. anon without swap): ask less often */
+    if (reclaimed < bytes / 2) {
+        state->backoff = state->backoff ? state->backoff * 2 : 1;
+        if (state->backoff > RECLAIM_MAX_BACKOFF) state->backoff = RECLAIM_MAX_BACKOFF;
+        state->skip_ticks = state->backoff;
+    } else {
+        state->backoff = 0;
+    }
+    mc_log(0, "Reclaimed %ld of %ld bytes from %s", reclaimed, bytes, container->config.name);
+    return reclaimed;
+}
@@ -0,0 +1,418 @@
+/*
+ * KernelSight - Linux Container Runtime
+ * sampler.c - Cached-fd cgroup metrics sampler
+ *
+ * Each sampler opens the cgroup files of one container once and keeps the
+ * descriptors.  A sample is then a single pread() per file into a buffer
+ * owned by the sampler, with no path formatting and no stdio allocations.
+ * The sampler also remembers the previous sample so that CPU percentage and
+ * per-second rates come straight out of cgroup_sampler_read().
+ */
+
+#define _GNU_SOURCE
+#include "../include/container.h"
+#include <time.h>
+
+/* Size of the per-sampler read buffer (memory.stat alone is ~2KB) */
+#define SAMPLER_BUF_SIZE 8192
+
+/* Cgroup files kept open by a sampler */
+enum {
+    SAMPLER_MEMORY_CURRENT = 0,
+    SAMPLER_MEMORY_PEAK,
+    SAMPLER_MEMORY_MAX,
+    SAMPLER_CPU_STAT,
+    SAMPLER_MEMORY_STAT,
+    SAMPLER_MEMORY_EVENTS,
+    SAMPLER_PIDS_CURRENT,
+    SAMPLER_PIDS_MAX,
+    SAMPLER_IO_STAT,
+    SAMPLER_CPU_PRESSURE,
+    SAMPLER_MEMORY_PRESSURE,
+    SAMPLER_IO_PRESSURE,
+    SAMPLER_FILE_COUNT
+};
+
+static const char *const sampler_files[SAMPLER_FILE_COUNT] = {
+    [SAMPLER_MEMORY_CURRENT] = "memory.current",
+    [SAMPLER_MEMORY_PEAK]    = "memory.peak",
+    [SAMPLER_MEMORY_MAX]     = "memory.max",
+    [SAMPLER_CPU_STAT]       = "cpu.stat",
+    [SAMPLER_MEMORY_STAT]    = "memory.stat",
+    [SAMPLER_MEMORY_EVENTS]  = "memory.events",
+    [SAMPLER_PIDS_CURRENT]   = "pids.current",
+    [SAMPLER_PIDS_MAX]       = "pids.max",
+    [SAMPLER_IO_STAT]        = "io.stat",
+    [SAMPLER_CPU_PRESSURE]   = "cpu.pressure",
+    [SAMPLER_MEMORY_PRESSURE] = "memory.pressure",
+    [SAMPLER_IO_PRESSURE]    = "io.pressure",
+};
+
+struct cgroup_sampler {
+    int fds[SAMPLER_FILE_COUNT];  /* Open cgroup files (-1 if missing) */
+    int net_fd;                   /* /proc/<pid>/net/dev in the container netns */
+    char net_if[16];              /* Host end of the container's veth ("" = use net_fd) */
+    char buf[SAMPLER_BUF_SIZE];   /* Preallocated read buffer */
+    
+    /* Previous sample, used for rate computation */
+    int has_prev;
+    long prev_time_ns;            /* CLOCK_MONOTONIC timestamp */
+    long prev_usage_usec;
+    long prev_memory_bytes;
+    long prev_net_rx_bytes;
+    long prev_net_tx_bytes;
+    long prev_io_read_bytes;
+    long prev_io_write_bytes;
+    long prev_pgfault;
+    long prev_pgmajfault;
+    long prev_refaults;
+};
+
+/**
+ * Current CLOCK_MONOTONIC time in nanoseconds
+ */
+static long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * Open /proc/<pid>/net/dev if the process has its own network namespace
+ */
+static int open_net_dev(pid_t pid) {
+    char path[64];
+    struct stat self_ns, pid_ns;
+    
+    if (pid <= 0) {
+        return -1;
+    }
+    
+    snprintf(path, sizeof(path), "/proc/%d/ns/net", pid);
+    if (stat(path, &pid_ns) != 0 || stat("/proc/self/ns/net", &self_ns) != 0) {
+        return -1;
+    }
+    
+    /* Same namespace as the host: the counters would not be per-container */
+    if (pid_ns.st_ino == self_ns.st_ino && pid_ns.st_dev == self_ns.st_dev) {
+        return -1;
+    }
+    
+    snprintf(path, sizeof(path), "/proc/%d/net/dev", pid);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/**
+ * Re-read one cached file into the sampler buffer
+ * @return Number of bytes read, or -1 if the file is unavailable
+ */
+static ssize_t sampler_pread(cgroup_sampler_t *s, int file) {
+    if (s->fds[file] < 0) {
+        return -1;
+    }
+
+    ssize_t n = pread(s->fds[file], s->buf, sizeof(s->buf) - 1, 0);
+    mc_counter_inc(MC_COUNTER_CGROUP_READ, n < 0);
+    if (n < 0) {
+        return -1;
+    }
+
+    s->buf[n] = '\0';
+    return n;
+}
+
+/**
+ * Read a single numeric value ("max" is reported as -1)
+ */
+static long sampler_read_value(cgroup_sampler_t *s, int file, long fallback) {
+    if (sampler_pread(s, file) < 0) {
+        return fallback;
+    }
+
+    if (strncmp(s->buf, "max", 3) == 0) {
+        return -1;  /* Unlimited */
+    }
+
+    char *end;
+    long value = strtol(s->buf, &end, 10);
+    return end == s->buf ? fallback : value;
+}
+
+/**
+ * Container RX/TX bytes: from its veth's host end when it has one (one
+ * cached netlink dump for all containers), else summed over all
+ * non-loopback interfaces in /proc/<pid>/net/dev
+ */
+static int sampler_read_net(cgroup_sampler_t *s, long *rx, long *tx) {
+    long host_rx, host_tx;
+    if (s->net_if[0] && net_link_stats(s->net_if, &host_rx, &host_tx) == MC_OK) {
+        *rx = host_tx;
+        *tx = host_rx;
+        return MC_OK;
+    }
+    
+    if (s->net_fd < 0) {
+        return MC_ERR_NOT_FOUND;
+    }
+    
+    ssize_t n = pread(s->net_fd, s->buf, sizeof(s->buf) - 1, 0);
+    if (n <= 0) {
+        return MC_ERR_IO;
+    }
+    s->buf[n] = '\0';
+    
+    *rx = 0;
+    *tx = 0;
+    
+    /* Lines look like "  eth0: <8 rx fields> <8 tx fields>" */
+    for (char *line = s->buf; line && *line; ) {
+        char *next = strchr(line, '\n');
+        if (next) {
+            *next++ = '\0';
+        }
+    
+        char *colon = strchr(line, ':');
+        if (colon) {
+            char *name = line;
+            while (*name == ' ') name++;
+    
+            if (strncmp(name, "lo:", 3) != 0) {
+                char *p = colon + 1;
+                long fields[9];
+                int i;
+                for (i = 0; i < 9; i++) {
+                    char *end;
+                    fields[i] = strtol(p, &end, 10);
+                    if (end == p) break;
+                    p = end;
+                }
+                if (i == 9) {
+                    *rx += fields[0];
+                    *tx += fields[8];
+                }
+            }
+        }
+        line = next;
+    }
+    
+    return MC_OK;
+}
+
+/**
+ * Sum the byte and operation counters of io.stat over all devices
+ */
+static int sampler_read_io(cgroup_sampler_t *s, container_metrics_t *m) {
+    io_stat_t io;
+    
+    if (sampler_pread(s, SAMPLER_IO_STAT) < 0) {
+        return MC_ERR_NOT_FOUND;
+    }
+    
+    cgroup_parse_io_stat(s->buf, &io);
+    m->io_read_bytes = io.rbytes;
+    m->io_write_bytes = io.wbytes;
+    m->io_read_ops = io.rios;
+    m->io_write_ops = io.wios;
+    return MC_OK;
+}
+
+/**
+ * Open a metrics sampler for a cgroup directory
+ */
+int cgroup_sampler_open_path(const char *cgroup_path, pid_t pid,
+                             cgroup_sampler_t **sampler) {
+    if (!cgroup_path || !sampler || cgroup_path[0] == '\0') {
+        return MC_ERR_INVALID;
+    }
+
+    int dirfd = open(cgroup_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0) {
+        mc_log(0, "Could not open cgroup %s: %s", cgroup_path, strerror(errno));
+        return MC_ERR_CGROUP;
+    }
+
+    cgroup_sampler_t *s = malloc(sizeof(*s));
+    if (!s) {
+        close(dirfd);
+        return MC_ERR_MEMORY;
+    }
+
+    /* Missing files (e.g. memory.peak on older kernels) stay at -1 */
+    for (int i = 0; i < SAMPLER_FILE_COUNT; i++) {
+        s->fds[i] = openat(dirfd, sampler_files[i], O_RDONLY | O_CLOEXEC);
+    }
+    s->net_fd = open_net_dev(pid);
+    s->net_if[0] = '\0';
+    s->has_prev = 0;
+
+    close(dirfd);
+    *sampler = s;
+    return MC_OK;
+}
+
+/**
+ * Open a metrics sampler for a container
+ */
+int cgroup_sampler_open(container_t *container, cgroup_sampler_t **sampler) {
+    if (!container) {
+        return MC_ERR_INVALID;
+    }
+    int ret = cgroup_sampler_open_path(container->cgroup_path, container->pid, sampler);
+    if (ret != MC_OK) return ret;
+    
+    /* Loaded containers only have the record of their network */
+    net_lease_t lease = container->net;
+    if (lease.host_if[0] || net_lease_load(container->state_dir, &lease) == MC_OK) {
+        snprintf((*sampler)->net_if, sizeof((*sampler)->net_if), "%s", lease.host_if);
+    }
+    return MC_OK;
+}
+
+/**
+ * Take one sample from an open sampler
+ */
+int cgroup_sampler_read(cgroup_sampler_t *s, container_metrics_t *metrics) {
+    if (!s || !metrics) {
+        return MC_ERR_INVALID;
+    }
+
+    memset(metrics, 0, sizeof(*metrics));
+    long now_ns = monotonic_ns();
+
+    /* Memory usage, peak and limit */
+    metrics->memory_usage_bytes = sampler_read_value(s, SAMPLER_MEMORY_CURRENT, -1);
+    metrics->memory_max_usage_bytes = sampler_read_value(s, SAMPLER_MEMORY_PEAK, -1);
+    metrics->memory_limit_bytes = sampler_read_value(s, SAMPLER_MEMORY_MAX, 0);
+
+    /* Memory breakdown and limit events */
+    int have_memory_stat = sampler_pread(s, SAMPLER_MEMORY_STAT) > 0 &&
+                           cgroup_parse_memory_stat(s->buf, &metrics->memory_stat) > 0;
+    if (sampler_pread(s, SAMPLER_MEMORY_EVENTS) > 0) {
+        cgroup_parse_memory_events(s->buf, &metrics->memory_events);
+    }
+    long refaults = metrics->memory_stat.workingset_refault_anon +
+                    metrics->memory_stat.workingset_refault_file;
+    
+    /* CPU usage */
+    long usage_usec = -1;
+    if (sampler_pread(s, SAMPLER_CPU_STAT) > 0 &&
+        cgroup_parse_cpu_stat(s->buf, &metrics->cpu_stat) > 0) {
+        usage_usec = metrics->cpu_stat.usage_usec;
+        metrics->cpu_usage_ns = usage_usec * 1000;  /* Convert to nanoseconds */
+    }
+
+    /* PID count and limit */
+    metrics->pids_current = (int)sampler_read_value(s, SAMPLER_PIDS_CURRENT, -1);
+    metrics->pids_limit = (int)sampler_read_value(s, SAMPLER_PIDS_MAX, 0);
+
+    /* Network counters (only when the container has its own netns) */
+    int have_net = sampler_read_net(s, &metrics->net_rx_bytes,
+                                    &metrics->net_tx_bytes) == MC_OK;
+    
+    /* Block IO (needs the io controller enabled for the cgroup) */
+    int have_io = sampler_read_io(s, metrics) == MC_OK;
+    
+    /* Pressure stall information (absent without CONFIG_PSI or psi=0) */
+    if (sampler_pread(s, SAMPLER_CPU_PRESSURE) > 0) {
+        cgroup_parse_pressure(s->buf, &metrics->cpu_pressure);
+    }
+    if (sampler_pread(s, SAMPLER_MEMORY_PRESSURE) > 0) {
+        cgroup_parse_pressure(s->buf, &metrics->memory_pressure);
+    }
+    if (sampler_pread(s, SAMPLER_IO_PRESSURE) > 0) {
+        cgroup_parse_pressure(s->buf, &metrics->io_pressure);
+    }
+    
+    /* Rates against the previous sample */
+    if (s->has_prev && now_ns > s->prev_time_ns) {
+        long interval_ns = now_ns - s->prev_time_ns;
+        double seconds = interval_ns / 1e9;
+    
+        metrics->sample_interval_ns = interval_ns;
+    
+        /* 100% = one core fully used */
+        if (usage_usec >= 0 && s->prev_usage_usec >= 0) {
+            metrics->cpu_usage_percent =
+                (usage_usec - s->prev_usage_usec) * 1000.0 / interval_ns * 100.0;
+        }
+        if (metrics->memory_usage_bytes >= 0 && s->prev_memory_bytes >= 0) {
+            metrics->memory_growth_bytes_per_sec =
+                (metrics->memory_usage_bytes - s->prev_memory_bytes) / seconds;
+        }
+        if (have_net) {
+            metrics->net_rx_bytes_per_sec =
+                (metrics->net_rx_bytes - s->prev_net_rx_bytes) / seconds;
+            metrics->net_tx_bytes_per_sec =
+                (metrics->net_tx_bytes - s->prev_net_tx_bytes) / seconds;
+        }
+        if (have_memory_stat && s->prev_pgfault >= 0) {
+            metrics->pgfault_per_sec =
+                (metrics->memory_stat.pgfault - s->prev_pgfault) / seconds;
+            metrics->pgmajfault_per_sec =
+                (metrics->memory_stat.pgmajfault - s->prev_pgmajfault) / seconds;
+            metrics->workingset_refault_per_sec = (refaults - s->prev_refaults) / seconds;
+        }
+        if (have_io) {
+            metrics->io_read_bytes_per_sec =
+                (metrics->io_read_bytes - s->prev_io_read_bytes) / seconds;
+            metrics->io_write_bytes_per_sec =
+                (metrics->io_write_bytes - s->prev_io_write_bytes) / seconds;
+        }
+    }
+    
+    s->has_prev = 1;
+    s->prev_time_ns = now_ns;
+    s->prev_usage_usec = usage_usec;
+    s->prev_memory_bytes = metrics->memory_usage_bytes;
+    s->prev_net_rx_bytes = metrics->net_rx_bytes;
+    s->prev_net_tx_bytes = metrics->net_tx_bytes;
+    s->prev_io_read_bytes = metrics->io_read_bytes;
+    s->prev_io_write_bytes = metrics->io_write_bytes;
+    s->prev_pgfault = have_memory_stat ? metrics->memory_stat.pgfault : -1;
+    s->prev_pgmajfault = metrics->memory_stat.pgmajfault;
+    s->prev_refaults = refaults;
+    
+    mc_histogram_observe(MC_HIST_SAMPLE, monotonic_ns() - now_ns);
+    return MC_OK;
+}
+
+/**
+ * Sample many containers into a contiguous metrics array
+ */
+int cgroup_sampler_read_many(cgroup_sampler_t **samplers, int count,
+                             container_metrics_t *metrics) {
+    if ((!samplers || !metrics) && count > 0) {
+        return MC_ERR_INVALID;
+    }
+
+    int ret = MC_OK;
+    for (int i = 0; i < count; i++) {
+        if (!samplers[i]) {
+            memset(&metrics[i], 0, sizeof(metrics[i]));
+            ret = MC_ERR_INVALID;
+            continue;
+        }
+        cgroup_sampler_read(samplers[i], &metrics[i]);
+    }
+
+    return ret;
+}
+
+/**
+ * Close a sampler and release its descriptors
+ */
+void cgroup_sampler_close(cgroup_sampler_t *s) {
+    if (!s) {
+        return;
+    }
+
+    for (int i = 0; i < SAMPLER_FILE_COUNT; i++) {
+        if (s->fds[i] >= 0) {
+            close(s->fds[i]);
+        }
+    }
+    if (s->net_fd >= 0) {
+        close(s->net_fd);
+    }
+    free(s);
+}
@@ -0,0 +1,578 @@
+/*
+ * KernelSight - Linux Container Runtime
+ * state_index.c - mmap-backed container state index
+ *
+ * <state_dir>/state.idx holds one fixed-size record per container plus two
+ * open-addressing hash tables (by id and by name) that point into the
+ * records, so finding a container is a couple of probes in a shared
+ * mapping instead of a directory scan.  Writers serialize on an flock()
+ * of state.idx.lock and readers hold it shared, so a reader never sees a
+ * half-written record.  Growing the index writes a new file and renames
+ * it over the old one; the old mapping is marked retired so other
+ * processes remap.  The per-container state.txt files stay authoritative
+ * and the index is rebuilt from them when it is missing or invalid.
+ */
+
+#define _GNU_SOURCE
+#include "../include/container.h"
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#define STATE_INDEX_MAGIC 0x4b534958u  /* "KSIX" */
+#define STATE_INDEX_VERSION 4
+#define STATE_INDEX_MIN_CAPACITY 64
+
+/* Bucket values: 0 = empty, otherwise record slot + 1 */
+#define BUCKET_EMPTY 0u
+#define BUCKET_TOMBSTONE 0xffffffffu
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;            /* Record slots */
+    uint32_t count;               /* Live records */
+    uint32_t nbuckets;            /* Buckets per hash table (power of two) */
+    uint32_t tombstones;          /* Deleted buckets per hash table */
+    uint32_t retired;             /* Replaced by a newer file: remap */
+    uint32_t reserved;
+    uint64_t generation;          /* Bumped on every change */
+} index_header_t;
+
+typedef struct {
+    uint32_t live;
+    int32_t state;
+    int32_t pid;
+    int32_t exit_code;
+    int64_t created_at;
+    int64_t started_at;
+    int64_t stopped_at;
+    char id[65];
+    char name[256];
+    char image[PATH_MAX];
+    char rootfs[PATH_MAX];
+    startup_trace_t startup;
+    int32_t limits_known;
+    resource_limits_t limits;     /* As last written to the cgroup */
+} index_record_t;
+
+/* flock() excludes other processes only: threads share the lock fd */
+static pthread_mutex_t idx_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* This process's mapping of the index */
+static struct {
+    int lock_fd;
+    int fd;
+    void *map;
+    size_t size;
+    void *prev;                   /* Last retired mapping, see index_unmap() */
+    size_t prev_size;
+} idx = { .lock_fd = -1, .fd = -1 };
+
+/* ===== Layout helpers ===== */
+
+static size_t index_size(uint32_t capacity, uint32_t nbuckets) {
+    return sizeof(index_header_t) + 2 * (size_t)nbuckets * sizeof(uint32_t) +
+           (size_t)capacity * sizeof(index_record_t);
+}
+
+static index_header_t *index_header(void *map) {
+    return (index_header_t *)map;
+}
+
+static uint32_t *id_buckets(void *map) {
+    return (uint32_t *)((char *)map + sizeof(index_header_t));
+}
+
+static uint32_t *name_buckets(void *map) {
+    return id_buckets(map) + index_header(map)->nbuckets;
+}
+
+static index_record_t *index_records(void *map) {
+    return (index_record_t *)(name_buckets(map) + index_header(map)->nbuckets);
+}
+
+static uint64_t hash_key(const char *key) {
+    uint64_t h = 0xcbf29ce484222325ULL;  /* FNV-1a */
+    for (; *key; key++) {
+        h ^= (unsigned char)*key;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/**
+ * Find the bucket holding key in a table (or -1)
+ */
+static long bucket_find(void *map, uint32_t *table, const char *key, int by_name) {
+    index_header_t *hdr = index_header(map);
+    index_record_t *records = index_records(map);
+    uint32_t mask = hdr->nbuckets - 1;
+    
+    for (uint32_t i = 0, b = hash_key(key) & mask; i < hdr->nbuckets; i++, b = (b + 1) & mask) {
+        uint32_t v = table[b];
+        if (v == BUCKET_EMPTY) {
+            return -1;
+        }
+        if (v != BUCKET_TOMBSTONE && v - 1 < hdr->capacity) {
+            index_record_t *r = &records[v - 1];
+            if (r->live && strcmp(by_name ? r->name : r->id, key) == 0) {
+                return b;
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * Insert slot into a table (reusing tombstones)
+ */
+static void bucket_insert(void *map, uint32_t *table, const char *key, uint32_t slot) {
+    index_header_t *hdr = index_header(map);
+    uint32_t mask = hdr->nbuckets - 1;
+    
+    for (uint32_t b = hash_key(key) & mask; ; b = (b + 1) & mask) {
+        if (table[b] == BUCKET_EMPTY || table[b] == BUCKET_TOMBSTONE) {
+            if (table[b] == BUCKET_TOMBSTONE && table == id_buckets(map)) {
+                hdr->tombstones--;
+            }
+            table[b] = slot + 1;
+            return;
+        }
+    }
+}
+
+/**
+ * Remove the bucket pointing at slot for key
+ */
+static void bucket_remove(void *map, uint32_t *table, const char *key, uint32_t slot) {
+    index_header_t *hdr = index_header(map);
+    uint32_t mask = hdr->nbuckets - 1;
+    
+    for (uint32_t i = 0, b = hash_key(key) & mask; i < hdr->nbuckets; i++, b = (b + 1) & mask) {
+        if (table[b] == BUCKET_EMPTY) {
+            return;
+        }
+        if (table[b] == slot + 1) {
+            table[b] = BUCKET_TOMBSTONE;
+            if (table == id_buckets(map)) {
+                hdr->tombstones++;
+            }
+            return;
+        }
+    }
+}
+
+/* ===== Mapping ===== */
+
+static void index_path(char *buf, size_t size, const char *suffix) {
+    snprintf(buf, size, "%s/state.idx%s", get_state_dir(), suffix);
+}
+
+/**
+ * Retire the current mapping (lock held).  Another thread may still be in
+ * the lock-free state_index_generation() path looking at its header, so it
+ * is kept as idx.prev and only the mapping retired before it is unmapped:
+ * a reader holds a mapping for a couple of loads, while retiring it again
+ * takes a whole index rewrite.
+ */
+static void index_unmap(void) {
+    if (idx.map) {
+        if (idx.prev) munmap(idx.prev, idx.prev_size);
+        idx.prev = idx.map;
+        idx.prev_size = idx.size;
+        __atomic_store_n(&idx.map, NULL, __ATOMIC_RELEASE);
+    }
+    if (idx.fd >= 0) {
+        close(idx.fd);
+        idx.fd = -1;
+    }
+}
+
+/**
+ * Take the index lock (LOCK_SH for readers, LOCK_EX for writers)
+ */
+static int index_lock(int op) {
+    pthread_mutex_lock(&idx_mutex);
+    if (idx.lock_fd < 0) {
+        char path[PATH_MAX];
+        index_path(path, sizeof(path), ".lock");
+        mkdir(get_state_dir(), 0755);
+        idx.lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    }
+    if (idx.lock_fd < 0 || flock(idx.lock_fd, op) != 0) {
+        pthread_mutex_unlock(&idx_mutex);
+        return MC_ERR_IO;
+    }
+    return MC_OK;
+}
+
+static void index_unlock(void) {
+    flock(idx.lock_fd, LOCK_UN);
+    pthread_mutex_unlock(&idx_mutex);
+}
+
+/**
+ * Make sure idx.map is a valid, current mapping (lock held)
+ */
+static int index_map(void) {
+    if (idx.map && !index_header(idx.map)->retired) {
+        return MC_OK;
+    }
+    index_unmap();
+    
+    char path[PATH_MAX];
+    index_path(path, sizeof(path), "");
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return MC_ERR_NOT_FOUND;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(index_header_t)) {
+        close(fd);
+        return MC_ERR_NOT_FOUND;
+    }
+    
+    void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return MC_ERR_IO;
+    }
+    
+    index_header_t *hdr = index_header(map);
+    if (hdr->magic != STATE_INDEX_MAGIC || hdr->version != STATE_INDEX_VERSION ||
+        hdr->nbuckets == 0 || (hdr->nbuckets & (hdr->nbuckets - 1)) != 0 ||
+        index_size(hdr->capacity, hdr->nbuckets) != (size_t)st.st_size) {
+        mc_log(2, "Ignoring invalid state index %s", path);
+        munmap(map, st.st_size);
+        close(fd);
+        return MC_ERR_NOT_FOUND;
+    }
+    
+    idx.fd = fd;
+    idx.size = st.st_size;
+    __atomic_store_n(&idx.map, map, __ATOMIC_RELEASE);
+    return MC_OK;
+}
+
+/**
+ * Write a fresh index with room for capacity records and swap it in
+ * (exclusive lock held).  Records are taken from the current mapping when
+ * src is NULL.
+ */
+static int index_write(uint32_t capacity, container_t **src, int src_count) {
+    char path[PATH_MAX], tmp[PATH_MAX];
+    
+    if (capacity < STATE_INDEX_MIN_CAPACITY) {
+        capacity = STATE_INDEX_MIN_CAPACITY;
+    }
+    uint32_t nbuckets = 1;
+    while (nbuckets < capacity * 2) {
+        nbuckets <<= 1;
+    }
+    size_t size = index_size(capacity, nbuckets);
+    
+    index_path(path, sizeof(path), "");
+    if (snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid()) >= (int)sizeof(tmp)) {
+        return MC_ERR_INVALID;
+    }
+    
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        mc_log(3, "Failed to create state index: %s", strerror(errno));
+        return MC_ERR_IO;
+    }
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        unlink(tmp);
+        return MC_ERR_IO;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        unlink(tmp);
+        return MC_ERR_IO;
+    }
+    
+    index_header_t *hdr = index_header(map);
+    hdr->magic = STATE_INDEX_MAGIC;
+    hdr->version = STATE_INDEX_VERSION;
+    hdr->capacity = capacity;
+    hdr->nbuckets = nbuckets;
+    hdr->generation = idx.map ? index_header(idx.map)->generation + 1 : 1;
+    
+    index_record_t *records = index_records(map);
+    uint32_t n = 0;
+    if (!src && idx.map) {
+        index_header_t *old = index_header(idx.map);
+        index_record_t *old_records = index_records(idx.map);
+        for (uint32_t i = 0; i < old->capacity && n < capacity; i++) {
+            if (old_records[i].live) {
+                records[n++] = old_records[i];
+            }
+        }
+    } else {
+        for (int i = 0; i < src_count && n < capacity; i++) {
+            index_record_t *r = &records[n++];
+            r->live = 1;
+            r->state = src[i]->state;
+            r->pid = src[i]->pid;
+            r->exit_code = src[i]->exit_code;
+            r->created_at = src[i]->created_at;
+            r->started_at = src[i]->started_at;
+            r->stopped_at = src[i]->stopped_at;
+            r->startup = src[i]->startup;
+            r->limits_known = src[i]->limits_known;
+            r->limits = src[i]->config.limits;
+            snprintf(r->id, sizeof(r->id), "%s", src[i]->config.id);
+            snprintf(r->name, sizeof(r->name), "%s", src[i]->config.name);
+            snprintf(r->image, sizeof(r->image), "%s", src[i]->config.image);
+            snprintf(r->rootfs, sizeof(r->rootfs), "%s", src[i]->config.rootfs);
+        }
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        bucket_insert(map, id_buckets(map), records[i].id, i);
+        bucket_insert(map, name_buckets(map), records[i].name, i);
+    }
+    hdr->count = n;
+    
+    munmap(map, size);
+    if (fsync(fd) != 0 || rename(tmp, path) != 0) {
+        close(fd);
+        unlink(tmp);
+        return MC_ERR_IO;
+    }
+    close(fd);
+    
+    /* Tell processes still mapping the old file to switch over */
+    if (idx.map) {
+        __atomic_store_n(&index_header(idx.map)->retired, 1, __ATOMIC_RELEASE);
+    }
+    index_unmap();
+    return index_map();
+}
+
+/* ===== Public API ===== */
+
+int state_index_rebuild(container_t **containers, int count) {
+    if (count < 0 || (count > 0 && !containers)) {
+        return MC_ERR_INVALID;
+    }
+    if (index_lock(LOCK_EX) != MC_OK) {
+        return MC_ERR_IO;
+    }
+    
+    index_map();  /* Carry the generation over if an index exists */
+    int ret = index_write(count * 2, containers, count);
+    
+    index_unlock();
+    return ret;
+}
+
+int state_index_put(const container_t *c) {
+    if (!c || !c->config.id[0]) {
+        return MC_ERR_INVALID;
+    }
+    if (index_lock(LOCK_EX) != MC_OK) {
+        return MC_ERR_IO;
+    }
+    
+    int ret = index_map();
+    if (ret != MC_OK) {
+        index_unlock();
+        return ret;
+    }
+    
+    index_header_t *hdr = index_header(idx.map);
+    long b = bucket_find(idx.map, id_buckets(idx.map), c->config.id, 0);
+    
+    /* New record: grow (or compact tombstones) when the tables fill up */
+    if (b < 0 && (hdr->count >= hdr->capacity ||
+                  (hdr->count + hdr->tombstones + 1) * 4 > hdr->nbuckets * 3)) {
+        uint32_t capacity = hdr->count >= hdr->capacity ? hdr->capacity * 2 : hdr->capacity;
+        ret = index_write(capacity, NULL, 0);
+        if (ret != MC_OK) {
+            index_unlock();
+            return ret;
+        }
+        hdr = index_header(idx.map);
+    }
+    
+    index_record_t *records = index_records(idx.map);
+    uint32_t slot;
+    if (b >= 0) {
+        slot = id_buckets(idx.map)[b] - 1;
+        if (strcmp(records[slot].name, c->config.name) != 0) {
+            bucket_remove(idx.map, name_buckets(idx.map), records[slot].name, slot);
+            bucket_insert(idx.map, name_buckets(idx.map), c->config.name, slot);
+        }
+    } else {
+        for (slot = 0; slot < hdr->capacity && records[slot].live; slot++);
+        bucket_insert(idx.map, id_buckets(idx.map), c->config.id, slot);
+        bucket_insert(idx.map, name_buckets(idx.map), c->config.name, slot);
+        hdr->count++;
+    }
+    
+    index_record_t *r = &records[slot];
+    r->live = 1;
+    r->state = c->state;
+    r->pid = c->pid;
+    r->exit_code = c->exit_code;
+    r->created_at = c->created_at;
+    r->started_at = c->started_at;
+    r->stopped_at = c->stopped_at;
+    r->startup = c->startup;
+    r->limits_known = c->limits_known;
+    r->limits = c->config.limits;
+    snprintf(r->id, sizeof(r->id), "%s", c->config.id);
+    snprintf(r->name, sizeof(r->name), "%s", c->config.name);
+    snprintf(r->image, sizeof(r->image), "%s", c->config.image);
+    snprintf(r->rootfs, sizeof(r->rootfs), "%s", c->config.rootfs);
+    __atomic_add_fetch(&hdr->generation, 1, __ATOMIC_RELEASE);
+    
+    index_unlock();
+    return MC_OK;
+}
+
+int state_index_remove(const char *id) {
+    if (!id) {
+        return MC_ERR_INVALID;
+    }
+    if (index_lock(LOCK_EX) != MC_OK) {
+        return MC_ERR_IO;
+    }
+    
+    int ret = index_map();
+    long b = ret == MC_OK ? bucket_find(idx.map, id_buckets(idx.map), id, 0) : -1;
+    if (b >= 0) {
+        index_header_t *hdr = index_header(idx.map);
+        uint32_t slot = id_buckets(idx.map)[b] - 1;
+        index_record_t *r = &index_records(idx.map)[slot];
+    
+        bucket_remove(idx.map, id_buckets(idx.map), r->id, slot);
+        bucket_remove(idx.map, name_buckets(idx.map), r->name, slot);
+        memset(r, 0, sizeof(*r));
+        hdr->count--;
+        __atomic_add_fetch(&hdr->generation, 1, __ATOMIC_RELEASE);
+    } else if (ret == MC_OK) {
+        ret = MC_ERR_NOT_FOUND;
+    }
+    
+    index_unlock();
+    return ret;
+}
+
+/**
+ * Fill a container from a record
+ */
+static void record_to_container(const index_record_t *r, container_t *c) {
+    memset(c, 0, sizeof(*c));
+    snprintf(c->config.id, sizeof(c->config.id), "%s", r->id);
+    snprintf(c->config.name, sizeof(c->config.name), "%s", r->name);
+    snprintf(c->config.image, sizeof(c->config.image), "%s", r->image);
+    snprintf(c->config.rootfs, sizeof(c->config.rootfs), "%s", r->rootfs);
+    c->state = (container_state_t)r->state;
+    c->pid = r->pid;
+    c->exit_code = r->exit_code;
+    c->created_at = r->created_at;
+    c->started_at = r->started_at;
+    c->stopped_at = r->stopped_at;
+    c->startup = r->startup;
+    c->limits_known = r->limits_known;
+    c->config.limits = r->limits;
+    snprintf(c->state_dir, sizeof(c->state_dir), "%s/containers/%s", get_state_dir(), r->id);
+    snprintf(c->cgroup_path, sizeof(c->cgroup_path), "/sys/fs/cgroup/kernelsight/%s", r->id);
+}
+
+int state_index_lookup(const char *id_or_name, container_t *container) {
+    if (!id_or_name || !container) {
+        return MC_ERR_INVALID;
+    }
+    if (index_lock(LOCK_SH) != MC_OK) {
+        return MC_ERR_IO;
+    }
+    
+    int ret = index_map();
+    if (ret == MC_OK) {
+        long b = bucket_find(idx.map, id_buckets(idx.map), id_or_name, 0);
+        uint32_t *table = id_buckets(idx.map);
+        if (b < 0) {
+            b = bucket_find(idx.map, name_buckets(idx.map), id_or_name, 1);
+            table = name_buckets(idx.map);
+        }
+        if (b >= 0) {
+            record_to_container(&index_records(idx.map)[table[b] - 1], container);
+        } else {
+            ret = MC_ERR_NOT_FOUND;
+        }
+    }
+    
+    index_unlock();
+    return ret;
+}
+
+int state_index_list(container_t ***containers, int *count) {
+    if (!containers || !count) {
+        return MC_ERR_INVALID;
+    }
+    if (index_lock(LOCK_SH) != MC_OK) {
+        return MC_ERR_IO;
+    }
+    
+    int ret = index_map();
+    if (ret != MC_OK) {
+        index_unlock();
+        return ret;
+    }
+    
+    index_header_t *hdr = index_header(idx.map);
+    index_record_t *records = index_records(idx.map);
+    container_t **list = hdr->count ? malloc(sizeof(container_t *) * hdr->count) : NULL;
+    int n = 0;
+    
+    if (hdr->count && !list) {
+        index_unlock();
+        return MC_ERR_MEMORY;
+    }
+    for (uint32_t i = 0; i < hdr->capacity && n < (int)hdr->count; i++) {
+        if (!records[i].live) continue;
+        container_t *c = malloc(sizeof(container_t));
+        if (!c) {
+            ret = MC_ERR_MEMORY;
+            break;
+        }
+        record_to_container(&records[i], c);
+        list[n++] = c;
+    }
+    
+    index_unlock();
+    
+    if (ret != MC_OK) {
+        while (n > 0) free(list[--n]);
+        free(list);
+        return ret;
+    }
+    *containers = list;
+    *count = n;
+    return MC_OK;
+}
+
+long state_index_generation(void) {
+    /* Fast path: a current mapping needs no lock, writers bump it last */
+    void *map = __atomic_load_n(&idx.map, __ATOMIC_ACQUIRE);
+    if (map && !__atomic_load_n(&index_header(map)->retired, __ATOMIC_ACQUIRE)) {
+        return (long)__atomic_load_n(&index_header(map)->generation, __ATOMIC_ACQUIRE);
+    }
+    
+    long generation = MC_ERR_NOT_FOUND;
+    if (index_lock(LOCK_SH) != MC_OK) {
+        return MC_ERR_IO;
+    }
+    if (index_map() == MC_OK) {
+        generation = (long)index_header(idx.map)->generation;
+    }
+    index_unlock();
+    return generation;
+}
@@ -0,0 +1,417 @@
+/*
+ * KernelSight - Linux Container Runtime
+ * topology.c - Topology-aware CPU and NUMA placement
+ *
+ * Containers created with a CPU count get a cpuset chosen from the host
+ * topology instead of floating over every CPU.  Each placement is
+ * recorded in <state_dir>/cpuset, so the set of CPUs in use is simply
+ * the records of the existing containers; deleting a container removes
+ * its state directory and frees its CPUs.  Exclusive placements hold
+ * whole physical cores, SMT siblings included, so a latency-critical
+ * container never shares a core with another placed container.
+ */
+
+#define _GNU_SOURCE
+#include "../include/container.h"
+#include <dirent.h>
+#include <sys/file.h>
+
+#define SYS_CPU "/sys/devices/system/cpu"
+#define SYS_NODE "/sys/devices/system/node"
+#define CPUSET_PARENT "/sys/fs/cgroup/kernelsight/cpuset.cpus.effective"
+#define PLACEMENT_FILE "cpuset"
+#define PLACEMENT_LOCK "cpuset.lock"
+
+/** Read a small sysfs/state file; returns 0 and an empty string on failure */
+static int read_small(const char *path, char *buf, size_t size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    buf[0] = '\0';
+    if (fd < 0) return 0;
+    
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n <= 0) return 0;
+    buf[n] = '\0';
+    return (int)n;
+}
+
+int cpuset_parse(const char *list, cpu_set_t *set) {
+    if (!list || !set) return MC_ERR_INVALID;
+    CPU_ZERO(set);
+    
+    for (const char *p = list; *p; ) {
+        p += strspn(p, " ,\n");
+        if (!*p) break;
+    
+        char *end;
+        long first = strtol(p, &end, 10), last = first;
+        if (end == p) return MC_ERR_INVALID;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p) return MC_ERR_INVALID;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE) return MC_ERR_INVALID;
+        if (*end && *end != ',' && *end != '\n' && *end != ' ') return MC_ERR_INVALID;
+        for (long cpu = first; cpu <= last; cpu++) CPU_SET(cpu, set);
+        p = end;
+    }
+    return MC_OK;
+}
+
+int cpuset_format(const cpu_set_t *set, char *buf, size_t size) {
+    size_t len = 0;
+    
+    if (!set || !buf || size == 0) return MC_ERR_INVALID;
+    buf[0] = '\0';
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, set)) continue;
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set)) last++;
+    
+        int n = last == cpu ? snprintf(buf + len, size - len, "%s%d", len ? "," : "", cpu)
+                            : snprintf(buf + len, size - len, "%s%d-%d", len ? "," : "", cpu, last);
+        if (n < 0 || (size_t)n >= size - len) return MC_ERR_INVALID;
+        len += n;
+        cpu = last;
+    }
+    return MC_OK;
+}
+
+int topology_load(cpu_topology_t *topo) {
+    char path[PATH_MAX], buf[4096];
+    cpu_set_t allowed;
+    
+    if (!topo) return MC_ERR_INVALID;
+    memset(topo, 0, sizeof(*topo));
+    
+    if (!read_small(SYS_CPU "/online", buf, sizeof(buf)) ||
+        cpuset_parse(buf, &topo->online) != MC_OK) {
+        mc_log(3, "Could not read the online CPUs");
+        return MC_ERR_IO;
+    }
+    /* With the cpuset controller on, placements stay inside our parent */
+    if (read_small(CPUSET_PARENT, buf, sizeof(buf)) && cpuset_parse(buf, &allowed) == MC_OK &&
+        CPU_COUNT(&allowed) > 0) {
+        CPU_AND(&topo->online, &topo->online, &allowed);
+    }
+    
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &topo->online)) continue;
+        cpu_set_t siblings;
+    
+        topo->cpus[cpu].core = cpu;
+        snprintf(path, sizeof(path), SYS_CPU "/cpu%d/topology/thread_siblings_list", cpu);
+        if (read_small(path, buf, sizeof(buf)) && cpuset_parse(buf, &siblings) == MC_OK) {
+            for (int s = 0; s < cpu; s++) {
+                if (CPU_ISSET(s, &siblings) && CPU_ISSET(s, &topo->online)) {
+                    topo->cpus[cpu].core = s;
+                    break;
+                }
+            }
+        }
+        topo->cpu_count++;
+    }
+    
+    /* Without NUMA (no node directories) everything is node 0 */
+    topo->node_count = 1;
+    DIR *dir = opendir(SYS_NODE);
+    struct dirent *ent;
+    while (dir && (ent = readdir(dir))) {
+        int node;
+        cpu_set_t cpus;
+        if (sscanf(ent->d_name, "node%d", &node) != 1 || node < 0) continue;
+    
+        snprintf(path, sizeof(path), SYS_NODE "/%s/cpulist", ent->d_name);
+        if (!read_small(path, buf, sizeof(buf)) || cpuset_parse(buf, &cpus) != MC_OK) continue;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &cpus) && CPU_ISSET(cpu, &topo->online)) topo->cpus[cpu].node = node;
+        }
+        if (node + 1 > topo->node_count) topo->node_count = node + 1;
+    }
+    if (dir) closedir(dir);
+    return topo->cpu_count > 0 ? MC_OK : MC_ERR_IO;
+}
+
+int cpu_usage_load(cpu_usage_t *usage, const char *exclude_id) {
+    char path[PATH_MAX], buf[1024];
+    
+    if (!usage) return MC_ERR_INVALID;
+    memset(usage, 0, sizeof(*usage));
+    
+    snprintf(path, sizeof(path), "%s/containers", get_state_dir());
+    DIR *dir = opendir(path);
+    if (!dir) return MC_OK;
+    
+    struct dirent *ent;
+    while ((ent = readdir(dir))) {
+        if (ent->d_name[0] == '.' || (exclude_id && strcmp(ent->d_name, exclude_id) == 0)) continue;
+        snprintf(path, sizeof(path), "%s/containers/%s/" PLACEMENT_FILE, get_state_dir(), ent->d_name);
+        if (!read_small(path, buf, sizeof(buf))) continue;
+    
+        cpu_set_t cpus, held;
+        int exclusive = 0;
+        CPU_ZERO(&cpus);
+        CPU_ZERO(&held);
+        char *save;
+        for (char *line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+            if (strncmp(line, "cpus=", 5) == 0) cpuset_parse(line + 5, &cpus);
+            else if (strncmp(line, "held=", 5) == 0) cpuset_parse(line + 5, &held);
+            else if (strncmp(line, "exclusive=", 10) == 0) exclusive = atoi(line + 10);
+        }
+    
+        if (exclusive) {
+            CPU_OR(&usage->held, &usage->held, &held);
+            CPU_OR(&usage->held, &usage->held, &cpus);
+        } else {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &cpus)) usage->shared[cpu]++;
+            }
+        }
+    }
+    closedir(dir);
+    return MC_OK;
+}
+
+/** A core is free for an exclusive placement if no placed container uses any of its CPUs */
+static int core_free(const cpu_topology_t *topo, const cpu_usage_t *usage, int core) {
+    for (int cpu = core; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &topo->online) || topo->cpus[cpu].core != core) continue;
+        if (CPU_ISSET(cpu, &usage->held) || usage->shared[cpu]) return 0;
+    }
+    return 1;
+}
+
+/**
+ * Take count free cores (on node, or anywhere if node < 0)
+ * @return Free cores on the node before taking, -1 if fewer than count
+ */
+static int pick_exclusive(const cpu_topology_t *topo, const cpu_usage_t *usage, int node,
+                          int count, cpu_set_t *cpus, cpu_set_t *held) {
+    int free_cores = 0;
+    
+    CPU_ZERO(cpus);
+    CPU_ZERO(held);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &topo->online) || topo->cpus[cpu].core != cpu) continue;
+        if (node >= 0 && topo->cpus[cpu].node != node) continue;
+        if (!core_free(topo, usage, cpu)) continue;
+    
+        if (free_cores++ < count) {
+            CPU_SET(cpu, cpus);
+            for (int s = cpu; s < CPU_SETSIZE; s++) {
+                if (CPU_ISSET(s, &topo->online) && topo->cpus[s].core == cpu) CPU_SET(s, held);
+            }
+        }
+    }
+    return free_cores >= count ? free_cores : -1;
+}
+
+/**
+ * Take the count least loaded CPUs outside held cores, a new physical
+ * core before a second thread of one already taken
+ * @return Total load of the CPUs taken, -1 if fewer than count are available
+ */
+static long pick_shared(const cpu_topology_t *topo, const cpu_usage_t *usage, int node,
+                        int count, cpu_set_t *cpus) {
+    cpu_set_t cores;
+    long load = 0;
+    
+    CPU_ZERO(cpus);
+    CPU_ZERO(&cores);
+    for (int k = 0; k < count; k++) {
+        long best_key = -1;
+        int best = -1;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (!CPU_ISSET(cpu, &topo->online) || CPU_ISSET(cpu, &usage->held) ||
+                CPU_ISSET(cpu, cpus)) {
+                continue;
+            }
+            if (node >= 0 && topo->cpus[cpu].node != node) continue;
+    
+            long key = 2L * usage->shared[cpu] + CPU_ISSET(topo->cpus[cpu].core, &cores);
+            if (best < 0 || key < best_key) {
+                best = cpu;
+                best_key = key;
+            }
+        }
+        if (best < 0) return -1;
+        CPU_SET(best, cpus);
+        CPU_SET(topo->cpus[best].core, &cores);
+        load += usage->shared[best];
+    }
+    return load;
+}
+
+static long node_load(const cpu_topology_t *topo, const cpu_usage_t *usage, int node) {
+    long load = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &topo->online) && topo->cpus[cpu].node == node) load += usage->shared[cpu];
+    }
+    return load;
+}
+
+int cpu_place(const cpu_topology_t *topo, const cpu_usage_t *usage, int count, int exclusive,
+              cpu_set_t *cpus, cpu_set_t *held, cpu_set_t *nodes) {
+    cpu_set_t try_cpus, try_held;
+    long best_cost = -1;
+    
+    if (!topo || !usage || !cpus || !held || !nodes || count <= 0) return MC_ERR_INVALID;
+    CPU_ZERO(cpus);
+    CPU_ZERO(held);
+    CPU_ZERO(nodes);
+    
+    /* One node if any can take the whole request, else span them all */
+    for (int node = 0; node < topo->node_count; node++) {
+        long cost = exclusive ? pick_exclusive(topo, usage, node, count, &try_cpus, &try_held)
+                              : pick_shared(topo, usage, node, count, &try_cpus);
+        /* Equally loaded picks: the quieter node, so shared tenants spread out */
+        if (!exclusive && cost >= 0) cost = (cost << 32) + node_load(topo, usage, node);
+        if (cost < 0 || (best_cost >= 0 && cost >= best_cost)) continue;
+        best_cost = cost;
+        *cpus = try_cpus;
+        if (exclusive) *held = try_held;
+    }
+    if (best_cost < 0) {
+        long cost = exclusive ? pick_exclusive(topo, usage, -1, count, cpus, held)
+                              : pick_shared(topo, usage, -1, count, cpus);
+        if (cost < 0) {
+            CPU_ZERO(cpus);
+            CPU_ZERO(held);
+            return MC_ERR_INVALID;
+        }
+    }
+    
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, cpus)) CPU_SET(topo->cpus[cpu].node, nodes);
+    }
+    return MC_OK;
+}
+
+/** Write <state_dir>/cpuset for the container's current cpuset */
+static int save_placement(const container_t *c, const cpu_set_t *held) {
+    char path[PATH_MAX], tmp[PATH_MAX], held_list[MC_CPUSET_LEN] = "";
+    const resource_limits_t *l = &c->config.limits;
+    
+    if (held) cpuset_format(held, held_list, sizeof(held_list));
+    if (snprintf(path, sizeof(path), "%s/" PLACEMENT_FILE, c->state_dir) >= (int)sizeof(path) ||
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        return MC_ERR_INVALID;
+    }
+    FILE *fp = fopen(tmp, "we");
+    if (!fp) return MC_ERR_IO;
+    fprintf(fp, "cpus=%s\nmems=%s\nexclusive=%d\nheld=%s\n", l->cpuset_cpus, l->cpuset_mems,
+            l->cpuset_exclusive ? 1 : 0, held_list);
+    if (fclose(fp) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return MC_ERR_IO;
+    }
+    return MC_OK;
+}
+
+int container_place_cpus(container_t *c) {
+    char path[PATH_MAX];
+    
+    if (!c || !c->state_dir[0]) return MC_ERR_INVALID;
+    resource_limits_t *l = &c->config.limits;
+    if (!l->cpuset_cpus[0] && l->cpuset_count <= 0) {
+        /* Nothing placed: drop a record left by an earlier cpuset */
+        if (snprintf(path, sizeof(path), "%s/" PLACEMENT_FILE, c->state_dir) < (int)sizeof(path)) {
+            unlink(path);
+        }
+        return MC_OK;
+    }
+    
+    cpu_topology_t *topo = malloc(sizeof(*topo));
+    cpu_usage_t *usage = malloc(sizeof(*usage));
+    if (!topo || !usage) {
+        free(topo);
+        free(usage);
+        return MC_ERR_MEMORY;
+    }
+    
+    /* Loading the usage and recording ours must not interleave with another placer */
+    snprintf(path, sizeof(path), "%s/" PLACEMENT_LOCK, get_state_dir());
+    int lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd >= 0) flock(lock_fd, LOCK_EX);
+    
+    int ret = topology_load(topo);
+    if (ret == MC_OK) ret = cpu_usage_load(usage, c->config.id);
+    
+    cpu_set_t cpus, held, nodes;
+    if (ret == MC_OK && !l->cpuset_cpus[0]) {
+        ret = cpu_place(topo, usage, l->cpuset_count, l->cpuset_exclusive, &cpus, &held, &nodes);
+        if (ret != MC_OK) {
+            mc_log(3, "Cannot place %d %s CPUs for %s (%d online)", l->cpuset_count,
+                   l->cpuset_exclusive ? "exclusive" : "shared", c->config.name, topo->cpu_count);
+        } else {
+            cpuset_format(&cpus, l->cpuset_cpus, sizeof(l->cpuset_cpus));
+            if (!l->cpuset_mems[0]) cpuset_format(&nodes, l->cpuset_mems, sizeof(l->cpuset_mems));
+            mc_log(1, "Placed %s on CPUs %s (nodes %s%s)", c->config.name, l->cpuset_cpus,
+                   l->cpuset_mems, l->cpuset_exclusive ? ", exclusive" : "");
+        }
+    } else if (ret == MC_OK) {
+        /* Explicit cpuset: recorded so the placer avoids it, siblings held if exclusive */
+        ret = cpuset_parse(l->cpuset_cpus, &cpus);
+        CPU_ZERO(&held);
+        for (int cpu = 0; ret == MC_OK && cpu < CPU_SETSIZE; cpu++) {
+            if (!CPU_ISSET(cpu, &cpus)) continue;
+            if (CPU_ISSET(cpu, &usage->held)) {
+                mc_log(2, "CPU %d of %s is held by an exclusive container", cpu, c->config.name);
+            }
+            if (!l->cpuset_exclusive || !CPU_ISSET(cpu, &topo->online)) continue;
+            for (int s = 0; s < CPU_SETSIZE; s++) {
+                if (CPU_ISSET(s, &topo->online) && topo->cpus[s].core == topo->cpus[cpu].core) {
+                    CPU_SET(s, &held);
+                }
+            }
+        }
+    }
+    if (ret == MC_OK) ret = save_placement(c, l->cpuset_exclusive ? &held : NULL);
+    
+    if (lock_fd >= 0) close(lock_fd);
+    free(topo);
+    free(usage);
+    return ret;
+}
+
+int container_record_cpuset(container_t *c, unsigned int fields) {
+    char path[PATH_MAX], buf[1024];
+    char cpus[MC_CPUSET_LEN] = "", mems[MC_CPUSET_LEN] = "";
+    int exclusive = 0;
+    
+    if (!c || !c->state_dir[0]) return MC_ERR_INVALID;
+    if (snprintf(path, sizeof(path), "%s/" PLACEMENT_FILE, c->state_dir) >= (int)sizeof(path)) {
+        return MC_ERR_INVALID;
+    }
+    if (read_small(path, buf, sizeof(buf))) {
+        char *save;
+        for (char *line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+            if (strncmp(line, "cpus=", 5) == 0) snprintf(cpus, sizeof(cpus), "%s", line + 5);
+            else if (strncmp(line, "mems=", 5) == 0) snprintf(mems, sizeof(mems), "%s", line + 5);
+            else if (strncmp(line, "exclusive=", 10) == 0) exclusive = atoi(line + 10);
+        }
+    }
+    
+    /* Merge into a copy: the caller's limits keep what it asked for */
+    container_t *tmp = malloc(sizeof(*tmp));
+    if (!tmp) return MC_ERR_MEMORY;
+    memcpy(tmp, c, sizeof(*tmp));
+    resource_limits_t *l = &tmp->config.limits;
+    if (!(fields & MC_LIMIT_CPUSET)) snprintf(l->cpuset_cpus, sizeof(l->cpuset_cpus), "%s", cpus);
+    if (!(fields & MC_LIMIT_CPUSET_MEMS)) snprintf(l->cpuset_mems, sizeof(l->cpuset_mems), "%s", mems);
+    l->cpuset_exclusive = exclusive;
+    l->cpuset_count = 0;
+    
+    int ret;
+    if (!l->cpuset_cpus[0] && !l->cpuset_mems[0]) {
+        unlink(path);
+        ret = MC_OK;
+    } else if (!l->cpuset_cpus[0]) {
+        ret = save_placement(tmp, NULL);
+    } else {
+        ret = container_place_cpus(tmp);
+    }
+    free(tmp);
+    return ret;
+}
@@ -0,0 +1,414 @@
+/*
+ * KernelSight - Linux Container Runtime
+ * zygote.c - Pre-forked container pool for fast starts
+ *
+ * A zygote is a container init process that has already been cloned into
+ * its namespaces, pivoted into the rootfs and had its essential mounts set
+ * up.  It parks on a SOCK_SEQPACKET control socket until it is handed the
+ * final configuration (hostname, command, environment).  By then the parent
+ * has moved it into the container cgroup, so starting reduces to
+ * "attach to cgroup + exec".
+ */
+
+#define _GNU_SOURCE
+#include "../include/container.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+
+/* Namespaces a zygote is cloned with; the cgroup namespace is unshared
+ * only after the parent has moved it into the container cgroup */
+#define ZYGOTE_NS_FLAGS (CLONE_NEWPID | CLONE_NEWNS | CLONE_NEWUTS | CLONE_NEWIPC)
+
+/* Largest configuration message (hostname + argv + envp) */
+#define ZYGOTE_MSG_MAX 65536
+#define ZYGOTE_MSG_MAGIC 0x5a59474fu  /* "ZYGO" */
+#define ZYGOTE_MAX_STRINGS 8192       /* argv and envp entries per message */
+
+/* Configuration message header, followed by NUL-terminated strings:
+ * hostname, argv[0..argc), envp[0..envc).  envp is complete (defaults
+ * merged in by the parent): the zygote cannot allocate to build it. */
+typedef struct {
+    uint32_t magic;
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t len;                 /* Bytes of string data */
+} zygote_msg_t;
+
+/* A parked zygote */
+typedef struct {
+    pid_t pid;
+    int sock;                     /* Parent end of the control socket */
+} zygote_t;
+
+struct zygote_pool {
+    char rootfs[PATH_MAX];
+    int enable_network;
+    int size;                     /* Target number of parked zygotes */
+    zygote_t *zygotes;
+    int count;
+    pthread_mutex_t lock;         /* Guards zygotes and count */
+    pthread_mutex_t refill_lock;  /* One refill at a time: count never overshoots size */
+    zygote_pool_t *next;          /* Registry link */
+};
+
+/* Pools registered for container_start() */
+static zygote_pool_t *pool_registry;
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+    zygote_pool_t *pool;
+    int sock;                     /* Child end of the control socket */
+} zygote_args_t;
+
+/**
+ * Zygote entry point: prepare the filesystem, then wait for a config
+ *
+ * Runs in a plain clone() of a multi-threaded process (the log drain and
+ * trace reader threads), so up to exec it sticks to async-signal-safe
+ * calls: no allocation, no logging.  Failures reach the parent as the
+ * errno it reads back, or as a zygote that is gone when it is handed out.
+ */
+static int zygote_main(void *arg) {
+    zygote_args_t *args = (zygote_args_t *)arg;
+    static struct {
+        char data[ZYGOTE_MSG_MAX];
+        char *strv[ZYGOTE_MAX_STRINGS + 2];  /* argv, NULL, envp, NULL */
+    } msg;
+    
+    mc_log_mute();
+    
+    /* Parked zygotes must not outlive the pool owner.  The signal follows
+     * the thread that cloned us, not the process: see zygote_pool_create() */
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    
+    if (fs_pivot_root(args->pool->rootfs) != MC_OK) {
+        _exit(1);
+    }
+    fs_mount_essentials();  /* Best effort, as for a cloned container */
+    
+    /* Park until the parent hands over a configuration */
+    ssize_t n = recv(args->sock, msg.data, sizeof(msg.data), 0);
+    if (n <= 0) {
+        _exit(0);  /* Pool destroyed */
+    }
+    
+    zygote_msg_t *hdr = (zygote_msg_t *)msg.data;
+    if ((size_t)n < sizeof(*hdr) || hdr->magic != ZYGOTE_MSG_MAGIC ||
+        hdr->len != (size_t)n - sizeof(*hdr) ||
+        hdr->argc + (uint64_t)hdr->envc > ZYGOTE_MAX_STRINGS) {
+        _exit(1);
+    }
+    
+    /* Split the string data into hostname, argv and envp */
+    char *p = msg.data + sizeof(*hdr), *end = msg.data + n;
+    char *hostname = p;
+    p += strnlen(p, end - p) + 1;
+    for (uint32_t i = 0; i < hdr->argc + hdr->envc && p < end; i++) {
+        msg.strv[i + (i >= hdr->argc)] = p;
+        p += strnlen(p, end - p) + 1;
+    }
+    
+    container_config_t config = {0};
+    config.cmd = msg.strv;
+    config.cmd_count = hdr->argc;
+    
+    /* We are in the container cgroup now; root the cgroup namespace here
+     * (best effort: without it the container sees host cgroup paths) */
+    unshare(CLONE_NEWCGROUP);
+    
+    ns_setup_uts(hostname);
+    prctl(PR_SET_PDEATHSIG, 0);
+    
+    /* The control socket is close-on-exec: EOF tells the parent exec worked */
+    ns_exec_command(&config, msg.strv + hdr->argc + 1);
+    
+    int err = errno;
+    send(args->sock, &err, sizeof(err), MSG_NOSIGNAL);
+    _exit(127);
+}
+
+/**
+ * Clone one zygote and add it to the pool
+ */
+static int zygote_spawn_one(zygote_pool_t *pool) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) {
+        mc_log(3, "Failed to create zygote socket: %s", strerror(errno));
+        return MC_ERR_IO;
+    }
+    
+    zygote_args_t args = { .pool = pool, .sock = sv[1] };
+    int flags = ZYGOTE_NS_FLAGS | SIGCHLD;
+    if (pool->enable_network) {
+        flags |= CLONE_NEWNET;
+    }
+    
+    /* Inherited by the zygote for its /dev */
+    fs_prepare_essentials();
+    
+    char *stack = ns_stack_get(STACK_SIZE);
+    if (!stack) {
+        close(sv[0]);
+        close(sv[1]);
+        return MC_ERR_MEMORY;
+    }
+    
+    pid_t pid = clone(zygote_main, stack, flags, &args);
+    
+    /* Without CLONE_VM the child runs on its own copy of the stack */
+    ns_stack_put(stack, STACK_SIZE);
+    close(sv[1]);
+    
+    if (pid < 0) {
+        mc_log(3, "Zygote clone() failed: %s", strerror(errno));
+        close(sv[0]);
+        return MC_ERR_NAMESPACE;
+    }
+    
+    pthread_mutex_lock(&pool->lock);
+    pool->zygotes[pool->count].pid = pid;
+    pool->zygotes[pool->count].sock = sv[0];
+    pool->count++;
+    pthread_mutex_unlock(&pool->lock);
+    
+    mc_log(0, "Parked zygote %d for %s", pid, pool->rootfs);
+    return MC_OK;
+}
+
+/**
+ * Discard a zygote (kill and reap it)
+ */
+static void zygote_discard(zygote_t *z) {
+    close(z->sock);
+    kill(z->pid, SIGKILL);
+    waitpid(z->pid, NULL, 0);
+}
+
+int zygote_pool_create(const char *rootfs, int enable_network, int size,
+                       zygote_pool_t **pool) {
+    if (!rootfs || !rootfs[0] || size <= 0 || !pool) {
+        return MC_ERR_INVALID;
+    }
+    
+    zygote_pool_t *p = calloc(1, sizeof(*p));
+    if (!p) {
+        return MC_ERR_MEMORY;
+    }
+    p->zygotes = calloc(size, sizeof(zygote_t));
+    if (!p->zygotes) {
+        free(p);
+        return MC_ERR_MEMORY;
+    }
+    
+    snprintf(p->rootfs, sizeof(p->rootfs), "%s", rootfs);
+    p->enable_network = !!enable_network;
+    p->size = size;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_mutex_init(&p->refill_lock, NULL);
+    
+    int ret = zygote_pool_refill(p);
+    if (ret != MC_OK && p->count == 0) {
+        zygote_pool_destroy(p);
+        return ret;
+    }
+    
+    /* Register for container_start() */
+    pthread_mutex_lock(&registry_mutex);
+    p->next = pool_registry;
+    pool_registry = p;
+    pthread_mutex_unlock(&registry_mutex);
+    
+    mc_log(1, "Created zygote pool for %s (%d/%d parked)", rootfs, p->count, size);
+    *pool = p;
+    return MC_OK;
+}
+
+int zygote_pool_refill(zygote_pool_t *pool) {
+    if (!pool) {
+        return MC_ERR_INVALID;
+    }
+    
+    int ret = MC_OK;
+    pthread_mutex_lock(&pool->refill_lock);
+    while (ret == MC_OK && zygote_pool_available(pool) < pool->size) {
+        ret = zygote_spawn_one(pool);
+    }
+    pthread_mutex_unlock(&pool->refill_lock);
+    return ret;
+}
+
+zygote_pool_t *zygote_pool_find(const container_config_t *config) {
+    /* User namespace mappings cannot be applied to a parked zygote */
+    if (!config || config->enable_user_ns) {
+        return NULL;
+    }
+    
+    zygote_pool_t *found = NULL;
+    pthread_mutex_lock(&registry_mutex);
+    for (zygote_pool_t *p = pool_registry; p; p = p->next) {
+        if (p->enable_network == !!config->enable_network &&
+            strcmp(p->rootfs, config->rootfs) == 0) {
+            found = p;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    return found;
+}
+
+/**
+ * Serialize hostname, argv and envp into a configuration message
+ */
+static ssize_t build_msg(container_config_t *config, char *const envp[], char *buf, size_t size) {
+    zygote_msg_t *hdr = (zygote_msg_t *)buf;
+    char *p = buf + sizeof(*hdr), *end = buf + size;
+    
+    char *default_cmd[] = {"/bin/sh", NULL};
+    char **cmd = config->cmd_count > 0 && config->cmd[0] ? config->cmd : default_cmd;
+    int argc = config->cmd_count > 0 && config->cmd[0] ? config->cmd_count : 1;
+    
+    hdr->magic = ZYGOTE_MSG_MAGIC;
+    hdr->argc = 0;
+    hdr->envc = 0;
+    
+    size_t len = strlen(config->hostname) + 1;
+    if (len > (size_t)(end - p)) return -1;
+    memcpy(p, config->hostname, len);
+    p += len;
+    
+    for (int i = 0; i < argc && cmd[i]; i++, hdr->argc++) {
+        len = strlen(cmd[i]) + 1;
+        if (len > (size_t)(end - p)) return -1;
+        memcpy(p, cmd[i], len);
+        p += len;
+    }
+    for (int i = 0; envp[i]; i++, hdr->envc++) {
+        len = strlen(envp[i]) + 1;
+        if (len > (size_t)(end - p)) return -1;
+        memcpy(p, envp[i], len);
+        p += len;
+    }
+    if (hdr->argc + hdr->envc > ZYGOTE_MAX_STRINGS) return -1;
+    
+    hdr->len = (uint32_t)(p - (buf + sizeof(*hdr)));
+    return p - buf;
+}
+
+/**
+ * Take a parked zygote off the pool
+ * @return 1 if one was taken, 0 if the pool is empty
+ */
+static int zygote_take(zygote_pool_t *pool, zygote_t *z) {
+    int taken = 0;
+    
+    pthread_mutex_lock(&pool->lock);
+    if (pool->count > 0) {
+        *z = pool->zygotes[--pool->count];
+        taken = 1;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return taken;
+}
+
+pid_t zygote_pool_spawn(zygote_pool_t *pool, container_t *container) {
+    zygote_t z;
+    
+    if (!pool || !container) {
+        return MC_ERR_INVALID;
+    }
+    
+    char *msg = malloc(ZYGOTE_MSG_MAX);
+    char **envp = ns_build_envp(&container->config);
+    if (!msg || !envp) {
+        free(msg);
+        free(envp);
+        return MC_ERR_MEMORY;
+    }
+    ssize_t len = build_msg(&container->config, envp, msg, ZYGOTE_MSG_MAX);
+    free(envp);
+    if (len < 0) {
+        mc_log(3, "Container configuration too large for zygote handoff");
+        free(msg);
+        return MC_ERR_INVALID;
+    }
+    
+    pid_t ret = MC_ERR_NOT_FOUND;
+    while (ret == MC_ERR_NOT_FOUND && zygote_take(pool, &z)) {
+        /* Born outside the container cgroup; move it before it can exec */
+        if (cgroup_add_pid(container, z.pid) != MC_OK) {
+            zygote_discard(&z);
+            ret = MC_ERR_CGROUP;
+            break;
+        }
+    
+        /* Likewise the network: eth0 is up before the command runs */
+        if (pool->enable_network) {
+            int net = net_attach(z.pid, &container->net);
+            if (net == MC_ERR_PERMISSION) {
+                mc_log(2, "No permission to attach zygote %d to %s, network stays isolated",
+                       z.pid, MC_NET_BRIDGE);
+            } else if (net != MC_OK) {
+                zygote_discard(&z);
+                ret = net;
+                break;
+            }
+        }
+    
+        if (send(z.sock, msg, len, MSG_NOSIGNAL) != len) {
+            mc_log(2, "Zygote %d is gone, trying the next one", z.pid);
+            zygote_discard(&z);
+            continue;
+        }
+    
+        /* EOF means the socket was closed by a successful exec */
+        int err = 0;
+        ssize_t n = recv(z.sock, &err, sizeof(err), 0);
+        close(z.sock);
+        if (n > 0) {
+            mc_log(3, "Zygote %d failed to exec: %s", z.pid, strerror(err));
+            waitpid(z.pid, NULL, 0);
+            ret = MC_ERR_PROCESS;
+            break;
+        }
+    
+        mc_log(1, "Started container from zygote (PID %d)", z.pid);
+        ret = z.pid;
+    }
+    
+    free(msg);
+    return ret;
+}
+
+int zygote_pool_available(zygote_pool_t *pool) {
+    if (!pool) return 0;
+    pthread_mutex_lock(&pool->lock);
+    int count = pool->count;
+    pthread_mutex_unlock(&pool->lock);
+    return count;
+}
+
+void zygote_pool_destroy(zygote_pool_t *pool) {
+    if (!pool) {
+        return;
+    }
+    
+    /* Unregister */
+    pthread_mutex_lock(&registry_mutex);
+    for (zygote_pool_t **pp = &pool_registry; *pp; pp = &(*pp)->next) {
+        if (*pp == pool) {
+            *pp = pool->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    
+    for (int i = 0; i < pool->count; i++) {
+        zygote_discard(&pool->zygotes[i]);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->refill_lock);
+    free(pool->zygotes);
+    free(pool);
+}